@@ -1,16 +1,86 @@
+#include "adaptive_batching.hh"
 #include "batched_spsc_queue.hh"
+#include "broadcast_queue.hh"
+#include "coroutine.hh"
+#include "dispatcher.hh"
+#include "file_io.hh"
+#include "lossy_queue.hh"
+#include "message_queue.hh"
+#include "metadata_ring.hh"
+#include "pipeline.hh"
+#include "queue_events.hh"
+#include "queue_set.hh"
+#include "segmented_queue.hh"
+#include "shared_queue.hh"
+#include "spill_queue.hh"
+#include "transform.hh"
+#include "typed_queue.hh"
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <benchmark/benchmark.h>
+#include <bit>
+#include <chrono>
+#include <cmath>
 #include <cstdint>
+#include <cstdio>
 #include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <limits>
 #include <memory>
+#include <pthread.h>
+#include <random>
+#include <sched.h>
+#include <string>
+#include <sys/epoll.h>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
 
 using Queue = batched_spsc_queue::Queue;
+using AdaptiveReader = batched_spsc_queue::AdaptiveReader;
+using BroadcastQueue = batched_spsc_queue::BroadcastQueue;
+using Dispatcher = batched_spsc_queue::Dispatcher;
+using Executor = batched_spsc_queue::Executor;
+using DispatchPolicy = batched_spsc_queue::DispatchPolicy;
+using FileIoOptions = batched_spsc_queue::FileIoOptions;
+using FileSink = batched_spsc_queue::FileSink;
+using FileSource = batched_spsc_queue::FileSource;
+using FullPolicy = batched_spsc_queue::FullPolicy;
+using LossyQueue = batched_spsc_queue::LossyQueue;
+using MessageQueue = batched_spsc_queue::MessageQueue;
+template <typename... Fields>
+using MetadataRing = batched_spsc_queue::MetadataRing<Fields...>;
+using WaitPolicy = batched_spsc_queue::WaitPolicy;
+using SegmentedQueue = batched_spsc_queue::SegmentedQueue;
+using SharedQueue = batched_spsc_queue::SharedQueue;
+using SpillQueue = batched_spsc_queue::SpillQueue;
+using SpillStats = batched_spsc_queue::SpillStats;
+using Transform = batched_spsc_queue::Transform;
+using BufferOptions = batched_spsc_queue::BufferOptions;
+using CopyKernel = batched_spsc_queue::CopyKernel;
+using HugePages = batched_spsc_queue::HugePages;
+using Pipeline = batched_spsc_queue::Pipeline;
+using QueueEvents = batched_spsc_queue::QueueEvents;
+using QueueSet = batched_spsc_queue::QueueSet;
+using Task = batched_spsc_queue::Task;
+using batched_spsc_queue::copy_batch;
+
+template <size_t NbSlots, size_t EnqueueBatchSize, size_t DequeueBatchSize>
+using TypedQueue =
+    batched_spsc_queue::TypedQueue<uint8_t, NbSlots, EnqueueBatchSize,
+                                   DequeueBatchSize>;
 
 static void BM_Enqueue_NoMemoryTransfer(benchmark::State &state) {
   size_t nb_slots = 1000;
   size_t enqueue_batch_size = 8;
   size_t dequeue_batch_size = 8;
   size_t element_size = sizeof(uint8_t);
+  size_t batch_bytes = enqueue_batch_size * element_size;
   auto buffer = std::make_unique<uint8_t[]>(nb_slots * element_size);
   auto queue = Queue(nb_slots, enqueue_batch_size, dequeue_batch_size,
                      element_size, buffer.get());
@@ -29,7 +99,8 @@ static void BM_Enqueue_NoMemoryTransfer(benchmark::State &state) {
       static_cast<double>(state.iterations()), benchmark::Counter::kIsRate);
 
   state.counters["Bandwidth"] = benchmark::Counter(
-      static_cast<double>(state.iterations()) * 8 * 512 * 512,
+      static_cast<double>(state.iterations()) *
+          static_cast<double>(batch_bytes),
       benchmark::Counter::kIsRate, benchmark::Counter::kIs1024);
 }
 
@@ -38,6 +109,7 @@ static void BM_Dequeue_NoMemoryTransfer(benchmark::State &state) {
   size_t enqueue_batch_size = 8;
   size_t dequeue_batch_size = 8;
   size_t element_size = sizeof(uint8_t);
+  size_t batch_bytes = dequeue_batch_size * element_size;
   auto buffer = std::make_unique<uint8_t[]>(nb_slots * element_size);
   auto queue = Queue(nb_slots, enqueue_batch_size, dequeue_batch_size,
                      element_size, buffer.get());
@@ -58,7 +130,8 @@ static void BM_Dequeue_NoMemoryTransfer(benchmark::State &state) {
       static_cast<double>(state.iterations()), benchmark::Counter::kIsRate);
 
   state.counters["Bandwidth"] = benchmark::Counter(
-      static_cast<double>(state.iterations()) * 8 * 512 * 512,
+      static_cast<double>(state.iterations()) *
+          static_cast<double>(batch_bytes),
       benchmark::Counter::kIsRate, benchmark::Counter::kIs1024);
 }
 
@@ -67,12 +140,13 @@ static void BM_Enqueue_WithMemoryTransfer(benchmark::State &state) {
   size_t enqueue_batch_size = 8;
   size_t dequeue_batch_size = 8;
   size_t element_size = 512 * 512 * sizeof(uint8_t);
+  size_t batch_bytes = enqueue_batch_size * element_size;
   auto buffer = std::make_unique<uint8_t[]>(nb_slots * element_size);
   auto queue = Queue(nb_slots, enqueue_batch_size, dequeue_batch_size,
                      element_size, buffer.get());
 
   uint8_t source[8 * 512 * 512];
-  memset(source, 0, 8 * 512 * 512);
+  memset(source, 0, batch_bytes);
 
   benchmark::DoNotOptimize(source);
   benchmark::DoNotOptimize(buffer.get());
@@ -84,7 +158,7 @@ static void BM_Enqueue_WithMemoryTransfer(benchmark::State &state) {
       batch_begin = queue.write_ptr();
     }
 
-    memcpy(batch_begin, source, 8 * 512 * 512);
+    memcpy(batch_begin, source, batch_bytes);
     queue.commit_write();
   }
 
@@ -92,7 +166,8 @@ static void BM_Enqueue_WithMemoryTransfer(benchmark::State &state) {
       static_cast<double>(state.iterations()), benchmark::Counter::kIsRate);
 
   state.counters["Bandwidth"] = benchmark::Counter(
-      static_cast<double>(state.iterations()) * 8 * 512 * 512,
+      static_cast<double>(state.iterations()) *
+          static_cast<double>(batch_bytes),
       benchmark::Counter::kIsRate, benchmark::Counter::kIs1024);
 }
 
@@ -101,6 +176,7 @@ static void BM_Dequeue_WithMemoryTransfer(benchmark::State &state) {
   size_t enqueue_batch_size = 8;
   size_t dequeue_batch_size = 8;
   size_t element_size = 512 * 512 * sizeof(uint8_t);
+  size_t batch_bytes = dequeue_batch_size * element_size;
   auto buffer = std::make_unique<uint8_t[]>(nb_slots * element_size);
   auto queue = Queue(nb_slots, enqueue_batch_size, dequeue_batch_size,
                      element_size, buffer.get());
@@ -118,15 +194,1884 @@ static void BM_Dequeue_WithMemoryTransfer(benchmark::State &state) {
       batch_begin = queue.read_ptr();
     }
 
-    memcpy(dest, batch_begin, 8 * 512 * 512);
+    memcpy(dest, batch_begin, batch_bytes);
+    queue.commit_read();
+  }
+
+  state.counters["Dequeues"] = benchmark::Counter(
+      static_cast<double>(state.iterations()), benchmark::Counter::kIsRate);
+
+  state.counters["Bandwidth"] = benchmark::Counter(
+      static_cast<double>(state.iterations()) *
+          static_cast<double>(batch_bytes),
+      benchmark::Counter::kIsRate, benchmark::Counter::kIs1024);
+}
+
+static void BM_TwoThreads_Throughput(benchmark::State &state) {
+  size_t nb_slots = 1024;
+  auto enqueue_batch_size = static_cast<size_t>(state.range(0));
+  auto dequeue_batch_size = static_cast<size_t>(state.range(0));
+  // With range(1) == 1, both sides first check for room or data with
+  // available_contiguous_write() (resp. available_contiguous_read()), which
+  // reload the other side's index on every poll as write_ptr() and read_ptr()
+  // did before they cached it.
+  bool reload = state.range(1) != 0;
+  size_t element_size = sizeof(uint64_t);
+  auto buffer = std::make_unique<uint8_t[]>(nb_slots * element_size);
+  auto queue = Queue(nb_slots, enqueue_batch_size, dequeue_batch_size,
+                     element_size, buffer.get());
+
+  // The consumer polls read_ptr() until the producer is done. Both sides spin,
+  // which is exactly the case where re-reading the other side's index on every
+  // poll would bounce its cache line between the two cores.
+  std::atomic<bool> stop{false};
+  std::thread consumer([&queue, &stop, reload, dequeue_batch_size]() {
+    while (!stop.load(std::memory_order_relaxed)) {
+      if (reload && queue.available_contiguous_read() < dequeue_batch_size)
+        continue;
+
+      uint8_t *batch_begin = queue.read_ptr();
+      if (batch_begin == nullptr)
+        continue;
+
+      benchmark::DoNotOptimize(*batch_begin);
+      queue.commit_read();
+    }
+  });
+
+  for (auto _ : state) {
+    uint8_t *batch_begin = nullptr;
+    while (batch_begin == nullptr) {
+      if (reload && queue.available_contiguous_write() < enqueue_batch_size)
+        continue;
+      batch_begin = queue.write_ptr();
+    }
+
+    *batch_begin = 0;
+    queue.commit_write();
+  }
+
+  stop.store(true, std::memory_order_relaxed);
+  consumer.join();
+
+  state.counters["Enqueues"] = benchmark::Counter(
+      static_cast<double>(state.iterations()), benchmark::Counter::kIsRate);
+
+  state.counters["Elements"] = benchmark::Counter(
+      static_cast<double>(state.iterations()) *
+          static_cast<double>(enqueue_batch_size),
+      benchmark::Counter::kIsRate);
+}
+
+template <size_t NbSlots>
+static void BM_TypedQueue_Enqueue_NoMemoryTransfer(benchmark::State &state) {
+  auto buffer = std::make_unique<uint8_t[]>(NbSlots);
+  auto queue = TypedQueue<NbSlots, 8, 8>(buffer.get());
+
+  for (auto _ : state) {
+    std::span<uint8_t> batch = queue.write_batch();
+    if (batch.empty()) {
+      queue.reset();
+      batch = queue.write_batch();
+    }
+
+    benchmark::DoNotOptimize(batch);
+    queue.commit_write();
+  }
+
+  state.counters["Enqueues"] = benchmark::Counter(
+      static_cast<double>(state.iterations()), benchmark::Counter::kIsRate);
+}
+
+template <size_t NbSlots>
+static void BM_TypedQueue_Dequeue_NoMemoryTransfer(benchmark::State &state) {
+  auto buffer = std::make_unique<uint8_t[]>(NbSlots);
+  auto queue = TypedQueue<NbSlots, 8, 8>(buffer.get());
+
+  queue.fill();
+
+  for (auto _ : state) {
+    std::span<uint8_t> batch = queue.read_batch();
+    if (batch.empty()) {
+      queue.fill();
+      batch = queue.read_batch();
+    }
+
+    benchmark::DoNotOptimize(batch);
     queue.commit_read();
   }
 
+  state.counters["Dequeues"] = benchmark::Counter(
+      static_cast<double>(state.iterations()), benchmark::Counter::kIsRate);
+}
+
+template <size_t BatchSize>
+static void BM_TypedQueue_TwoThreads_Throughput(benchmark::State &state) {
+  constexpr size_t nb_slots = 1024;
+  auto buffer = std::make_unique<uint8_t[]>(nb_slots);
+  auto queue = TypedQueue<nb_slots, BatchSize, BatchSize>(buffer.get());
+
+  std::atomic<bool> stop{false};
+  std::thread consumer([&queue, &stop]() {
+    while (!stop.load(std::memory_order_relaxed)) {
+      std::span<uint8_t> batch = queue.read_batch();
+      if (batch.empty())
+        continue;
+
+      benchmark::DoNotOptimize(batch.front());
+      queue.commit_read();
+    }
+  });
+
+  for (auto _ : state) {
+    std::span<uint8_t> batch;
+    while (batch.empty())
+      batch = queue.write_batch();
+
+    batch.front() = 0;
+    queue.commit_write();
+  }
+
+  stop.store(true, std::memory_order_relaxed);
+  consumer.join();
+
+  state.counters["Enqueues"] = benchmark::Counter(
+      static_cast<double>(state.iterations()), benchmark::Counter::kIsRate);
+
+  state.counters["Elements"] = benchmark::Counter(
+      static_cast<double>(state.iterations()) * BatchSize,
+      benchmark::Counter::kIsRate);
+}
+
+static void BM_Enqueue_Burst(benchmark::State &state) {
+  auto burst = static_cast<size_t>(state.range(0));
+  bool single_commit = state.range(1) != 0;
+  size_t nb_slots = 1024;
+  size_t enqueue_batch_size = 1;
+  size_t dequeue_batch_size = 1;
+  size_t element_size = sizeof(uint64_t);
+  auto buffer = std::make_unique<uint8_t[]>(nb_slots * element_size);
+  auto queue = Queue(nb_slots, enqueue_batch_size, dequeue_batch_size,
+                     element_size, buffer.get());
+
+  // Publish a burst either element by element through the fixed-size API, or
+  // with a single variable-size commit.
+  for (auto _ : state) {
+    if (queue.available_contiguous_write() < burst)
+      queue.reset();
+
+    if (single_commit) {
+      benchmark::DoNotOptimize(queue.write_ptr(burst));
+      queue.commit_write(burst);
+    } else {
+      for (size_t i = 0; i < burst; i++) {
+        benchmark::DoNotOptimize(queue.write_ptr());
+        queue.commit_write();
+      }
+    }
+  }
+
+  state.counters["Elements"] = benchmark::Counter(
+      static_cast<double>(state.iterations()) * static_cast<double>(burst),
+      benchmark::Counter::kIsRate);
+}
+
+static void BM_SharedQueue_CrossProcess_Throughput(benchmark::State &state) {
+  auto batch_size = static_cast<size_t>(state.range(0));
+  auto name = "/batched_spsc_queue_bench_" + std::to_string(getpid());
+  auto queue = SharedQueue::create(name, 1024, batch_size, batch_size,
+                                   sizeof(uint64_t),
+                                   SharedQueue::Role::Producer);
+
+  // The consumer runs in a child process and stops when the first element of
+  // a batch is the sentinel value.
+  constexpr uint64_t sentinel = std::numeric_limits<uint64_t>::max();
+  pid_t child = fork();
+  if (child == 0) {
+    auto consumer = SharedQueue::attach(name, SharedQueue::Role::Consumer);
+    bool stop = false;
+    while (!stop) {
+      auto *batch_begin = reinterpret_cast<uint64_t *>(consumer.read_ptr());
+      if (batch_begin == nullptr)
+        continue;
+
+      stop = *batch_begin == sentinel;
+      consumer.commit_read();
+    }
+    _exit(0);
+  }
+
+  for (auto _ : state) {
+    uint8_t *batch_begin = nullptr;
+    while (batch_begin == nullptr)
+      batch_begin = queue.write_ptr();
+
+    *reinterpret_cast<uint64_t *>(batch_begin) = 0;
+    queue.commit_write();
+  }
+
+  uint8_t *batch_begin = nullptr;
+  while (batch_begin == nullptr)
+    batch_begin = queue.write_ptr();
+  *reinterpret_cast<uint64_t *>(batch_begin) = sentinel;
+  queue.commit_write();
+  waitpid(child, nullptr, 0);
+
+  state.counters["Enqueues"] = benchmark::Counter(
+      static_cast<double>(state.iterations()), benchmark::Counter::kIsRate);
+
+  state.counters["Elements"] = benchmark::Counter(
+      static_cast<double>(state.iterations()) *
+          static_cast<double>(batch_size),
+      benchmark::Counter::kIsRate);
+}
+
+static void BM_Buffer_FirstLap(benchmark::State &state) {
+  BufferOptions options;
+  options.huge_pages = static_cast<HugePages>(state.range(0));
+  options.prefault = state.range(1) != 0;
+  size_t nb_slots = 128;
+  size_t enqueue_batch_size = 8;
+  size_t dequeue_batch_size = 8;
+  size_t element_size = 512 * 512 * sizeof(uint8_t);
+  size_t batch_bytes = enqueue_batch_size * element_size;
+  auto source = std::make_unique<uint8_t[]>(batch_bytes);
+  memset(source.get(), 0, batch_bytes);
+
+  // Time one lap of enqueues on a freshly allocated queue, which is when page
+  // faults and TLB misses hurt the most. Allocation (and prefaulting) happens
+  // outside of the timed region.
+  size_t nb_batches = nb_slots / enqueue_batch_size - 1;
+  for (auto _ : state) {
+    state.PauseTiming();
+    auto queue = std::make_unique<Queue>(nb_slots, enqueue_batch_size,
+                                         dequeue_batch_size, element_size,
+                                         options);
+    state.ResumeTiming();
+
+    for (size_t i = 0; i < nb_batches; i++) {
+      uint8_t *batch_begin = queue->write_ptr();
+      memcpy(batch_begin, source.get(), batch_bytes);
+      queue->commit_write();
+    }
+    benchmark::ClobberMemory();
+
+    state.PauseTiming();
+    queue.reset();
+    state.ResumeTiming();
+  }
+
+  state.counters["Bandwidth"] = benchmark::Counter(
+      static_cast<double>(state.iterations()) *
+          static_cast<double>(nb_batches * batch_bytes),
+      benchmark::Counter::kIsRate, benchmark::Counter::kIs1024);
+}
+
+static void BM_Buffer_SteadyState(benchmark::State &state) {
+  BufferOptions options;
+  options.huge_pages = static_cast<HugePages>(state.range(0));
+  options.prefault = true;
+  size_t nb_slots = 1000;
+  size_t enqueue_batch_size = 8;
+  size_t dequeue_batch_size = 8;
+  size_t element_size = 512 * 512 * sizeof(uint8_t);
+  size_t batch_bytes = enqueue_batch_size * element_size;
+  auto queue = Queue(nb_slots, enqueue_batch_size, dequeue_batch_size,
+                     element_size, options);
+  auto source = std::make_unique<uint8_t[]>(batch_bytes);
+  memset(source.get(), 0, batch_bytes);
+
+  for (auto _ : state) {
+    uint8_t *batch_begin = queue.write_ptr();
+    if (batch_begin == nullptr) {
+      queue.reset();
+      batch_begin = queue.write_ptr();
+    }
+
+    memcpy(batch_begin, source.get(), batch_bytes);
+    queue.commit_write();
+  }
+
+  state.counters["Bandwidth"] = benchmark::Counter(
+      static_cast<double>(state.iterations()) *
+          static_cast<double>(batch_bytes),
+      benchmark::Counter::kIsRate, benchmark::Counter::kIs1024);
+}
+
+static int64_t now_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+static double thread_cpu_seconds() {
+  timespec ts{};
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return static_cast<double>(ts.tv_sec) +
+         static_cast<double>(ts.tv_nsec) * 1e-9;
+}
+
+static void BM_WakeupLatency(benchmark::State &state) {
+  auto policy = static_cast<WaitPolicy>(state.range(0));
+  size_t nb_slots = 16;
+  size_t enqueue_batch_size = 1;
+  size_t dequeue_batch_size = 1;
+  size_t element_size = sizeof(int64_t);
+  auto buffer = std::make_unique<uint8_t[]>(nb_slots * element_size);
+  auto queue = Queue(nb_slots, enqueue_batch_size, dequeue_batch_size,
+                     element_size, buffer.get(), true);
+
+  // The producer publishes its send timestamp once every 50us; the consumer
+  // waits with the policy under test and accumulates wake-up latency and its
+  // own CPU time. A negative timestamp tells the consumer to stop.
+  int64_t total_latency_ns = 0;
+  double consumer_cpu_seconds = 0;
+  std::thread consumer([&]() {
+    double cpu_start = thread_cpu_seconds();
+    while (true) {
+      auto *sent_ns = reinterpret_cast<int64_t *>(queue.wait_read_ptr(policy));
+      if (*sent_ns < 0)
+        break;
+
+      total_latency_ns += now_ns() - *sent_ns;
+      queue.commit_read();
+    }
+    consumer_cpu_seconds = thread_cpu_seconds() - cpu_start;
+  });
+
+  auto wall_start = std::chrono::steady_clock::now();
+  for (auto _ : state) {
+    std::this_thread::sleep_for(std::chrono::microseconds(50));
+    auto *sent_ns = reinterpret_cast<int64_t *>(
+        queue.wait_write_ptr(WaitPolicy::Spin));
+    *sent_ns = now_ns();
+    queue.commit_write();
+  }
+
+  *reinterpret_cast<int64_t *>(queue.wait_write_ptr(WaitPolicy::Spin)) = -1;
+  queue.commit_write();
+  consumer.join();
+  std::chrono::duration<double> wall =
+      std::chrono::steady_clock::now() - wall_start;
+
+  state.counters["Latency_ns"] = static_cast<double>(total_latency_ns) /
+                                 static_cast<double>(state.iterations());
+
+  state.counters["ConsumerCPU"] = consumer_cpu_seconds / wall.count();
+}
+
+static void BM_Pipeline_Throughput(benchmark::State &state) {
+  // A source, range(0) in-place stages and a sink, streaming uint64_t
+  // elements. In-place stages share the source's buffer, so adding one adds a
+  // hop but no copy.
+  constexpr size_t nb_elements = 1 << 20;
+  auto nb_stages = static_cast<size_t>(state.range(0));
+  size_t batch_size = 64;
+
+  for (auto _ : state) {
+    Pipeline pipeline(1024);
+    size_t produced = 0;
+    pipeline.source("source", sizeof(uint64_t), batch_size,
+                    [&produced](uint8_t *batch, size_t n) {
+                      n = std::min(n, nb_elements - produced);
+                      std::memset(batch, 0, n * sizeof(uint64_t));
+                      produced += n;
+                      return n;
+                    });
+    for (size_t i = 0; i < nb_stages; i++)
+      pipeline.stage("stage", batch_size, [](uint8_t *batch, size_t n) {
+        auto *elements = reinterpret_cast<uint64_t *>(batch);
+        for (size_t j = 0; j < n; j++)
+          elements[j]++;
+      });
+    pipeline.sink("sink", batch_size, [](const uint8_t *batch, size_t) {
+      benchmark::DoNotOptimize(*batch);
+    });
+
+    pipeline.start();
+    pipeline.wait();
+  }
+
+  state.counters["Elements"] = benchmark::Counter(
+      static_cast<double>(state.iterations()) *
+          static_cast<double>(nb_elements),
+      benchmark::Counter::kIsRate);
+}
+
+static void BM_Broadcast_Throughput(benchmark::State &state) {
+  // One producer, range(0) consumers reading every batch in place. Compared to
+  // BM_TwoThreads_Throughput, the producer writes each batch once whatever
+  // the number of consumers, and waits for the slowest one.
+  size_t nb_slots = 1024;
+  size_t batch_size = 8;
+  auto nb_consumers = static_cast<size_t>(state.range(0));
+  auto buffer = std::make_unique<uint8_t[]>(nb_slots * sizeof(uint64_t));
+  BroadcastQueue queue(nb_slots, batch_size, batch_size, sizeof(uint64_t),
+                       buffer.get(), nb_consumers);
+
+  std::atomic<bool> stop{false};
+  std::vector<std::thread> consumers;
+  for (size_t i = 0; i < nb_consumers; i++)
+    consumers.emplace_back([consumer = queue.attach(), &stop]() mutable {
+      while (!stop.load(std::memory_order_relaxed)) {
+        uint8_t *batch_begin = consumer.read_ptr();
+        if (batch_begin == nullptr)
+          continue;
+
+        benchmark::DoNotOptimize(*batch_begin);
+        consumer.commit_read();
+      }
+    });
+
+  for (auto _ : state) {
+    uint8_t *batch_begin = nullptr;
+    while (batch_begin == nullptr)
+      batch_begin = queue.write_ptr();
+
+    *batch_begin = 0;
+    queue.commit_write();
+  }
+
+  stop.store(true, std::memory_order_relaxed);
+  for (auto &consumer : consumers)
+    consumer.join();
+
+  state.counters["Elements"] = benchmark::Counter(
+      static_cast<double>(state.iterations()) *
+          static_cast<double>(batch_size),
+      benchmark::Counter::kIsRate);
+}
+
+static void BM_FanIn_FindReady(benchmark::State &state) {
+  // range(0) queues of which only the last one receives batches, the worst
+  // case for polling. With range(1) == 0 the consumer polls read_ptr() on
+  // every queue in turn, with range(1) == 1 it asks a QueueSet.
+  auto nb_queues = static_cast<size_t>(state.range(0));
+  bool use_set = state.range(1) != 0;
+  size_t nb_slots = 64;
+  auto buffer = std::make_unique<uint8_t[]>(nb_queues * nb_slots);
+  std::vector<std::unique_ptr<Queue>> queues;
+  QueueSet set;
+  for (size_t i = 0; i < nb_queues; i++) {
+    queues.push_back(std::make_unique<Queue>(nb_slots, 1, 1, 1,
+                                             buffer.get() + i * nb_slots));
+    if (use_set)
+      set.add(*queues.back());
+  }
+  Queue &active = *queues.back();
+
+  size_t next = 0;
+  for (auto _ : state) {
+    *active.write_ptr() = 0;
+    active.commit_write();
+
+    uint8_t *batch_begin = nullptr;
+    size_t index = 0;
+    if (use_set) {
+      batch_begin = set.read_ptr(index);
+    } else {
+      while (batch_begin == nullptr) {
+        index = next;
+        batch_begin = queues[index]->read_ptr();
+        next = next + 1 == nb_queues ? 0 : next + 1;
+      }
+    }
+
+    benchmark::DoNotOptimize(*batch_begin);
+    if (use_set)
+      set.commit_read(index);
+    else
+      queues[index]->commit_read();
+  }
+}
+
+static void BM_Dispatcher_Scaling(benchmark::State &state) {
+  // One producer dispatching batches to range(0) consumers, each spending
+  // some time per batch, with the policy range(1). The aggregate throughput
+  // should grow with the number of consumers until the producer saturates.
+  auto nb_consumers = static_cast<size_t>(state.range(0));
+  auto policy = static_cast<DispatchPolicy>(state.range(1));
+  size_t batch_size = 8;
+  Dispatcher dispatcher(nb_consumers, 256, batch_size, batch_size,
+                        sizeof(uint64_t), policy);
+
+  std::atomic<bool> stop{false};
+  std::vector<std::thread> consumers;
+  for (size_t i = 0; i < nb_consumers; i++)
+    consumers.emplace_back([&queue = dispatcher.queue(i), &stop]() {
+      while (!stop.load(std::memory_order_relaxed)) {
+        auto *batch_begin = reinterpret_cast<uint64_t *>(queue.read_ptr());
+        if (batch_begin == nullptr) {
+          std::this_thread::yield();
+          continue;
+        }
+
+        // Simulated work: about a microsecond per batch.
+        uint64_t hash = batch_begin[0];
+        for (size_t j = 0; j < 1000; j++)
+          hash = hash * 6364136223846793005 + 1442695040888963407;
+        benchmark::DoNotOptimize(hash);
+        queue.commit_read();
+      }
+    });
+
+  for (auto _ : state) {
+    uint8_t *batch_begin = nullptr;
+    while ((batch_begin = dispatcher.write_ptr()) == nullptr)
+      std::this_thread::yield();
+
+    *batch_begin = 0;
+    dispatcher.commit_write();
+  }
+
+  stop.store(true, std::memory_order_relaxed);
+  for (auto &consumer : consumers)
+    consumer.join();
+
+  state.counters["Elements"] = benchmark::Counter(
+      static_cast<double>(state.iterations()) *
+          static_cast<double>(batch_size),
+      benchmark::Counter::kIsRate);
+}
+
+static void BM_Copy_Bandwidth(benchmark::State &state) {
+  auto kernel = static_cast<CopyKernel>(state.range(0));
+  auto size = static_cast<size_t>(state.range(1));
+  auto src = std::make_unique<uint8_t[]>(size);
+  auto dst = std::make_unique<uint8_t[]>(size);
+  memset(src.get(), 1, size);
+  memset(dst.get(), 0, size);
+
+  for (auto _ : state) {
+    copy_batch(dst.get(), src.get(), size, kernel);
+    benchmark::ClobberMemory();
+  }
+
+  state.counters["Bandwidth"] = benchmark::Counter(
+      static_cast<double>(state.iterations()) * static_cast<double>(size),
+      benchmark::Counter::kIsRate, benchmark::Counter::kIs1024);
+}
+
+static void BM_Copy_CachePollution(benchmark::State &state) {
+  auto kernel = static_cast<CopyKernel>(state.range(0));
+  size_t batch_bytes = 8 * 512 * 512;
+  size_t working_set_bytes = 512 * 1024;
+  auto src = std::make_unique<uint8_t[]>(batch_bytes);
+  auto dst = std::make_unique<uint8_t[]>(batch_bytes);
+  memset(src.get(), 1, batch_bytes);
+  memset(dst.get(), 0, batch_bytes);
+
+  // The working set is a random cycle through its cache lines, so that the
+  // walk is a chain of dependent loads the prefetchers cannot hide.
+  constexpr size_t line_words = 64 / sizeof(uint64_t);
+  size_t nb_lines = working_set_bytes / 64;
+  std::vector<uint64_t> order(nb_lines);
+  for (size_t i = 0; i < nb_lines; ++i)
+    order[i] = i * line_words;
+  std::shuffle(order.begin(), order.end(), std::mt19937_64(42));
+  std::vector<uint64_t> working_set(nb_lines * line_words);
+  for (size_t i = 0; i < nb_lines; ++i)
+    working_set[order[i]] = order[(i + 1) % nb_lines];
+
+  // Each iteration copies an image batch, then walks a working set that fits
+  // in L2, as a producer would between two batches. The walk is slower when
+  // the copy evicted the working set.
+  int64_t copy_ns = 0;
+  int64_t walk_ns = 0;
+  for (auto _ : state) {
+    int64_t start_ns = now_ns();
+    copy_batch(dst.get(), src.get(), batch_bytes, kernel);
+    benchmark::ClobberMemory();
+    int64_t copied_ns = now_ns();
+
+    uint64_t index = 0;
+    for (size_t i = 0; i < nb_lines; ++i)
+      index = working_set[index];
+    benchmark::DoNotOptimize(index);
+    int64_t walked_ns = now_ns();
+
+    copy_ns += copied_ns - start_ns;
+    walk_ns += walked_ns - copied_ns;
+  }
+
+  auto iterations = static_cast<double>(state.iterations());
+  state.counters["Copy_ns"] = static_cast<double>(copy_ns) / iterations;
+  state.counters["WorkingSet_ns"] = static_cast<double>(walk_ns) / iterations;
+}
+
+static void BM_Dequeue_Copy(benchmark::State &state) {
+  size_t nb_slots = 1000;
+  size_t enqueue_batch_size = 8;
+  size_t dequeue_batch_size = 8;
+  size_t element_size = 512 * 512 * sizeof(uint8_t);
+  size_t batch_bytes = dequeue_batch_size * element_size;
+  auto buffer = std::make_unique<uint8_t[]>(nb_slots * element_size);
+  auto queue = Queue(nb_slots, enqueue_batch_size, dequeue_batch_size,
+                     element_size, buffer.get());
+
+  // The dequeue_copy() counterpart of BM_Dequeue_WithMemoryTransfer.
+  auto dest = std::make_unique<uint8_t[]>(batch_bytes);
+  queue.fill();
+
+  for (auto _ : state) {
+    if (!queue.dequeue_copy(dest.get())) {
+      queue.fill();
+      queue.dequeue_copy(dest.get());
+    }
+    benchmark::ClobberMemory();
+  }
+
   state.counters["Dequeues"] = benchmark::Counter(
       static_cast<double>(state.iterations()), benchmark::Counter::kIsRate);
 
   state.counters["Bandwidth"] = benchmark::Counter(
-      static_cast<double>(state.iterations()) * 8 * 512 * 512,
+      static_cast<double>(state.iterations()) *
+          static_cast<double>(batch_bytes),
+      benchmark::Counter::kIsRate, benchmark::Counter::kIs1024);
+}
+
+/// How the file benchmarks move data between the file and the queue.
+enum class FileMode : int64_t {
+  /// read()/write() through a scratch buffer, copied to or from the slots.
+  CopyThrough,
+  /// FileSource/FileSink, through the page cache.
+  ZeroCopy,
+  /// FileSource/FileSink with O_DIRECT.
+  ZeroCopyDirect,
+};
+
+static std::string bench_file_path() {
+  return (std::filesystem::temp_directory_path() /
+          ("batched_spsc_queue_bench_" + std::to_string(getpid())))
+      .string();
+}
+
+// Image-sized batches: 4 elements of 256 KiB, in a 16 MiB queue.
+constexpr size_t kFileElementSize = 256 * 1024;
+constexpr size_t kFileBatchSize = 4;
+constexpr size_t kFileNbSlots = 64;
+constexpr size_t kFileBytes = 256 * 1024 * 1024;
+
+static void BM_File_Replay(benchmark::State &state) {
+  auto mode = static_cast<FileMode>(state.range(0));
+  std::string path = bench_file_path();
+  {
+    std::vector<char> chunk(kFileElementSize, 1);
+    std::ofstream file(path, std::ios::binary);
+    for (size_t i = 0; i < kFileBytes; i += chunk.size())
+      file.write(chunk.data(), static_cast<std::streamsize>(chunk.size()));
+  }
+
+  size_t batch_bytes = kFileBatchSize * kFileElementSize;
+  auto queue = Queue(kFileNbSlots, kFileBatchSize, kFileBatchSize,
+                     kFileElementSize, BufferOptions{});
+  auto scratch = std::make_unique<uint8_t[]>(batch_bytes);
+  FileIoOptions options;
+  options.direct = mode == FileMode::ZeroCopyDirect;
+
+  // Each iteration replays the whole file to a consumer that only touches
+  // the first byte of each batch.
+  for (auto _ : state) {
+    std::thread consumer([&queue, batch_bytes]() {
+      for (size_t read = 0; read < kFileBytes; read += batch_bytes) {
+        uint8_t *batch_begin = queue.wait_read_ptr(WaitPolicy::SpinThenYield);
+        benchmark::DoNotOptimize(*batch_begin);
+        queue.commit_read();
+      }
+    });
+
+    if (mode == FileMode::CopyThrough) {
+      int fd = open(path.c_str(), O_RDONLY);
+      for (size_t i = 0; i < kFileBytes; i += batch_bytes) {
+        if (read(fd, scratch.get(), batch_bytes) !=
+            static_cast<ssize_t>(batch_bytes))
+          break;
+        uint8_t *batch_begin = queue.wait_write_ptr(WaitPolicy::SpinThenYield);
+        memcpy(batch_begin, scratch.get(), batch_bytes);
+        queue.commit_write();
+      }
+      close(fd);
+    } else {
+      FileSource source(path, queue, options);
+      source.run();
+    }
+
+    consumer.join();
+  }
+
+  std::remove(path.c_str());
+  state.counters["Bandwidth"] = benchmark::Counter(
+      static_cast<double>(state.iterations()) * kFileBytes,
+      benchmark::Counter::kIsRate, benchmark::Counter::kIs1024);
+}
+
+static void BM_File_Record(benchmark::State &state) {
+  auto mode = static_cast<FileMode>(state.range(0));
+  std::string path = bench_file_path();
+  size_t batch_bytes = kFileBatchSize * kFileElementSize;
+  auto queue = Queue(kFileNbSlots, kFileBatchSize, kFileBatchSize,
+                     kFileElementSize, BufferOptions{});
+  auto scratch = std::make_unique<uint8_t[]>(batch_bytes);
+  FileIoOptions options;
+  options.direct = mode == FileMode::ZeroCopyDirect;
+
+  // Each iteration records a whole file from a producer that only touches the
+  // first byte of each batch.
+  for (auto _ : state) {
+    std::thread producer([&queue, batch_bytes]() {
+      for (size_t written = 0; written < kFileBytes; written += batch_bytes) {
+        uint8_t *batch_begin = queue.wait_write_ptr(WaitPolicy::SpinThenYield);
+        *batch_begin = 1;
+        queue.commit_write();
+      }
+    });
+
+    if (mode == FileMode::CopyThrough) {
+      int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+      for (size_t i = 0; i < kFileBytes; i += batch_bytes) {
+        uint8_t *batch_begin = queue.wait_read_ptr(WaitPolicy::SpinThenYield);
+        memcpy(scratch.get(), batch_begin, batch_bytes);
+        queue.commit_read();
+        if (write(fd, scratch.get(), batch_bytes) !=
+            static_cast<ssize_t>(batch_bytes))
+          break;
+      }
+      close(fd);
+    } else {
+      FileSink sink(path, queue, options);
+      while (sink.bytes_written() < kFileBytes)
+        sink.poll();
+    }
+
+    producer.join();
+  }
+
+  std::remove(path.c_str());
+  state.counters["Bandwidth"] = benchmark::Counter(
+      static_cast<double>(state.iterations()) * kFileBytes,
+      benchmark::Counter::kIsRate, benchmark::Counter::kIs1024);
+}
+
+static void BM_SpillQueue_FastPath(benchmark::State &state) {
+  auto queue = SpillQueue(1024, 8, sizeof(uint64_t),
+                          std::filesystem::temp_directory_path().string());
+
+  // A consumer keeping up: the ring is never full, so nothing is spilled and
+  // only the cost of the spill checks is added to a Queue's.
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(queue.write_ptr());
+    queue.commit_write();
+    benchmark::DoNotOptimize(queue.read_ptr());
+    queue.commit_read();
+  }
+
+  state.counters["Batches"] = benchmark::Counter(
+      static_cast<double>(state.iterations()), benchmark::Counter::kIsRate);
+}
+
+static void BM_SpillQueue_Burst(benchmark::State &state) {
+  auto nb_frames = static_cast<size_t>(state.range(0));
+  size_t frame_bytes = 1024 * 1024;
+  auto queue = SpillQueue(16, 1, frame_bytes,
+                          std::filesystem::temp_directory_path().string());
+  auto frame = std::make_unique<uint8_t[]>(frame_bytes);
+  memset(frame.get(), 1, frame_bytes);
+
+  // A burst of 1 MiB frames while the consumer is stalled, most of which are
+  // spilled, then the consumer catching up.
+  int64_t burst_ns = 0;
+  for (auto _ : state) {
+    int64_t start_ns = now_ns();
+    for (size_t i = 0; i < nb_frames; ++i) {
+      memcpy(queue.write_ptr(), frame.get(), frame_bytes);
+      queue.commit_write();
+    }
+    burst_ns += now_ns() - start_ns;
+
+    for (size_t i = 0; i < nb_frames; ++i) {
+      benchmark::DoNotOptimize(*queue.read_ptr());
+      queue.commit_read();
+    }
+  }
+
+  SpillStats stats = queue.stats();
+  state.counters["BurstRate"] =
+      benchmark::Counter(static_cast<double>(state.iterations() * nb_frames *
+                                             frame_bytes) *
+                             1e9 / static_cast<double>(burst_ns),
+                         benchmark::Counter::kDefaults,
+                         benchmark::Counter::kIs1024);
+  state.counters["DrainRate"] = benchmark::Counter(
+      stats.drain_rate, benchmark::Counter::kDefaults,
+      benchmark::Counter::kIs1024);
+  state.counters["SpilledFraction"] =
+      static_cast<double>(stats.spilled_bytes) /
+      static_cast<double>(state.iterations() * nb_frames * frame_bytes);
+}
+
+/// Where the cross-thread benchmarks run the producer and the consumer.
+enum class Placement : int64_t {
+  /// Left to the scheduler.
+  Unpinned,
+  /// Two SMT siblings of the same physical core.
+  SameCore,
+  /// Two physical cores of the same socket.
+  SameSocket,
+  /// Two cores of different sockets.
+  CrossSocket,
+};
+
+/// A CPU the process may run on, with its topology as reported by sysfs.
+struct Cpu {
+  int id;
+  int core;
+  int package;
+};
+
+static int read_topology(int cpu, const char *name) {
+  std::ifstream file("/sys/devices/system/cpu/cpu" + std::to_string(cpu) +
+                     "/topology/" + name);
+  int value = -1;
+  file >> value;
+  return value;
+}
+
+static std::vector<Cpu> allowed_cpus() {
+  std::vector<Cpu> cpus;
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  if (sched_getaffinity(0, sizeof(set), &set) != 0)
+    return cpus;
+
+  for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+    if (!CPU_ISSET(cpu, &set))
+      continue;
+
+    Cpu entry{cpu, read_topology(cpu, "core_id"),
+              read_topology(cpu, "physical_package_id")};
+    if (entry.core >= 0 && entry.package >= 0)
+      cpus.push_back(entry);
+  }
+  return cpus;
+}
+
+/// Finds a producer and a consumer CPU matching the placement, or returns
+/// false if the machine has none. Both are -1 when unpinned.
+static bool find_cpu_pair(Placement placement, int &producer, int &consumer) {
+  producer = -1;
+  consumer = -1;
+  if (placement == Placement::Unpinned)
+    return true;
+
+  std::vector<Cpu> cpus = allowed_cpus();
+  for (const Cpu &a : cpus) {
+    for (const Cpu &b : cpus) {
+      bool same_package = a.package == b.package;
+      bool same_core = same_package && a.core == b.core;
+      bool match = false;
+      switch (placement) {
+      case Placement::SameCore:
+        match = same_core;
+        break;
+      case Placement::SameSocket:
+        match = same_package && !same_core;
+        break;
+      case Placement::CrossSocket:
+        match = !same_package;
+        break;
+      case Placement::Unpinned:
+        break;
+      }
+
+      if (a.id != b.id && match) {
+        producer = a.id;
+        consumer = b.id;
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+/// Pins the calling thread to a CPU, or does nothing for -1, and restores its
+/// previous affinity on destruction, so that the benchmark thread does not
+/// stay pinned for the next benchmarks.
+class ScopedPin {
+public:
+  explicit ScopedPin(int cpu) : pinned_(cpu >= 0) {
+    if (!pinned_)
+      return;
+
+    pthread_getaffinity_np(pthread_self(), sizeof(previous_), &previous_);
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+  }
+
+  ~ScopedPin() {
+    if (pinned_)
+      pthread_setaffinity_np(pthread_self(), sizeof(previous_), &previous_);
+  }
+
+  ScopedPin(const ScopedPin &) = delete;
+  ScopedPin &operator=(const ScopedPin &) = delete;
+
+private:
+  bool pinned_;
+  cpu_set_t previous_{};
+};
+
+/// Labels a cross-thread benchmark with the CPUs it ran on, or skips it when
+/// the machine has no pair of CPUs with the requested placement.
+static bool setup_placement(benchmark::State &state, Placement placement,
+                            int &producer_cpu, int &consumer_cpu) {
+  if (!find_cpu_pair(placement, producer_cpu, consumer_cpu)) {
+    state.SkipWithError("No pair of CPUs with this placement");
+    return false;
+  }
+
+  if (placement != Placement::Unpinned)
+    state.SetLabel("cpus:" + std::to_string(producer_cpu) + "," +
+                   std::to_string(consumer_cpu));
+  return true;
+}
+
+static void BM_CrossThread_Throughput(benchmark::State &state) {
+  auto placement = static_cast<Placement>(state.range(0));
+  auto element_size = static_cast<size_t>(state.range(1));
+  auto enqueue_batch_size = static_cast<size_t>(state.range(2));
+  auto dequeue_batch_size = static_cast<size_t>(state.range(3));
+  auto nb_slots = static_cast<size_t>(state.range(4));
+  int producer_cpu = -1;
+  int consumer_cpu = -1;
+  if (!setup_placement(state, placement, producer_cpu, consumer_cpu))
+    return;
+
+  auto buffer = std::make_unique<uint8_t[]>(nb_slots * element_size);
+  auto queue = Queue(nb_slots, enqueue_batch_size, dequeue_batch_size,
+                     element_size, buffer.get());
+
+  // Unlike the single-threaded benchmarks, every byte is written by the
+  // producer and read by the consumer, so the cache lines of the slots move
+  // between the two CPUs as they would in an application.
+  size_t enqueue_bytes = enqueue_batch_size * element_size;
+  size_t dequeue_bytes = dequeue_batch_size * element_size;
+  std::atomic<bool> stop{false};
+  std::thread consumer([&]() {
+    ScopedPin pin(consumer_cpu);
+    auto scratch = std::make_unique<uint8_t[]>(dequeue_bytes);
+    while (!stop.load(std::memory_order_relaxed)) {
+      uint8_t *batch_begin = queue.read_ptr();
+      if (batch_begin == nullptr)
+        continue;
+
+      memcpy(scratch.get(), batch_begin, dequeue_bytes);
+      benchmark::DoNotOptimize(scratch.get());
+      queue.commit_read();
+    }
+  });
+
+  {
+    ScopedPin pin(producer_cpu);
+    uint8_t value = 0;
+    for (auto _ : state) {
+      uint8_t *batch_begin = nullptr;
+      while (batch_begin == nullptr)
+        batch_begin = queue.write_ptr();
+
+      memset(batch_begin, value++, enqueue_bytes);
+      queue.commit_write();
+    }
+  }
+
+  stop.store(true, std::memory_order_relaxed);
+  consumer.join();
+
+  double elements = static_cast<double>(state.iterations()) *
+                    static_cast<double>(enqueue_batch_size);
+  state.counters["Elements"] =
+      benchmark::Counter(elements, benchmark::Counter::kIsRate);
+
+  state.counters["Bandwidth"] = benchmark::Counter(
+      elements * static_cast<double>(element_size),
+      benchmark::Counter::kIsRate, benchmark::Counter::kIs1024);
+}
+
+/// Registers, for every placement, a baseline of 8-byte elements, batches of
+/// 8 and 1024 slots, and sweeps of each parameter in turn around it. A full
+/// cross product would take hours.
+static void cross_thread_sweep(benchmark::internal::Benchmark *benchmark) {
+  const std::vector<int64_t> baseline = {8, 8, 8, 1024};
+  const std::vector<std::vector<int64_t>> sweeps = {
+      {8, 64, 512, 4096},         // element_size
+      {1, 8, 64, 256},            // enqueue_batch_size
+      {1, 8, 64, 256},            // dequeue_batch_size
+      {256, 1024, 16384, 262144}, // nb_slots
+  };
+
+  for (int64_t placement = 0;
+       placement <= static_cast<int64_t>(Placement::CrossSocket);
+       ++placement) {
+    benchmark->Args({placement, baseline[0], baseline[1], baseline[2],
+                     baseline[3]});
+    for (size_t i = 0; i < sweeps.size(); ++i) {
+      for (int64_t value : sweeps[i]) {
+        if (value == baseline[i])
+          continue;
+
+        std::vector<int64_t> args = baseline;
+        args[i] = value;
+        benchmark->Args({placement, args[0], args[1], args[2], args[3]});
+      }
+    }
+  }
+}
+
+/// A log-linear histogram of latencies in nanoseconds, with 32 buckets per
+/// power of two, so that percentiles are within 1/32 of the exact value
+/// without storing every sample.
+class LatencyHistogram {
+public:
+  void record(uint64_t ns) {
+    ++counts_[bucket(ns)];
+    ++total_;
+    max_ = std::max(max_, ns);
+  }
+
+  /// Returns the lower bound of the bucket holding the given percentile.
+  [[nodiscard]] uint64_t percentile(double percent) const {
+    auto rank = static_cast<uint64_t>(
+        std::ceil(percent / 100.0 * static_cast<double>(total_)));
+    uint64_t seen = 0;
+    for (size_t i = 0; i < counts_.size(); ++i) {
+      seen += counts_[i];
+      if (seen >= rank && seen > 0)
+        return lower_bound(i);
+    }
+    return max_;
+  }
+
+  [[nodiscard]] uint64_t max() const { return max_; }
+
+private:
+  static constexpr int kSubBits = 5;
+  static constexpr uint64_t kSubBuckets = uint64_t{1} << kSubBits;
+
+  static size_t bucket(uint64_t ns) {
+    if (ns < kSubBuckets)
+      return ns;
+
+    int shift = std::bit_width(ns) - 1 - kSubBits;
+    return ((static_cast<size_t>(shift) + 1) << kSubBits) +
+           ((ns >> shift) - kSubBuckets);
+  }
+
+  static uint64_t lower_bound(size_t bucket) {
+    if (bucket < kSubBuckets)
+      return bucket;
+
+    size_t shift = (bucket >> kSubBits) - 1;
+    return ((bucket & (kSubBuckets - 1)) + kSubBuckets) << shift;
+  }
+
+  std::array<uint64_t, 64 * kSubBuckets> counts_{};
+  uint64_t total_ = 0;
+  uint64_t max_ = 0;
+};
+
+static void BM_CrossThread_PingPong(benchmark::State &state) {
+  auto placement = static_cast<Placement>(state.range(0));
+  auto element_size = static_cast<size_t>(state.range(1));
+  int producer_cpu = -1;
+  int consumer_cpu = -1;
+  if (!setup_placement(state, placement, producer_cpu, consumer_cpu))
+    return;
+
+  size_t nb_slots = 16;
+  auto ping_buffer = std::make_unique<uint8_t[]>(nb_slots * element_size);
+  auto pong_buffer = std::make_unique<uint8_t[]>(nb_slots * element_size);
+  auto ping = Queue(nb_slots, 1, 1, element_size, ping_buffer.get());
+  auto pong = Queue(nb_slots, 1, 1, element_size, pong_buffer.get());
+
+  // The consumer echoes every element back; the producer times each round
+  // trip, clock reads included.
+  std::atomic<bool> stop{false};
+  std::thread echo([&]() {
+    ScopedPin pin(consumer_cpu);
+    while (!stop.load(std::memory_order_relaxed)) {
+      uint8_t *in = ping.read_ptr();
+      if (in == nullptr)
+        continue;
+
+      uint8_t *out = nullptr;
+      while (out == nullptr)
+        out = pong.write_ptr();
+
+      memcpy(out, in, element_size);
+      ping.commit_read();
+      pong.commit_write();
+    }
+  });
+
+  auto histogram = std::make_unique<LatencyHistogram>();
+  {
+    ScopedPin pin(producer_cpu);
+    uint8_t value = 0;
+    for (auto _ : state) {
+      int64_t start_ns = now_ns();
+      uint8_t *out = nullptr;
+      while (out == nullptr)
+        out = ping.write_ptr();
+
+      memset(out, value++, element_size);
+      ping.commit_write();
+
+      uint8_t *in = nullptr;
+      while (in == nullptr)
+        in = pong.read_ptr();
+
+      benchmark::DoNotOptimize(*in);
+      pong.commit_read();
+      histogram->record(static_cast<uint64_t>(now_ns() - start_ns));
+    }
+  }
+
+  stop.store(true, std::memory_order_relaxed);
+  echo.join();
+
+  state.counters["p50_ns"] = static_cast<double>(histogram->percentile(50));
+  state.counters["p90_ns"] = static_cast<double>(histogram->percentile(90));
+  state.counters["p99_ns"] = static_cast<double>(histogram->percentile(99));
+  state.counters["p99.9_ns"] =
+      static_cast<double>(histogram->percentile(99.9));
+  state.counters["max_ns"] = static_cast<double>(histogram->max());
+}
+
+static void BM_Lossy_Staleness(benchmark::State &state) {
+  auto policy = static_cast<FullPolicy>(state.range(0));
+  size_t nb_slots = 64;
+  auto buffer = std::make_unique<uint8_t[]>(nb_slots * sizeof(int64_t));
+  auto queue = LossyQueue(nb_slots, 1, 1, sizeof(int64_t), buffer.get(),
+                          policy);
+
+  // The producer captures a frame every 2us and publishes its capture time; a
+  // Reject producer waits for room, so its frames queue up behind it. The
+  // consumer takes 5us per frame, and measures how old each frame is.
+  constexpr int64_t capture_period_ns = 2000;
+  constexpr int64_t process_ns = 5000;
+  std::atomic<bool> stop{false};
+  std::thread producer([&]() {
+    int64_t capture_ns = now_ns();
+    while (!stop.load(std::memory_order_relaxed)) {
+      while (now_ns() < capture_ns)
+        ;
+
+      uint8_t *batch_begin = nullptr;
+      while (batch_begin == nullptr && !stop.load(std::memory_order_relaxed))
+        batch_begin = queue.write_ptr();
+      if (batch_begin == nullptr)
+        break;
+
+      memcpy(batch_begin, &capture_ns, sizeof(capture_ns));
+      queue.commit_write();
+      capture_ns += capture_period_ns;
+    }
+  });
+
+  auto histogram = std::make_unique<LatencyHistogram>();
+  uint64_t discarded = 0;
+  for (auto _ : state) {
+    uint8_t *batch_begin = nullptr;
+    while (batch_begin == nullptr)
+      batch_begin = queue.read_ptr();
+
+    int64_t capture_ns;
+    memcpy(&capture_ns, batch_begin, sizeof(capture_ns));
+    if (!queue.commit_read()) {
+      ++discarded;
+      continue;
+    }
+
+    int64_t start_ns = now_ns();
+    histogram->record(static_cast<uint64_t>(start_ns - capture_ns));
+    while (now_ns() < start_ns + process_ns)
+      ;
+  }
+
+  stop.store(true, std::memory_order_relaxed);
+  producer.join();
+
+  state.counters["p50_staleness_ns"] =
+      static_cast<double>(histogram->percentile(50));
+  state.counters["p99_staleness_ns"] =
+      static_cast<double>(histogram->percentile(99));
+  state.counters["max_staleness_ns"] = static_cast<double>(histogram->max());
+  state.counters["Lost"] =
+      static_cast<double>(queue.dropped() + queue.overwritten() + discarded);
+}
+
+/// How BM_ManyQueues serves its producer/consumer pairs.
+enum class ServeMode {
+  /// One thread per side of each pair, spinning on write_ptr()/read_ptr().
+  SpinningThreads,
+
+  /// One coroutine per side, all the producers on one executor thread and
+  /// all the consumers on another.
+  Coroutines,
+};
+
+static Task produce_batches(Queue &queue, size_t nb_batches) {
+  for (size_t i = 0; i < nb_batches; i++) {
+    auto *batch_begin =
+        reinterpret_cast<uint64_t *>(co_await queue.next_write_batch());
+    batch_begin[0] = i;
+    queue.commit_write();
+  }
+}
+
+static Task consume_batches(Queue &queue, size_t nb_batches) {
+  for (size_t i = 0; i < nb_batches; i++) {
+    auto *batch_begin =
+        reinterpret_cast<uint64_t *>(co_await queue.next_read_batch());
+    benchmark::DoNotOptimize(batch_begin[0]);
+    queue.commit_read();
+  }
+}
+
+static void BM_ManyQueues(benchmark::State &state) {
+  // range(0) queue pairs each transfer nb_batches per iteration, served
+  // either by two spinning threads per pair or by two executor threads in
+  // total.
+  auto nb_pairs = static_cast<size_t>(state.range(0));
+  auto mode = static_cast<ServeMode>(state.range(1));
+  size_t nb_slots = 256;
+  size_t batch_size = 8;
+  size_t nb_batches = 4096;
+
+  std::vector<std::unique_ptr<Queue>> queues;
+  for (size_t i = 0; i < nb_pairs; i++)
+    queues.push_back(std::make_unique<Queue>(nb_slots, batch_size, batch_size,
+                                             sizeof(uint64_t),
+                                             BufferOptions{}, true));
+
+  for (auto _ : state) {
+    if (mode == ServeMode::Coroutines) {
+      Executor producers;
+      for (auto &queue : queues)
+        producers.spawn(produce_batches(*queue, nb_batches));
+      std::thread producer_thread([&producers]() { producers.run(); });
+
+      Executor consumers;
+      for (auto &queue : queues)
+        consumers.spawn(consume_batches(*queue, nb_batches));
+      consumers.run();
+      producer_thread.join();
+      continue;
+    }
+
+    std::vector<std::thread> threads;
+    for (auto &queue : queues) {
+      threads.emplace_back([&queue = *queue, nb_batches]() {
+        for (size_t i = 0; i < nb_batches; i++) {
+          auto *batch_begin = reinterpret_cast<uint64_t *>(
+              queue.wait_write_ptr(WaitPolicy::Spin));
+          batch_begin[0] = i;
+          queue.commit_write();
+        }
+      });
+      threads.emplace_back([&queue = *queue, nb_batches]() {
+        for (size_t i = 0; i < nb_batches; i++) {
+          auto *batch_begin = reinterpret_cast<uint64_t *>(
+              queue.wait_read_ptr(WaitPolicy::Spin));
+          benchmark::DoNotOptimize(batch_begin[0]);
+          queue.commit_read();
+        }
+      });
+    }
+    for (auto &thread : threads)
+      thread.join();
+  }
+
+  state.counters["Elements"] = benchmark::Counter(
+      static_cast<double>(state.iterations() * nb_pairs * nb_batches *
+                          batch_size),
+      benchmark::Counter::kIsRate);
+}
+
+static int watch_fd(int fd) {
+  int epoll_fd = epoll_create1(0);
+  epoll_event event{};
+  event.events = EPOLLIN;
+  epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event);
+  return epoll_fd;
+}
+
+static void BM_Events_SyscallsPerBatch(benchmark::State &state) {
+  // Both sides wait in epoll_wait() on the queue's eventfds, the producer
+  // pausing range(0) ns between batches. Under load, the consumer rarely
+  // finds the queue empty, so few batches should cost a system call.
+  auto gap_ns = static_cast<int64_t>(state.range(0));
+  size_t nb_slots = 256;
+  size_t batch_size = 8;
+  auto buffer = std::make_unique<uint8_t[]>(nb_slots * sizeof(uint64_t));
+  auto queue = Queue(nb_slots, batch_size, batch_size, sizeof(uint64_t),
+                     buffer.get());
+  QueueEvents events(queue);
+
+  std::atomic<bool> stop{false};
+  std::atomic<uint64_t> producer_waits{0};
+  std::thread producer([&]() {
+    int epoll_fd = watch_fd(events.space_fd());
+    uint64_t waits = 0;
+    while (!stop.load(std::memory_order_relaxed)) {
+      int64_t start_ns = now_ns();
+      while (now_ns() < start_ns + gap_ns)
+        ;
+
+      uint8_t *batch_begin;
+      while ((batch_begin = queue.write_ptr()) == nullptr &&
+             !stop.load(std::memory_order_relaxed)) {
+        if (!events.arm_write())
+          continue;
+        // Bounded, so that the producer notices stop.
+        epoll_event event;
+        epoll_wait(epoll_fd, &event, 1, 1);
+        events.clear_space();
+        waits++;
+      }
+      if (batch_begin == nullptr)
+        break;
+
+      *batch_begin = 0;
+      queue.commit_write();
+    }
+    producer_waits.store(waits, std::memory_order_relaxed);
+    close(epoll_fd);
+  });
+
+  int epoll_fd = watch_fd(events.data_fd());
+  uint64_t consumer_waits = 0;
+  for (auto _ : state) {
+    uint8_t *batch_begin;
+    while ((batch_begin = queue.read_ptr()) == nullptr) {
+      if (!events.arm_read())
+        continue;
+      epoll_event event;
+      epoll_wait(epoll_fd, &event, 1, -1);
+      events.clear_data();
+      consumer_waits++;
+    }
+
+    benchmark::DoNotOptimize(*batch_begin);
+    queue.commit_read();
+  }
+
+  stop.store(true, std::memory_order_relaxed);
+  producer.join();
+  close(epoll_fd);
+
+  // Each wait is an epoll_wait() and a read() of the eventfd, and each signal
+  // a write().
+  uint64_t waits =
+      consumer_waits + producer_waits.load(std::memory_order_relaxed);
+  uint64_t syscalls =
+      2 * waits + events.data_signals() + events.space_signals();
+  state.counters["syscalls_per_batch"] =
+      static_cast<double>(syscalls) / static_cast<double>(state.iterations());
+  state.counters["Elements"] = benchmark::Counter(
+      static_cast<double>(state.iterations()) *
+          static_cast<double>(batch_size),
+      benchmark::Counter::kIsRate);
+}
+
+/// Where BM_Metadata_SkipStale keeps the header of each frame.
+enum class HeaderLayout {
+  /// At the start of the frame's payload.
+  Embedded,
+
+  /// In a MetadataRing next to the queue.
+  SideRing,
+};
+
+/// The header of a frame when embedded in its payload.
+struct FrameHeader {
+  int64_t capture_ns;
+  uint64_t frame_id;
+  uint32_t valid_bytes;
+};
+
+/// Evicts the cache line at p from every cache level. Only implemented on
+/// x86, elsewhere the line stays cached.
+static void flush_cache_line([[maybe_unused]] const void *p) {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_clflush(p);
+#endif
+}
+
+static void BM_Metadata_SkipStale(benchmark::State &state) {
+  // The queue holds 64 KiB frames, 1 in 8 of them fresh. Before each pass,
+  // the first cache lines of the frames are flushed, as if another core or a
+  // device had just written them, and the same slots are published again.
+  // The consumer skips the stale frames from their capture timestamp and
+  // only touches the payload of the fresh ones. Only the consumer is timed.
+  auto layout = static_cast<HeaderLayout>(state.range(0));
+  size_t frame_size = 64 * 1024;
+  size_t nb_slots = 256;
+  size_t batch_size = 8;
+  auto queue = Queue(nb_slots, batch_size, batch_size, frame_size,
+                     BufferOptions{});
+  MetadataRing<int64_t, uint64_t, uint32_t> metadata(queue);
+  uint8_t *slots = queue.owned_buffer().data();
+
+  // Frame i lives in slot i, and each pass below starts at slot 0.
+  for (size_t slot = 0; slot < nb_slots; slot++) {
+    FrameHeader header{slot % 8 == 0 ? 1 : 0, slot,
+                       static_cast<uint32_t>(frame_size)};
+    memset(slots + slot * frame_size, 0, frame_size);
+    if (layout == HeaderLayout::Embedded)
+      memcpy(slots + slot * frame_size, &header, sizeof(header));
+  }
+
+  uint64_t fresh = 0;
+  for (auto _ : state) {
+    state.PauseTiming();
+    queue.reset();
+    for (size_t slot = 0; slot < nb_slots; slot++) {
+      flush_cache_line(slots + slot * frame_size);
+      if (slot % 8 == 0)
+        flush_cache_line(slots + slot * frame_size + 64);
+    }
+    while (queue.write_ptr() != nullptr) {
+      if (layout == HeaderLayout::SideRing) {
+        auto capture_ns = metadata.write<0>();
+        auto frame_ids = metadata.write<1>();
+        auto valid_bytes = metadata.write<2>();
+        for (size_t i = 0; i < batch_size; i++) {
+          capture_ns[i] = i == 0 ? 1 : 0;
+          frame_ids[i] = i;
+          valid_bytes[i] = static_cast<uint32_t>(frame_size);
+        }
+      }
+      queue.commit_write();
+    }
+    state.ResumeTiming();
+
+    while (uint8_t *batch_begin = queue.read_ptr()) {
+      auto capture_ns = metadata.read<0>();
+      for (size_t i = 0; i < batch_size; i++) {
+        int64_t capture;
+        if (layout == HeaderLayout::Embedded)
+          memcpy(&capture, batch_begin + i * frame_size, sizeof(capture));
+        else
+          capture = capture_ns[i];
+        if (capture == 0)
+          continue;
+
+        benchmark::DoNotOptimize(batch_begin[i * frame_size + 64]);
+        fresh++;
+      }
+      queue.commit_read();
+    }
+  }
+
+  // The queue holds nb_slots - batch_size frames when full.
+  state.counters["Frames"] = benchmark::Counter(
+      static_cast<double>(state.iterations()) *
+          static_cast<double>(nb_slots - batch_size),
+      benchmark::Counter::kIsRate);
+  state.counters["Fresh"] = static_cast<double>(fresh);
+}
+
+/// How BM_Messages_Throughput stores variable-length records.
+enum class RecordMode {
+  /// A Queue with one slot per record, sized for the largest record.
+  FixedSlots,
+
+  /// A MessageQueue.
+  Messages,
+};
+
+static void BM_Messages_Throughput(benchmark::State &state) {
+  // Records of 16 B to 64 KiB, log-uniformly distributed, so that most are
+  // small. Each iteration fills the ring, then drains it. Both rings are
+  // sized for about 256 records of the largest size in fixed-slot mode.
+  auto mode = static_cast<RecordMode>(state.range(0));
+  size_t max_record_size = 64 * 1024;
+  size_t ring_bytes = mode == RecordMode::FixedSlots ? 256 * max_record_size
+                                                     : 4 * 1024 * 1024;
+
+  std::mt19937_64 rng(42);
+  std::uniform_real_distribution<double> log_size(std::log2(16.0),
+                                                  std::log2(65536.0));
+  std::vector<uint32_t> sizes(4096);
+  for (auto &size : sizes)
+    size = static_cast<uint32_t>(std::exp2(log_size(rng)));
+  auto source = std::make_unique<uint8_t[]>(max_record_size);
+  memset(source.get(), 1, max_record_size);
+
+  std::unique_ptr<Queue> queue;
+  std::unique_ptr<MessageQueue> messages;
+  if (mode == RecordMode::FixedSlots)
+    queue = std::make_unique<Queue>(256, 1, 1, max_record_size,
+                                    BufferOptions{});
+  else
+    messages = std::make_unique<MessageQueue>(ring_bytes);
+
+  size_t next = 0;
+  uint64_t records = 0;
+  uint64_t bytes = 0;
+  for (auto _ : state) {
+    for (;;) {
+      uint32_t size = sizes[next % sizes.size()];
+      uint8_t *record;
+      if (mode == RecordMode::FixedSlots) {
+        // The size goes in the first bytes of the slot.
+        uint8_t *slot = queue->write_ptr();
+        if (slot == nullptr)
+          break;
+        memcpy(slot, &size, sizeof(size));
+        record = slot + sizeof(size);
+      } else {
+        record = messages->reserve(size);
+        if (record == nullptr)
+          break;
+      }
+
+      memcpy(record, source.get(), size - sizeof(size));
+      if (mode == RecordMode::FixedSlots)
+        queue->commit_write();
+      else
+        messages->commit(size);
+      next++;
+      records++;
+      bytes += size;
+    }
+
+    if (mode == RecordMode::FixedSlots) {
+      while (const uint8_t *slot = queue->read_ptr()) {
+        uint32_t size;
+        memcpy(&size, slot, sizeof(size));
+        benchmark::DoNotOptimize(slot[size - 1]);
+        queue->commit_read();
+      }
+    } else {
+      size_t size;
+      while (const uint8_t *record = messages->read(size))
+        benchmark::DoNotOptimize(record[size - 1]);
+      messages->release();
+    }
+  }
+
+  state.counters["Bytes"] =
+      benchmark::Counter(static_cast<double>(bytes),
+                         benchmark::Counter::kIsRate,
+                         benchmark::Counter::kIs1024);
+  state.counters["Records"] = benchmark::Counter(
+      static_cast<double>(records), benchmark::Counter::kIsRate);
+  state.counters["RingBytes"] = static_cast<double>(ring_bytes);
+  // Each iteration fills the ring once.
+  state.counters["RingBytesPerRecord"] =
+      static_cast<double>(ring_bytes) /
+      (static_cast<double>(records) / static_cast<double>(state.iterations()));
+}
+
+static void BM_PartialRead_Latency(benchmark::State &state) {
+  // A producer commits one timestamped element every range(0) ns, and the
+  // consumer reads batches of 64 with read_ptr() (range(1) == 0) or with
+  // partial_read_ptr() and a max_delay of range(1) us. Each iteration is a
+  // batch, and the latency is measured per element.
+  auto gap_ns = static_cast<int64_t>(state.range(0));
+  auto max_delay = std::chrono::microseconds(state.range(1));
+  bool partial = state.range(1) != 0;
+  size_t nb_slots = 4096;
+  size_t dequeue_batch_size = 64;
+  auto buffer = std::make_unique<uint8_t[]>(nb_slots * sizeof(int64_t));
+  auto queue = Queue(nb_slots, 1, dequeue_batch_size, sizeof(int64_t),
+                     buffer.get());
+
+  std::atomic<bool> stop{false};
+  std::thread producer([&]() {
+    int64_t next_ns = now_ns();
+    while (!stop.load(std::memory_order_relaxed)) {
+      while (now_ns() < next_ns)
+        std::this_thread::yield();
+      next_ns += gap_ns;
+
+      uint8_t *slot = queue.write_ptr();
+      if (slot == nullptr) {
+        std::this_thread::yield();
+        continue;
+      }
+      int64_t sent_ns = now_ns();
+      memcpy(slot, &sent_ns, sizeof(sent_ns));
+      queue.commit_write();
+    }
+  });
+
+  auto histogram = std::make_unique<LatencyHistogram>();
+  uint64_t elements = 0;
+  for (auto _ : state) {
+    uint8_t *batch_begin;
+    size_t count = dequeue_batch_size;
+    while ((batch_begin = partial ? queue.partial_read_ptr(count, max_delay)
+                                  : queue.read_ptr()) == nullptr)
+      std::this_thread::yield();
+
+    int64_t received_ns = now_ns();
+    for (size_t i = 0; i < count; i++) {
+      int64_t sent_ns;
+      memcpy(&sent_ns, batch_begin + i * sizeof(int64_t), sizeof(sent_ns));
+      histogram->record(static_cast<uint64_t>(received_ns - sent_ns));
+    }
+    elements += count;
+    queue.commit_read(count);
+  }
+
+  stop.store(true, std::memory_order_relaxed);
+  producer.join();
+
+  state.counters["p50_ns"] = static_cast<double>(histogram->percentile(50));
+  state.counters["p99_ns"] = static_cast<double>(histogram->percentile(99));
+  state.counters["Elements"] = benchmark::Counter(
+      static_cast<double>(elements), benchmark::Counter::kIsRate);
+  state.counters["AvgBatch"] = static_cast<double>(elements) /
+                               static_cast<double>(state.iterations());
+}
+
+enum class BatchMode {
+  /// read_ptr(1).
+  FixedSmall,
+
+  /// read_ptr(64).
+  FixedLarge,
+
+  /// An AdaptiveReader between 1 and 64.
+  Adaptive,
+};
+
+static void BM_AdaptiveBatching_Bursty(benchmark::State &state) {
+  // A producer commits bursts of range(1) timestamped elements, one every
+  // 200 us, and the consumer reads them in batches whose size depends on
+  // range(0). Each iteration is a batch, and the latency is measured per
+  // element.
+  auto mode = static_cast<BatchMode>(state.range(0));
+  auto burst = static_cast<size_t>(state.range(1));
+  int64_t period_ns = 200000;
+  size_t nb_slots = 4096;
+  size_t max_batch_size = 64;
+  auto buffer = std::make_unique<uint8_t[]>(nb_slots * sizeof(int64_t));
+  auto queue = Queue(nb_slots, 1, 1, sizeof(int64_t), buffer.get());
+  AdaptiveReader reader(queue, {.min_batch_size = 1,
+                                .max_batch_size = max_batch_size});
+
+  std::atomic<bool> stop{false};
+  std::thread producer([&]() {
+    int64_t next_ns = now_ns();
+    while (!stop.load(std::memory_order_relaxed)) {
+      while (now_ns() < next_ns && !stop.load(std::memory_order_relaxed))
+        std::this_thread::yield();
+      next_ns += period_ns;
+
+      for (size_t i = 0; i < burst && !stop.load(std::memory_order_relaxed);) {
+        uint8_t *slot = queue.write_ptr(1);
+        if (slot == nullptr) {
+          std::this_thread::yield();
+          continue;
+        }
+        int64_t sent_ns = now_ns();
+        memcpy(slot, &sent_ns, sizeof(sent_ns));
+        queue.commit_write(1);
+        i++;
+      }
+    }
+  });
+
+  auto histogram = std::make_unique<LatencyHistogram>();
+  uint64_t elements = 0;
+  uint64_t size_sum = 0;
+  for (auto _ : state) {
+    uint8_t *batch_begin;
+    size_t count = mode == BatchMode::FixedLarge ? max_batch_size : 1;
+    while ((batch_begin = mode == BatchMode::Adaptive
+                              ? reader.read_ptr(count)
+                              : queue.read_ptr(count)) == nullptr)
+      std::this_thread::yield();
+
+    int64_t received_ns = now_ns();
+    for (size_t i = 0; i < count; i++) {
+      int64_t sent_ns;
+      memcpy(&sent_ns, batch_begin + i * sizeof(int64_t), sizeof(sent_ns));
+      histogram->record(static_cast<uint64_t>(received_ns - sent_ns));
+    }
+    elements += count;
+    size_sum += mode == BatchMode::Adaptive ? reader.batch_size() : count;
+    queue.commit_read(count);
+  }
+
+  stop.store(true, std::memory_order_relaxed);
+  producer.join();
+
+  auto iterations = static_cast<double>(state.iterations());
+  state.counters["p50_ns"] = static_cast<double>(histogram->percentile(50));
+  state.counters["p99_ns"] = static_cast<double>(histogram->percentile(99));
+  state.counters["Elements"] = benchmark::Counter(
+      static_cast<double>(elements), benchmark::Counter::kIsRate);
+  state.counters["AvgBatch"] = static_cast<double>(elements) / iterations;
+  state.counters["AvgSize"] = static_cast<double>(size_sum) / iterations;
+  state.counters["Resizes"] = static_cast<double>(reader.resizes());
+}
+
+/// The resident set size of the process in bytes.
+static size_t resident_bytes() {
+  std::ifstream statm("/proc/self/statm");
+  size_t size_pages = 0;
+  size_t resident_pages = 0;
+  statm >> size_pages >> resident_pages;
+  return resident_pages * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+}
+
+enum class Storage {
+  /// A Queue sized for the largest burst.
+  FixedRing,
+
+  /// A SegmentedQueue with 2 MiB segments, one transparent huge page each.
+  Segmented,
+};
+
+static void BM_Segmented_Memory(benchmark::State &state) {
+  // Each iteration builds a queue, pushes a 64 MiB burst through it, then
+  // runs 64 MiB of steady traffic with a backlog of a few batches. The
+  // resident memory the queue adds is sampled after the burst (peak) and
+  // after the steady phase.
+  auto storage = static_cast<Storage>(state.range(0));
+  size_t element_size = 1024;
+  size_t batch_size = 16;
+  size_t burst = 64 * 1024;
+  size_t backlog = 4 * batch_size;
+  size_t segment_slots = 2048;
+  auto source = std::make_unique<uint8_t[]>(batch_size * element_size);
+  memset(source.get(), 1, batch_size * element_size);
+  auto sink = std::make_unique<uint8_t[]>(batch_size * element_size);
+
+  auto run = [&](auto &queue, size_t &peak, size_t &steady, size_t base) {
+    auto write = [&]() {
+      uint8_t *batch_begin = queue.write_ptr();
+      memcpy(batch_begin, source.get(), batch_size * element_size);
+      queue.commit_write();
+    };
+    auto read = [&]() {
+      const uint8_t *batch_begin = queue.read_ptr();
+      memcpy(sink.get(), batch_begin, batch_size * element_size);
+      queue.commit_read();
+    };
+
+    for (size_t i = 0; i < burst; i += batch_size)
+      write();
+    peak = resident_bytes() - base;
+    for (size_t i = backlog; i < burst; i += batch_size)
+      read();
+
+    for (size_t i = 0; i < burst; i += batch_size) {
+      write();
+      read();
+    }
+    steady = resident_bytes() - base;
+    for (size_t i = 0; i < backlog; i += batch_size)
+      read();
+    benchmark::DoNotOptimize(sink.get());
+  };
+
+  size_t peak = 0;
+  size_t steady = 0;
+  for (auto _ : state) {
+    size_t base = resident_bytes();
+    if (storage == Storage::FixedRing) {
+      auto queue = std::make_unique<Queue>(burst + batch_size, batch_size,
+                                           batch_size, element_size,
+                                           BufferOptions{});
+      run(*queue, peak, steady, base);
+    } else {
+      auto queue = std::make_unique<SegmentedQueue>(
+          segment_slots, batch_size, batch_size, element_size);
+      run(*queue, peak, steady, base);
+    }
+  }
+
+  state.counters["PeakRSS_MiB"] = static_cast<double>(peak) / (1 << 20);
+  state.counters["SteadyRSS_MiB"] = static_cast<double>(steady) / (1 << 20);
+  state.counters["Bandwidth"] = benchmark::Counter(
+      static_cast<double>(state.iterations()) *
+          static_cast<double>(2 * burst * element_size),
+      benchmark::Counter::kIsRate, benchmark::Counter::kIs1024);
+}
+
+enum class TransformKind {
+  /// u8 to float, 4 bytes out per byte in.
+  Normalize,
+
+  /// RGB to planar, on 3-channel frames.
+  Deinterleave,
+
+  /// 16-bit byte swap.
+  Byteswap,
+};
+
+static void BM_Transform_Dequeue(benchmark::State &state) {
+  // Dequeues batches of four 1024x1024 frames (of 3 channels for
+  // Deinterleave) with a transform, either fused with the copy out of the
+  // queue (range(1) == 1) or applied as a second pass after a memcpy() out of
+  // it.
+  auto kind = static_cast<TransformKind>(state.range(0));
+  bool fused = state.range(1) != 0;
+  size_t channels = kind == TransformKind::Deinterleave ? 3 : 1;
+  size_t element_size = 1024 * 1024 * channels;
+  size_t nb_slots = 16;
+  size_t batch_size = 4;
+  size_t batch_bytes = batch_size * element_size;
+  auto queue = Queue(nb_slots, batch_size, batch_size, element_size,
+                     BufferOptions{});
+  memset(queue.owned_buffer().data(), 7, nb_slots * element_size);
+
+  Transform transform;
+  switch (kind) {
+  case TransformKind::Normalize:
+    transform = batched_spsc_queue::normalize_transform(1.0f / 255, 0.0f);
+    break;
+  case TransformKind::Deinterleave:
+    transform =
+        batched_spsc_queue::deinterleave_transform(channels, element_size);
+    break;
+  case TransformKind::Byteswap:
+    transform = batched_spsc_queue::byteswap_transform(2);
+    break;
+  }
+  size_t output_bytes = batch_bytes / transform.in_bytes * transform.out_bytes;
+  auto staging = std::make_unique<uint8_t[]>(batch_bytes);
+  auto output = std::make_unique<uint8_t[]>(output_bytes);
+  memset(staging.get(), 0, batch_bytes);
+  memset(output.get(), 0, output_bytes);
+
+  queue.fill();
+  for (auto _ : state) {
+    if (queue.size() == 0)
+      queue.fill();
+
+    if (fused) {
+      queue.dequeue_transform(output.get(), transform);
+    } else {
+      queue.dequeue_copy(staging.get());
+      transform.kernel(output.get(), staging.get(), batch_bytes);
+    }
+    benchmark::ClobberMemory();
+  }
+
+  state.counters["Frames"] = benchmark::Counter(
+      static_cast<double>(state.iterations() * batch_size),
+      benchmark::Counter::kIsRate);
+  state.counters["Bandwidth"] = benchmark::Counter(
+      static_cast<double>(state.iterations()) *
+          static_cast<double>(batch_bytes),
       benchmark::Counter::kIsRate, benchmark::Counter::kIs1024);
 }
 
@@ -134,5 +2079,218 @@ BENCHMARK(BM_Enqueue_NoMemoryTransfer)->MinTime(5.0);
 BENCHMARK(BM_Dequeue_NoMemoryTransfer)->MinTime(5.0);
 BENCHMARK(BM_Enqueue_WithMemoryTransfer)->MinTime(5.0);
 BENCHMARK(BM_Dequeue_WithMemoryTransfer)->MinTime(5.0);
+BENCHMARK(BM_TwoThreads_Throughput)
+    ->ArgNames({"batch", "reload"})
+    ->ArgsProduct({{1, 8, 64}, {0, 1}})
+    ->UseRealTime()
+    ->MinTime(5.0);
+
+// Compile-time specialized counterparts of the benchmarks above. 1000 slots
+// matches the runtime Queue benchmarks; 1024 slots enables mask arithmetic.
+BENCHMARK_TEMPLATE(BM_TypedQueue_Enqueue_NoMemoryTransfer, 1000)->MinTime(5.0);
+BENCHMARK_TEMPLATE(BM_TypedQueue_Enqueue_NoMemoryTransfer, 1024)->MinTime(5.0);
+BENCHMARK_TEMPLATE(BM_TypedQueue_Dequeue_NoMemoryTransfer, 1000)->MinTime(5.0);
+BENCHMARK_TEMPLATE(BM_TypedQueue_Dequeue_NoMemoryTransfer, 1024)->MinTime(5.0);
+BENCHMARK_TEMPLATE(BM_TypedQueue_TwoThreads_Throughput, 1)
+    ->UseRealTime()
+    ->MinTime(5.0);
+BENCHMARK_TEMPLATE(BM_TypedQueue_TwoThreads_Throughput, 8)
+    ->UseRealTime()
+    ->MinTime(5.0);
+BENCHMARK_TEMPLATE(BM_TypedQueue_TwoThreads_Throughput, 64)
+    ->UseRealTime()
+    ->MinTime(5.0);
 
-BENCHMARK_MAIN();
+BENCHMARK(BM_Enqueue_Burst)
+    ->ArgNames({"burst", "single_commit"})
+    ->ArgsProduct({{5, 17, 63}, {0, 1}})
+    ->MinTime(5.0);
+BENCHMARK(BM_SharedQueue_CrossProcess_Throughput)
+    ->Arg(1)
+    ->Arg(8)
+    ->Arg(64)
+    ->UseRealTime()
+    ->MinTime(5.0);
+BENCHMARK(BM_Buffer_FirstLap)
+    ->ArgNames({"huge_pages", "prefault"})
+    ->ArgsProduct({{static_cast<int64_t>(HugePages::None),
+                    static_cast<int64_t>(HugePages::Transparent),
+                    static_cast<int64_t>(HugePages::Explicit)},
+                   {0, 1}})
+    ->MinTime(5.0);
+BENCHMARK(BM_Buffer_SteadyState)
+    ->ArgName("huge_pages")
+    ->Arg(static_cast<int64_t>(HugePages::None))
+    ->Arg(static_cast<int64_t>(HugePages::Transparent))
+    ->Arg(static_cast<int64_t>(HugePages::Explicit))
+    ->MinTime(5.0);
+BENCHMARK(BM_WakeupLatency)
+    ->ArgName("policy")
+    ->Arg(static_cast<int64_t>(WaitPolicy::Spin))
+    ->Arg(static_cast<int64_t>(WaitPolicy::SpinThenYield))
+    ->Arg(static_cast<int64_t>(WaitPolicy::Park))
+    ->UseRealTime()
+    ->MinTime(5.0);
+BENCHMARK(BM_Pipeline_Throughput)
+    ->ArgName("in_place_stages")
+    ->Arg(0)
+    ->Arg(1)
+    ->Arg(3)
+    ->UseRealTime()
+    ->MinTime(5.0);
+BENCHMARK(BM_Broadcast_Throughput)
+    ->ArgName("consumers")
+    ->Arg(1)
+    ->Arg(2)
+    ->Arg(4)
+    ->UseRealTime()
+    ->MinTime(5.0);
+BENCHMARK(BM_FanIn_FindReady)
+    ->ArgNames({"queues", "queue_set"})
+    ->ArgsProduct({{4, 16, 64}, {0, 1}})
+    ->MinTime(5.0);
+BENCHMARK(BM_Dispatcher_Scaling)
+    ->ArgNames({"consumers", "policy"})
+    ->ArgsProduct({{1, 2, 4, 8, 16},
+                   {static_cast<int64_t>(DispatchPolicy::RoundRobin),
+                    static_cast<int64_t>(DispatchPolicy::LeastOccupied)}})
+    ->UseRealTime()
+    ->MinTime(5.0);
+BENCHMARK(BM_CrossThread_Throughput)
+    ->ArgNames({"placement", "element_size", "enqueue_batch_size",
+                "dequeue_batch_size", "nb_slots"})
+    ->Apply(cross_thread_sweep)
+    ->UseRealTime()
+    ->MinTime(5.0);
+BENCHMARK(BM_CrossThread_PingPong)
+    ->ArgNames({"placement", "element_size"})
+    ->ArgsProduct({{static_cast<int64_t>(Placement::Unpinned),
+                    static_cast<int64_t>(Placement::SameCore),
+                    static_cast<int64_t>(Placement::SameSocket),
+                    static_cast<int64_t>(Placement::CrossSocket)},
+                   {8, 64, 512}})
+    ->UseRealTime()
+    ->MinTime(5.0);
+
+BENCHMARK(BM_Copy_Bandwidth)
+    ->ArgNames({"kernel", "size"})
+    ->ArgsProduct({{static_cast<int64_t>(CopyKernel::Scalar),
+                    static_cast<int64_t>(CopyKernel::AVX2),
+                    static_cast<int64_t>(CopyKernel::AVX512)},
+                   {64 << 10, 256 << 10, 1 << 20, 8 << 20, 64 << 20}})
+    ->MinTime(5.0);
+BENCHMARK(BM_Copy_CachePollution)
+    ->ArgName("kernel")
+    ->Arg(static_cast<int64_t>(CopyKernel::Scalar))
+    ->Arg(static_cast<int64_t>(CopyKernel::AVX2))
+    ->Arg(static_cast<int64_t>(CopyKernel::AVX512))
+    ->MinTime(5.0);
+BENCHMARK(BM_Dequeue_Copy)->MinTime(5.0);
+
+BENCHMARK(BM_File_Replay)
+    ->ArgName("mode")
+    ->Arg(static_cast<int64_t>(FileMode::CopyThrough))
+    ->Arg(static_cast<int64_t>(FileMode::ZeroCopy))
+    ->Arg(static_cast<int64_t>(FileMode::ZeroCopyDirect))
+    ->UseRealTime()
+    ->MinTime(5.0);
+BENCHMARK(BM_File_Record)
+    ->ArgName("mode")
+    ->Arg(static_cast<int64_t>(FileMode::CopyThrough))
+    ->Arg(static_cast<int64_t>(FileMode::ZeroCopy))
+    ->Arg(static_cast<int64_t>(FileMode::ZeroCopyDirect))
+    ->UseRealTime()
+    ->MinTime(5.0);
+
+BENCHMARK(BM_SpillQueue_FastPath)->MinTime(5.0);
+BENCHMARK(BM_SpillQueue_Burst)
+    ->ArgName("frames")
+    ->Arg(64)
+    ->Arg(512)
+    ->UseRealTime()
+    ->MinTime(5.0);
+
+BENCHMARK(BM_Lossy_Staleness)
+    ->ArgName("policy")
+    ->Arg(static_cast<int64_t>(FullPolicy::Reject))
+    ->Arg(static_cast<int64_t>(FullPolicy::DropNewest))
+    ->Arg(static_cast<int64_t>(FullPolicy::OverwriteOldest))
+    ->UseRealTime()
+    ->MinTime(5.0);
+
+BENCHMARK(BM_ManyQueues)
+    ->ArgNames({"pairs", "mode"})
+    ->ArgsProduct({{1, 4, 16},
+                   {static_cast<int64_t>(ServeMode::SpinningThreads),
+                    static_cast<int64_t>(ServeMode::Coroutines)}})
+    ->UseRealTime()
+    ->MinTime(5.0);
+
+BENCHMARK(BM_Events_SyscallsPerBatch)
+    ->ArgName("producer_gap_ns")
+    ->Arg(0)
+    ->Arg(1000)
+    ->Arg(10000)
+    ->UseRealTime()
+    ->MinTime(5.0);
+
+BENCHMARK(BM_Metadata_SkipStale)
+    ->ArgName("layout")
+    ->Arg(static_cast<int64_t>(HeaderLayout::Embedded))
+    ->Arg(static_cast<int64_t>(HeaderLayout::SideRing))
+    ->MinTime(5.0);
+
+BENCHMARK(BM_Messages_Throughput)
+    ->ArgName("mode")
+    ->Arg(static_cast<int64_t>(RecordMode::FixedSlots))
+    ->Arg(static_cast<int64_t>(RecordMode::Messages))
+    ->MinTime(5.0);
+
+BENCHMARK(BM_PartialRead_Latency)
+    ->ArgNames({"gap_ns", "max_delay_us"})
+    ->ArgsProduct({{0, 1000, 10000}, {0, 20}})
+    ->UseRealTime()
+    ->MinTime(5.0);
+
+BENCHMARK(BM_AdaptiveBatching_Bursty)
+    ->ArgNames({"mode", "burst"})
+    ->ArgsProduct({{static_cast<int64_t>(BatchMode::FixedSmall),
+                    static_cast<int64_t>(BatchMode::FixedLarge),
+                    static_cast<int64_t>(BatchMode::Adaptive)},
+                   {16, 1000}})
+    ->UseRealTime()
+    ->MinTime(5.0);
+
+BENCHMARK(BM_Segmented_Memory)
+    ->ArgName("storage")
+    ->Arg(static_cast<int64_t>(Storage::FixedRing))
+    ->Arg(static_cast<int64_t>(Storage::Segmented))
+    ->MinTime(5.0);
+
+BENCHMARK(BM_Transform_Dequeue)
+    ->ArgNames({"transform", "fused"})
+    ->ArgsProduct({{static_cast<int64_t>(TransformKind::Normalize),
+                    static_cast<int64_t>(TransformKind::Deinterleave),
+                    static_cast<int64_t>(TransformKind::Byteswap)},
+                   {0, 1}})
+    ->MinTime(5.0);
+
+int main(int argc, char **argv) {
+  // Recorded in the context of every report, JSON and CSV included, so that
+  // results from builds with a different padding can be told apart.
+  benchmark::AddCustomContext("cache_line_size",
+                              std::to_string(CACHE_LINE_SIZE));
+  benchmark::AddCustomContext("queue_stats",
+                              Queue::kStatsEnabled ? "on" : "off");
+  const char *kernels[] = {"scalar", "avx2", "avx512"};
+  benchmark::AddCustomContext(
+      "copy_kernel",
+      kernels[static_cast<int>(batched_spsc_queue::best_copy_kernel())]);
+
+  benchmark::Initialize(&argc, argv);
+  if (benchmark::ReportUnrecognizedArguments(argc, argv))
+    return 1;
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+  return 0;
+}
@@ -13,18 +13,16 @@ constexpr size_t ENQUEUE_BATCH_SIZE = 8;
 constexpr size_t DEQUEUE_BATCH_SIZE = 64;
 
 using Queue = batched_spsc_queue::Queue;
+using WaitPolicy = batched_spsc_queue::WaitPolicy;
 
 void producer(Queue &queue) {
   // Enqueue 16 batch for a total of 128 images.
   for (size_t i = 0; i < 16; i++) {
-    // Wait until there is enough space to perform an enqueue.
-    uint8_t *batch_begin = nullptr;
-    while (batch_begin == nullptr) {
-      // write_ptr() returns a pointer to the next write location. In this case
-      // this is the write location for the next batch to enqueue. One should
-      // check for nullity as this happens when the queue is full.
-      batch_begin = queue.write_ptr();
-    }
+    // Wait until there is enough space to perform an enqueue. write_ptr()
+    // returns a pointer to the next write location, or nullptr when the queue
+    // is full. wait_write_ptr() blocks instead, here by parking the thread so
+    // that an idle producer does not burn a core.
+    uint8_t *batch_begin = queue.wait_write_ptr(WaitPolicy::Park);
 
     // Fill the batch of image with:
     // - 0s for the first image
@@ -48,14 +46,11 @@ void producer(Queue &queue) {
 void consumer(Queue &queue) {
   // Dequeue 2 batch for a total of 128 images.
   for (size_t i = 0; i < 2; i++) {
-    // Wait until there is enough images to perform a dequeue.
-    uint8_t *batch_begin = nullptr;
-    while (batch_begin == nullptr) {
-      // read_ptr() returns a pointer to the next read location. In this case
-      // this is the read location for the next batch to dequeue. One should
-      // check for nullity as this happens when the queue is empty.
-      batch_begin = queue.read_ptr();
-    }
+    // Wait until there is enough images to perform a dequeue. read_ptr()
+    // returns a pointer to the next read location, or nullptr when the queue
+    // is empty. wait_read_ptr() blocks instead, here by parking the thread so
+    // that an idle consumer does not burn a core.
+    uint8_t *batch_begin = queue.wait_read_ptr(WaitPolicy::Park);
 
     // Check the content of the batch is correct.
     for (size_t j = 0; j < DEQUEUE_BATCH_SIZE; j++) {
@@ -84,8 +79,10 @@ int main() {
   size_t dequeue_batch_size = DEQUEUE_BATCH_SIZE;
   size_t element_size = IMG_WIDTH * IMG_HEIGHT * sizeof(uint8_t);
   auto buffer = std::make_unique<uint8_t[]>(nb_slots * element_size);
+
+  // Enable parking, as both threads block with WaitPolicy::Park.
   auto queue = Queue(nb_slots, enqueue_batch_size, dequeue_batch_size,
-                     element_size, buffer.get());
+                     element_size, buffer.get(), true);
 
   // Launch producer and consumer on separate threads.
   std::future<void> producer_thread = std::async(producer, std::ref(queue));
@@ -0,0 +1,71 @@
+#include "pipeline.hh"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <numeric>
+#include <ostream>
+
+constexpr size_t IMG_WIDTH = 1024;
+constexpr size_t IMG_HEIGHT = 1024;
+constexpr size_t IMG_SIZE = IMG_WIDTH * IMG_HEIGHT;
+constexpr size_t NB_IMAGES = 128;
+
+using Pipeline = batched_spsc_queue::Pipeline;
+
+int main() {
+  // Every queue of the pipeline has 32 slots, enough for the batch sizes of
+  // the stages sharing a buffer: 8 + 8 + 16 images, then 16 + 16 sums.
+  Pipeline pipeline(32);
+
+  // capture: fill batches of 8 images, image i being filled with i % 256.
+  // Returning fewer images than requested ends the stream.
+  size_t next_image = 0;
+  pipeline.source(
+      "capture", IMG_SIZE, 8, [&](uint8_t *batch, size_t batch_size) {
+        size_t n = std::min(batch_size, NB_IMAGES - next_image);
+        for (size_t i = 0; i < n; i++, next_image++)
+          std::fill_n(batch + i * IMG_SIZE, IMG_SIZE, next_image);
+        return n;
+      });
+
+  // preprocess: invert the images in place. The batch is the very memory
+  // capture wrote to, no copy happens between the two stages.
+  pipeline.stage("preprocess", 8, [](uint8_t *batch, size_t n) {
+    std::transform(batch, batch + n * IMG_SIZE, batch,
+                   [](uint8_t pixel) { return 255 - pixel; });
+  });
+
+  // compute: reduce each image to the sum of its pixels. The element size
+  // changes, so the sums are written to a new buffer.
+  pipeline.stage("compute", sizeof(uint64_t), 16,
+                 [](const uint8_t *input, uint8_t *output, size_t n) {
+                   for (size_t i = 0; i < n; i++) {
+                     const uint8_t *image = input + i * IMG_SIZE;
+                     uint64_t sum = std::accumulate(image, image + IMG_SIZE,
+                                                    uint64_t{0});
+                     std::memcpy(output + i * sizeof(sum), &sum, sizeof(sum));
+                   }
+                 });
+
+  // sink: check the sums.
+  size_t checked = 0;
+  pipeline.sink("sink", 16, [&](const uint8_t *batch, size_t n) {
+    for (size_t i = 0; i < n; i++, checked++) {
+      uint64_t sum = 0;
+      std::memcpy(&sum, batch + i * sizeof(sum), sizeof(sum));
+      if (sum != (255 - checked % 256) * IMG_SIZE)
+        std::cout << "ERROR" << std::endl;
+    }
+  });
+
+  pipeline.start();
+  pipeline.wait();
+
+  // The stage with the least stall time is the bottleneck.
+  for (const auto &stage : pipeline.stats())
+    std::cout << stage.name << ": " << stage.elements << " images, "
+              << stage.throughput() << " images/s, busy "
+              << stage.busy.count() / 1000 << " us, stalled "
+              << stage.stalled.count() / 1000 << " us" << std::endl;
+}
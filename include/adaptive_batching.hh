@@ -0,0 +1,200 @@
+#pragma once
+
+#include "batched_spsc_queue.hh"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace batched_spsc_queue {
+/**
+ * @brief The bounds and sampling rate of an AdaptiveReader or AdaptiveWriter.
+ */
+struct AdaptiveBatchOptions {
+  /// The smallest batch size, a power of two. With 1, no element is ever left
+  /// waiting for a batch to fill up once the traffic stops.
+  size_t min_batch_size = 1;
+
+  /// The largest batch size, a power of two, smaller than nb_slots. Unless the
+  /// queue is on a MirroredBuffer, nb_slots must be a multiple of it.
+  size_t max_batch_size = 64;
+
+  /// The number of calls between two samples of the occupancy.
+  size_t sample_interval = 16;
+};
+
+/**
+ * @class AdaptiveBatchSize
+ * @brief The batch size policy shared by AdaptiveReader and AdaptiveWriter.
+ *
+ * Every sample_interval calls, the side samples the occupancy of the queue
+ * with the same reload of the other side's index as its size(), and folds it
+ * into a moving average. Sampling thus costs one load of the other side's
+ * cache line every sample_interval calls. With s the current batch size, and
+ * "ready" the average number of elements (for the consumer) or free slots (for
+ * the producer) the side can take:
+ *
+ * - s halves when ready < s, that is when a batch of s would usually have to
+ *   wait, so that a quiet queue is served with small batches.
+ * - s doubles when the average occupancy reaches 4 * s and ready reaches 2 * s,
+ *   that is when the queue holds at least two batches of the larger size.
+ *
+ * The gap between the two thresholds is the hysteresis: after growing to 2 * s
+ * the size only shrinks back once the occupancy falls below 2 * s, so an
+ * occupancy that hovers around a threshold does not make it flap.
+ *
+ * Batches end on a multiple of the current size, so after a change the first
+ * batch may be shorter. Since nb_slots is a multiple of every size, no batch
+ * straddles the end of the buffer.
+ */
+class AdaptiveBatchSize {
+public:
+  /**
+   * @brief Returns the current batch size.
+   *
+   * Thread-safe.
+   */
+  [[nodiscard]] size_t batch_size() const {
+    return exported_size_.load(std::memory_order_relaxed);
+  }
+
+  /**
+   * @brief Returns the number of times the batch size changed.
+   *
+   * Thread-safe.
+   */
+  [[nodiscard]] uint64_t resizes() const {
+    return resizes_.load(std::memory_order_relaxed);
+  }
+
+protected:
+  /**
+   * @throws std::invalid_argument if the options do not satisfy the
+   * constraints of AdaptiveBatchOptions.
+   */
+  AdaptiveBatchSize(size_t nb_slots, bool mirrored,
+                    const AdaptiveBatchOptions &options);
+
+  /// Counts a call, returning true every sample_interval calls.
+  bool sample_due() {
+    if (++calls_ < sample_interval_)
+      return false;
+    calls_ = 0;
+    return true;
+  }
+
+  /// Folds an occupancy sample into the average and resizes accordingly.
+  /// producer tells whether ready counts free slots rather than elements.
+  void update(size_t occupancy, bool producer);
+
+  /// The number of elements of the batch starting at slot idx.
+  [[nodiscard]] size_t batch_at(size_t idx) const {
+    if (mirrored_)
+      return size_;
+    return size_ - (idx & (size_ - 1));
+  }
+
+private:
+  /// The weight of a new sample in the average is 2^-kSmoothingShift.
+  static constexpr unsigned kSmoothingShift = 2;
+
+  size_t nb_slots_;
+  bool mirrored_;
+  size_t min_batch_size_;
+  size_t max_batch_size_;
+  size_t sample_interval_;
+
+  /// The current batch size, and the calls since the last sample.
+  size_t size_;
+  size_t calls_;
+
+  /// The average occupancy, times 2^kSmoothingShift.
+  size_t scaled_occupancy_;
+
+  /// Copies of size_ and a resize count for other threads.
+  std::atomic<size_t> exported_size_;
+  std::atomic<uint64_t> resizes_;
+};
+
+/**
+ * @class AdaptiveReader
+ * @brief Reads from a Queue in batches whose size follows the load, between
+ * the bounds of its AdaptiveBatchOptions.
+ *
+ * Small batches keep the latency low while the queue is nearly empty, and
+ * larger ones cut the number of commits once it backs up. See
+ * AdaptiveBatchSize for the policy.
+ *
+ * @code
+ * AdaptiveReader reader(queue, {.min_batch_size = 1, .max_batch_size = 64});
+ * size_t count;
+ * while (uint8_t *batch = reader.read_ptr(count)) {
+ *   ...
+ *   queue.commit_read(count);
+ * }
+ * @endcode
+ *
+ * @note The reader belongs to the consumer thread, and the consumer should
+ * not use the other read methods of the queue meanwhile. Only batch_size()
+ * and resizes() may be called from other threads.
+ */
+class AdaptiveReader : public AdaptiveBatchSize {
+public:
+  /**
+   * @param queue The queue to read from. It must outlive the reader.
+   * @param options The bounds of the batch size, which starts at
+   * min_batch_size.
+   *
+   * @throws std::invalid_argument if the options do not satisfy the
+   * constraints of AdaptiveBatchOptions.
+   */
+  AdaptiveReader(Queue &queue, const AdaptiveBatchOptions &options);
+
+  /**
+   * @brief Returns the next batch for reading.
+   *
+   * @param count Set to the number of elements of the batch, to be passed to
+   * commit_read(count). Only meaningful when the batch is not nullptr.
+   * @return A pointer to count elements, or nullptr if fewer are available.
+   */
+  uint8_t *read_ptr(size_t &count);
+
+private:
+  Queue &queue_;
+};
+
+/**
+ * @class AdaptiveWriter
+ * @brief Producer counterpart of AdaptiveReader.
+ *
+ * The producer publishes small batches while the consumer keeps up, and
+ * larger ones once the queue backs up, as long as they fit in the free slots.
+ *
+ * @note The writer belongs to the producer thread, and the producer should
+ * not use the other write methods of the queue meanwhile. Only batch_size()
+ * and resizes() may be called from other threads.
+ */
+class AdaptiveWriter : public AdaptiveBatchSize {
+public:
+  /**
+   * @param queue The queue to write to. It must outlive the writer.
+   * @param options The bounds of the batch size, which starts at
+   * min_batch_size.
+   *
+   * @throws std::invalid_argument if the options do not satisfy the
+   * constraints of AdaptiveBatchOptions.
+   */
+  AdaptiveWriter(Queue &queue, const AdaptiveBatchOptions &options);
+
+  /**
+   * @brief Returns the next batch for writing.
+   *
+   * @param count Set to the number of slots of the batch, to be passed to
+   * commit_write(count). Only meaningful when the batch is not nullptr.
+   * @return A pointer to count slots, or nullptr if fewer are free.
+   */
+  uint8_t *write_ptr(size_t &count);
+
+private:
+  Queue &queue_;
+};
+} // namespace batched_spsc_queue
@@ -1,6 +1,10 @@
 #pragma once
 
+#include "buffer.hh"
+#include "copy.hh"
+#include <array>
 #include <atomic>
+#include <chrono>
 #include <cstddef>
 #include <cstdint>
 
@@ -9,6 +13,67 @@
 #endif
 
 namespace batched_spsc_queue {
+class AdaptiveReader;
+class AdaptiveWriter;
+class BatchAwaiter;
+template <typename... Fields> class MetadataRing;
+class MirroredBuffer;
+class QueueEvents;
+class QueueSet;
+struct Transform;
+
+/**
+ * @brief How a blocking call waits for the queue to become ready.
+ */
+enum class WaitPolicy {
+  /// Busy-loop on the queue. Lowest wake-up latency, burns a full core.
+  Spin,
+
+  /// Busy-loop for a bounded number of attempts, then yield the CPU between
+  /// attempts.
+  SpinThenYield,
+
+  /// Busy-loop for a bounded number of attempts, then park the thread on the
+  /// other side's index with std::atomic::wait(). The other side only issues a
+  /// notify_one() when this side is actually parked. Requires a queue
+  /// constructed with enable_parking, otherwise behaves like SpinThenYield.
+  Park,
+};
+
+/**
+ * @brief A snapshot of the statistics of a Queue, see Queue::stats().
+ */
+struct QueueStats {
+  /// Number of buckets of the occupancy histograms. Bucket i counts the
+  /// commits after which the queue held between i / kOccupancyBuckets and
+  /// (i + 1) / kOccupancyBuckets of nb_slots elements.
+  static constexpr size_t kOccupancyBuckets = 16;
+
+  /// The statistics of one side of the queue.
+  struct Side {
+    /// Number of write_ptr() (resp. read_ptr()) calls that returned nullptr
+    /// because the queue was full (resp. empty).
+    uint64_t rejections = 0;
+
+    /// Number of commit_write() (resp. commit_read()) calls.
+    uint64_t batches = 0;
+
+    /// Number of elements committed.
+    uint64_t elements = 0;
+
+    /// Accumulated time between the first rejection of a streak and the next
+    /// successful call.
+    std::chrono::nanoseconds stalled{0};
+
+    /// Occupancy of the queue sampled on each commit, right after it, from
+    /// this side's new index and a load of the other side's index.
+    std::array<uint64_t, kOccupancyBuckets> occupancy{};
+  };
+
+  Side producer;
+  Side consumer;
+};
+
 /**
  * @class Queue
  * @brief A batched single-producer single-consumer (SPSC) queue implemented
@@ -51,6 +116,10 @@ public:
    * @param element_size The size of each element in bytes.
    * @param buffer A pre-allocated memory block that is large enough to contain
    * nb_slots * element_size bytes.
+   * @param enable_parking Whether WaitPolicy::Park may be used. Parking needs
+   * commit_write() and commit_read() to publish their index with a full
+   * barrier so that a parked thread is never missed, which costs a few
+   * nanoseconds per commit. Queues that never park should leave it off.
    *
    * @note Not meeting the specified conditions results in undefined behavior.
    *       This includes:
@@ -58,7 +127,57 @@ public:
    * dequeue_batch_size.
    */
   Queue(size_t nb_slots, size_t enqueue_batch_size, size_t dequeue_batch_size,
-        size_t element_size, uint8_t *buffer);
+        size_t element_size, uint8_t *buffer, bool enable_parking = false);
+
+  /**
+   * @brief Constructs a Queue that allocates and owns its buffer.
+   *
+   * The buffer is a Buffer of nb_slots * element_size bytes allocated with the
+   * given options. With the default options it is bound to the NUMA node of
+   * the calling thread, so the queue should be constructed on the consumer
+   * thread.
+   *
+   * @param nb_slots The number of slots in the circular buffer, see above.
+   * @param enqueue_batch_size The number of elements that can be
+   * enqueued in a single batch.
+   * @param dequeue_batch_size The number of elements that can be
+   * dequeued in a single batch.
+   * @param element_size The size of each element in bytes.
+   * @param options How to allocate the buffer.
+   * @param enable_parking Whether WaitPolicy::Park may be used.
+   *
+   * @throws std::system_error if the buffer cannot be allocated.
+   */
+  Queue(size_t nb_slots, size_t enqueue_batch_size, size_t dequeue_batch_size,
+        size_t element_size, const BufferOptions &options,
+        bool enable_parking = false);
+
+  /**
+   * @brief Constructs a Queue on top of a mirrored buffer.
+   *
+   * Since the buffer is mapped twice back to back, a batch starting at any
+   * slot is contiguous. nb_slots therefore does not need to be a multiple of
+   * the batch sizes, and write_ptr(n)/read_ptr(n) accept any n that fits in
+   * the queue, across the end of the buffer.
+   *
+   * @param nb_slots The number of slots in the circular buffer. The actual
+   * capacity of the queue is nb_slots - enqueue_batch_size.
+   * @param enqueue_batch_size The number of elements that can be
+   * enqueued in a single batch.
+   * @param dequeue_batch_size The number of elements that can be
+   * dequeued in a single batch.
+   * @param element_size The size of each element in bytes.
+   * @param buffer A mirrored buffer of exactly nb_slots * element_size bytes.
+   * It must outlive the queue.
+   * @param enable_parking Whether WaitPolicy::Park may be used.
+   *
+   * @note Not meeting the specified conditions results in undefined behavior.
+   *       This includes:
+   *       - buffer.size() being different from nb_slots * element_size.
+   */
+  Queue(size_t nb_slots, size_t enqueue_batch_size, size_t dequeue_batch_size,
+        size_t element_size, MirroredBuffer &buffer,
+        bool enable_parking = false);
 
   /**
    * @brief Returns a pointer to the next available slot for writing.
@@ -116,6 +235,242 @@ public:
    */
   void commit_read();
 
+  /**
+   * @brief Returns a pointer to n contiguous slots for writing.
+   *
+   * Variable-size counterpart of write_ptr(). Any n up to
+   * available_contiguous_write() can be claimed, so a burst of any size can be
+   * published with a single commit_write(n).
+   *
+   * @param n The number of elements to write.
+   * @return A pointer to the next available slot for writing, or nullptr if
+   * fewer than n slots are free before the end of the buffer.
+   *
+   * @note Mixing with the fixed-size API is only valid while the write index
+   * stays a multiple of enqueue_batch_size, otherwise a fixed-size batch could
+   * straddle the end of the buffer. This restriction does not apply to queues
+   * built on a MirroredBuffer.
+   */
+  uint8_t *write_ptr(size_t n);
+
+  /**
+   * @brief Commits a variable-size write operation.
+   *
+   * @param n The number of elements written. Must not exceed the n passed to
+   * the matching write_ptr(n).
+   */
+  void commit_write(size_t n);
+
+  /**
+   * @brief Returns a pointer to n contiguous elements for reading.
+   *
+   * Variable-size counterpart of read_ptr().
+   *
+   * @param n The number of elements to read.
+   * @return A pointer to the next available slot for reading, or nullptr if
+   * fewer than n elements are available before the end of the buffer.
+   *
+   * @note Mixing with the fixed-size API is only valid while the read index
+   * stays a multiple of dequeue_batch_size, except on a MirroredBuffer.
+   */
+  uint8_t *read_ptr(size_t n);
+
+  /**
+   * @brief Commits a variable-size read operation.
+   *
+   * @param n The number of elements read. Must not exceed the n passed to the
+   * matching read_ptr(n).
+   */
+  void commit_read(size_t n);
+
+  /**
+   * @brief Returns the next batch for reading, or a partial one when the
+   * elements have waited long enough.
+   *
+   * Under load this behaves like read_ptr() and count is
+   * dequeue_batch_size. When fewer elements are available, they are returned
+   * as a partial batch once max_delay has elapsed since the consumer first
+   * saw them, or right away if the producer called flush() after committing
+   * them. Only these slow paths read the clock. Either way, release the
+   * batch with commit_read(n), n being at most count. Until then, calling
+   * this again starts at the same element.
+   *
+   * After a partial batch, the next batch is shortened so that it ends on a
+   * multiple of dequeue_batch_size. The read index is thus back on a batch
+   * boundary after it, and read_ptr() may be used again, since a batch never
+   * straddles the end of the buffer.
+   *
+   * @param count Set to the number of elements returned.
+   * @param max_delay How long available elements may wait for a full batch.
+   * @return A pointer to count elements, or nullptr if there is nothing to
+   * read yet.
+   * @note This method should only be called by the consumer thread.
+   */
+  uint8_t *partial_read_ptr(size_t &count, std::chrono::nanoseconds max_delay);
+
+  /**
+   * @brief Lets the consumer read the elements committed so far with
+   * partial_read_ptr() without waiting for a full batch or for the deadline.
+   *
+   * @note This method should only be called by the producer thread.
+   */
+  void flush();
+
+  /**
+   * @brief Returns the largest n for which write_ptr(n) currently succeeds.
+   *
+   * This is the free space left before the end of the buffer (or all the free
+   * space on a MirroredBuffer), one slot being kept empty to distinguish a full
+   * queue from an empty one.
+   *
+   * @note This method should only be called by the producer thread.
+   */
+  size_t available_contiguous_write();
+
+  /**
+   * @brief Returns the largest n for which read_ptr(n) currently succeeds.
+   *
+   * This is the number of elements available before the end of the buffer (or
+   * all of them on a MirroredBuffer).
+   *
+   * @note This method should only be called by the consumer thread.
+   */
+  size_t available_contiguous_read();
+
+  /**
+   * @brief Copies a batch of enqueue_batch_size elements from src into the
+   * queue and commits it.
+   *
+   * Batches of at least kNonTemporalThreshold bytes are copied with
+   * non-temporal stores (see copy_batch()), so that they do not evict the
+   * producer's working set.
+   *
+   * @return false, without copying anything, if the queue is full.
+   * @note This method should only be called by the producer thread.
+   */
+  bool enqueue_copy(const uint8_t *src);
+
+  /**
+   * @brief Copies a batch of dequeue_batch_size elements out of the queue into
+   * dst and commits the read.
+   *
+   * Batches of at least kNonTemporalThreshold bytes are copied with
+   * non-temporal stores (see copy_batch()).
+   *
+   * @return false, without copying anything, if the queue is empty.
+   * @note This method should only be called by the consumer thread.
+   */
+  bool dequeue_copy(uint8_t *dst);
+
+  /**
+   * @brief Writes a batch of enqueue_batch_size elements with a transform of
+   * src, and commits it.
+   *
+   * The kernel of the transform writes the slots directly, so the data is
+   * only touched once instead of being transformed in a staging buffer and
+   * then copied. src holds the input of the transform, that is
+   * enqueue_batch_size * element_size / transform.out_bytes *
+   * transform.in_bytes bytes.
+   *
+   * @return false, without reading src, if the queue is full.
+   * @throws std::invalid_argument if the batch is not a multiple of
+   * transform.out_bytes.
+   * @note This method should only be called by the producer thread.
+   */
+  bool enqueue_transform(const uint8_t *src, const Transform &transform);
+
+  /**
+   * @brief Writes a transform of a batch of dequeue_batch_size elements to
+   * dst, and commits the read.
+   *
+   * dst receives dequeue_batch_size * element_size / transform.in_bytes *
+   * transform.out_bytes bytes.
+   *
+   * @return false, without writing dst, if the queue is empty.
+   * @throws std::invalid_argument if the batch is not a multiple of
+   * transform.in_bytes.
+   * @note This method should only be called by the consumer thread.
+   */
+  bool dequeue_transform(uint8_t *dst, const Transform &transform);
+
+  /**
+   * @brief Blocks until a slot is available for writing.
+   *
+   * Same as write_ptr(), but waits according to the given policy instead of
+   * returning nullptr when the queue is full.
+   *
+   * @param policy How to wait while the queue is full.
+   * @return A pointer to the next available slot for writing.
+   */
+  uint8_t *wait_write_ptr(WaitPolicy policy);
+
+  /**
+   * @brief Blocks until a slot is available for writing, or until the timeout
+   * expires.
+   *
+   * std::atomic::wait() has no timed form, so with WaitPolicy::Park this
+   * overload sleeps with an exponential backoff once the spin phase is over
+   * instead of parking on the index.
+   *
+   * @param policy How to wait while the queue is full.
+   * @param timeout The maximum time to wait.
+   * @return A pointer to the next available slot for writing, or nullptr if
+   * the timeout expired.
+   */
+  uint8_t *wait_write_ptr(WaitPolicy policy, std::chrono::nanoseconds timeout);
+
+  /**
+   * @brief Blocks until a batch is available for reading.
+   *
+   * Same as read_ptr(), but waits according to the given policy instead of
+   * returning nullptr when the queue is empty.
+   *
+   * @param policy How to wait while the queue is empty.
+   * @return A pointer to the next available slot for reading.
+   */
+  uint8_t *wait_read_ptr(WaitPolicy policy);
+
+  /**
+   * @brief Blocks until a batch is available for reading, or until the timeout
+   * expires.
+   *
+   * See wait_write_ptr(WaitPolicy, std::chrono::nanoseconds) for how
+   * WaitPolicy::Park behaves with a timeout.
+   *
+   * @param policy How to wait while the queue is empty.
+   * @param timeout The maximum time to wait.
+   * @return A pointer to the next available slot for reading, or nullptr if
+   * the timeout expired.
+   */
+  uint8_t *wait_read_ptr(WaitPolicy policy, std::chrono::nanoseconds timeout);
+
+  /**
+   * @brief Returns an awaitable for the next slot for writing, for coroutines
+   * run by an Executor (see coroutine.hh).
+   *
+   * co_await queue.next_write_batch() gives the same pointer as write_ptr(),
+   * suspending the coroutine while the queue is full instead of returning
+   * nullptr. The consumer's commit_read() hands it back to its executor.
+   *
+   * @throws std::logic_error if the queue was constructed without
+   * enable_parking.
+   * @note This method should only be called by the producer.
+   */
+  BatchAwaiter next_write_batch();
+
+  /**
+   * @brief Returns an awaitable for the next batch for reading, for coroutines
+   * run by an Executor (see coroutine.hh).
+   *
+   * Consumer counterpart of next_write_batch(), resumed by the producer's
+   * commit_write().
+   *
+   * @throws std::logic_error if the queue was constructed without
+   * enable_parking.
+   * @note This method should only be called by the consumer.
+   */
+  BatchAwaiter next_read_batch();
+
   /**
    * @brief Returns the number of elements currently in the queue.
    *
@@ -126,6 +481,54 @@ public:
    */
   size_t size();
 
+  /// Whether the library was built with BATCHED_SPSC_QUEUE_STATS, without
+  /// which stats() always returns zeros.
+#ifdef BATCHED_SPSC_QUEUE_STATS
+  static constexpr bool kStatsEnabled = true;
+#else
+  static constexpr bool kStatsEnabled = false;
+#endif
+
+  /**
+   * @brief Returns a snapshot of the statistics of the queue.
+   *
+   * Statistics are only collected when the library is built with
+   * BATCHED_SPSC_QUEUE_STATS defined (the BATCHED_SPSC_QUEUE_ENABLE_STATS CMake
+   * option); otherwise they cost nothing and this returns zeros. Each side
+   * only updates its own counters, on its own cache lines. Sampling the
+   * occupancy loads the other side's index on every commit, which is the
+   * only cross-core traffic the statistics add.
+   *
+   * This method is safe to call from any thread. Counters are read one by
+   * one, so a snapshot taken while the queue is in use may be slightly
+   * inconsistent across counters.
+   */
+  [[nodiscard]] QueueStats stats() const;
+
+  /// The number of slots in the circular buffer.
+  [[nodiscard]] size_t nb_slots() const { return nb_slots_; }
+
+  /// The number of elements enqueued in a single batch.
+  [[nodiscard]] size_t enqueue_batch_size() const {
+    return enqueue_batch_size_;
+  }
+
+  /// The number of elements dequeued in a single batch.
+  [[nodiscard]] size_t dequeue_batch_size() const {
+    return dequeue_batch_size_;
+  }
+
+  /// The size of each element in bytes.
+  [[nodiscard]] size_t element_size() const { return element_size_; }
+
+  /**
+   * @brief Returns the buffer owned by the queue.
+   *
+   * @return The owned buffer, empty if the queue was constructed on top of a
+   * caller-provided buffer.
+   */
+  [[nodiscard]] const Buffer &owned_buffer() const { return owned_buffer_; }
+
   /**
    * @brief Resets the queue.
    *
@@ -148,7 +551,8 @@ private:
    * @brief Returns the number of elements currently in the queue.
    *
    * This method provides the current size of the queue, i.e., the number of
-   * elements that have been enqueued but not yet dequeued.
+   * elements that have been enqueued but not yet dequeued. It also refreshes
+   * the producer's cached copy of the read index.
    *
    * @return The number of elements currently in the queue.
    *
@@ -160,7 +564,8 @@ private:
    * @brief Returns the number of elements currently in the queue.
    *
    * This method provides the current size of the queue, i.e., the number of
-   * elements that have been enqueued but not yet dequeued.
+   * elements that have been enqueued but not yet dequeued. It also refreshes
+   * the consumer's cached copy of the write index.
    *
    * @return The number of elements currently in the queue.
    *
@@ -168,7 +573,111 @@ private:
    */
   size_t reader_size();
 
+  /**
+   * @brief Checks whether n slots can be written at write_idx, only reloading
+   * read_idx_ when the cached value says they cannot.
+   *
+   * @note This method should only be called by the producer thread.
+   */
+  bool writer_has_room(size_t write_idx, size_t n);
+
+  /**
+   * @brief Checks whether n elements can be read at read_idx, only reloading
+   * write_idx_ when the cached value says they cannot.
+   *
+   * @note This method should only be called by the consumer thread.
+   */
+  bool reader_has_data(size_t read_idx, size_t n);
+
+  /**
+   * @brief Records the outcome of a write_ptr() call. No-op unless
+   * BATCHED_SPSC_QUEUE_STATS is defined.
+   */
+  void record_write_ptr(bool success);
+
+  /**
+   * @brief Records a commit_write() of n elements, the write index being
+   * next_write_idx afterwards. No-op unless BATCHED_SPSC_QUEUE_STATS is
+   * defined.
+   */
+  void record_commit_write(size_t n, size_t next_write_idx);
+
+  /**
+   * @brief Consumer counterpart of record_write_ptr().
+   */
+  void record_read_ptr(bool success);
+
+  /**
+   * @brief Consumer counterpart of record_commit_write().
+   */
+  void record_commit_read(size_t n, size_t next_read_idx);
+
+  /**
+   * @brief Parks the producer until read_idx_ moves away from the value it
+   * had when write_ptr() last failed.
+   *
+   * @note This method should only be called by the producer thread.
+   */
+  void park_writer();
+
+  /**
+   * @brief Parks the consumer until write_idx_ moves away from the value it
+   * had when read_ptr() last failed.
+   *
+   * @note This method should only be called by the consumer thread.
+   */
+  void park_reader();
+
+  /**
+   * @brief Registers a coroutine waiting for room, after write_ptr() failed.
+   *
+   * @return false if read_idx_ moved meanwhile and a batch is now available,
+   * in which case awaiter is not registered and holds the batch.
+   * @note This method should only be called by the producer.
+   */
+  bool suspend_writer(BatchAwaiter &awaiter);
+
+  /**
+   * @brief Consumer counterpart of suspend_writer().
+   */
+  bool suspend_reader(BatchAwaiter &awaiter);
+
+  /**
+   * @brief Hands the coroutine registered in waiter, if any, back to its
+   * executor.
+   */
+  static void wake(std::atomic<BatchAwaiter *> &waiter);
+
 private:
+  friend class AdaptiveReader;
+  friend class AdaptiveWriter;
+  friend class BatchAwaiter;
+  template <typename... Fields> friend class MetadataRing;
+  friend class QueueEvents;
+  friend class QueueSet;
+
+#ifdef BATCHED_SPSC_QUEUE_STATS
+  /// The statistics of one side, only written by that side.
+  struct alignas(CACHE_LINE_SIZE) SideCounters {
+    std::atomic<uint64_t> rejections{0};
+    std::atomic<uint64_t> batches{0};
+    std::atomic<uint64_t> elements{0};
+    std::atomic<int64_t> stalled_ns{0};
+    std::array<std::atomic<uint64_t>, QueueStats::kOccupancyBuckets>
+        occupancy{};
+
+    /// When the current streak of rejections started, or 0.
+    int64_t stall_start_ns = 0;
+
+    /// 2^32 * kOccupancyBuckets / nb_slots, so that sampling the occupancy
+    /// needs no division.
+    uint64_t bucket_scale = 0;
+  };
+#endif
+
+  /// Number of failed attempts before SpinThenYield and Park stop spinning.
+  static constexpr size_t kSpinCount = 1024;
+
   /// The number of slots in the circular buffer.
   size_t nb_slots_;
 
@@ -184,10 +693,66 @@ private:
   /// A pre-allocated memory block for storing elements.
   uint8_t *buffer_;
 
+  /// The memory behind buffer_ when the queue allocated it itself.
+  Buffer owned_buffer_;
+
+  /// Whether commits must check for, and wake up, a parked thread.
+  bool parking_enabled_;
+
+  /// Whether buffer_ is a MirroredBuffer, in which case batches may run past
+  /// the end of the buffer.
+  bool mirrored_;
+
+  /// The QueueSet commits must report readiness to, or nullptr.
+  QueueSet *set_;
+
+  /// The index of the queue in set_.
+  size_t set_index_;
+
+  /// The eventfds commits must signal, or nullptr.
+  QueueEvents *events_;
+
   /// The current write index.
   alignas(CACHE_LINE_SIZE) std::atomic<size_t> write_idx_;
 
   /// The current read index.
   alignas(CACHE_LINE_SIZE) std::atomic<size_t> read_idx_;
+
+  /// The producer's last observed value of read_idx_. Only refreshed when the
+  /// queue looks full, so that write_ptr() does not touch the consumer's cache
+  /// line on every call.
+  alignas(CACHE_LINE_SIZE) size_t cached_read_idx_;
+
+  /// The consumer's last observed value of write_idx_. Only refreshed when the
+  /// queue looks empty, so that read_ptr() does not touch the producer's cache
+  /// line on every call.
+  alignas(CACHE_LINE_SIZE) size_t cached_write_idx_;
+
+  /// The consumer's partial read state: when it first saw elements it could
+  /// not return as a full batch (0 if none), and how many flushed elements
+  /// are left. Both are updated by commit_read(), with the elements read.
+  int64_t partial_since_ns_;
+  size_t flush_remaining_;
+
+  /// Set by flush() until the consumer sees it.
+  alignas(CACHE_LINE_SIZE) std::atomic<bool> flush_requested_;
+
+  /// Set while the producer is parked on read_idx_, and the producer's
+  /// coroutine suspended until it moves, if any.
+  alignas(CACHE_LINE_SIZE) std::atomic<bool> writer_parked_;
+  std::atomic<BatchAwaiter *> writer_waiter_;
+
+  /// Set while the consumer is parked on write_idx_, and the consumer's
+  /// coroutine suspended until it moves, if any.
+  alignas(CACHE_LINE_SIZE) std::atomic<bool> reader_parked_;
+  std::atomic<BatchAwaiter *> reader_waiter_;
+
+#ifdef BATCHED_SPSC_QUEUE_STATS
+  /// The producer's statistics.
+  SideCounters producer_stats_;
+
+  /// The consumer's statistics.
+  SideCounters consumer_stats_;
+#endif
 };
 } // namespace batched_spsc_queue
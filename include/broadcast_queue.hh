@@ -0,0 +1,247 @@
+#pragma once
+
+#include "batched_spsc_queue.hh"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace batched_spsc_queue {
+/**
+ * @class BroadcastQueue
+ * @brief A single-producer queue whose batches are seen by every consumer.
+ *
+ * Each consumer attached with attach() has its own read cursor, on its own
+ * cache line, and reads the batches in place with read_ptr()/commit_read(),
+ * so every element is written once and never copied per consumer. The
+ * producer only overwrites a slot once the slowest attached consumer has read
+ * it. Consumers can attach and detach at any time: a new consumer starts with
+ * the next batch written, and a detached consumer no longer holds the producer
+ * back. When no consumer is attached, the producer never blocks and the
+ * batches are dropped.
+ *
+ * A tap, created with tap(), is a consumer that never holds the producer
+ * back. When the producer laps it, the tap skips ahead to the most recent
+ * batches and reports how many elements it missed. Since the producer may
+ * overwrite a batch while a tap reads it, the tap's commit_read() tells
+ * whether the batch was intact.
+ *
+ * Positions are 64-bit counters that never wrap in practice; slots are
+ * positions modulo nb_slots.
+ *
+ * @note The nb_slots must be a multiple of enqueue_batch_size and
+ * dequeue_batch_size, as for Queue. The queue must outlive its consumers and
+ * taps.
+ */
+class BroadcastQueue {
+public:
+  class Consumer;
+  class Tap;
+
+  /**
+   * @brief Constructs a BroadcastQueue.
+   *
+   * @param nb_slots The number of slots in the circular buffer.
+   * @param enqueue_batch_size The number of elements that can be
+   * enqueued in a single batch.
+   * @param dequeue_batch_size The number of elements that can be
+   * dequeued in a single batch by every consumer.
+   * @param element_size The size of each element in bytes.
+   * @param buffer A pointer to the buffer of nb_slots * element_size bytes.
+   * @param max_consumers The maximum number of consumers attached at once,
+   * taps excluded.
+   */
+  BroadcastQueue(size_t nb_slots, size_t enqueue_batch_size,
+                 size_t dequeue_batch_size, size_t element_size,
+                 uint8_t *buffer, size_t max_consumers);
+
+  /**
+   * @brief Returns a pointer to the next available slot for writing, or
+   * nullptr if the slowest consumer has not freed enough slots yet.
+   *
+   * The free space is computed against a cached copy of the slowest cursor,
+   * which is only refreshed, by scanning every cursor, when it says the queue
+   * is full.
+   */
+  uint8_t *write_ptr();
+
+  /**
+   * @brief Publishes the batch claimed with write_ptr() to every consumer.
+   */
+  void commit_write();
+
+  /**
+   * @brief Attaches a new consumer, which starts with the next batch written.
+   *
+   * Thread-safe with respect to the producer and other consumers.
+   *
+   * @throws std::runtime_error if max_consumers consumers are attached.
+   */
+  Consumer attach();
+
+  /**
+   * @brief Creates a tap, which starts with the next batch written.
+   */
+  Tap tap();
+
+  /**
+   * @class Consumer
+   * @brief A consumer holding one read cursor of a BroadcastQueue.
+   *
+   * Each consumer must be used by a single thread at a time. Destroying it
+   * detaches it.
+   */
+  class Consumer {
+  public:
+    ~Consumer();
+
+    Consumer(const Consumer &) = delete;
+    Consumer &operator=(const Consumer &) = delete;
+
+    Consumer(Consumer &&other) noexcept;
+    Consumer &operator=(Consumer &&other) noexcept;
+
+    /**
+     * @brief Returns a pointer to the next batch to read, or nullptr if the
+     * producer has not written it yet.
+     */
+    uint8_t *read_ptr();
+
+    /**
+     * @brief Releases the batch returned by read_ptr().
+     */
+    void commit_read();
+
+    /**
+     * @brief Returns the number of elements written but not yet read by this
+     * consumer.
+     */
+    size_t size();
+
+    /**
+     * @brief Releases the cursor, so that the consumer no longer holds the
+     * producer back. The consumer cannot be used afterwards.
+     */
+    void detach();
+
+  private:
+    friend class BroadcastQueue;
+
+    Consumer(BroadcastQueue *queue, std::atomic<uint64_t> *cursor,
+             uint64_t position);
+
+    /// The queue, or nullptr once detached.
+    BroadcastQueue *queue_;
+
+    /// The cursor published to the producer.
+    std::atomic<uint64_t> *cursor_;
+
+    /// The position of the next batch to read.
+    uint64_t position_;
+
+    /// The slot of the next batch to read, position_ modulo nb_slots.
+    size_t slot_;
+
+    /// The last write position seen.
+    uint64_t cached_write_pos_;
+  };
+
+  /**
+   * @class Tap
+   * @brief A consumer that never holds the producer back, and skips ahead when
+   * it is lapped.
+   *
+   * @note Reading a batch that the producer overwrites at the same time is a
+   * data race in the C++ memory model, like any seqlock reader. commit_read()
+   * detects it; the contents of such a batch must be discarded.
+   */
+  class Tap {
+  public:
+    /**
+     * @brief Returns a pointer to the next batch to read, or nullptr if the
+     * producer has not written it yet.
+     *
+     * If the producer has lapped the tap, the tap first skips to the most
+     * recent batches, adding the skipped elements to lapped().
+     */
+    uint8_t *read_ptr();
+
+    /**
+     * @brief Releases the batch returned by read_ptr().
+     *
+     * @return true if the batch was intact, false if the producer may have
+     * overwritten it while it was read. The elements of a batch that was not
+     * intact are added to lapped().
+     */
+    bool commit_read();
+
+    /**
+     * @brief Returns the number of elements the tap has missed so far because
+     * the producer lapped it.
+     */
+    [[nodiscard]] uint64_t lapped() const { return lapped_; }
+
+  private:
+    friend class BroadcastQueue;
+
+    Tap(BroadcastQueue *queue, uint64_t position);
+
+    /// Whether the producer may be writing the slots of the batch at
+    /// position_, given the write position.
+    [[nodiscard]] bool overwritten(uint64_t write_pos) const;
+
+    BroadcastQueue *queue_;
+
+    /// The position of the next batch to read.
+    uint64_t position_;
+
+    /// The slot of the next batch to read, position_ modulo nb_slots.
+    size_t slot_;
+
+    /// The number of elements missed so far.
+    uint64_t lapped_;
+  };
+
+private:
+  /// A read cursor, on its own cache line.
+  struct alignas(CACHE_LINE_SIZE) Cursor {
+    std::atomic<uint64_t> position;
+  };
+
+  /// The position of a cursor not held by any consumer.
+  static constexpr uint64_t kDetached = UINT64_MAX;
+
+  /// Returns the position of the slowest attached consumer, or write_pos if
+  /// none is attached.
+  uint64_t min_read_position(uint64_t write_pos);
+
+  /// The number of slots in the circular buffer.
+  size_t nb_slots_;
+
+  /// The number of elements enqueued in a single batch.
+  size_t enqueue_batch_size_;
+
+  /// The number of elements dequeued in a single batch.
+  size_t dequeue_batch_size_;
+
+  /// The size of each element in bytes.
+  size_t element_size_;
+
+  /// A pointer to the buffer.
+  uint8_t *buffer_;
+
+  /// The number of cursors.
+  size_t max_consumers_;
+
+  /// The read cursors, kDetached when not held by any consumer.
+  std::unique_ptr<Cursor[]> cursors_;
+
+  /// The position of the next batch to write.
+  alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> write_pos_;
+
+  /// The producer's slot of the next batch to write, and its cached copy of
+  /// the slowest cursor.
+  alignas(CACHE_LINE_SIZE) size_t write_slot_;
+  uint64_t cached_min_read_;
+};
+} // namespace batched_spsc_queue
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace batched_spsc_queue {
+/**
+ * @brief Which kind of pages back a Buffer.
+ */
+enum class HugePages {
+  /// Regular pages only.
+  None,
+
+  /// Regular pages, aligned and advised (MADV_HUGEPAGE) so that the kernel can
+  /// back them with transparent huge pages.
+  Transparent,
+
+  /// Pages from the hugetlbfs pool (MAP_HUGETLB). Falls back to Transparent
+  /// when the pool cannot satisfy the allocation.
+  Explicit,
+};
+
+/**
+ * @brief How a Buffer is allocated.
+ */
+struct BufferOptions {
+  /// Bind the buffer to the NUMA node of the thread constructing it. Construct
+  /// the buffer (or the queue owning it) on the consumer thread to place it
+  /// next to the consumer.
+  static constexpr int kCallerNode = -1;
+
+  /// Do not bind the buffer to any NUMA node.
+  static constexpr int kAnyNode = -2;
+
+  /// Which kind of pages to use.
+  HugePages huge_pages = HugePages::Transparent;
+
+  /// The NUMA node to bind the buffer to, kCallerNode or kAnyNode.
+  int numa_node = kCallerNode;
+
+  /// Whether to touch every page on allocation, so that the first lap of the
+  /// queue does not pay for page faults.
+  bool prefault = false;
+};
+
+/**
+ * @class Buffer
+ * @brief An owned, page-aligned memory block suitable as queue storage.
+ *
+ * Compared to std::make_unique<uint8_t[]>, the memory is mapped directly with
+ * mmap(), so it is always aligned to the page size (and therefore to
+ * CACHE_LINE_SIZE), it can be backed by huge pages to cut TLB misses on large
+ * queues, bound to a NUMA node, and prefaulted. Huge pages and NUMA binding are
+ * best effort: when the system refuses them, the buffer silently falls back to
+ * regular, unbound pages, which huge_pages() and numa_node() report.
+ *
+ * @note This class is only available on Linux.
+ */
+class Buffer {
+public:
+  /**
+   * @brief Constructs an empty buffer, owning no memory.
+   */
+  Buffer() noexcept;
+
+  /**
+   * @brief Allocates a buffer of at least size bytes.
+   *
+   * @param size The size of the buffer in bytes.
+   * @param options How to allocate the buffer.
+   *
+   * @throws std::invalid_argument if size is zero.
+   * @throws std::system_error if the memory cannot be mapped at all.
+   */
+  explicit Buffer(size_t size, const BufferOptions &options = {});
+
+  ~Buffer();
+
+  Buffer(const Buffer &) = delete;
+  Buffer &operator=(const Buffer &) = delete;
+
+  Buffer(Buffer &&other) noexcept;
+  Buffer &operator=(Buffer &&other) noexcept;
+
+  /// The beginning of the buffer, or nullptr for an empty buffer.
+  [[nodiscard]] uint8_t *data() const { return data_; }
+
+  /// The size requested at construction, in bytes.
+  [[nodiscard]] size_t size() const { return size_; }
+
+  /// Which kind of pages were actually obtained.
+  [[nodiscard]] HugePages huge_pages() const { return huge_pages_; }
+
+  /// The NUMA node the buffer is bound to, or BufferOptions::kAnyNode.
+  [[nodiscard]] int numa_node() const { return numa_node_; }
+
+private:
+  /// Unmaps the buffer, if any.
+  void release();
+
+  /// The beginning of the buffer.
+  uint8_t *data_;
+
+  /// The size requested at construction, in bytes.
+  size_t size_;
+
+  /// The size of the mapping, rounded up to the page size.
+  size_t mapping_size_;
+
+  /// Which kind of pages were actually obtained.
+  HugePages huge_pages_;
+
+  /// The NUMA node the buffer is bound to, or BufferOptions::kAnyNode.
+  int numa_node_;
+};
+} // namespace batched_spsc_queue
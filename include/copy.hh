@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace batched_spsc_queue {
+/**
+ * @brief The instruction set used to copy large batches.
+ */
+enum class CopyKernel {
+  /// Plain memcpy().
+  Scalar,
+
+  /// 32-byte non-temporal stores.
+  AVX2,
+
+  /// 64-byte non-temporal stores.
+  AVX512,
+};
+
+/// The size from which copy_batch() switches to non-temporal stores. Below it,
+/// the destination is likely to be read again while still cached, and
+/// bypassing the cache would only make the copy slower.
+inline constexpr size_t kNonTemporalThreshold = 256 * 1024;
+
+/**
+ * @brief Returns the best kernel supported by the CPU, detected once.
+ *
+ * Always CopyKernel::Scalar on non-x86 targets.
+ */
+CopyKernel best_copy_kernel();
+
+/**
+ * @brief Copies size bytes from src to dst, with non-temporal stores of the
+ * best supported kernel when size is at least kNonTemporalThreshold, and with
+ * memcpy() otherwise.
+ *
+ * Non-temporal stores write around the cache, so that copying a batch into a
+ * queue does not evict the copier's working set for data it never reads
+ * again. The source is still read through the cache. The stores are fenced
+ * before returning, so that a following commit_write() or commit_read()
+ * publishes them like any other.
+ *
+ * @note The ranges must not overlap.
+ */
+void copy_batch(uint8_t *dst, const uint8_t *src, size_t size);
+
+/**
+ * @brief Copies size bytes from src to dst with the given kernel, whatever
+ * the size, falling back to CopyKernel::Scalar if the CPU does not support it.
+ */
+void copy_batch(uint8_t *dst, const uint8_t *src, size_t size,
+                CopyKernel kernel);
+} // namespace batched_spsc_queue
@@ -0,0 +1,187 @@
+#pragma once
+
+#include "batched_spsc_queue.hh"
+#include <condition_variable>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <vector>
+
+namespace batched_spsc_queue {
+class Executor;
+
+/**
+ * @class Task
+ * @brief The return type of a coroutine run by an Executor.
+ *
+ * A Task does not start until it is given to Executor::spawn(), and its frame
+ * is destroyed when it returns. It returns nothing; an exception escaping it
+ * calls std::terminate(), as with std::thread.
+ */
+class Task {
+public:
+  struct promise_type {
+    /// The executor the task was spawned on.
+    Executor *executor = nullptr;
+
+    Task get_return_object() {
+      return Task(std::coroutine_handle<promise_type>::from_promise(*this));
+    }
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    auto final_suspend() noexcept;
+    void return_void() noexcept {}
+    void unhandled_exception() noexcept { std::terminate(); }
+  };
+
+  Task(Task &&other) noexcept : handle_(other.handle_) {
+    other.handle_ = nullptr;
+  }
+  Task &operator=(Task &&) = delete;
+
+  /// Destroys the coroutine if it was never spawned.
+  ~Task() {
+    if (handle_)
+      handle_.destroy();
+  }
+
+private:
+  friend class Executor;
+
+  explicit Task(std::coroutine_handle<promise_type> handle)
+      : handle_(handle) {}
+
+  std::coroutine_handle<promise_type> handle_;
+};
+
+/**
+ * @class BatchAwaiter
+ * @brief What Queue::next_write_batch() and Queue::next_read_batch() return:
+ * co_await it to get a pointer to the next batch, as returned by write_ptr()
+ * or read_ptr().
+ *
+ * If the batch is available, the coroutine does not suspend. Otherwise it
+ * registers itself on the queue and suspends, and the other side's next
+ * commit hands it back to its executor, which retries and resumes it once the
+ * batch is available.
+ *
+ * @note The awaiting coroutine must run on an Executor, and at most one
+ * coroutine may wait on each side of a queue, as the queue is SPSC.
+ */
+class BatchAwaiter {
+public:
+  bool await_ready() {
+    batch_ = try_acquire();
+    return batch_ != nullptr;
+  }
+
+  /**
+   * @throws std::logic_error if the coroutine is not run by an Executor.
+   */
+  bool await_suspend(std::coroutine_handle<> handle);
+
+  uint8_t *await_resume() const { return batch_; }
+
+private:
+  friend class Queue;
+  friend class Executor;
+
+  BatchAwaiter(Queue &queue, bool write) : queue_(queue), write_(write) {}
+
+  /// Calls write_ptr() or read_ptr().
+  uint8_t *try_acquire();
+
+  /// Registers on the queue. Returns false if the batch became available
+  /// meanwhile, in which case batch_ is set and the awaiter is not
+  /// registered.
+  bool suspend();
+
+  /// Called by the executor after a wake-up: returns true if the batch is now
+  /// available, otherwise registers again unless it became available
+  /// meanwhile.
+  bool retry();
+
+  Queue &queue_;
+  bool write_;
+  uint8_t *batch_ = nullptr;
+  std::coroutine_handle<> handle_;
+  Executor *executor_ = nullptr;
+};
+
+/**
+ * @class Executor
+ * @brief A minimal single-threaded executor for coroutines that wait on
+ * queues.
+ *
+ * run() resumes the spawned tasks on the calling thread until they have all
+ * returned. A task suspended on a queue is handed back to the executor by the
+ * commit that unblocks it, possibly from another thread, so one executor per
+ * thread can serve many queues, whether the other ends are on the same
+ * executor, another one, or plain threads. While no task is ready, run()
+ * sleeps on a condition variable.
+ *
+ * Waking a suspended task goes through the same path as WaitPolicy::Park, so
+ * the awaited queues must be constructed with enable_parking. Commits only do
+ * the extra work when a task is actually suspended on the other side.
+ *
+ * @note spawn() must be called before run() or from a task of the same
+ * executor.
+ */
+class Executor {
+public:
+  Executor() = default;
+  Executor(const Executor &) = delete;
+  Executor &operator=(const Executor &) = delete;
+
+  /**
+   * @brief Schedules a task to start on the next run().
+   */
+  void spawn(Task task);
+
+  /**
+   * @brief Runs the tasks on the calling thread until they have all returned.
+   */
+  void run();
+
+  /**
+   * @brief Returns the executor running on the calling thread, or nullptr.
+   */
+  static Executor *current();
+
+private:
+  friend class BatchAwaiter;
+  friend class Queue;
+  friend struct Task::promise_type;
+
+  /// Hands a suspended awaiter back to the executor. Thread-safe.
+  void wake(BatchAwaiter *awaiter);
+
+  /// The coroutines ready to resume, only touched by the executor's thread.
+  std::deque<std::coroutine_handle<>> ready_;
+
+  /// The number of spawned tasks that have not returned yet.
+  size_t live_ = 0;
+
+  /// The awaiters woken up since the executor last looked, and whether it is
+  /// sleeping until there is one.
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::vector<BatchAwaiter *> woken_;
+  bool sleeping_ = false;
+};
+
+inline auto Task::promise_type::final_suspend() noexcept {
+  struct Final {
+    bool await_ready() noexcept { return false; }
+    void await_suspend(std::coroutine_handle<promise_type> handle) noexcept {
+      Executor *executor = handle.promise().executor;
+      handle.destroy();
+      executor->live_--;
+    }
+    void await_resume() noexcept {}
+  };
+  return Final{};
+}
+} // namespace batched_spsc_queue
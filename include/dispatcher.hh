@@ -0,0 +1,143 @@
+#pragma once
+
+#include "batched_spsc_queue.hh"
+#include "buffer.hh"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace batched_spsc_queue {
+/**
+ * @brief How a Dispatcher picks the queue of each batch.
+ */
+enum class DispatchPolicy {
+  /// Each queue in turn. A full queue is skipped, so a slow consumer's share
+  /// goes to the others.
+  RoundRobin,
+
+  /// The queue with the fewest elements according to the producer's
+  /// estimates. A full queue is skipped.
+  LeastOccupied,
+
+  /// The queue picked by hashing the key given to write_ptr(key), so that
+  /// batches with the same key always go to the same consumer, in order.
+  KeyAffinity,
+};
+
+/**
+ * @class Dispatcher
+ * @brief One producer dispatching batches across N Queues, one per consumer.
+ *
+ * The producer calls write_ptr() and commit_write() as on a Queue, and the
+ * dispatcher picks the target queue according to its DispatchPolicy. Each
+ * consumer reads its own queue(index) as a plain Queue.
+ *
+ * For DispatchPolicy::LeastOccupied, the producer keeps an estimate of each
+ * queue's size, increased on each commit and refreshed from one queue's
+ * size() per dispatched batch in turn, so that picking a queue does not read
+ * every consumer's index.
+ *
+ * With sequence numbers enabled, every batch gets the next number of a
+ * global sequence, stored next to the queue, which consumers read with
+ * sequence(). A downstream merger can then put the batches back in order.
+ *
+ * @note As for Queue, nb_slots must be a multiple of enqueue_batch_size and
+ * dequeue_batch_size.
+ */
+class Dispatcher {
+public:
+  /**
+   * @brief Constructs a Dispatcher owning nb_queues queues with the same
+   * geometry.
+   *
+   * @param nb_queues The number of queues, one per consumer.
+   * @param nb_slots The number of slots of each queue.
+   * @param enqueue_batch_size The number of elements that can be
+   * enqueued in a single batch.
+   * @param dequeue_batch_size The number of elements that can be
+   * dequeued in a single batch.
+   * @param element_size The size of each element in bytes.
+   * @param policy How to pick the queue of each batch.
+   * @param sequence_numbers Whether to number the batches.
+   * @param options How to allocate the buffer of each queue.
+   *
+   * @throws std::invalid_argument if nb_queues is zero.
+   */
+  Dispatcher(size_t nb_queues, size_t nb_slots, size_t enqueue_batch_size,
+             size_t dequeue_batch_size, size_t element_size,
+             DispatchPolicy policy, bool sequence_numbers = false,
+             const BufferOptions &options = {});
+
+  /**
+   * @brief Picks a queue and returns a pointer to its next batch, or nullptr
+   * if no eligible queue has room.
+   *
+   * @note With DispatchPolicy::KeyAffinity, use write_ptr(key) instead.
+   */
+  uint8_t *write_ptr();
+
+  /**
+   * @brief Returns a pointer to the next batch of the queue the key hashes
+   * to, or nullptr if that queue is full.
+   */
+  uint8_t *write_ptr(uint64_t key);
+
+  /**
+   * @brief Enqueues the batch returned by write_ptr() into its queue.
+   */
+  void commit_write();
+
+  /// The number of queues.
+  [[nodiscard]] size_t nb_queues() const { return queues_.size(); }
+
+  /// The queue of the given consumer.
+  [[nodiscard]] Queue &queue(size_t index) const { return *queues_[index]; }
+
+  /// The queue the batch returned by the last write_ptr() goes to.
+  [[nodiscard]] size_t target() const { return target_; }
+
+  /**
+   * @brief Returns the sequence number of a batch read from a queue.
+   *
+   * @param index The index of the queue.
+   * @param batch A pointer returned by queue(index).read_ptr().
+   *
+   * @note Only meaningful with sequence numbers enabled. When
+   * dequeue_batch_size differs from enqueue_batch_size, this is the number of
+   * the enqueued batch containing the first element of batch.
+   */
+  [[nodiscard]] uint64_t sequence(size_t index, const uint8_t *batch) const;
+
+private:
+  /// Tries the queues in policy order, sets target_ and returns the batch of
+  /// the first one with room, or nullptr.
+  uint8_t *pick();
+
+  /// The queues, one per consumer.
+  std::vector<std::unique_ptr<Queue>> queues_;
+
+  /// The sequence number of each enqueue batch slot of each queue, or empty.
+  std::vector<std::unique_ptr<uint64_t[]>> sequences_;
+
+  /// The producer's estimate of each queue's size.
+  std::vector<size_t> estimates_;
+
+  size_t nb_slots_;
+  size_t enqueue_batch_size_;
+  size_t element_size_;
+  DispatchPolicy policy_;
+
+  /// The queue of the batch returned by the last write_ptr().
+  size_t target_;
+
+  /// The batch returned by the last write_ptr().
+  uint8_t *pending_;
+
+  /// The queue RoundRobin starts from, and LeastOccupied refreshes, next.
+  size_t next_;
+
+  /// The sequence number of the next batch.
+  uint64_t next_sequence_;
+};
+} // namespace batched_spsc_queue
@@ -0,0 +1,221 @@
+#pragma once
+
+#include "batched_spsc_queue.hh"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace batched_spsc_queue {
+/// The alignment of the slots, batches and file offsets needed for O_DIRECT.
+/// 4096 bytes covers the logical block size of every common device.
+inline constexpr size_t kDirectIoAlignment = 4096;
+
+/**
+ * @brief How a FileSource or a FileSink does its I/O.
+ */
+struct FileIoOptions {
+  /// The number of batches read or written at once.
+  size_t queue_depth = 4;
+
+  /// Whether to bypass the page cache with O_DIRECT. Only used when the batches
+  /// are a multiple of kDirectIoAlignment bytes and the slots are aligned to
+  /// it, e.g. with an owned Buffer, and when the file system supports it.
+  bool direct = true;
+
+  /// How FileSource::run() waits for the consumer to free a batch.
+  WaitPolicy wait_policy = WaitPolicy::SpinThenYield;
+};
+
+/**
+ * @class AsyncFile
+ * @brief The asynchronous I/O shared by FileSource and FileSink.
+ *
+ * Batches are read or written in place in the slots of the queue with Linux
+ * native AIO, up to queue_depth at once, and completions are handed back in
+ * submission order. Without O_DIRECT, the kernel performs each request within
+ * its submission, so only O_DIRECT actually keeps several batches in flight.
+ *
+ * @note This class is only available on Linux.
+ */
+class AsyncFile {
+public:
+  AsyncFile(const AsyncFile &) = delete;
+  AsyncFile &operator=(const AsyncFile &) = delete;
+
+  /**
+   * @brief Returns whether the file is accessed with O_DIRECT.
+   */
+  [[nodiscard]] bool direct() const { return direct_; }
+
+protected:
+  /**
+   * @throws std::invalid_argument if options.queue_depth is zero.
+   * @throws std::system_error if opening the file or setting up the AIO
+   * context fails.
+   */
+  AsyncFile(const std::string &path, int flags, Queue &queue,
+            size_t batch_size, const FileIoOptions &options);
+
+  /// Waits for the I/O in flight, which targets the queue's slots.
+  ~AsyncFile();
+
+  /// Submits a read or a write of size bytes at data, from or to the file
+  /// offset following the previous submission.
+  void submit(bool write, uint8_t *data, size_t size);
+
+  /// Collects the completions, waiting for at least one if wait is set and I/O
+  /// is in flight.
+  void reap(bool wait);
+
+  /// Pops the result of the oldest request if it completed.
+  bool pop(int64_t &result);
+
+  /// Turns O_DIRECT on or off for the following submissions.
+  void set_direct(bool direct);
+
+  struct Request;
+
+  Queue &queue_;
+
+  /// The number of elements read or written at once, and their size in bytes.
+  size_t batch_size_;
+  size_t batch_bytes_;
+
+  /// The maximum number of requests in flight.
+  size_t queue_depth_;
+
+  WaitPolicy wait_policy_;
+
+  int fd_;
+  bool direct_;
+
+  /// The AIO context.
+  unsigned long context_;
+
+  /// A ring of queue_depth_ requests, the oldest at head_.
+  std::unique_ptr<Request[]> requests_;
+  size_t head_;
+  size_t in_flight_;
+
+  /// The file offset of the next submission.
+  uint64_t offset_;
+};
+
+/**
+ * @class FileSource
+ * @brief Reads a file straight into the slots of a queue, as the producer.
+ *
+ * Each read fills a whole enqueue batch in place, with no intermediate
+ * buffer, and up to queue_depth batches are read at once. Since they must be
+ * contiguous, fewer are read in flight just before the end of the buffer
+ * (unless the queue is on a MirroredBuffer). The batches are committed in file
+ * order.
+ *
+ * The last batch may be partial, and is committed with commit_write(n);
+ * trailing bytes that do not make a whole element are dropped.
+ *
+ * @note The source must be the only producer of the queue, and the queue must
+ * outlive it. This class is only available on Linux.
+ */
+class FileSource : public AsyncFile {
+public:
+  /**
+   * @brief Opens a file to read into the queue.
+   *
+   * @throws std::invalid_argument if options.queue_depth is zero.
+   * @throws std::system_error if the file cannot be opened.
+   */
+  FileSource(const std::string &path, Queue &queue,
+             const FileIoOptions &options = {});
+
+  /**
+   * @brief Starts reads into the free batches and commits the completed ones,
+   * without blocking.
+   *
+   * @return The number of batches committed.
+   * @throws std::system_error if a read fails.
+   */
+  size_t poll();
+
+  /**
+   * @brief Reads the whole file into the queue, waiting for the consumer when
+   * the queue is full.
+   *
+   * @return The number of bytes committed.
+   * @throws std::system_error if a read fails.
+   */
+  uint64_t run();
+
+  /**
+   * @brief Returns whether the end of the file was reached.
+   */
+  [[nodiscard]] bool eof() const { return eof_; }
+
+  /**
+   * @brief Returns the number of bytes committed to the queue so far.
+   */
+  [[nodiscard]] uint64_t bytes_read() const { return bytes_; }
+
+private:
+  size_t step(bool wait);
+
+  bool eof_;
+  uint64_t bytes_;
+};
+
+/**
+ * @class FileSink
+ * @brief Writes the batches of a queue straight out to a file, as the
+ * consumer.
+ *
+ * Each write takes a whole dequeue batch from its slots, with no intermediate
+ * buffer, and up to queue_depth batches are written at once. A batch is only
+ * released with commit_read() once its write completed, so the producer never
+ * overwrites data still being written.
+ *
+ * @note The sink must be the only consumer of the queue, and the queue must
+ * outlive it. This class is only available on Linux.
+ */
+class FileSink : public AsyncFile {
+public:
+  /**
+   * @brief Creates or truncates a file to write the queue to.
+   *
+   * @throws std::invalid_argument if options.queue_depth is zero.
+   * @throws std::system_error if the file cannot be opened.
+   */
+  FileSink(const std::string &path, Queue &queue,
+           const FileIoOptions &options = {});
+
+  /**
+   * @brief Starts writes of the full batches in the queue and releases the
+   * written ones, without blocking.
+   *
+   * @return The number of batches released.
+   * @throws std::system_error if a write fails.
+   */
+  size_t poll();
+
+  /**
+   * @brief Waits for the writes in flight, then writes everything left in the
+   * queue, partial batch included.
+   *
+   * Call it once the producer is done.
+   *
+   * @throws std::system_error if a write fails.
+   */
+  void flush();
+
+  /**
+   * @brief Returns the number of bytes written and released so far.
+   */
+  [[nodiscard]] uint64_t bytes_written() const { return bytes_; }
+
+private:
+  /// Releases the completed writes, in order.
+  size_t release();
+
+  uint64_t bytes_;
+};
+} // namespace batched_spsc_queue
@@ -0,0 +1,170 @@
+#pragma once
+
+#include "batched_spsc_queue.hh"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace batched_spsc_queue {
+/**
+ * @brief What a LossyQueue does with a batch written while it is full.
+ */
+enum class FullPolicy {
+  /// write_ptr() returns nullptr, as with Queue.
+  Reject,
+
+  /// write_ptr() returns a scratch batch that commit_write() discards, and the
+  /// discarded elements are counted in dropped().
+  DropNewest,
+
+  /// The batch overwrites the oldest unread one. The consumer skips what was
+  /// overwritten, counted in overwritten(), and commit_read() tells whether
+  /// the batch it read was overwritten meanwhile.
+  OverwriteOldest,
+};
+
+/**
+ * @class LossyQueue
+ * @brief A batched SPSC queue whose producer never blocks, for live feeds
+ * where a lost batch is better than a stale one.
+ *
+ * Positions are 64-bit counters that never wrap in practice, like
+ * BroadcastQueue's, so that the consumer can tell from the write position
+ * alone whether the producer overwrote the slots it reads: it checks before
+ * returning a batch, and again in commit_read(), like a seqlock reader. The
+ * producer never reads the consumer's position in OverwriteOldest, and only
+ * when its cached copy says the queue is full otherwise, so when the queue is
+ * not full the hot path is the same as Queue's.
+ *
+ * @note The nb_slots must be a multiple of enqueue_batch_size and
+ * dequeue_batch_size, as for Queue. With OverwriteOldest, reading a batch that
+ * the producer overwrites at the same time is a data race in the C++ memory
+ * model, like any seqlock reader; commit_read() detects it and the contents of
+ * such a batch must be discarded.
+ */
+class LossyQueue {
+public:
+  /**
+   * @brief Constructs a LossyQueue.
+   *
+   * @param nb_slots The number of slots in the circular buffer.
+   * @param enqueue_batch_size The number of elements that can be
+   * enqueued in a single batch.
+   * @param dequeue_batch_size The number of elements that can be
+   * dequeued in a single batch.
+   * @param element_size The size of each element in bytes.
+   * @param buffer A pointer to the buffer of nb_slots * element_size bytes.
+   * @param policy What to do with a batch written while the queue is full.
+   */
+  LossyQueue(size_t nb_slots, size_t enqueue_batch_size,
+             size_t dequeue_batch_size, size_t element_size, uint8_t *buffer,
+             FullPolicy policy);
+
+  /**
+   * @brief Returns a pointer to the next batch to write.
+   *
+   * @return nullptr only with FullPolicy::Reject when the queue is full.
+   * @note This method should only be called by the producer thread.
+   */
+  uint8_t *write_ptr();
+
+  /**
+   * @brief Publishes the batch returned by write_ptr(), or discards it if it
+   * was dropped.
+   *
+   * @note This method should only be called by the producer thread.
+   */
+  void commit_write();
+
+  /**
+   * @brief Returns a pointer to the next batch to read, or nullptr if there is
+   * none.
+   *
+   * With FullPolicy::OverwriteOldest, the batches the producer overwrote are
+   * skipped first, and the returned one is the oldest still intact.
+   *
+   * @note This method should only be called by the consumer thread.
+   */
+  uint8_t *read_ptr();
+
+  /**
+   * @brief Releases the batch returned by read_ptr().
+   *
+   * @return false if the producer may have overwritten the batch while it was
+   * read, in which case its contents must be discarded and its elements are
+   * counted in overwritten(). Always true unless the policy is
+   * FullPolicy::OverwriteOldest.
+   * @note This method should only be called by the consumer thread.
+   */
+  bool commit_read();
+
+  /**
+   * @brief Returns the number of elements discarded by FullPolicy::DropNewest.
+   *
+   * Thread-safe.
+   */
+  [[nodiscard]] uint64_t dropped() const {
+    return dropped_.load(std::memory_order_relaxed);
+  }
+
+  /**
+   * @brief Returns the number of elements the consumer missed or discarded
+   * because of FullPolicy::OverwriteOldest.
+   *
+   * Thread-safe.
+   */
+  [[nodiscard]] uint64_t overwritten() const {
+    return overwritten_.load(std::memory_order_relaxed);
+  }
+
+  /**
+   * @brief Returns the policy of the queue.
+   */
+  [[nodiscard]] FullPolicy policy() const { return policy_; }
+
+private:
+  /// Whether the producer may be writing the slots of the batch at position,
+  /// given the write position.
+  [[nodiscard]] bool overwritten(uint64_t position, uint64_t write_pos) const;
+
+  /// The number of slots in the circular buffer.
+  size_t nb_slots_;
+
+  /// The number of elements enqueued in a single batch.
+  size_t enqueue_batch_size_;
+
+  /// The number of elements dequeued in a single batch.
+  size_t dequeue_batch_size_;
+
+  /// The size of each element in bytes.
+  size_t element_size_;
+
+  /// A pointer to the buffer.
+  uint8_t *buffer_;
+
+  FullPolicy policy_;
+
+  /// The position of the next batch to write.
+  alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> write_pos_;
+
+  /// The position of the next batch to read. Not maintained with
+  /// FullPolicy::OverwriteOldest, where the producer ignores it.
+  alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> read_pos_;
+
+  /// Producer state: its slot, its cached copy of read_pos_, whether the
+  /// pending batch is dropped, and the scratch batch it is written to.
+  alignas(CACHE_LINE_SIZE) size_t write_slot_;
+  uint64_t cached_read_pos_;
+  bool dropping_;
+  std::unique_ptr<uint8_t[]> scratch_;
+  std::atomic<uint64_t> dropped_;
+
+  /// Consumer state: its position and slot, and its cached copy of
+  /// write_pos_.
+  alignas(CACHE_LINE_SIZE) uint64_t position_;
+  size_t read_slot_;
+  uint64_t cached_write_pos_;
+  std::atomic<uint64_t> overwritten_;
+};
+} // namespace batched_spsc_queue
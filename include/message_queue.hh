@@ -0,0 +1,130 @@
+#pragma once
+
+#include "batched_spsc_queue.hh"
+#include "buffer.hh"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace batched_spsc_queue {
+/**
+ * @class MessageQueue
+ * @brief An SPSC byte ring carrying variable-length records, each contiguous
+ * in memory.
+ *
+ * The producer reserves room for a record with reserve(), writes it in place
+ * and publishes it with commit(). Every record is stored after an 8-byte
+ * length header and padded to kRecordAlignment. A record never wraps around
+ * the end of the ring: when it does not fit before the end, the producer
+ * writes a skip marker there and stores the record at the beginning, and the
+ * consumer jumps over the marker.
+ *
+ * The consumer reads records one by one with read(), and releases all the
+ * records read so far with a single store in release(), so that a batch of
+ * small records costs one cross-core write.
+ *
+ * Positions are 64-bit byte counters, like LossyQueue's, so the whole
+ * capacity is usable and no slot is kept empty.
+ *
+ * @note As with Queue, one thread produces and one consumes.
+ */
+class MessageQueue {
+public:
+  /// The alignment of records, and the size of their header.
+  static constexpr size_t kRecordAlignment = 8;
+
+  /**
+   * @brief Constructs a MessageQueue that allocates and owns its ring.
+   *
+   * @param capacity The size of the ring in bytes, a multiple of
+   * kRecordAlignment and at least 4 * kRecordAlignment.
+   * @param options How to allocate the ring.
+   *
+   * @throws std::invalid_argument if capacity is not a multiple of
+   * kRecordAlignment or is too small.
+   * @throws std::system_error if the ring cannot be allocated.
+   */
+  explicit MessageQueue(size_t capacity, const BufferOptions &options = {});
+
+  /**
+   * @brief Returns the largest record that reserve() accepts.
+   *
+   * A record takes at most half the ring with its header and padding, so that
+   * it always fits once the ring is empty, wherever the wrap falls.
+   */
+  [[nodiscard]] size_t max_record_size() const {
+    return capacity_ / 2 - kRecordAlignment;
+  }
+
+  /**
+   * @brief Returns a pointer to size contiguous bytes for the next record.
+   *
+   * @return nullptr if the ring does not have room for the record yet.
+   * @throws std::invalid_argument if size exceeds max_record_size().
+   * @note This method should only be called by the producer thread.
+   */
+  uint8_t *reserve(size_t size);
+
+  /**
+   * @brief Publishes the record returned by reserve().
+   *
+   * @param size The size of the record, at most the size given to reserve().
+   * @note This method should only be called by the producer thread.
+   */
+  void commit(size_t size);
+
+  /**
+   * @brief Returns the next record, without releasing it.
+   *
+   * @param size Set to the size of the record.
+   * @return A pointer to the record, valid until release(), or nullptr if
+   * there is none.
+   * @note This method should only be called by the consumer thread.
+   */
+  const uint8_t *read(size_t &size);
+
+  /**
+   * @brief Releases every record returned by read() so far.
+   *
+   * @note This method should only be called by the consumer thread.
+   */
+  void release();
+
+  /**
+   * @brief Returns the number of bytes in the ring, headers and padding
+   * included.
+   */
+  size_t size() const;
+
+  /// The size of the ring in bytes.
+  [[nodiscard]] size_t capacity() const { return capacity_; }
+
+private:
+  /// The header of a skip marker, which no record length can match.
+  static constexpr uint64_t kSkipMarker = UINT64_MAX;
+
+  /// The size of the ring in bytes.
+  size_t capacity_;
+
+  /// The memory behind the ring.
+  Buffer buffer_;
+
+  /// The position of the end of the last committed record.
+  alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> write_pos_;
+
+  /// The position of the end of the last released record.
+  alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> read_pos_;
+
+  /// Producer state: the offset of write_pos_ in the ring, the number of bytes
+  /// skipped before the reserved record, and the cached copy of read_pos_.
+  alignas(CACHE_LINE_SIZE) size_t write_offset_;
+  size_t reserve_skip_;
+  uint64_t cached_read_pos_;
+
+  /// Consumer state: the position after the last record read, its offset in
+  /// the ring, and the cached copy of write_pos_.
+  alignas(CACHE_LINE_SIZE) uint64_t read_end_pos_;
+  size_t read_offset_;
+  uint64_t cached_write_pos_;
+};
+} // namespace batched_spsc_queue
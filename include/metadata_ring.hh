@@ -0,0 +1,113 @@
+#pragma once
+
+#include "batched_spsc_queue.hh"
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <span>
+#include <stdexcept>
+#include <tuple>
+#include <type_traits>
+
+namespace batched_spsc_queue {
+/**
+ * @class MetadataRing
+ * @brief Per-element metadata stored next to a Queue rather than in its
+ * payload, one array per field (structure of arrays).
+ *
+ * The ring has one entry per slot of the queue and follows its indices, so
+ * the metadata of a batch is always at the same positions as its elements.
+ * The producer fills it after write_ptr() and before commit_write(), whose
+ * release store publishes the metadata along with the payload; the consumer
+ * reads it after read_ptr(). The queue's hot path is unchanged.
+ *
+ * Since each field is a separate array, scanning one field of a batch, e.g.
+ * the timestamps to skip stale frames, reads a few contiguous cache lines and
+ * never touches the payload.
+ *
+ * @code
+ * // Capture timestamp, frame id and valid byte count of each frame.
+ * MetadataRing<int64_t, uint64_t, uint32_t> metadata(queue);
+ *
+ * // Producer, after write_ptr():
+ * metadata.write<0>()[i] = capture_ns;
+ *
+ * // Consumer, after read_ptr():
+ * for (int64_t capture_ns : metadata.read<0>())
+ *   ...
+ * @endcode
+ *
+ * @tparam Fields The type of each field, trivially copyable.
+ *
+ * @note Same threading rules as Queue: write() is for the producer thread and
+ * read() for the consumer thread. Queues on a MirroredBuffer are not
+ * supported, as their batches may run past the end of the arrays.
+ */
+template <typename... Fields> class MetadataRing {
+  static_assert(sizeof...(Fields) > 0, "MetadataRing needs a field.");
+  static_assert((std::is_trivially_copyable_v<Fields> && ...),
+                "Fields must be trivially copyable.");
+
+public:
+  /**
+   * @brief Allocates one zero-initialized array per field, of
+   * queue.nb_slots() entries.
+   *
+   * @param queue The queue the metadata follows. It must outlive the ring.
+   *
+   * @throws std::invalid_argument if the queue is on a MirroredBuffer.
+   */
+  explicit MetadataRing(Queue &queue)
+      : queue_(queue),
+        fields_(std::make_unique<Fields[]>(queue.nb_slots())...) {
+    if (queue.mirrored_)
+      throw std::invalid_argument(
+          "MetadataRing does not support mirrored buffers");
+  }
+
+  /**
+   * @brief Returns field I of the batch returned by write_ptr().
+   *
+   * @note This method should only be called by the producer thread.
+   */
+  template <size_t I> auto write() {
+    return write<I>(queue_.enqueue_batch_size_);
+  }
+
+  /**
+   * @brief Returns field I of the n elements returned by write_ptr(n).
+   *
+   * @note This method should only be called by the producer thread.
+   */
+  template <size_t I> auto write(size_t n) {
+    size_t write_idx = queue_.write_idx_.load(std::memory_order_relaxed);
+    return std::span(std::get<I>(fields_).get() + write_idx, n);
+  }
+
+  /**
+   * @brief Returns field I of the batch returned by read_ptr().
+   *
+   * @note This method should only be called by the consumer thread.
+   */
+  template <size_t I> auto read() const {
+    return read<I>(queue_.dequeue_batch_size_);
+  }
+
+  /**
+   * @brief Returns field I of the n elements returned by read_ptr(n).
+   *
+   * @note This method should only be called by the consumer thread.
+   */
+  template <size_t I> auto read(size_t n) const {
+    size_t read_idx = queue_.read_idx_.load(std::memory_order_relaxed);
+    const auto *field = std::get<I>(fields_).get();
+    return std::span(field + read_idx, n);
+  }
+
+private:
+  Queue &queue_;
+
+  /// One array of nb_slots entries per field.
+  std::tuple<std::unique_ptr<Fields[]>...> fields_;
+};
+} // namespace batched_spsc_queue
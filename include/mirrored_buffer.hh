@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace batched_spsc_queue {
+/**
+ * @class MirroredBuffer
+ * @brief A memory block mapped twice, back to back, in virtual memory.
+ *
+ * The same anonymous file (memfd) is mapped at data() and at data() + size(),
+ * so that any run of up to size() bytes starting at any offset in
+ * [0, size()) is contiguous in virtual memory: writing past the end of the
+ * buffer writes to its beginning. A Queue built on top of a MirroredBuffer
+ * never splits a batch at the wrap point, and its slot count does not need to
+ * be a multiple of the batch sizes.
+ *
+ * @note This class is only available on Linux.
+ */
+class MirroredBuffer {
+public:
+  /**
+   * @brief Maps a mirrored buffer of the given size.
+   *
+   * @param size The size of the buffer in bytes. It must be a multiple of
+   * page_size().
+   *
+   * @throws std::invalid_argument if size is zero or not a multiple of
+   * page_size().
+   * @throws std::system_error if creating or mapping the memory fails.
+   */
+  explicit MirroredBuffer(size_t size);
+
+  ~MirroredBuffer();
+
+  MirroredBuffer(const MirroredBuffer &) = delete;
+  MirroredBuffer &operator=(const MirroredBuffer &) = delete;
+
+  MirroredBuffer(MirroredBuffer &&other) noexcept;
+  MirroredBuffer &operator=(MirroredBuffer &&other) noexcept;
+
+  /**
+   * @brief Returns the beginning of the buffer.
+   *
+   * The 2 * size() bytes starting here are valid, the second half aliasing the
+   * first one.
+   */
+  [[nodiscard]] uint8_t *data() const { return data_; }
+
+  /**
+   * @brief Returns the size of the buffer in bytes, not counting the mirror.
+   */
+  [[nodiscard]] size_t size() const { return size_; }
+
+  /**
+   * @brief Returns the granularity that size() must be a multiple of.
+   */
+  static size_t page_size();
+
+private:
+  /// The beginning of the 2 * size_ bytes mapping.
+  uint8_t *data_;
+
+  /// The size of the buffer in bytes, not counting the mirror.
+  size_t size_;
+};
+} // namespace batched_spsc_queue
@@ -0,0 +1,213 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace batched_spsc_queue {
+/**
+ * @class Pipeline
+ * @brief A chain of stages connected by Queues, each stage running on its own
+ * thread.
+ *
+ * A pipeline is built from a source, any number of intermediate stages and a
+ * sink, each with its own batch size:
+ *
+ * @code
+ * Pipeline pipeline(nb_slots);
+ * pipeline.source("capture", frame_size, 8, capture)
+ *     .stage("preprocess", 8, preprocess)              // in place
+ *     .stage("compute", result_size, 64, compute)      // new element size
+ *     .sink("write", 64, write);
+ * pipeline.start();
+ * pipeline.wait();
+ * @endcode
+ *
+ * Consecutive stages that keep the same element size form a segment: the
+ * Queues between them share one buffer, and an in-place stage forwards the
+ * very batch it read, so no stage copies its input to its output. Only a
+ * transform stage, which changes the element size, writes into the buffer of
+ * a new segment. The producer at the head of a segment only writes once the
+ * last stage of the segment has released enough slots.
+ *
+ * The stream ends when the source returns fewer elements than requested, or
+ * when stop() is called. Every stage then drains what is left in its input,
+ * including partial batches, before the next stage is told to finish.
+ *
+ * stats() reports, for each stage, how many elements it moved, how long it
+ * spent in its function and how long it stalled waiting for input or output
+ * space, which points at the bottleneck stage. It can be called from any
+ * thread while the pipeline runs.
+ *
+ * @note Stage functions must not throw. This class is only available on Linux.
+ */
+class Pipeline {
+public:
+  /// Fills a batch of up to batch_size elements and returns how many it
+  /// wrote. Returning less than batch_size ends the stream.
+  using SourceFn = std::function<size_t(uint8_t *batch, size_t batch_size)>;
+
+  /// Processes n elements in place.
+  using InPlaceFn = std::function<void(uint8_t *batch, size_t n)>;
+
+  /// Reads n input elements and writes n output elements.
+  using TransformFn =
+      std::function<void(const uint8_t *input, uint8_t *output, size_t n)>;
+
+  /// Consumes n elements.
+  using SinkFn = std::function<void(const uint8_t *batch, size_t n)>;
+
+  /// A stage that is not pinned to any CPU.
+  static constexpr int kAnyCpu = -1;
+
+  /// Activity of one stage, see stats().
+  struct StageStats {
+    /// The name given when adding the stage.
+    std::string name;
+
+    /// Number of batches processed, partial ones included.
+    uint64_t batches;
+
+    /// Number of elements processed.
+    uint64_t elements;
+
+    /// Time spent inside the stage function.
+    std::chrono::nanoseconds busy;
+
+    /// Time spent waiting for input elements or for output space.
+    std::chrono::nanoseconds stalled;
+
+    /// Time since the stage started, or its total running time once it has
+    /// finished.
+    std::chrono::nanoseconds elapsed;
+
+    /// Elements per second over elapsed.
+    [[nodiscard]] double throughput() const;
+  };
+
+  /**
+   * @brief Constructs an empty pipeline.
+   *
+   * @param nb_slots The number of slots of every Queue in the pipeline. It must
+   * be a multiple of every stage's batch size, and at least the sum of the
+   * batch sizes of the stages reading from or writing to the same segment.
+   */
+  explicit Pipeline(size_t nb_slots);
+
+  /**
+   * @brief Stops and waits for the pipeline if it is still running.
+   */
+  ~Pipeline();
+
+  Pipeline(const Pipeline &) = delete;
+  Pipeline &operator=(const Pipeline &) = delete;
+
+  /**
+   * @brief Sets the source, which must be added first.
+   *
+   * @param name The name reported by stats().
+   * @param element_size The size of each produced element in bytes.
+   * @param batch_size The number of elements produced per batch.
+   * @param fn The function producing the batches.
+   * @param cpu The CPU to pin the stage's thread to, or kAnyCpu.
+   *
+   * @throws std::logic_error if the pipeline already has stages.
+   */
+  Pipeline &source(std::string name, size_t element_size, size_t batch_size,
+                   SourceFn fn, int cpu = kAnyCpu);
+
+  /**
+   * @brief Appends a stage that processes batches in place.
+   *
+   * @param name The name reported by stats().
+   * @param batch_size The number of elements processed per batch.
+   * @param fn The function processing the batches.
+   * @param cpu The CPU to pin the stage's thread to, or kAnyCpu.
+   */
+  Pipeline &stage(std::string name, size_t batch_size, InPlaceFn fn,
+                  int cpu = kAnyCpu);
+
+  /**
+   * @brief Appends a stage that transforms batches into elements of another
+   * size, starting a new segment.
+   *
+   * @param name The name reported by stats().
+   * @param element_size The size of each output element in bytes.
+   * @param batch_size The number of elements processed per batch.
+   * @param fn The function transforming the batches.
+   * @param cpu The CPU to pin the stage's thread to, or kAnyCpu.
+   */
+  Pipeline &stage(std::string name, size_t element_size, size_t batch_size,
+                  TransformFn fn, int cpu = kAnyCpu);
+
+  /**
+   * @brief Sets the sink, which must be added last.
+   *
+   * @param name The name reported by stats().
+   * @param batch_size The number of elements consumed per batch.
+   * @param fn The function consuming the batches.
+   * @param cpu The CPU to pin the stage's thread to, or kAnyCpu.
+   */
+  Pipeline &sink(std::string name, size_t batch_size, SinkFn fn,
+                 int cpu = kAnyCpu);
+
+  /**
+   * @brief Allocates the queues and starts one thread per stage.
+   *
+   * @throws std::logic_error if the pipeline has no sink, if nb_slots does not
+   * meet the conditions above, or if the pipeline already started.
+   * @throws std::system_error if a buffer cannot be allocated.
+   */
+  void start();
+
+  /**
+   * @brief Asks the source to stop producing. The stages then drain the
+   * elements already in flight. Does not block.
+   */
+  void stop();
+
+  /**
+   * @brief Blocks until every stage has drained its input and finished.
+   */
+  void wait();
+
+  /**
+   * @brief Returns the activity of every stage, from source to sink.
+   */
+  [[nodiscard]] std::vector<StageStats> stats() const;
+
+private:
+  struct Segment;
+  struct Link;
+  struct Stage;
+
+  /// Appends a stage after checking the builder order.
+  Pipeline &add(std::unique_ptr<Stage> stage);
+
+  /// The body of a stage's thread.
+  void run(Stage &stage);
+
+  /// The number of slots of every Queue.
+  size_t nb_slots_;
+
+  /// The stages, from source to sink.
+  std::vector<std::unique_ptr<Stage>> stages_;
+
+  /// The queues between consecutive stages.
+  std::vector<std::unique_ptr<Link>> links_;
+
+  /// The buffers shared by the queues of each segment.
+  std::vector<std::unique_ptr<Segment>> segments_;
+
+  /// Set by stop(), polled by the source.
+  std::atomic<bool> stop_requested_;
+
+  /// Whether start() has been called.
+  bool started_;
+};
+} // namespace batched_spsc_queue
@@ -0,0 +1,141 @@
+#pragma once
+
+#include "batched_spsc_queue.hh"
+#include <atomic>
+#include <cstdint>
+
+namespace batched_spsc_queue {
+/**
+ * @class QueueEvents
+ * @brief Readiness notification for a Queue through two eventfds, so that
+ * each side can wait in an epoll loop alongside sockets and timers.
+ *
+ * data_fd() tells the consumer that commit_write() published data, and
+ * space_fd() tells the producer that commit_read() freed slots. Signals are
+ * edge-coalesced: a side arms its eventfd with arm_read() or arm_write() when
+ * it is about to wait, and only the first commit of the other side after that
+ * writes to the eventfd. While neither side is waiting, commits make no system
+ * call, just a load of the armed flag.
+ *
+ * A typical consumer loop, with data_fd() registered in epoll:
+ *
+ *     for (;;) {
+ *       while (uint8_t *batch = queue.read_ptr()) {
+ *         ...
+ *         queue.commit_read();
+ *       }
+ *       if (!events.arm_read())
+ *         continue;
+ *       epoll_wait(...);
+ *       events.clear_data();
+ *     }
+ *
+ * @note Commits of a queue with events are seq_cst stores followed by a load
+ * of the armed flag, as with WaitPolicy::Park. The events must be created
+ * before the producer and consumer start, and outlive them. This class is
+ * only available on Linux.
+ */
+class QueueEvents {
+public:
+  /**
+   * @brief Creates the eventfds and attaches them to the queue.
+   *
+   * @throws std::logic_error if the queue already has events.
+   * @throws std::system_error if an eventfd cannot be created.
+   */
+  explicit QueueEvents(Queue &queue);
+
+  /**
+   * @brief Detaches the events from the queue and closes the eventfds.
+   */
+  ~QueueEvents();
+
+  QueueEvents(const QueueEvents &) = delete;
+  QueueEvents &operator=(const QueueEvents &) = delete;
+
+  /**
+   * @brief Returns the eventfd that becomes readable when data is committed
+   * after arm_read().
+   */
+  [[nodiscard]] int data_fd() const { return data_.fd; }
+
+  /**
+   * @brief Returns the eventfd that becomes readable when slots are freed
+   * after arm_write().
+   */
+  [[nodiscard]] int space_fd() const { return space_.fd; }
+
+  /**
+   * @brief Arms data_fd() before the consumer waits on it.
+   *
+   * @return false if a batch became available meanwhile, in which case the
+   * consumer should read it instead of waiting.
+   * @note This method should only be called by the consumer thread.
+   */
+  bool arm_read();
+
+  /**
+   * @brief Arms space_fd() before the producer waits on it.
+   *
+   * @return false if a batch can be written meanwhile, in which case the
+   * producer should write it instead of waiting.
+   * @note This method should only be called by the producer thread.
+   */
+  bool arm_write();
+
+  /**
+   * @brief Resets data_fd() after it was reported readable.
+   *
+   * @note This method should only be called by the consumer thread.
+   */
+  void clear_data();
+
+  /**
+   * @brief Resets space_fd() after it was reported readable.
+   *
+   * @note This method should only be called by the producer thread.
+   */
+  void clear_space();
+
+  /**
+   * @brief Returns the number of writes to data_fd() so far.
+   *
+   * Thread-safe.
+   */
+  [[nodiscard]] uint64_t data_signals() const {
+    return data_.signals.load(std::memory_order_relaxed);
+  }
+
+  /**
+   * @brief Returns the number of writes to space_fd() so far.
+   *
+   * Thread-safe.
+   */
+  [[nodiscard]] uint64_t space_signals() const {
+    return space_.signals.load(std::memory_order_relaxed);
+  }
+
+private:
+  friend class Queue;
+
+  /// The eventfd of one direction, with the flag set by the waiting side.
+  struct alignas(CACHE_LINE_SIZE) Direction {
+    std::atomic<bool> armed{false};
+    std::atomic<uint64_t> signals{0};
+    int fd = -1;
+  };
+
+  /**
+   * @brief Writes to the eventfd of a direction if it is armed. Called by
+   * Queue's commits after their seq_cst store of the index.
+   */
+  static void signal(Direction &direction);
+
+  /// Resets the eventfd of a direction.
+  static void clear(Direction &direction);
+
+  Queue &queue_;
+  Direction data_;
+  Direction space_;
+};
+} // namespace batched_spsc_queue
@@ -0,0 +1,127 @@
+#pragma once
+
+#include "batched_spsc_queue.hh"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace batched_spsc_queue {
+/**
+ * @class QueueSet
+ * @brief Lets one consumer read from many Queues, each with its own producer.
+ *
+ * The set keeps a readiness bitmap with one bit per queue. A producer sets its
+ * queue's bit on commit_write(), unless it is already set, and the consumer
+ * finds the queues to read from with a bit scan instead of polling every
+ * queue's indices. The consumer clears a bit when it finds the queue empty.
+ *
+ * Queues are served in round-robin order. A queue added with a weight greater
+ * than 1 is served up to that many batches in a row before moving on to the
+ * next ready queue (weighted round-robin).
+ *
+ * Reading happens through the set: read_ptr() returns the next batch and the
+ * index of its queue, and commit_read() releases it. wait_read_ptr() blocks
+ * until any queue is ready, parking the consumer with std::atomic::wait() on
+ * the bitmap. Producers only notify when the consumer is actually parked.
+ *
+ * @note Commits of a queue in a set are seq_cst stores followed by a load of
+ * the bitmap, and the first commit after the consumer cleared the queue's bit
+ * is an atomic read-modify-write on the bitmap. The set must outlive its
+ * queues' producers, and queues must only be added before their producers
+ * start.
+ */
+class QueueSet {
+public:
+  /// The maximum number of queues in a set, one bit of the bitmap each.
+  static constexpr size_t kMaxQueues = 64;
+
+  QueueSet();
+
+  /**
+   * @brief Detaches the queues from the set.
+   */
+  ~QueueSet();
+
+  QueueSet(const QueueSet &) = delete;
+  QueueSet &operator=(const QueueSet &) = delete;
+
+  /**
+   * @brief Adds a queue to the set.
+   *
+   * @param queue The queue, which must not be in another set. Its consumer is
+   * the set's consumer from now on.
+   * @param weight The number of batches read in a row from the queue when it
+   * is selected. Must be at least 1.
+   * @return The index of the queue in the set.
+   *
+   * @throws std::length_error if the set already has kMaxQueues queues.
+   */
+  size_t add(Queue &queue, size_t weight = 1);
+
+  /// The number of queues in the set.
+  [[nodiscard]] size_t size() const { return queues_.size(); }
+
+  /// The queue at the given index.
+  [[nodiscard]] Queue &queue(size_t index) const {
+    return *queues_[index].queue;
+  }
+
+  /**
+   * @brief Returns the next batch to read from any ready queue, or nullptr if
+   * every queue is empty.
+   *
+   * @param index Set to the index of the queue the batch belongs to.
+   */
+  uint8_t *read_ptr(size_t &index);
+
+  /**
+   * @brief Blocks until a batch is available in any queue and returns it.
+   *
+   * Spins for a bounded number of attempts, then parks until a producer
+   * marks a queue ready.
+   *
+   * @param index Set to the index of the queue the batch belongs to.
+   */
+  uint8_t *wait_read_ptr(size_t &index);
+
+  /**
+   * @brief Releases the batch returned by read_ptr() or wait_read_ptr().
+   *
+   * @param index The index returned with the batch.
+   */
+  void commit_read(size_t index);
+
+private:
+  friend class Queue;
+
+  struct Entry {
+    Queue *queue;
+    size_t weight;
+  };
+
+  /**
+   * @brief Sets the bit of a queue. Called by Queue::commit_write() after its
+   * seq_cst store of the write index.
+   */
+  void mark_ready(size_t index);
+
+  /// Number of failed attempts before wait_read_ptr() parks.
+  static constexpr size_t kSpinCount = 1024;
+
+  /// The queues, in the order they were added.
+  std::vector<Entry> queues_;
+
+  /// The queue that is currently being served.
+  size_t current_;
+
+  /// The number of batches still to read from current_ before moving on.
+  size_t credits_;
+
+  /// One bit per queue that may have a batch to read.
+  alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> ready_;
+
+  /// Set while the consumer is parked on ready_.
+  alignas(CACHE_LINE_SIZE) std::atomic<bool> consumer_parked_;
+};
+} // namespace batched_spsc_queue
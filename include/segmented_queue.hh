@@ -0,0 +1,197 @@
+#pragma once
+
+#include "batched_spsc_queue.hh"
+#include "buffer.hh"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace batched_spsc_queue {
+/**
+ * @brief How a SegmentedQueue allocates and keeps its segments.
+ */
+struct SegmentedQueueOptions {
+  /// No limit on the number of segments.
+  static constexpr size_t kUnlimited = 0;
+
+  /// The maximum number of segments allocated at once, after which
+  /// write_ptr() returns nullptr until the consumer drains one, or
+  /// kUnlimited.
+  size_t max_segments = kUnlimited;
+
+  /// The number of drained segments kept for reuse. Beyond that, the producer
+  /// unmaps them, so that the memory of a burst is given back once the
+  /// consumer catches up.
+  size_t spare_segments = 2;
+
+  /// How to allocate each segment. With huge pages, each segment is rounded
+  /// up to a multiple of 2 MiB, so segments should be sized accordingly.
+  BufferOptions buffer = {};
+};
+
+/**
+ * @class SegmentedQueue
+ * @brief An unbounded SPSC queue made of a linked list of fixed-size segments,
+ * so that memory follows the backlog instead of the worst-case burst.
+ *
+ * Each segment is laid out like the buffer of a Queue, with batches
+ * contiguous in memory, and holds segment_slots elements. When the producer
+ * fills a segment, it links in another one and carries on; when the consumer
+ * drains a segment, it moves to the next one and hands the drained segment
+ * back to the producer.
+ *
+ * The list itself is the free-list: the segments the consumer has moved past
+ * stay linked ahead of it, and the producer unlinks them from the front and
+ * reuses them, with the consumer publishing how many it has released and the
+ * producer counting how many it took. Only switching segments touches this
+ * state, and a queue whose backlog stays below spare_segments segments never
+ * allocates after warming up.
+ *
+ * Positions are 64-bit element counters, so no slot is kept empty.
+ *
+ * @note As with Queue, one thread produces and one consumes. Unlike Queue,
+ * the producer may allocate and free memory, in write_ptr(), whenever it needs
+ * a segment and no drained one is available.
+ */
+class SegmentedQueue {
+public:
+  /**
+   * @brief Constructs a SegmentedQueue with a single segment.
+   *
+   * @param segment_slots The number of slots of each segment, a multiple of
+   * both batch sizes.
+   * @param enqueue_batch_size The number of elements that can be enqueued in
+   * a single batch.
+   * @param dequeue_batch_size The number of elements that can be dequeued in
+   * a single batch.
+   * @param element_size The size of each element in bytes.
+   * @param options How to allocate and keep the segments.
+   *
+   * @throws std::invalid_argument if segment_slots is not a multiple of the
+   * batch sizes, or if max_segments is 1.
+   * @throws std::system_error if the first segment cannot be allocated.
+   */
+  SegmentedQueue(size_t segment_slots, size_t enqueue_batch_size,
+                 size_t dequeue_batch_size, size_t element_size,
+                 const SegmentedQueueOptions &options = {});
+
+  ~SegmentedQueue();
+
+  SegmentedQueue(const SegmentedQueue &) = delete;
+  SegmentedQueue &operator=(const SegmentedQueue &) = delete;
+
+  /**
+   * @brief Returns a pointer to the next batch for writing.
+   *
+   * @return nullptr if the current segment is full and max_segments are
+   * already allocated.
+   * @throws std::system_error if a new segment cannot be allocated.
+   * @note This method should only be called by the producer thread.
+   */
+  uint8_t *write_ptr();
+
+  /**
+   * @brief Publishes the batch returned by write_ptr().
+   *
+   * @note This method should only be called by the producer thread.
+   */
+  void commit_write();
+
+  /**
+   * @brief Returns a pointer to the next batch for reading, or nullptr if
+   * there is none.
+   *
+   * @note This method should only be called by the consumer thread.
+   */
+  uint8_t *read_ptr();
+
+  /**
+   * @brief Releases the batch returned by read_ptr().
+   *
+   * @note This method should only be called by the consumer thread.
+   */
+  void commit_read();
+
+  /**
+   * @brief Returns the number of elements in the queue.
+   *
+   * Thread-safe.
+   */
+  [[nodiscard]] size_t size() const;
+
+  /**
+   * @brief Returns the number of segments currently allocated, spare ones
+   * included.
+   *
+   * Thread-safe.
+   */
+  [[nodiscard]] size_t allocated_segments() const {
+    return allocated_segments_.load(std::memory_order_relaxed);
+  }
+
+  /**
+   * @brief Returns the number of segments allocated since construction,
+   * the first one included. Constant once the queue reached its steady state.
+   *
+   * Thread-safe.
+   */
+  [[nodiscard]] uint64_t segment_allocations() const {
+    return segment_allocations_.load(std::memory_order_relaxed);
+  }
+
+  /// The number of slots of each segment.
+  [[nodiscard]] size_t segment_slots() const { return segment_slots_; }
+
+private:
+  /// A segment and the link to the one written after it.
+  struct Segment {
+    Buffer buffer;
+    std::atomic<Segment *> next{nullptr};
+  };
+
+  /**
+   * @brief Returns a segment to write after the current one, a drained one if
+   * possible, and unmaps the drained segments beyond spare_segments.
+   *
+   * @return nullptr if none is drained and max_segments are allocated.
+   */
+  Segment *next_segment();
+
+  size_t segment_slots_;
+  size_t enqueue_batch_size_;
+  size_t dequeue_batch_size_;
+  size_t element_size_;
+  SegmentedQueueOptions options_;
+
+  /// The number of elements committed so far.
+  alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> write_count_;
+
+  /// The number of elements released so far.
+  alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> read_count_;
+
+  /// The number of segments the consumer has moved past.
+  alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> released_segments_;
+
+  /// Producer state: the segment being written and the offset in it, the
+  /// oldest segment of the list and how many segments were unlinked from the
+  /// front so far, and the local copy of write_count_.
+  alignas(CACHE_LINE_SIZE) Segment *head_;
+  size_t write_offset_;
+  Segment *first_;
+  uint64_t taken_segments_;
+  uint64_t write_count_local_;
+
+  /// Consumer state: the segment being read and the offset in it, the cached
+  /// copy of write_count_, and the local copies of read_count_ and
+  /// released_segments_.
+  alignas(CACHE_LINE_SIZE) Segment *tail_;
+  size_t read_offset_;
+  uint64_t cached_write_count_;
+  uint64_t read_count_local_;
+  uint64_t released_segments_local_;
+
+  /// Read by other threads.
+  alignas(CACHE_LINE_SIZE) std::atomic<size_t> allocated_segments_;
+  std::atomic<uint64_t> segment_allocations_;
+};
+} // namespace batched_spsc_queue
@@ -0,0 +1,178 @@
+#pragma once
+
+#include "batched_spsc_queue.hh"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace batched_spsc_queue {
+/**
+ * @class SharedQueue
+ * @brief A batched SPSC queue living in named shared memory, so that the
+ * producer and the consumer can be in different processes.
+ *
+ * A single POSIX shared memory object holds a versioned header (geometry,
+ * write and read indices, and the pid of each attached side, each on its own
+ * cache line) followed by the payload. One process creates the queue with
+ * create(), the other one attaches to it by name with attach(). The hot path
+ * is the same as Queue's, including the cached copy of the other side's index.
+ *
+ * Each side records its pid in the header when it attaches and clears it when
+ * the SharedQueue is destroyed, which lets peer_state() tell a peer that
+ * detached cleanly from one that crashed. A crashed side can be replaced by
+ * attaching again with the same role: the indices only ever cover committed
+ * batches, so the queue is consistent.
+ *
+ * @note Both processes must be built with the same CACHE_LINE_SIZE, as it
+ * determines the header layout. attach() checks it.
+ * @note This class is only available on Linux. Blocking waits are not
+ * supported, since std::atomic::wait() does not work across processes.
+ */
+class SharedQueue {
+public:
+  /// Which side of the queue a SharedQueue object is used as.
+  enum class Role { Producer, Consumer };
+
+  /// What is known about the process on the other side of the queue.
+  enum class PeerState {
+    /// No process is attached on the other side.
+    Detached,
+    /// The process on the other side is running.
+    Alive,
+    /// The process on the other side exited without detaching.
+    Dead,
+  };
+
+  /**
+   * @brief Creates a new named shared memory queue and attaches to it.
+   *
+   * The name is unlinked when the returned object is destroyed. Processes that
+   * are still attached keep their mapping.
+   *
+   * @param name The POSIX shared memory name, e.g. "/camera0".
+   * @param nb_slots The number of slots in the circular buffer, see
+   * Queue::Queue().
+   * @param enqueue_batch_size The number of elements that can be
+   * enqueued in a single batch.
+   * @param dequeue_batch_size The number of elements that can be
+   * dequeued in a single batch.
+   * @param element_size The size of each element in bytes.
+   * @param role The side this process uses.
+   *
+   * @throws std::system_error if the name already exists or if creating or
+   * mapping the shared memory fails.
+   */
+  static SharedQueue create(const std::string &name, size_t nb_slots,
+                            size_t enqueue_batch_size,
+                            size_t dequeue_batch_size, size_t element_size,
+                            Role role);
+
+  /**
+   * @brief Attaches to a queue previously created with create().
+   *
+   * @param name The POSIX shared memory name passed to create().
+   * @param role The side this process uses.
+   *
+   * @throws std::system_error if opening or mapping the shared memory fails.
+   * @throws std::runtime_error if the shared memory is not a queue, was
+   * created by an incompatible version, or if a live process already holds
+   * the role.
+   */
+  static SharedQueue attach(const std::string &name, Role role);
+
+  ~SharedQueue();
+
+  SharedQueue(const SharedQueue &) = delete;
+  SharedQueue &operator=(const SharedQueue &) = delete;
+
+  SharedQueue(SharedQueue &&other) noexcept;
+  SharedQueue &operator=(SharedQueue &&other) noexcept;
+
+  /**
+   * @brief Returns a pointer to the next available slot for writing, or
+   * nullptr if the queue is full. See Queue::write_ptr().
+   */
+  uint8_t *write_ptr();
+
+  /**
+   * @brief Commits the write operation. See Queue::commit_write().
+   */
+  void commit_write();
+
+  /**
+   * @brief Returns a pointer to the next available slot for reading, or
+   * nullptr if the queue is empty. See Queue::read_ptr().
+   */
+  uint8_t *read_ptr();
+
+  /**
+   * @brief Commits the read operation. See Queue::commit_read().
+   */
+  void commit_read();
+
+  /**
+   * @brief Returns the number of elements currently in the queue.
+   */
+  size_t size();
+
+  /**
+   * @brief Returns the state of the process attached on the other side.
+   *
+   * A peer that crashed is reported as Dead once it has been reaped by its
+   * parent; until then the kernel still considers it alive.
+   */
+  [[nodiscard]] PeerState peer_state() const;
+
+  /// The number of slots in the circular buffer.
+  [[nodiscard]] size_t nb_slots() const { return nb_slots_; }
+
+  /// The number of elements enqueued in a single batch.
+  [[nodiscard]] size_t enqueue_batch_size() const {
+    return enqueue_batch_size_;
+  }
+
+  /// The number of elements dequeued in a single batch.
+  [[nodiscard]] size_t dequeue_batch_size() const {
+    return dequeue_batch_size_;
+  }
+
+  /// The size of each element in bytes.
+  [[nodiscard]] size_t element_size() const { return element_size_; }
+
+private:
+  struct Header;
+
+  SharedQueue(void *mapping, size_t mapping_size, Role role, std::string name);
+
+  /// Unmaps the shared memory and releases the role, if still attached.
+  void detach();
+
+  /// The shared memory mapping, starting with the header.
+  Header *header_;
+
+  /// The payload, right after the header.
+  uint8_t *buffer_;
+
+  /// The size of the whole mapping in bytes.
+  size_t mapping_size_;
+
+  /// The side this object is used as.
+  Role role_;
+
+  /// The shared memory name to unlink on destruction, empty if this object
+  /// did not create the queue.
+  std::string owned_name_;
+
+  /// Process-local copies of the geometry stored in the header.
+  size_t nb_slots_;
+  size_t enqueue_batch_size_;
+  size_t dequeue_batch_size_;
+  size_t element_size_;
+
+  /// The producer's last observed value of the read index.
+  alignas(CACHE_LINE_SIZE) size_t cached_read_idx_;
+
+  /// The consumer's last observed value of the write index.
+  alignas(CACHE_LINE_SIZE) size_t cached_write_idx_;
+};
+} // namespace batched_spsc_queue
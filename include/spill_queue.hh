@@ -0,0 +1,168 @@
+#pragma once
+
+#include "batched_spsc_queue.hh"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace batched_spsc_queue {
+/**
+ * @brief A snapshot of the spill activity of a SpillQueue.
+ */
+struct SpillStats {
+  /// The number of bytes written to the spill file so far.
+  uint64_t spilled_bytes = 0;
+
+  /// The number of bytes read back from the spill file so far.
+  uint64_t drained_bytes = 0;
+
+  /// The number of bytes in the spill file not read back yet.
+  uint64_t backlog_bytes = 0;
+
+  /// The rate at which the consumer read the spill file back, in bytes per
+  /// second of draining, or 0 if it never did.
+  double drain_rate = 0;
+};
+
+/**
+ * @class SpillQueue
+ * @brief A Queue that spills batches to a file instead of rejecting them when
+ * the consumer falls behind.
+ *
+ * As long as the ring has room, batches go through it exactly as with Queue.
+ * When the ring is full, write_ptr() returns a staging batch instead of
+ * nullptr, and commit_write() appends it to a spill file. Until the consumer
+ * has read every spilled batch back, the following batches are spilled too,
+ * so the order is preserved. The consumer reads the ring up to the point where
+ * spilling started, then the spill file, then the ring again.
+ *
+ * The spill file is an unnamed temporary file in the given directory, so it
+ * disappears with the queue or the process. Each spill episode starts writing
+ * at the beginning of the file again, so the file only grows to the largest
+ * episode. Read-back batches are dropped from the page cache.
+ *
+ * @note Both directions go through a staging batch while spilling, so spilled
+ * batches are copied once more than ring batches. The enqueue and dequeue
+ * batch sizes are the same. This class is only available on Linux.
+ */
+class SpillQueue {
+public:
+  /// No limit on the size of the spill file.
+  static constexpr uint64_t kUnlimited = 0;
+
+  /**
+   * @brief Constructs a SpillQueue with an owned ring buffer.
+   *
+   * @param nb_slots The number of slots in the ring, a multiple of
+   * batch_size.
+   * @param batch_size The number of elements in a batch.
+   * @param element_size The size of each element in bytes.
+   * @param spill_directory The directory of the spill file, on a local disk.
+   * @param max_spill_bytes The maximum size of the spill file, after which
+   * write_ptr() returns nullptr, or kUnlimited.
+   * @param options How to allocate the ring buffer.
+   *
+   * @throws std::system_error if the spill file cannot be created.
+   */
+  SpillQueue(size_t nb_slots, size_t batch_size, size_t element_size,
+             const std::string &spill_directory,
+             uint64_t max_spill_bytes = kUnlimited,
+             const BufferOptions &options = {});
+
+  ~SpillQueue();
+
+  SpillQueue(const SpillQueue &) = delete;
+  SpillQueue &operator=(const SpillQueue &) = delete;
+
+  /**
+   * @brief Returns a pointer to the next batch to write: a ring slot, or a
+   * staging batch when spilling.
+   *
+   * @return nullptr only if the spill file reached max_spill_bytes.
+   * @note This method should only be called by the producer thread.
+   */
+  uint8_t *write_ptr();
+
+  /**
+   * @brief Commits the batch returned by write_ptr(), to the ring or to the
+   * spill file.
+   *
+   * @throws std::system_error if writing to the spill file fails.
+   * @note This method should only be called by the producer thread.
+   */
+  void commit_write();
+
+  /**
+   * @brief Returns a pointer to the next batch to read, from the ring or from
+   * the spill file, or nullptr if there is none.
+   *
+   * @throws std::system_error if reading from the spill file fails.
+   * @note This method should only be called by the consumer thread.
+   */
+  uint8_t *read_ptr();
+
+  /**
+   * @brief Releases the batch returned by read_ptr().
+   *
+   * @note This method should only be called by the consumer thread.
+   */
+  void commit_read();
+
+  /**
+   * @brief Returns whether the spill file holds batches not read back yet, in
+   * which case new batches are spilled too.
+   *
+   * Thread-safe.
+   */
+  [[nodiscard]] bool spilling() const;
+
+  /**
+   * @brief Returns a snapshot of the spill activity.
+   *
+   * Thread-safe.
+   */
+  [[nodiscard]] SpillStats stats() const;
+
+  /**
+   * @brief Returns the in-memory ring.
+   */
+  [[nodiscard]] Queue &ring() { return queue_; }
+
+private:
+  /// Whether the pending batch is a ring slot or a staging batch.
+  enum class Target { Ring, Spill };
+
+  Queue queue_;
+  size_t batch_size_;
+  size_t batch_bytes_;
+  uint64_t max_spill_bytes_;
+  int fd_;
+
+  /// Published by the producer when a spill episode starts, before the first
+  /// spilled batch: the number of elements committed to the ring so far, and
+  /// the spill position at which the episode starts in the file.
+  alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> boundary_;
+  std::atomic<uint64_t> episode_base_;
+
+  /// The spill positions, in bytes since construction, written and read back.
+  alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> spill_written_;
+  alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> spill_read_;
+
+  /// The consumer's drain accounting, readable by stats().
+  alignas(CACHE_LINE_SIZE) std::atomic<int64_t> drain_start_ns_;
+  std::atomic<int64_t> drain_ns_;
+
+  /// Producer state.
+  alignas(CACHE_LINE_SIZE) std::unique_ptr<uint8_t[]> write_staging_;
+  Target write_target_;
+  uint64_t ring_committed_;
+
+  /// Consumer state.
+  alignas(CACHE_LINE_SIZE) std::unique_ptr<uint8_t[]> read_staging_;
+  Target read_source_;
+  bool staged_;
+  uint64_t ring_consumed_;
+};
+} // namespace batched_spsc_queue
@@ -0,0 +1,74 @@
+#pragma once
+
+#include "copy.hh"
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+namespace batched_spsc_queue {
+/**
+ * @brief A kernel applied to a batch while it is copied into or out of a
+ * queue, see Queue::enqueue_transform() and Queue::dequeue_transform().
+ *
+ * Fusing the transform with the copy means the data is only read and written
+ * once, instead of a copy followed by a second pass over the result.
+ *
+ * Any callable can be used as a kernel. The built-in ones below are
+ * vectorized, and pick their instruction set when they are created.
+ */
+struct Transform {
+  /// The signature of a kernel: transforms the size bytes at src and writes
+  /// size / in_bytes * out_bytes bytes at dst. The ranges do not overlap.
+  using Kernel =
+      std::function<void(uint8_t *dst, const uint8_t *src, size_t size)>;
+
+  Kernel kernel;
+
+  /// The kernel turns every in_bytes of input into out_bytes of output. The
+  /// batches of the queue must be a multiple of the unit on their side.
+  size_t in_bytes = 1;
+  size_t out_bytes = 1;
+};
+
+/**
+ * @brief Converts bytes to floats, out[i] = in[i] * scale + bias, e.g. to
+ * normalize 8-bit pixels to [0, 1] with a scale of 1 / 255.
+ *
+ * @param kernel The instruction set to use, lowered to the best supported
+ * one if needed.
+ */
+Transform normalize_transform(float scale, float bias,
+                              CopyKernel kernel = best_copy_kernel());
+
+/**
+ * @brief Splits frames of interleaved channels (e.g. RGBRGB...) into one plane
+ * per channel (RR...GG...BB...).
+ *
+ * Each frame of frame_bytes is de-interleaved on its own, so a batch of frames
+ * gives the planes of each frame in turn. Vectorized kernels use 128-bit
+ * shuffles, AVX-512 included.
+ *
+ * @param channels The number of channels, from 2 to 4.
+ * @param frame_bytes The size of a frame, a multiple of channels.
+ * @param kernel The instruction set to use, lowered as for
+ * normalize_transform().
+ *
+ * @throws std::invalid_argument if channels or frame_bytes is invalid.
+ */
+Transform deinterleave_transform(size_t channels, size_t frame_bytes,
+                                 CopyKernel kernel = best_copy_kernel());
+
+/**
+ * @brief Reverses the byte order of every word, e.g. to convert big-endian
+ * 16-bit samples.
+ *
+ * @param word_size The size of a word: 2, 4 or 8 bytes.
+ * @param kernel The instruction set to use, lowered as for
+ * normalize_transform(). The AVX-512 kernel also needs AVX512BW, and falls
+ * back to AVX2 without it.
+ *
+ * @throws std::invalid_argument if word_size is not supported.
+ */
+Transform byteswap_transform(size_t word_size,
+                             CopyKernel kernel = best_copy_kernel());
+} // namespace batched_spsc_queue
@@ -0,0 +1,197 @@
+#pragma once
+
+#include "batched_spsc_queue.hh"
+#include <atomic>
+#include <cstddef>
+#include <span>
+
+namespace batched_spsc_queue {
+/**
+ * @class TypedQueue
+ * @brief A header-only, compile-time specialized variant of Queue.
+ *
+ * The element type, the number of slots and both batch sizes are template
+ * parameters, so every index computation folds into constants and the hot
+ * functions can be inlined into the caller. When NbSlots is a power of two,
+ * wrapping and distance computations use mask arithmetic instead of branches.
+ * Batches are returned as std::span<T>; an empty span means the queue is full
+ * (for writing) or empty (for reading).
+ *
+ * The divisibility rules documented on Queue::Queue() are checked at compile
+ * time.
+ *
+ * @tparam T The element type.
+ * @tparam NbSlots The number of slots in the circular buffer. The actual
+ * capacity of the queue is NbSlots - EnqueueBatchSize.
+ * @tparam EnqueueBatchSize The number of elements enqueued in a single batch.
+ * @tparam DequeueBatchSize The number of elements dequeued in a single batch.
+ *
+ * @note Same threading rules as Queue: one producer thread, one consumer
+ * thread.
+ */
+template <typename T, size_t NbSlots, size_t EnqueueBatchSize,
+          size_t DequeueBatchSize>
+class TypedQueue {
+  static_assert(EnqueueBatchSize > 0, "EnqueueBatchSize must be positive.");
+  static_assert(DequeueBatchSize > 0, "DequeueBatchSize must be positive.");
+  static_assert(NbSlots > EnqueueBatchSize,
+                "NbSlots must be greater than EnqueueBatchSize.");
+  static_assert(NbSlots % EnqueueBatchSize == 0,
+                "NbSlots must be a multiple of EnqueueBatchSize.");
+  static_assert(NbSlots % DequeueBatchSize == 0,
+                "NbSlots must be a multiple of DequeueBatchSize.");
+
+  /// Whether index arithmetic can use a mask instead of a comparison.
+  static constexpr bool kIsPowerOfTwo = (NbSlots & (NbSlots - 1)) == 0;
+
+public:
+  /**
+   * @brief Constructs a TypedQueue on top of a pre-allocated buffer.
+   *
+   * @param buffer A pre-allocated memory block that is large enough to contain
+   * NbSlots elements of type T.
+   */
+  explicit TypedQueue(T *buffer) : buffer_(buffer) {}
+
+  /**
+   * @brief Returns the next batch available for writing.
+   *
+   * @return A span of EnqueueBatchSize elements, or an empty span if the queue
+   * is full.
+   *
+   * @note The span returned by this method is invalidated after calling
+   * commit_write().
+   */
+  std::span<T> write_batch() {
+    size_t write_idx = write_idx_.load(std::memory_order_relaxed);
+
+    // Only reload read_idx_ when the cached value says the queue is full.
+    if (NbSlots - distance(cached_read_idx_, write_idx) <
+        EnqueueBatchSize + 1) {
+      cached_read_idx_ = read_idx_.load(std::memory_order_acquire);
+      if (NbSlots - distance(cached_read_idx_, write_idx) <
+          EnqueueBatchSize + 1)
+        return {};
+    }
+
+    return {buffer_ + write_idx, EnqueueBatchSize};
+  }
+
+  /**
+   * @brief Commits the write operation.
+   *
+   * @note The span returned by write_batch() is invalidated after calling this
+   * method.
+   */
+  void commit_write() {
+    size_t write_idx = write_idx_.load(std::memory_order_relaxed);
+    write_idx_.store(wrap(write_idx + EnqueueBatchSize),
+                     std::memory_order_release);
+  }
+
+  /**
+   * @brief Returns the next batch available for reading.
+   *
+   * @return A span of DequeueBatchSize elements, or an empty span if the queue
+   * is empty.
+   *
+   * @note The span returned by this method is invalidated after calling
+   * commit_read().
+   */
+  std::span<T> read_batch() {
+    size_t read_idx = read_idx_.load(std::memory_order_relaxed);
+
+    // Only reload write_idx_ when the cached value says the queue is empty.
+    if (distance(read_idx, cached_write_idx_) < DequeueBatchSize) {
+      cached_write_idx_ = write_idx_.load(std::memory_order_acquire);
+      if (distance(read_idx, cached_write_idx_) < DequeueBatchSize)
+        return {};
+    }
+
+    return {buffer_ + read_idx, DequeueBatchSize};
+  }
+
+  /**
+   * @brief Commits the read operation.
+   *
+   * @note The span returned by read_batch() is invalidated after calling this
+   * method.
+   */
+  void commit_read() {
+    size_t read_idx = read_idx_.load(std::memory_order_relaxed);
+    read_idx_.store(wrap(read_idx + DequeueBatchSize),
+                    std::memory_order_release);
+  }
+
+  /**
+   * @brief Returns the number of elements currently in the queue.
+   *
+   * @return The number of elements currently in the queue.
+   */
+  size_t size() {
+    size_t write_idx = write_idx_.load(std::memory_order_acquire);
+    size_t read_idx = read_idx_.load(std::memory_order_acquire);
+    return distance(read_idx, write_idx);
+  }
+
+  /**
+   * @brief Resets the queue.
+   *
+   * This method clears the queue and resets the read and write indices. It is
+   * not thread-safe and should only be used for testing or benchmarking
+   * purposes.
+   */
+  void reset() {
+    write_idx_.store(0, std::memory_order_release);
+    read_idx_.store(0, std::memory_order_release);
+    cached_read_idx_ = 0;
+    cached_write_idx_ = 0;
+  }
+
+  /**
+   * @brief Fills the queue to capacity with uninitialized data.
+   *
+   * Unlike Queue::fill(), the write index stays a valid slot index, so the
+   * queue holds NbSlots - EnqueueBatchSize elements afterwards. It is not
+   * thread-safe and should only be used for testing or benchmarking purposes.
+   */
+  void fill() {
+    write_idx_.store(NbSlots - EnqueueBatchSize, std::memory_order_release);
+    read_idx_.store(0, std::memory_order_release);
+    cached_read_idx_ = 0;
+    cached_write_idx_ = NbSlots - EnqueueBatchSize;
+  }
+
+private:
+  /// Wraps an index in [0, 2 * NbSlots) back into [0, NbSlots).
+  static constexpr size_t wrap(size_t idx) {
+    if constexpr (kIsPowerOfTwo)
+      return idx & (NbSlots - 1);
+    else
+      return idx >= NbSlots ? idx - NbSlots : idx;
+  }
+
+  /// Number of elements between from and to, going forward in the ring.
+  static constexpr size_t distance(size_t from, size_t to) {
+    if constexpr (kIsPowerOfTwo)
+      return (to - from) & (NbSlots - 1);
+    else
+      return to >= from ? to - from : to + NbSlots - from;
+  }
+
+  /// A pre-allocated memory block for storing elements.
+  T *buffer_;
+
+  /// The current write index.
+  alignas(CACHE_LINE_SIZE) std::atomic<size_t> write_idx_{0};
+
+  /// The current read index.
+  alignas(CACHE_LINE_SIZE) std::atomic<size_t> read_idx_{0};
+
+  /// The producer's last observed value of read_idx_.
+  alignas(CACHE_LINE_SIZE) size_t cached_read_idx_{0};
+
+  /// The consumer's last observed value of write_idx_.
+  alignas(CACHE_LINE_SIZE) size_t cached_write_idx_{0};
+};
+} // namespace batched_spsc_queue
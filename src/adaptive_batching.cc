@@ -0,0 +1,75 @@
+#include "adaptive_batching.hh"
+#include <atomic>
+#include <bit>
+#include <stdexcept>
+
+namespace batched_spsc_queue {
+AdaptiveBatchSize::AdaptiveBatchSize(size_t nb_slots, bool mirrored,
+                                     const AdaptiveBatchOptions &options)
+    : nb_slots_(nb_slots), mirrored_(mirrored),
+      min_batch_size_(options.min_batch_size),
+      max_batch_size_(options.max_batch_size),
+      sample_interval_(options.sample_interval), size_(options.min_batch_size),
+      calls_(0), scaled_occupancy_(0), exported_size_(options.min_batch_size),
+      resizes_(0) {
+  if (!std::has_single_bit(min_batch_size_) ||
+      !std::has_single_bit(max_batch_size_))
+    throw std::invalid_argument("Batch size bounds must be powers of two");
+  if (min_batch_size_ > max_batch_size_ || max_batch_size_ >= nb_slots)
+    throw std::invalid_argument(
+        "Batch size bounds must be ordered and below nb_slots");
+  if (!mirrored && nb_slots % max_batch_size_ != 0)
+    throw std::invalid_argument(
+        "nb_slots must be a multiple of max_batch_size");
+  if (sample_interval_ == 0)
+    throw std::invalid_argument("sample_interval must be positive");
+}
+
+void AdaptiveBatchSize::update(size_t occupancy, bool producer) {
+  scaled_occupancy_ += occupancy - (scaled_occupancy_ >> kSmoothingShift);
+  size_t average = scaled_occupancy_ >> kSmoothingShift;
+  // One slot is always kept empty.
+  size_t ready = average;
+  if (producer)
+    ready = average < nb_slots_ ? nb_slots_ - 1 - average : 0;
+
+  size_t size = size_;
+  if (ready < size && size > min_batch_size_)
+    size /= 2;
+  else if (average >= 4 * size && ready >= 2 * size && size < max_batch_size_)
+    size *= 2;
+  else
+    return;
+
+  size_ = size;
+  exported_size_.store(size, std::memory_order_relaxed);
+  resizes_.store(resizes_.load(std::memory_order_relaxed) + 1,
+                 std::memory_order_relaxed);
+}
+
+AdaptiveReader::AdaptiveReader(Queue &queue,
+                               const AdaptiveBatchOptions &options)
+    : AdaptiveBatchSize(queue.nb_slots(), queue.mirrored_, options),
+      queue_(queue) {}
+
+uint8_t *AdaptiveReader::read_ptr(size_t &count) {
+  if (sample_due())
+    update(queue_.reader_size(), false);
+
+  count = batch_at(queue_.read_idx_.load(std::memory_order_relaxed));
+  return queue_.read_ptr(count);
+}
+
+AdaptiveWriter::AdaptiveWriter(Queue &queue,
+                               const AdaptiveBatchOptions &options)
+    : AdaptiveBatchSize(queue.nb_slots(), queue.mirrored_, options),
+      queue_(queue) {}
+
+uint8_t *AdaptiveWriter::write_ptr(size_t &count) {
+  if (sample_due())
+    update(queue_.writer_size(), true);
+
+  count = batch_at(queue_.write_idx_.load(std::memory_order_relaxed));
+  return queue_.write_ptr(count);
+}
+} // namespace batched_spsc_queue
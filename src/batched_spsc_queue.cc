@@ -1,49 +1,420 @@
 #include "batched_spsc_queue.hh"
+#include "coroutine.hh"
+#include "mirrored_buffer.hh"
+#include "queue_events.hh"
+#include "queue_set.hh"
+#include "transform.hh"
+#include <algorithm>
 #include <atomic>
+#include <chrono>
 #include <cstdint>
+#include <stdexcept>
+#include <thread>
 
 namespace batched_spsc_queue {
+namespace {
+/// Upper bound of the sleep used by timed WaitPolicy::Park waits.
+constexpr std::chrono::microseconds kMaxBackoff{100};
+
+template <typename TryFn, typename ParkFn>
+uint8_t *wait_for_ptr(WaitPolicy policy, size_t spin_count, bool can_park,
+                      TryFn try_ptr, ParkFn park) {
+  for (size_t attempt = 0;; attempt++) {
+    uint8_t *ptr = try_ptr();
+    if (ptr != nullptr)
+      return ptr;
+
+    if (policy == WaitPolicy::Spin || attempt < spin_count)
+      continue;
+
+    if (policy == WaitPolicy::Park && can_park)
+      park();
+    else
+      std::this_thread::yield();
+  }
+}
+
+template <typename TryFn>
+uint8_t *wait_for_ptr(WaitPolicy policy, size_t spin_count,
+                      std::chrono::nanoseconds timeout, TryFn try_ptr) {
+  auto deadline = std::chrono::steady_clock::now() + timeout;
+  std::chrono::nanoseconds backoff = std::chrono::microseconds(1);
+
+  for (size_t attempt = 0;; attempt++) {
+    uint8_t *ptr = try_ptr();
+    if (ptr != nullptr)
+      return ptr;
+
+    auto now = std::chrono::steady_clock::now();
+    if (now >= deadline)
+      return nullptr;
+
+    if (policy == WaitPolicy::Spin || attempt < spin_count)
+      continue;
+
+    if (policy == WaitPolicy::SpinThenYield) {
+      std::this_thread::yield();
+    } else {
+      std::this_thread::sleep_for(
+          std::min<std::chrono::nanoseconds>(backoff, deadline - now));
+      backoff = std::min<std::chrono::nanoseconds>(backoff * 2, kMaxBackoff);
+    }
+  }
+}
+
+#ifdef BATCHED_SPSC_QUEUE_STATS
+int64_t now_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+/// Adds to a counter only written by the calling thread, without a
+/// read-modify-write instruction.
+template <typename T> void bump(std::atomic<T> &counter, T value) {
+  counter.store(counter.load(std::memory_order_relaxed) + value,
+                std::memory_order_relaxed);
+}
+
+template <typename Counters> void record_ptr(Counters &counters, bool success) {
+  if (!success) {
+    bump<uint64_t>(counters.rejections, 1);
+    if (counters.stall_start_ns == 0)
+      counters.stall_start_ns = now_ns();
+  } else if (counters.stall_start_ns != 0) {
+    bump<int64_t>(counters.stalled_ns, now_ns() - counters.stall_start_ns);
+    counters.stall_start_ns = 0;
+  }
+}
+
+template <typename Counters>
+void record_commit(Counters &counters, size_t n, size_t occupancy) {
+  bump<uint64_t>(counters.batches, 1);
+  bump<uint64_t>(counters.elements, n);
+  size_t bucket = std::min<size_t>((occupancy * counters.bucket_scale) >> 32,
+                                   QueueStats::kOccupancyBuckets - 1);
+  bump<uint64_t>(counters.occupancy[bucket], 1);
+}
+
+template <typename Counters>
+QueueStats::Side snapshot(const Counters &counters) {
+  QueueStats::Side side;
+  side.rejections = counters.rejections.load(std::memory_order_relaxed);
+  side.batches = counters.batches.load(std::memory_order_relaxed);
+  side.elements = counters.elements.load(std::memory_order_relaxed);
+  side.stalled = std::chrono::nanoseconds(
+      counters.stalled_ns.load(std::memory_order_relaxed));
+  for (size_t i = 0; i < QueueStats::kOccupancyBuckets; i++)
+    side.occupancy[i] = counters.occupancy[i].load(std::memory_order_relaxed);
+  return side;
+}
+#endif
+} // namespace
+
 Queue::Queue(size_t nb_slots, size_t enqueue_batch_size,
-             size_t dequeue_batch_size, size_t element_size, uint8_t *buffer)
+             size_t dequeue_batch_size, size_t element_size, uint8_t *buffer,
+             bool enable_parking)
     : nb_slots_(nb_slots), enqueue_batch_size_(enqueue_batch_size),
       dequeue_batch_size_(dequeue_batch_size), element_size_(element_size),
-      buffer_(buffer) {}
+      buffer_(buffer), parking_enabled_(enable_parking), mirrored_(false),
+      set_(nullptr), set_index_(0), events_(nullptr), write_idx_(0),
+      read_idx_(0), cached_read_idx_(0), cached_write_idx_(0),
+      partial_since_ns_(0), flush_remaining_(0), flush_requested_(false),
+      writer_parked_(false), writer_waiter_(nullptr), reader_parked_(false),
+      reader_waiter_(nullptr) {
+#ifdef BATCHED_SPSC_QUEUE_STATS
+  uint64_t bucket_scale = (uint64_t{QueueStats::kOccupancyBuckets} << 32) /
+                          (nb_slots > 0 ? nb_slots : 1);
+  producer_stats_.bucket_scale = bucket_scale;
+  consumer_stats_.bucket_scale = bucket_scale;
+#endif
+}
+
+Queue::Queue(size_t nb_slots, size_t enqueue_batch_size,
+             size_t dequeue_batch_size, size_t element_size,
+             const BufferOptions &options, bool enable_parking)
+    : Queue(nb_slots, enqueue_batch_size, dequeue_batch_size, element_size,
+            nullptr, enable_parking) {
+  owned_buffer_ = Buffer(nb_slots * element_size, options);
+  buffer_ = owned_buffer_.data();
+}
+
+Queue::Queue(size_t nb_slots, size_t enqueue_batch_size,
+             size_t dequeue_batch_size, size_t element_size,
+             MirroredBuffer &buffer, bool enable_parking)
+    : Queue(nb_slots, enqueue_batch_size, dequeue_batch_size, element_size,
+            buffer.data(), enable_parking) {
+  mirrored_ = true;
+}
 
 uint8_t *Queue::write_ptr() {
-  if (nb_slots_ - writer_size() < enqueue_batch_size_ + 1) {
+  size_t write_idx = write_idx_.load(std::memory_order_relaxed);
+  if (!writer_has_room(write_idx, enqueue_batch_size_)) {
+    record_write_ptr(false);
     return nullptr;
   }
+  record_write_ptr(true);
 
+  uint8_t *dst = buffer_ + write_idx * element_size_;
+  return dst;
+}
+
+void Queue::commit_write() { commit_write(enqueue_batch_size_); }
+
+uint8_t *Queue::write_ptr(size_t n) {
   size_t write_idx = write_idx_.load(std::memory_order_relaxed);
+  if ((!mirrored_ && write_idx + n > nb_slots_) ||
+      !writer_has_room(write_idx, n)) {
+    record_write_ptr(false);
+    return nullptr;
+  }
+  record_write_ptr(true);
+
   uint8_t *dst = buffer_ + write_idx * element_size_;
   return dst;
 }
 
-void Queue::commit_write() {
+void Queue::commit_write(size_t n) {
   size_t write_idx = write_idx_.load(std::memory_order_relaxed);
-  size_t next_write_idx = write_idx + enqueue_batch_size_;
-  if (next_write_idx == nb_slots_)
-    next_write_idx = 0;
+  size_t next_write_idx = write_idx + n;
+  if (next_write_idx >= nb_slots_)
+    next_write_idx -= nb_slots_;
+  record_commit_write(n, next_write_idx);
+
+  if (!parking_enabled_ && set_ == nullptr && events_ == nullptr) {
+    write_idx_.store(next_write_idx, std::memory_order_release);
+    return;
+  }
 
-  write_idx_.store(next_write_idx, std::memory_order_release);
+  // The seq_cst store/load pairs match the ones in park_reader(),
+  // suspend_reader(), QueueEvents::arm_read() and QueueSet::read_ptr(): either
+  // the consumer sees the new index, or this side sees that it is parked,
+  // suspended or waiting on its eventfd, or that the queue is not marked
+  // ready.
+  write_idx_.store(next_write_idx, std::memory_order_seq_cst);
+  if (set_ != nullptr)
+    set_->mark_ready(set_index_);
+  if (events_ != nullptr)
+    QueueEvents::signal(events_->data_);
+  if (!parking_enabled_)
+    return;
+  if (reader_parked_.load(std::memory_order_seq_cst))
+    write_idx_.notify_one();
+  wake(reader_waiter_);
 }
 
 uint8_t *Queue::read_ptr() {
-  if (reader_size() < dequeue_batch_size_)
+  size_t read_idx = read_idx_.load(std::memory_order_relaxed);
+  if (!reader_has_data(read_idx, dequeue_batch_size_)) {
+    record_read_ptr(false);
     return nullptr;
+  }
+  record_read_ptr(true);
+
+  uint8_t *src = buffer_ + read_idx * element_size_;
+  return src;
+}
+
+void Queue::commit_read() { commit_read(dequeue_batch_size_); }
 
+uint8_t *Queue::read_ptr(size_t n) {
   size_t read_idx = read_idx_.load(std::memory_order_relaxed);
+  if ((!mirrored_ && read_idx + n > nb_slots_) ||
+      !reader_has_data(read_idx, n)) {
+    record_read_ptr(false);
+    return nullptr;
+  }
+  record_read_ptr(true);
+
   uint8_t *src = buffer_ + read_idx * element_size_;
   return src;
 }
 
-void Queue::commit_read() {
+void Queue::commit_read(size_t n) {
+  size_t read_idx = read_idx_.load(std::memory_order_relaxed);
+  size_t next_read_idx = read_idx + n;
+  if (next_read_idx >= nb_slots_)
+    next_read_idx -= nb_slots_;
+  record_commit_read(n, next_read_idx);
+  // The partial_read_ptr() state follows the elements actually read. It is
+  // all zeros unless partial reads are pending, keeping full batches cheap.
+  if (partial_since_ns_ != 0 || flush_remaining_ != 0) {
+    partial_since_ns_ = 0;
+    flush_remaining_ -= std::min(flush_remaining_, n);
+  }
+
+  if (!parking_enabled_ && events_ == nullptr) {
+    read_idx_.store(next_read_idx, std::memory_order_release);
+    return;
+  }
+
+  // The seq_cst store/load pairs match the ones in park_writer(),
+  // suspend_writer() and QueueEvents::arm_write(): either the producer sees
+  // the new index, or this side sees that it is parked, suspended or waiting
+  // on its eventfd.
+  read_idx_.store(next_read_idx, std::memory_order_seq_cst);
+  if (events_ != nullptr)
+    QueueEvents::signal(events_->space_);
+  if (!parking_enabled_)
+    return;
+  if (writer_parked_.load(std::memory_order_seq_cst))
+    read_idx_.notify_one();
+  wake(writer_waiter_);
+}
+
+uint8_t *Queue::partial_read_ptr(size_t &count,
+                                 std::chrono::nanoseconds max_delay) {
+  // The rest of the current batch, so that reads end on batch boundaries,
+  // which also makes it contiguous. It is derived from the committed read
+  // index only, so that polling again before commit_read() returns the same
+  // elements.
+  size_t read_idx = read_idx_.load(std::memory_order_relaxed);
+  size_t batch_rest = dequeue_batch_size_ - read_idx % dequeue_batch_size_;
+  if (reader_has_data(read_idx, batch_rest)) {
+    record_read_ptr(true);
+    count = batch_rest;
+    return buffer_ + read_idx * element_size_;
+  }
+
+  // reader_has_data() just refreshed cached_write_idx_. The flushed elements
+  // were committed before the flag was set, so they are counted by the reload
+  // that follows clearing it.
+  if (flush_requested_.load(std::memory_order_relaxed) &&
+      flush_requested_.exchange(false, std::memory_order_acquire))
+    flush_remaining_ = reader_size();
+
+  size_t available = cached_write_idx_ - read_idx;
+  if (cached_write_idx_ < read_idx)
+    available += nb_slots_;
+  if (available == 0) {
+    record_read_ptr(false);
+    return nullptr;
+  }
+
+  if (flush_remaining_ == 0) {
+    int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                      std::chrono::steady_clock::now().time_since_epoch())
+                      .count();
+    if (partial_since_ns_ == 0)
+      partial_since_ns_ = now;
+    if (now - partial_since_ns_ < max_delay.count()) {
+      record_read_ptr(false);
+      return nullptr;
+    }
+  }
+
+  record_read_ptr(true);
+  count = std::min(available, batch_rest);
+  return buffer_ + read_idx * element_size_;
+}
+
+void Queue::flush() {
+  if (!flush_requested_.load(std::memory_order_relaxed))
+    flush_requested_.store(true, std::memory_order_release);
+}
+
+size_t Queue::available_contiguous_write() {
+  size_t write_idx = write_idx_.load(std::memory_order_relaxed);
+  size_t free_slots = nb_slots_ - writer_size();
+  size_t before_end = mirrored_ ? nb_slots_ : nb_slots_ - write_idx;
+  // fill() leaves no free slot at all.
+  if (free_slots == 0)
+    return 0;
+
+  return std::min(free_slots - 1, before_end);
+}
+
+size_t Queue::available_contiguous_read() {
   size_t read_idx = read_idx_.load(std::memory_order_relaxed);
-  size_t next_read_idx = read_idx + dequeue_batch_size_;
-  if (next_read_idx == nb_slots_)
-    next_read_idx = 0;
+  size_t before_end = mirrored_ ? nb_slots_ : nb_slots_ - read_idx;
+  return std::min(reader_size(), before_end);
+}
+
+bool Queue::enqueue_copy(const uint8_t *src) {
+  uint8_t *batch_begin = write_ptr();
+  if (batch_begin == nullptr)
+    return false;
+
+  copy_batch(batch_begin, src, enqueue_batch_size_ * element_size_);
+  commit_write();
+  return true;
+}
+
+bool Queue::dequeue_copy(uint8_t *dst) {
+  const uint8_t *batch_begin = read_ptr();
+  if (batch_begin == nullptr)
+    return false;
+
+  copy_batch(dst, batch_begin, dequeue_batch_size_ * element_size_);
+  commit_read();
+  return true;
+}
+
+bool Queue::enqueue_transform(const uint8_t *src, const Transform &transform) {
+  size_t batch_bytes = enqueue_batch_size_ * element_size_;
+  if (batch_bytes % transform.out_bytes != 0)
+    throw std::invalid_argument(
+        "The batch is not a multiple of the transform output");
+
+  uint8_t *batch_begin = write_ptr();
+  if (batch_begin == nullptr)
+    return false;
+
+  transform.kernel(batch_begin, src,
+                   batch_bytes / transform.out_bytes * transform.in_bytes);
+  commit_write();
+  return true;
+}
+
+bool Queue::dequeue_transform(uint8_t *dst, const Transform &transform) {
+  size_t batch_bytes = dequeue_batch_size_ * element_size_;
+  if (batch_bytes % transform.in_bytes != 0)
+    throw std::invalid_argument(
+        "The batch is not a multiple of the transform input");
+
+  const uint8_t *batch_begin = read_ptr();
+  if (batch_begin == nullptr)
+    return false;
+
+  transform.kernel(dst, batch_begin, batch_bytes);
+  commit_read();
+  return true;
+}
+
+uint8_t *Queue::wait_write_ptr(WaitPolicy policy) {
+  return wait_for_ptr(
+      policy, kSpinCount, parking_enabled_, [this]() { return write_ptr(); },
+      [this]() { park_writer(); });
+}
+
+uint8_t *Queue::wait_write_ptr(WaitPolicy policy,
+                               std::chrono::nanoseconds timeout) {
+  return wait_for_ptr(policy, kSpinCount, timeout,
+                      [this]() { return write_ptr(); });
+}
+
+uint8_t *Queue::wait_read_ptr(WaitPolicy policy) {
+  return wait_for_ptr(
+      policy, kSpinCount, parking_enabled_, [this]() { return read_ptr(); },
+      [this]() { park_reader(); });
+}
+
+uint8_t *Queue::wait_read_ptr(WaitPolicy policy,
+                              std::chrono::nanoseconds timeout) {
+  return wait_for_ptr(policy, kSpinCount, timeout,
+                      [this]() { return read_ptr(); });
+}
+
+BatchAwaiter Queue::next_write_batch() {
+  if (!parking_enabled_)
+    throw std::logic_error("next_write_batch() requires enable_parking");
+  return BatchAwaiter(*this, true);
+}
 
-  read_idx_.store(next_read_idx, std::memory_order_release);
+BatchAwaiter Queue::next_read_batch() {
+  if (!parking_enabled_)
+    throw std::logic_error("next_read_batch() requires enable_parking");
+  return BatchAwaiter(*this, false);
 }
 
 [[maybe_unused]] size_t Queue::size() {
@@ -61,16 +432,69 @@ void Queue::commit_read() {
 void Queue::reset() {
   write_idx_.store(0, std::memory_order_release);
   read_idx_.store(0, std::memory_order_release);
+  cached_read_idx_ = 0;
+  cached_write_idx_ = 0;
+  partial_since_ns_ = 0;
+  flush_remaining_ = 0;
 }
 
 void Queue::fill() {
   write_idx_.store(nb_slots_, std::memory_order_release);
   read_idx_.store(0, std::memory_order_release);
+  cached_read_idx_ = 0;
+  cached_write_idx_ = nb_slots_;
+}
+
+QueueStats Queue::stats() const {
+  QueueStats stats;
+#ifdef BATCHED_SPSC_QUEUE_STATS
+  stats.producer = snapshot(producer_stats_);
+  stats.consumer = snapshot(consumer_stats_);
+#endif
+  return stats;
+}
+
+void Queue::record_write_ptr([[maybe_unused]] bool success) {
+#ifdef BATCHED_SPSC_QUEUE_STATS
+  record_ptr(producer_stats_, success);
+#endif
+}
+
+void Queue::record_commit_write([[maybe_unused]] size_t n,
+                                [[maybe_unused]] size_t next_write_idx) {
+#ifdef BATCHED_SPSC_QUEUE_STATS
+  // cached_read_idx_ is only refreshed when the queue looks full, so the
+  // consumer's index is loaded instead, in the stats build only.
+  size_t read_idx = read_idx_.load(std::memory_order_relaxed);
+  size_t occupancy = next_write_idx - read_idx;
+  if (next_write_idx < read_idx)
+    occupancy += nb_slots_;
+  record_commit(producer_stats_, n, occupancy);
+#endif
+}
+
+void Queue::record_read_ptr([[maybe_unused]] bool success) {
+#ifdef BATCHED_SPSC_QUEUE_STATS
+  record_ptr(consumer_stats_, success);
+#endif
+}
+
+void Queue::record_commit_read([[maybe_unused]] size_t n,
+                               [[maybe_unused]] size_t next_read_idx) {
+#ifdef BATCHED_SPSC_QUEUE_STATS
+  // Same as record_commit_write(), with the producer's index.
+  size_t write_idx = write_idx_.load(std::memory_order_relaxed);
+  size_t occupancy = write_idx - next_read_idx;
+  if (write_idx < next_read_idx)
+    occupancy += nb_slots_;
+  record_commit(consumer_stats_, n, occupancy);
+#endif
 }
 
 size_t Queue::writer_size() {
   size_t write_idx = write_idx_.load(std::memory_order_relaxed);
   size_t read_idx = read_idx_.load(std::memory_order_acquire);
+  cached_read_idx_ = read_idx;
 
   size_t diff = write_idx - read_idx;
 
@@ -83,6 +507,7 @@ size_t Queue::writer_size() {
 size_t Queue::reader_size() {
   size_t write_idx = write_idx_.load(std::memory_order_acquire);
   size_t read_idx = read_idx_.load(std::memory_order_relaxed);
+  cached_write_idx_ = write_idx;
 
   size_t diff = write_idx - read_idx;
 
@@ -91,4 +516,86 @@ size_t Queue::reader_size() {
 
   return diff;
 }
+
+bool Queue::writer_has_room(size_t write_idx, size_t n) {
+  // Only reload read_idx_ when the cached value says the queue is full.
+  size_t cached_diff = write_idx - cached_read_idx_;
+  if (write_idx < cached_read_idx_)
+    cached_diff += nb_slots_;
+
+  return nb_slots_ - cached_diff >= n + 1 || nb_slots_ - writer_size() >= n + 1;
+}
+
+bool Queue::reader_has_data(size_t read_idx, size_t n) {
+  // Only reload write_idx_ when the cached value says the queue is empty.
+  size_t cached_diff = cached_write_idx_ - read_idx;
+  if (cached_write_idx_ < read_idx)
+    cached_diff += nb_slots_;
+
+  return cached_diff >= n || reader_size() >= n;
+}
+
+void Queue::park_writer() {
+  // write_ptr() just failed, so cached_read_idx_ is the freshly loaded value.
+  size_t read_idx = cached_read_idx_;
+  writer_parked_.store(true, std::memory_order_seq_cst);
+  if (read_idx_.load(std::memory_order_seq_cst) == read_idx)
+    read_idx_.wait(read_idx, std::memory_order_acquire);
+  writer_parked_.store(false, std::memory_order_relaxed);
+}
+
+void Queue::park_reader() {
+  // read_ptr() just failed, so cached_write_idx_ is the freshly loaded value.
+  size_t write_idx = cached_write_idx_;
+  reader_parked_.store(true, std::memory_order_seq_cst);
+  if (write_idx_.load(std::memory_order_seq_cst) == write_idx)
+    write_idx_.wait(write_idx, std::memory_order_acquire);
+  reader_parked_.store(false, std::memory_order_relaxed);
+}
+
+bool Queue::suspend_writer(BatchAwaiter &awaiter) {
+  for (;;) {
+    // write_ptr() just failed, so cached_read_idx_ is the freshly loaded
+    // value.
+    size_t read_idx = cached_read_idx_;
+    writer_waiter_.store(&awaiter, std::memory_order_seq_cst);
+    if (read_idx_.load(std::memory_order_seq_cst) == read_idx)
+      return true;
+
+    // The consumer committed meanwhile. Unless it already took the awaiter,
+    // and will wake it up, take it back and try again.
+    if (writer_waiter_.exchange(nullptr, std::memory_order_seq_cst) == nullptr)
+      return true;
+    awaiter.batch_ = write_ptr();
+    if (awaiter.batch_ != nullptr)
+      return false;
+  }
+}
+
+bool Queue::suspend_reader(BatchAwaiter &awaiter) {
+  for (;;) {
+    // read_ptr() just failed, so cached_write_idx_ is the freshly loaded
+    // value.
+    size_t write_idx = cached_write_idx_;
+    reader_waiter_.store(&awaiter, std::memory_order_seq_cst);
+    if (write_idx_.load(std::memory_order_seq_cst) == write_idx)
+      return true;
+
+    if (reader_waiter_.exchange(nullptr, std::memory_order_seq_cst) == nullptr)
+      return true;
+    awaiter.batch_ = read_ptr();
+    if (awaiter.batch_ != nullptr)
+      return false;
+  }
+}
+
+void Queue::wake(std::atomic<BatchAwaiter *> &waiter) {
+  // Only a plain load when no coroutine is suspended.
+  if (waiter.load(std::memory_order_seq_cst) == nullptr)
+    return;
+
+  BatchAwaiter *awaiter = waiter.exchange(nullptr, std::memory_order_acq_rel);
+  if (awaiter != nullptr)
+    awaiter->executor_->wake(awaiter);
+}
 } // namespace batched_spsc_queue
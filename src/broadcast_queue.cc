@@ -0,0 +1,197 @@
+#include "broadcast_queue.hh"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+
+namespace batched_spsc_queue {
+BroadcastQueue::BroadcastQueue(size_t nb_slots, size_t enqueue_batch_size,
+                               size_t dequeue_batch_size, size_t element_size,
+                               uint8_t *buffer, size_t max_consumers)
+    : nb_slots_(nb_slots), enqueue_batch_size_(enqueue_batch_size),
+      dequeue_batch_size_(dequeue_batch_size), element_size_(element_size),
+      buffer_(buffer), max_consumers_(max_consumers),
+      cursors_(std::make_unique<Cursor[]>(max_consumers)), write_pos_(0),
+      write_slot_(0), cached_min_read_(0) {
+  for (size_t i = 0; i < max_consumers_; ++i)
+    cursors_[i].position.store(kDetached, std::memory_order_relaxed);
+}
+
+uint8_t *BroadcastQueue::write_ptr() {
+  uint64_t write_pos = write_pos_.load(std::memory_order_relaxed);
+
+  // Only scan the cursors when the cached slowest one says the queue is full.
+  if (write_pos + enqueue_batch_size_ - cached_min_read_ > nb_slots_) {
+    cached_min_read_ = min_read_position(write_pos);
+    if (write_pos + enqueue_batch_size_ - cached_min_read_ > nb_slots_)
+      return nullptr;
+  }
+
+  // Taps validate a batch by checking that the write position did not move
+  // past it, so the slots must not be written before the previous commit is
+  // visible.
+  std::atomic_thread_fence(std::memory_order_release);
+  return buffer_ + write_slot_ * element_size_;
+}
+
+void BroadcastQueue::commit_write() {
+  uint64_t write_pos = write_pos_.load(std::memory_order_relaxed);
+  write_slot_ += enqueue_batch_size_;
+  if (write_slot_ == nb_slots_)
+    write_slot_ = 0;
+
+  write_pos_.store(write_pos + enqueue_batch_size_, std::memory_order_release);
+}
+
+uint64_t BroadcastQueue::min_read_position(uint64_t write_pos) {
+  // Pairs with the seq_cst operations in attach(): either the scan sees the
+  // new cursor, or the new consumer sees write_pos and starts after it.
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+
+  uint64_t min = write_pos;
+  for (size_t i = 0; i < max_consumers_; ++i) {
+    uint64_t position = cursors_[i].position.load(std::memory_order_acquire);
+    if (position < min)
+      min = position;
+  }
+  return min;
+}
+
+BroadcastQueue::Consumer BroadcastQueue::attach() {
+  for (size_t i = 0; i < max_consumers_; ++i) {
+    // Claim the cursor at a position the producer cannot have overwritten,
+    // then move it to the first batch boundary not yet written.
+    std::atomic<uint64_t> &cursor = cursors_[i].position;
+    uint64_t expected = kDetached;
+    if (!cursor.compare_exchange_strong(
+            expected, write_pos_.load(std::memory_order_seq_cst),
+            std::memory_order_seq_cst))
+      continue;
+
+    uint64_t write_pos = write_pos_.load(std::memory_order_seq_cst);
+    uint64_t position = (write_pos + dequeue_batch_size_ - 1) /
+                        dequeue_batch_size_ * dequeue_batch_size_;
+    cursor.store(position, std::memory_order_seq_cst);
+    return Consumer(this, &cursor, position);
+  }
+
+  throw std::runtime_error("BroadcastQueue has no free consumer slot.");
+}
+
+BroadcastQueue::Tap BroadcastQueue::tap() {
+  uint64_t write_pos = write_pos_.load(std::memory_order_acquire);
+  uint64_t position = (write_pos + dequeue_batch_size_ - 1) /
+                      dequeue_batch_size_ * dequeue_batch_size_;
+  return Tap(this, position);
+}
+
+BroadcastQueue::Consumer::Consumer(BroadcastQueue *queue,
+                                   std::atomic<uint64_t> *cursor,
+                                   uint64_t position)
+    : queue_(queue), cursor_(cursor), position_(position),
+      slot_(position % queue->nb_slots_), cached_write_pos_(position) {}
+
+BroadcastQueue::Consumer::~Consumer() { detach(); }
+
+BroadcastQueue::Consumer::Consumer(Consumer &&other) noexcept
+    : queue_(std::exchange(other.queue_, nullptr)), cursor_(other.cursor_),
+      position_(other.position_), slot_(other.slot_),
+      cached_write_pos_(other.cached_write_pos_) {}
+
+BroadcastQueue::Consumer &
+BroadcastQueue::Consumer::operator=(Consumer &&other) noexcept {
+  if (this != &other) {
+    detach();
+    queue_ = std::exchange(other.queue_, nullptr);
+    cursor_ = other.cursor_;
+    position_ = other.position_;
+    slot_ = other.slot_;
+    cached_write_pos_ = other.cached_write_pos_;
+  }
+  return *this;
+}
+
+uint8_t *BroadcastQueue::Consumer::read_ptr() {
+  size_t batch_size = queue_->dequeue_batch_size_;
+
+  // Only reload the write position when the cached value says the batch is
+  // not written yet.
+  if (cached_write_pos_ < position_ + batch_size) {
+    cached_write_pos_ = queue_->write_pos_.load(std::memory_order_acquire);
+    if (cached_write_pos_ < position_ + batch_size)
+      return nullptr;
+  }
+
+  return queue_->buffer_ + slot_ * queue_->element_size_;
+}
+
+void BroadcastQueue::Consumer::commit_read() {
+  position_ += queue_->dequeue_batch_size_;
+  slot_ += queue_->dequeue_batch_size_;
+  if (slot_ == queue_->nb_slots_)
+    slot_ = 0;
+
+  cursor_->store(position_, std::memory_order_release);
+}
+
+size_t BroadcastQueue::Consumer::size() {
+  uint64_t write_pos = queue_->write_pos_.load(std::memory_order_acquire);
+  return write_pos > position_ ? write_pos - position_ : 0;
+}
+
+void BroadcastQueue::Consumer::detach() {
+  if (queue_ == nullptr)
+    return;
+
+  cursor_->store(kDetached, std::memory_order_release);
+  queue_ = nullptr;
+}
+
+BroadcastQueue::Tap::Tap(BroadcastQueue *queue, uint64_t position)
+    : queue_(queue), position_(position), slot_(position % queue->nb_slots_),
+      lapped_(0) {}
+
+bool BroadcastQueue::Tap::overwritten(uint64_t write_pos) const {
+  // The producer may be writing the batch at write_pos, whose slots are those
+  // of the batch at write_pos - nb_slots.
+  return write_pos + queue_->enqueue_batch_size_ >
+         position_ + queue_->nb_slots_;
+}
+
+uint8_t *BroadcastQueue::Tap::read_ptr() {
+  size_t batch_size = queue_->dequeue_batch_size_;
+  uint64_t write_pos = queue_->write_pos_.load(std::memory_order_acquire);
+
+  // Lapped: skip ahead to the batch being written, the most recent one.
+  if (overwritten(write_pos)) {
+    uint64_t position = write_pos / batch_size * batch_size;
+    lapped_ += position - position_;
+    position_ = position;
+    slot_ = position_ % queue_->nb_slots_;
+  }
+
+  if (write_pos < position_ + batch_size)
+    return nullptr;
+
+  return queue_->buffer_ + slot_ * queue_->element_size_;
+}
+
+bool BroadcastQueue::Tap::commit_read() {
+  // Seqlock-style validation: the batch was read before the write position
+  // is reloaded.
+  std::atomic_thread_fence(std::memory_order_acquire);
+  uint64_t write_pos = queue_->write_pos_.load(std::memory_order_relaxed);
+  bool intact = !overwritten(write_pos);
+  if (!intact)
+    lapped_ += queue_->dequeue_batch_size_;
+
+  position_ += queue_->dequeue_batch_size_;
+  slot_ += queue_->dequeue_batch_size_;
+  if (slot_ == queue_->nb_slots_)
+    slot_ = 0;
+
+  return intact;
+}
+} // namespace batched_spsc_queue
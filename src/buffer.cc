@@ -0,0 +1,156 @@
+#include "buffer.hh"
+#include <array>
+#include <cerrno>
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <system_error>
+#include <unistd.h>
+#include <utility>
+
+namespace batched_spsc_queue {
+namespace {
+/// The size of a huge page on the platforms we care about.
+constexpr size_t kHugePageSize = 2 * 1024 * 1024;
+
+/// mbind() policy, from <numaif.h>, which is not always installed.
+constexpr int kMpolBind = 2;
+
+/// Number of NUMA nodes supported by the mbind() node mask.
+constexpr size_t kMaxNumaNodes = 1024;
+
+size_t round_up(size_t value, size_t alignment) {
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+size_t page_size() {
+  static const auto page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  return page_size;
+}
+
+int current_numa_node() {
+  unsigned cpu = 0;
+  unsigned node = 0;
+  if (syscall(SYS_getcpu, &cpu, &node, nullptr) == -1)
+    return BufferOptions::kAnyNode;
+  return static_cast<int>(node);
+}
+
+bool bind_to_numa_node(void *addr, size_t size, int node) {
+  if (node < 0 || static_cast<size_t>(node) >= kMaxNumaNodes)
+    return false;
+
+  constexpr size_t bits_per_word = sizeof(unsigned long) * CHAR_BIT;
+  std::array<unsigned long, kMaxNumaNodes / bits_per_word> mask{};
+  auto bit = static_cast<size_t>(node);
+  mask[bit / bits_per_word] = 1UL << (bit % bits_per_word);
+
+  // The kernel ignores the last bit of maxnode, hence the + 1.
+  return syscall(SYS_mbind, addr, size, kMpolBind, mask.data(),
+                 kMaxNumaNodes + 1, 0) == 0;
+}
+
+/// Maps size bytes aligned to alignment, trimming the excess of an oversized
+/// mapping. Returns MAP_FAILED on failure.
+void *map_aligned(size_t size, size_t alignment) {
+  size_t reserved_size = size + alignment;
+  void *reserved = mmap(nullptr, reserved_size, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (reserved == MAP_FAILED)
+    return MAP_FAILED;
+
+  auto begin = reinterpret_cast<uintptr_t>(reserved);
+  uintptr_t aligned = round_up(begin, alignment);
+  size_t head = aligned - begin;
+  size_t tail = reserved_size - head - size;
+  if (head > 0)
+    munmap(reserved, head);
+  if (tail > 0)
+    munmap(reinterpret_cast<void *>(aligned + size), tail);
+
+  return reinterpret_cast<void *>(aligned);
+}
+} // namespace
+
+Buffer::Buffer() noexcept
+    : data_(nullptr), size_(0), mapping_size_(0), huge_pages_(HugePages::None),
+      numa_node_(BufferOptions::kAnyNode) {}
+
+Buffer::Buffer(size_t size, const BufferOptions &options) : Buffer() {
+  if (size == 0)
+    throw std::invalid_argument("Buffer size must be non-zero.");
+
+  void *mapping = MAP_FAILED;
+  if (options.huge_pages == HugePages::Explicit) {
+    mapping_size_ = round_up(size, kHugePageSize);
+    mapping = mmap(nullptr, mapping_size_, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (mapping != MAP_FAILED)
+      huge_pages_ = HugePages::Explicit;
+  }
+
+  if (mapping == MAP_FAILED && options.huge_pages != HugePages::None) {
+    // Align to the huge page size so that the whole buffer is eligible for
+    // transparent huge pages. madvise() failing just means no THP.
+    mapping_size_ = round_up(size, kHugePageSize);
+    mapping = map_aligned(mapping_size_, kHugePageSize);
+    if (mapping != MAP_FAILED &&
+        madvise(mapping, mapping_size_, MADV_HUGEPAGE) == 0)
+      huge_pages_ = HugePages::Transparent;
+  }
+
+  if (mapping == MAP_FAILED) {
+    mapping_size_ = round_up(size, page_size());
+    mapping = mmap(nullptr, mapping_size_, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapping == MAP_FAILED)
+      throw std::system_error(errno, std::generic_category(), "mmap");
+  }
+
+  data_ = static_cast<uint8_t *>(mapping);
+  size_ = size;
+
+  // Bind before touching anything, so that prefaulted pages land on the node.
+  int node = options.numa_node == BufferOptions::kCallerNode
+                 ? current_numa_node()
+                 : options.numa_node;
+  if (bind_to_numa_node(data_, mapping_size_, node))
+    numa_node_ = node;
+
+  if (options.prefault) {
+    size_t stride =
+        huge_pages_ == HugePages::Explicit ? kHugePageSize : page_size();
+    for (size_t offset = 0; offset < mapping_size_; offset += stride)
+      static_cast<volatile uint8_t *>(data_)[offset] = 0;
+  }
+}
+
+Buffer::~Buffer() { release(); }
+
+Buffer::Buffer(Buffer &&other) noexcept
+    : data_(std::exchange(other.data_, nullptr)),
+      size_(std::exchange(other.size_, 0)),
+      mapping_size_(std::exchange(other.mapping_size_, 0)),
+      huge_pages_(other.huge_pages_), numa_node_(other.numa_node_) {}
+
+Buffer &Buffer::operator=(Buffer &&other) noexcept {
+  if (this != &other) {
+    release();
+    data_ = std::exchange(other.data_, nullptr);
+    size_ = std::exchange(other.size_, 0);
+    mapping_size_ = std::exchange(other.mapping_size_, 0);
+    huge_pages_ = other.huge_pages_;
+    numa_node_ = other.numa_node_;
+  }
+  return *this;
+}
+
+void Buffer::release() {
+  if (data_ != nullptr)
+    munmap(data_, mapping_size_);
+  data_ = nullptr;
+}
+} // namespace batched_spsc_queue
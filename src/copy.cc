@@ -0,0 +1,122 @@
+#include "copy.hh"
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define BATCHED_SPSC_QUEUE_X86
+#endif
+
+namespace batched_spsc_queue {
+namespace {
+#ifdef BATCHED_SPSC_QUEUE_X86
+/// Returns the number of bytes to copy with memcpy() before dst is aligned.
+size_t head_size(const uint8_t *dst, size_t alignment, size_t size) {
+  size_t misalignment = reinterpret_cast<uintptr_t>(dst) & (alignment - 1);
+  size_t head = misalignment == 0 ? 0 : alignment - misalignment;
+  return head < size ? head : size;
+}
+
+// Both kernels copy the unaligned head and the partial tail with memcpy(),
+// and the aligned middle with unaligned loads and aligned streaming stores,
+// four vectors per iteration.
+
+__attribute__((target("avx2"))) void copy_avx2(uint8_t *dst,
+                                               const uint8_t *src,
+                                               size_t size) {
+  size_t head = head_size(dst, 32, size);
+  std::memcpy(dst, src, head);
+  dst += head;
+  src += head;
+  size -= head;
+
+  for (; size >= 128; size -= 128, dst += 128, src += 128) {
+    const auto *in = reinterpret_cast<const __m256i *>(src);
+    auto *out = reinterpret_cast<__m256i *>(dst);
+    __m256i a = _mm256_loadu_si256(in);
+    __m256i b = _mm256_loadu_si256(in + 1);
+    __m256i c = _mm256_loadu_si256(in + 2);
+    __m256i d = _mm256_loadu_si256(in + 3);
+    _mm256_stream_si256(out, a);
+    _mm256_stream_si256(out + 1, b);
+    _mm256_stream_si256(out + 2, c);
+    _mm256_stream_si256(out + 3, d);
+  }
+
+  std::memcpy(dst, src, size);
+  _mm_sfence();
+}
+
+__attribute__((target("avx512f"))) void copy_avx512(uint8_t *dst,
+                                                    const uint8_t *src,
+                                                    size_t size) {
+  size_t head = head_size(dst, 64, size);
+  std::memcpy(dst, src, head);
+  dst += head;
+  src += head;
+  size -= head;
+
+  for (; size >= 256; size -= 256, dst += 256, src += 256) {
+    __m512i a = _mm512_loadu_si512(src);
+    __m512i b = _mm512_loadu_si512(src + 64);
+    __m512i c = _mm512_loadu_si512(src + 128);
+    __m512i d = _mm512_loadu_si512(src + 192);
+    _mm512_stream_si512(reinterpret_cast<__m512i *>(dst), a);
+    _mm512_stream_si512(reinterpret_cast<__m512i *>(dst + 64), b);
+    _mm512_stream_si512(reinterpret_cast<__m512i *>(dst + 128), c);
+    _mm512_stream_si512(reinterpret_cast<__m512i *>(dst + 192), d);
+  }
+
+  std::memcpy(dst, src, size);
+  _mm_sfence();
+}
+
+CopyKernel detect_copy_kernel() {
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f"))
+    return CopyKernel::AVX512;
+  if (__builtin_cpu_supports("avx2"))
+    return CopyKernel::AVX2;
+  return CopyKernel::Scalar;
+}
+#else
+CopyKernel detect_copy_kernel() { return CopyKernel::Scalar; }
+#endif
+} // namespace
+
+CopyKernel best_copy_kernel() {
+  static const CopyKernel kernel = detect_copy_kernel();
+  return kernel;
+}
+
+void copy_batch(uint8_t *dst, const uint8_t *src, size_t size) {
+  if (size < kNonTemporalThreshold) {
+    std::memcpy(dst, src, size);
+    return;
+  }
+
+  copy_batch(dst, src, size, best_copy_kernel());
+}
+
+void copy_batch(uint8_t *dst, const uint8_t *src, size_t size,
+                CopyKernel kernel) {
+  // Kernels above the best supported one would fault.
+  if (static_cast<int>(kernel) > static_cast<int>(best_copy_kernel()))
+    kernel = CopyKernel::Scalar;
+
+  switch (kernel) {
+#ifdef BATCHED_SPSC_QUEUE_X86
+  case CopyKernel::AVX512:
+    copy_avx512(dst, src, size);
+    return;
+  case CopyKernel::AVX2:
+    copy_avx2(dst, src, size);
+    return;
+#endif
+  default:
+    std::memcpy(dst, src, size);
+    return;
+  }
+}
+} // namespace batched_spsc_queue
@@ -0,0 +1,80 @@
+#include "coroutine.hh"
+#include <coroutine>
+#include <mutex>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+namespace batched_spsc_queue {
+namespace {
+thread_local Executor *current_executor = nullptr;
+} // namespace
+
+bool BatchAwaiter::await_suspend(std::coroutine_handle<> handle) {
+  executor_ = Executor::current();
+  if (executor_ == nullptr)
+    throw std::logic_error("BatchAwaiter awaited outside of an Executor");
+
+  handle_ = handle;
+  return suspend();
+}
+
+uint8_t *BatchAwaiter::try_acquire() {
+  return write_ ? queue_.write_ptr() : queue_.read_ptr();
+}
+
+bool BatchAwaiter::suspend() {
+  return write_ ? queue_.suspend_writer(*this) : queue_.suspend_reader(*this);
+}
+
+bool BatchAwaiter::retry() {
+  batch_ = try_acquire();
+  return batch_ != nullptr || !suspend();
+}
+
+void Executor::spawn(Task task) {
+  auto handle = std::exchange(task.handle_, nullptr);
+  handle.promise().executor = this;
+  live_++;
+  ready_.push_back(handle);
+}
+
+void Executor::run() {
+  Executor *previous = std::exchange(current_executor, this);
+  std::vector<BatchAwaiter *> woken;
+
+  while (live_ > 0) {
+    if (ready_.empty()) {
+      std::unique_lock lock(mutex_);
+      sleeping_ = woken_.empty();
+      cv_.wait(lock, [this]() { return !woken_.empty(); });
+      sleeping_ = false;
+      woken.swap(woken_);
+      lock.unlock();
+
+      // A wake-up only means that the other side committed something, which
+      // may not be enough for a whole batch.
+      for (BatchAwaiter *awaiter : woken)
+        if (awaiter->retry())
+          ready_.push_back(awaiter->handle_);
+      woken.clear();
+      continue;
+    }
+
+    auto handle = ready_.front();
+    ready_.pop_front();
+    handle.resume();
+  }
+
+  current_executor = previous;
+}
+
+Executor *Executor::current() { return current_executor; }
+
+void Executor::wake(BatchAwaiter *awaiter) {
+  std::lock_guard lock(mutex_);
+  woken_.push_back(awaiter);
+  if (sleeping_)
+    cv_.notify_one();
+}
+} // namespace batched_spsc_queue
@@ -0,0 +1,110 @@
+#include "dispatcher.hh"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+
+namespace batched_spsc_queue {
+namespace {
+/// The splitmix64 finalizer, so that consecutive keys spread over the queues.
+uint64_t mix(uint64_t key) {
+  key ^= key >> 30;
+  key *= 0xbf58476d1ce4e5b9;
+  key ^= key >> 27;
+  key *= 0x94d049bb133111eb;
+  key ^= key >> 31;
+  return key;
+}
+} // namespace
+
+Dispatcher::Dispatcher(size_t nb_queues, size_t nb_slots,
+                       size_t enqueue_batch_size, size_t dequeue_batch_size,
+                       size_t element_size, DispatchPolicy policy,
+                       bool sequence_numbers, const BufferOptions &options)
+    : estimates_(nb_queues, 0), nb_slots_(nb_slots),
+      enqueue_batch_size_(enqueue_batch_size), element_size_(element_size),
+      policy_(policy), target_(0), pending_(nullptr), next_(0),
+      next_sequence_(0) {
+  if (nb_queues == 0)
+    throw std::invalid_argument("Dispatcher needs at least one queue.");
+
+  for (size_t i = 0; i < nb_queues; ++i) {
+    queues_.push_back(std::make_unique<Queue>(nb_slots, enqueue_batch_size,
+                                              dequeue_batch_size, element_size,
+                                              options));
+    if (sequence_numbers)
+      sequences_.push_back(
+          std::make_unique<uint64_t[]>(nb_slots / enqueue_batch_size));
+  }
+}
+
+uint8_t *Dispatcher::write_ptr() {
+  pending_ = pick();
+  return pending_;
+}
+
+uint8_t *Dispatcher::write_ptr(uint64_t key) {
+  target_ = mix(key) % queues_.size();
+  pending_ = queues_[target_]->write_ptr();
+  return pending_;
+}
+
+void Dispatcher::commit_write() {
+  if (!sequences_.empty()) {
+    const uint8_t *base = queues_[target_]->owned_buffer().data();
+    auto slot = static_cast<size_t>(pending_ - base) / element_size_;
+    sequences_[target_][slot / enqueue_batch_size_] = next_sequence_++;
+  }
+
+  queues_[target_]->commit_write();
+  estimates_[target_] += enqueue_batch_size_;
+}
+
+uint64_t Dispatcher::sequence(size_t index, const uint8_t *batch) const {
+  const uint8_t *base = queues_[index]->owned_buffer().data();
+  auto slot = static_cast<size_t>(batch - base) / element_size_;
+  return sequences_[index][slot / enqueue_batch_size_];
+}
+
+uint8_t *Dispatcher::pick() {
+  size_t nb_queues = queues_.size();
+
+  if (policy_ != DispatchPolicy::LeastOccupied) {
+    for (size_t i = 0; i < nb_queues; ++i) {
+      size_t index = next_ + i < nb_queues ? next_ + i : next_ + i - nb_queues;
+      uint8_t *batch = queues_[index]->write_ptr();
+      if (batch != nullptr) {
+        target_ = index;
+        next_ = index + 1 == nb_queues ? 0 : index + 1;
+        return batch;
+      }
+    }
+    return nullptr;
+  }
+
+  // Refresh one estimate per batch, in turn. Between refreshes, estimates only
+  // grow with commits, so a queue that drains fast is picked a bit late, never
+  // too early.
+  estimates_[next_] = queues_[next_]->size();
+  next_ = next_ + 1 == nb_queues ? 0 : next_ + 1;
+
+  for (size_t attempt = 0; attempt < nb_queues; ++attempt) {
+    size_t index = 0;
+    for (size_t i = 1; i < nb_queues; ++i)
+      if (estimates_[i] < estimates_[index])
+        index = i;
+    if (estimates_[index] >= nb_slots_)
+      break;
+
+    uint8_t *batch = queues_[index]->write_ptr();
+    if (batch != nullptr) {
+      target_ = index;
+      return batch;
+    }
+
+    // Full: skip it until its estimate is refreshed.
+    estimates_[index] = nb_slots_;
+  }
+  return nullptr;
+}
+} // namespace batched_spsc_queue
@@ -0,0 +1,275 @@
+#include "file_io.hh"
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <fcntl.h>
+#include <linux/aio_abi.h>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <sys/syscall.h>
+#include <system_error>
+#include <unistd.h>
+
+namespace batched_spsc_queue {
+namespace {
+// glibc has no wrappers for the native AIO system calls.
+
+long aio_setup(unsigned nr_events, aio_context_t *context) {
+  return syscall(SYS_io_setup, nr_events, context);
+}
+
+long aio_destroy(aio_context_t context) {
+  return syscall(SYS_io_destroy, context);
+}
+
+long aio_submit(aio_context_t context, long nr, iocb **iocbs) {
+  return syscall(SYS_io_submit, context, nr, iocbs);
+}
+
+long aio_getevents(aio_context_t context, long min_nr, long nr,
+                   io_event *events, timespec *timeout) {
+  return syscall(SYS_io_getevents, context, min_nr, nr, events, timeout);
+}
+
+bool aligned(uint64_t value) { return value % kDirectIoAlignment == 0; }
+
+/// Writes size bytes at offset, retrying short writes.
+void write_fully(int fd, const uint8_t *data, size_t size, uint64_t offset) {
+  while (size > 0) {
+    ssize_t written = pwrite(fd, data, size, static_cast<off_t>(offset));
+    if (written < 0) {
+      if (errno == EINTR)
+        continue;
+      throw std::system_error(errno, std::generic_category(), "pwrite");
+    }
+
+    data += written;
+    size -= static_cast<size_t>(written);
+    offset += static_cast<uint64_t>(written);
+  }
+}
+} // namespace
+
+struct AsyncFile::Request {
+  iocb control_block;
+  bool done;
+  int64_t result;
+};
+
+AsyncFile::AsyncFile(const std::string &path, int flags, Queue &queue,
+                     size_t batch_size, const FileIoOptions &options)
+    : queue_(queue), batch_size_(batch_size),
+      batch_bytes_(batch_size * queue.element_size()),
+      queue_depth_(options.queue_depth), wait_policy_(options.wait_policy),
+      fd_(-1), direct_(options.direct && aligned(batch_bytes_)), context_(0),
+      head_(0), in_flight_(0), offset_(0) {
+  if (queue_depth_ == 0)
+    throw std::invalid_argument("File I/O queue depth must be at least 1.");
+
+  fd_ = open(path.c_str(), flags | (direct_ ? O_DIRECT : 0), 0644);
+  // Some file systems, like tmpfs, refuse O_DIRECT.
+  if (fd_ < 0 && direct_ && errno == EINVAL) {
+    direct_ = false;
+    fd_ = open(path.c_str(), flags, 0644);
+  }
+  if (fd_ < 0)
+    throw std::system_error(errno, std::generic_category(), "open");
+
+  aio_context_t context = 0;
+  if (aio_setup(static_cast<unsigned>(queue_depth_), &context) < 0) {
+    int err = errno;
+    close(fd_);
+    throw std::system_error(err, std::generic_category(), "io_setup");
+  }
+  context_ = context;
+  requests_ = std::make_unique<Request[]>(queue_depth_);
+}
+
+AsyncFile::~AsyncFile() {
+  // io_destroy() cancels or waits for the requests in flight.
+  aio_destroy(context_);
+  close(fd_);
+}
+
+void AsyncFile::submit(bool write, uint8_t *data, size_t size) {
+  if (direct_ && !aligned(reinterpret_cast<uintptr_t>(data)))
+    set_direct(false);
+
+  Request &request = requests_[(head_ + in_flight_) % queue_depth_];
+  request.control_block = {};
+  request.control_block.aio_data = reinterpret_cast<uintptr_t>(&request);
+  request.control_block.aio_lio_opcode =
+      write ? IOCB_CMD_PWRITE : IOCB_CMD_PREAD;
+  request.control_block.aio_fildes = static_cast<uint32_t>(fd_);
+  request.control_block.aio_buf = reinterpret_cast<uintptr_t>(data);
+  request.control_block.aio_nbytes = size;
+  request.control_block.aio_offset = static_cast<int64_t>(offset_);
+  request.done = false;
+
+  iocb *control_block = &request.control_block;
+  long submitted;
+  do {
+    submitted = aio_submit(context_, 1, &control_block);
+  } while (submitted < 0 && errno == EINTR);
+  if (submitted != 1)
+    throw std::system_error(submitted < 0 ? errno : EAGAIN,
+                            std::generic_category(), "io_submit");
+
+  offset_ += size;
+  ++in_flight_;
+}
+
+void AsyncFile::reap(bool wait) {
+  constexpr long kMaxEvents = 64;
+  io_event events[kMaxEvents];
+  timespec no_wait{};
+  bool block = wait && in_flight_ > 0;
+
+  long nb_events;
+  do {
+    nb_events = aio_getevents(context_, block ? 1 : 0, kMaxEvents, events,
+                              block ? nullptr : &no_wait);
+  } while (nb_events < 0 && errno == EINTR);
+  if (nb_events < 0)
+    throw std::system_error(errno, std::generic_category(), "io_getevents");
+
+  for (long i = 0; i < nb_events; ++i) {
+    auto *request = reinterpret_cast<Request *>(events[i].data);
+    request->done = true;
+    request->result = events[i].res;
+  }
+}
+
+bool AsyncFile::pop(int64_t &result) {
+  if (in_flight_ == 0 || !requests_[head_].done)
+    return false;
+
+  result = requests_[head_].result;
+  head_ = (head_ + 1) % queue_depth_;
+  --in_flight_;
+  return true;
+}
+
+void AsyncFile::set_direct(bool direct) {
+  int flags = fcntl(fd_, F_GETFL);
+  if (flags < 0 ||
+      fcntl(fd_, F_SETFL, direct ? flags | O_DIRECT : flags & ~O_DIRECT) < 0)
+    throw std::system_error(errno, std::generic_category(), "fcntl");
+  direct_ = direct;
+}
+
+FileSource::FileSource(const std::string &path, Queue &queue,
+                       const FileIoOptions &options)
+    : AsyncFile(path, O_RDONLY, queue, queue.enqueue_batch_size(), options),
+      eof_(false), bytes_(0) {}
+
+size_t FileSource::poll() { return step(false); }
+
+uint64_t FileSource::run() {
+  while (!eof_ || in_flight_ > 0) {
+    step(true);
+
+    // Nothing in flight before the end of the file: the queue is full.
+    if (!eof_ && in_flight_ == 0)
+      queue_.wait_write_ptr(wait_policy_);
+  }
+  return bytes_;
+}
+
+size_t FileSource::step(bool wait) {
+  // The batches in flight are claimed but not committed, so the next one is
+  // claimed by asking for all of them.
+  while (!eof_ && in_flight_ < queue_depth_) {
+    uint8_t *batch_begin = queue_.write_ptr((in_flight_ + 1) * batch_size_);
+    if (batch_begin == nullptr)
+      break;
+
+    submit(false, batch_begin + in_flight_ * batch_bytes_, batch_bytes_);
+  }
+
+  reap(wait);
+
+  size_t committed = 0;
+  int64_t result;
+  while (pop(result)) {
+    if (result < 0)
+      throw std::system_error(static_cast<int>(-result),
+                              std::generic_category(), "pread");
+
+    // Reads submitted past the end of the file.
+    if (eof_)
+      continue;
+
+    size_t nb_elements = static_cast<size_t>(result) / queue_.element_size();
+    if (nb_elements > 0) {
+      queue_.commit_write(nb_elements);
+      bytes_ += nb_elements * queue_.element_size();
+      ++committed;
+    }
+
+    if (static_cast<size_t>(result) < batch_bytes_)
+      eof_ = true;
+  }
+  return committed;
+}
+
+FileSink::FileSink(const std::string &path, Queue &queue,
+                   const FileIoOptions &options)
+    : AsyncFile(path, O_WRONLY | O_CREAT | O_TRUNC, queue,
+                queue.dequeue_batch_size(), options),
+      bytes_(0) {}
+
+size_t FileSink::poll() {
+  // Same as FileSource::step(): the batches in flight are not released yet.
+  while (in_flight_ < queue_depth_) {
+    uint8_t *batch_begin = queue_.read_ptr((in_flight_ + 1) * batch_size_);
+    if (batch_begin == nullptr)
+      break;
+
+    submit(true, batch_begin + in_flight_ * batch_bytes_, batch_bytes_);
+  }
+
+  reap(false);
+  return release();
+}
+
+void FileSink::flush() {
+  while (in_flight_ > 0) {
+    reap(true);
+    release();
+  }
+
+  // The rest is written synchronously, as it may not be a whole batch.
+  while (size_t nb_elements = queue_.available_contiguous_read()) {
+    size_t size = nb_elements * queue_.element_size();
+    uint8_t *data = queue_.read_ptr(nb_elements);
+    bool direct = aligned(size) && aligned(reinterpret_cast<uintptr_t>(data));
+    if (direct_ && !direct)
+      set_direct(false);
+
+    write_fully(fd_, data, size, offset_);
+    offset_ += size;
+    bytes_ += size;
+    queue_.commit_read(nb_elements);
+  }
+}
+
+size_t FileSink::release() {
+  size_t released = 0;
+  int64_t result;
+  while (pop(result)) {
+    if (result < 0)
+      throw std::system_error(static_cast<int>(-result),
+                              std::generic_category(), "pwrite");
+    if (static_cast<size_t>(result) != batch_bytes_)
+      throw std::system_error(EIO, std::generic_category(), "short pwrite");
+
+    queue_.commit_read(batch_size_);
+    bytes_ += batch_bytes_;
+    ++released;
+  }
+  return released;
+}
+} // namespace batched_spsc_queue
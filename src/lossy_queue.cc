@@ -0,0 +1,127 @@
+#include "lossy_queue.hh"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace batched_spsc_queue {
+LossyQueue::LossyQueue(size_t nb_slots, size_t enqueue_batch_size,
+                       size_t dequeue_batch_size, size_t element_size,
+                       uint8_t *buffer, FullPolicy policy)
+    : nb_slots_(nb_slots), enqueue_batch_size_(enqueue_batch_size),
+      dequeue_batch_size_(dequeue_batch_size), element_size_(element_size),
+      buffer_(buffer), policy_(policy), write_pos_(0), read_pos_(0),
+      write_slot_(0), cached_read_pos_(0), dropping_(false),
+      scratch_(policy == FullPolicy::DropNewest
+                   ? std::make_unique<uint8_t[]>(enqueue_batch_size *
+                                                 element_size)
+                   : nullptr),
+      dropped_(0), position_(0), read_slot_(0), cached_write_pos_(0),
+      overwritten_(0) {}
+
+uint8_t *LossyQueue::write_ptr() {
+  if (policy_ == FullPolicy::OverwriteOldest) {
+    // The consumer validates a batch by checking that the write position did
+    // not move past it, so the slots must not be written before the previous
+    // commit is visible.
+    std::atomic_thread_fence(std::memory_order_release);
+    return buffer_ + write_slot_ * element_size_;
+  }
+
+  // Only reload the read position when the cached value says the queue is
+  // full.
+  uint64_t write_pos = write_pos_.load(std::memory_order_relaxed);
+  if (write_pos + enqueue_batch_size_ - cached_read_pos_ > nb_slots_) {
+    cached_read_pos_ = read_pos_.load(std::memory_order_acquire);
+    if (write_pos + enqueue_batch_size_ - cached_read_pos_ > nb_slots_) {
+      if (policy_ == FullPolicy::Reject)
+        return nullptr;
+
+      dropping_ = true;
+      return scratch_.get();
+    }
+  }
+
+  return buffer_ + write_slot_ * element_size_;
+}
+
+void LossyQueue::commit_write() {
+  if (dropping_) {
+    dropping_ = false;
+    dropped_.store(dropped_.load(std::memory_order_relaxed) +
+                       enqueue_batch_size_,
+                   std::memory_order_relaxed);
+    return;
+  }
+
+  uint64_t write_pos = write_pos_.load(std::memory_order_relaxed);
+  write_slot_ += enqueue_batch_size_;
+  if (write_slot_ == nb_slots_)
+    write_slot_ = 0;
+
+  write_pos_.store(write_pos + enqueue_batch_size_, std::memory_order_release);
+}
+
+bool LossyQueue::overwritten(uint64_t position, uint64_t write_pos) const {
+  // The producer may be writing the batch at write_pos, whose slots are those
+  // of the batch at write_pos - nb_slots.
+  return write_pos + enqueue_batch_size_ > position + nb_slots_;
+}
+
+uint8_t *LossyQueue::read_ptr() {
+  // Only reload the write position when the cached value says the queue is
+  // empty. Overwrites are detected from the latest one, so it is always
+  // reloaded with OverwriteOldest.
+  if (policy_ != FullPolicy::OverwriteOldest) {
+    if (cached_write_pos_ < position_ + dequeue_batch_size_) {
+      cached_write_pos_ = write_pos_.load(std::memory_order_acquire);
+      if (cached_write_pos_ < position_ + dequeue_batch_size_)
+        return nullptr;
+    }
+    return buffer_ + read_slot_ * element_size_;
+  }
+
+  uint64_t write_pos = write_pos_.load(std::memory_order_acquire);
+
+  // Lapped: skip to the oldest batch the producer cannot be writing.
+  if (overwritten(position_, write_pos)) {
+    uint64_t oldest = write_pos + enqueue_batch_size_ - nb_slots_;
+    uint64_t position = (oldest + dequeue_batch_size_ - 1) /
+                        dequeue_batch_size_ * dequeue_batch_size_;
+    overwritten_.store(overwritten_.load(std::memory_order_relaxed) +
+                           position - position_,
+                       std::memory_order_relaxed);
+    position_ = position;
+    read_slot_ = position_ % nb_slots_;
+  }
+
+  if (write_pos < position_ + dequeue_batch_size_)
+    return nullptr;
+
+  return buffer_ + read_slot_ * element_size_;
+}
+
+bool LossyQueue::commit_read() {
+  bool intact = true;
+  if (policy_ == FullPolicy::OverwriteOldest) {
+    // Seqlock-style validation: the batch was read before the write position
+    // is reloaded.
+    std::atomic_thread_fence(std::memory_order_acquire);
+    intact = !overwritten(position_,
+                          write_pos_.load(std::memory_order_relaxed));
+    if (!intact)
+      overwritten_.store(overwritten_.load(std::memory_order_relaxed) +
+                             dequeue_batch_size_,
+                         std::memory_order_relaxed);
+  }
+
+  position_ += dequeue_batch_size_;
+  read_slot_ += dequeue_batch_size_;
+  if (read_slot_ == nb_slots_)
+    read_slot_ = 0;
+
+  if (policy_ != FullPolicy::OverwriteOldest)
+    read_pos_.store(position_, std::memory_order_release);
+  return intact;
+}
+} // namespace batched_spsc_queue
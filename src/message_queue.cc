@@ -0,0 +1,112 @@
+#include "message_queue.hh"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+
+namespace batched_spsc_queue {
+namespace {
+/// The room taken by a record of size bytes: its header and its padding.
+size_t record_bytes(size_t size) {
+  constexpr size_t alignment = MessageQueue::kRecordAlignment;
+  return alignment + (size + alignment - 1) / alignment * alignment;
+}
+} // namespace
+
+MessageQueue::MessageQueue(size_t capacity, const BufferOptions &options)
+    : capacity_(capacity), write_pos_(0), read_pos_(0), write_offset_(0),
+      reserve_skip_(0), cached_read_pos_(0), read_end_pos_(0),
+      read_offset_(0), cached_write_pos_(0) {
+  if (capacity % kRecordAlignment != 0 || capacity < 4 * kRecordAlignment)
+    throw std::invalid_argument(
+        "The capacity must be a multiple of kRecordAlignment and at least 4 "
+        "times kRecordAlignment");
+  buffer_ = Buffer(capacity, options);
+}
+
+uint8_t *MessageQueue::reserve(size_t size) {
+  if (size > max_record_size())
+    throw std::invalid_argument("The record exceeds max_record_size()");
+
+  // A record that does not fit before the end of the ring goes to the
+  // beginning, and the bytes left before the end are skipped.
+  size_t needed = record_bytes(size);
+  size_t before_end = capacity_ - write_offset_;
+  size_t skip = needed > before_end ? before_end : 0;
+
+  // Only reload the read position when the cached value says the ring is
+  // full.
+  uint64_t write_pos = write_pos_.load(std::memory_order_relaxed);
+  if (write_pos + skip + needed - cached_read_pos_ > capacity_) {
+    cached_read_pos_ = read_pos_.load(std::memory_order_acquire);
+    if (write_pos + skip + needed - cached_read_pos_ > capacity_)
+      return nullptr;
+  }
+
+  uint8_t *buffer = buffer_.data();
+  size_t offset = write_offset_;
+  if (skip != 0) {
+    memcpy(buffer + offset, &kSkipMarker, sizeof(kSkipMarker));
+    offset = 0;
+  }
+  reserve_skip_ = skip;
+  return buffer + offset + kRecordAlignment;
+}
+
+void MessageQueue::commit(size_t size) {
+  size_t offset = reserve_skip_ != 0 ? 0 : write_offset_;
+  uint64_t header = size;
+  memcpy(buffer_.data() + offset, &header, sizeof(header));
+
+  size_t bytes = record_bytes(size);
+  write_offset_ = offset + bytes;
+  if (write_offset_ == capacity_)
+    write_offset_ = 0;
+
+  // The skip marker, if any, is published along with the record.
+  uint64_t write_pos = write_pos_.load(std::memory_order_relaxed);
+  write_pos_.store(write_pos + reserve_skip_ + bytes,
+                   std::memory_order_release);
+  reserve_skip_ = 0;
+}
+
+const uint8_t *MessageQueue::read(size_t &size) {
+  // Only reload the write position when the cached value says the ring is
+  // empty.
+  if (cached_write_pos_ == read_end_pos_) {
+    cached_write_pos_ = write_pos_.load(std::memory_order_acquire);
+    if (cached_write_pos_ == read_end_pos_)
+      return nullptr;
+  }
+
+  // A skip marker is always followed by a record at the beginning.
+  const uint8_t *buffer = buffer_.data();
+  uint64_t header;
+  memcpy(&header, buffer + read_offset_, sizeof(header));
+  if (header == kSkipMarker) {
+    read_end_pos_ += capacity_ - read_offset_;
+    read_offset_ = 0;
+    memcpy(&header, buffer, sizeof(header));
+  }
+
+  const uint8_t *record = buffer + read_offset_ + kRecordAlignment;
+  size = static_cast<size_t>(header);
+  size_t bytes = record_bytes(size);
+  read_end_pos_ += bytes;
+  read_offset_ += bytes;
+  if (read_offset_ == capacity_)
+    read_offset_ = 0;
+  return record;
+}
+
+void MessageQueue::release() {
+  read_pos_.store(read_end_pos_, std::memory_order_release);
+}
+
+size_t MessageQueue::size() const {
+  uint64_t read_pos = read_pos_.load(std::memory_order_acquire);
+  uint64_t write_pos = write_pos_.load(std::memory_order_acquire);
+  return static_cast<size_t>(write_pos - read_pos);
+}
+} // namespace batched_spsc_queue
@@ -0,0 +1,78 @@
+#include "mirrored_buffer.hh"
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <system_error>
+#include <unistd.h>
+#include <utility>
+
+namespace batched_spsc_queue {
+MirroredBuffer::MirroredBuffer(size_t size) : data_(nullptr), size_(size) {
+  if (size == 0 || size % page_size() != 0)
+    throw std::invalid_argument(
+        "MirroredBuffer size must be a non-zero multiple of the page size.");
+
+  int fd = memfd_create("batched_spsc_queue", MFD_CLOEXEC);
+  if (fd == -1)
+    throw std::system_error(errno, std::generic_category(), "memfd_create");
+
+  if (ftruncate(fd, static_cast<off_t>(size)) == -1) {
+    int err = errno;
+    close(fd);
+    throw std::system_error(err, std::generic_category(), "ftruncate");
+  }
+
+  // Reserve 2 * size bytes of address space, then map the file over both
+  // halves. MAP_FIXED inside our own reservation cannot clobber other mappings.
+  void *reserved =
+      mmap(nullptr, 2 * size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (reserved == MAP_FAILED) {
+    int err = errno;
+    close(fd);
+    throw std::system_error(err, std::generic_category(), "mmap");
+  }
+
+  auto *base = static_cast<uint8_t *>(reserved);
+  for (uint8_t *half : {base, base + size}) {
+    void *mapped = mmap(half, size, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_FIXED, fd, 0);
+    if (mapped == MAP_FAILED) {
+      int err = errno;
+      munmap(reserved, 2 * size);
+      close(fd);
+      throw std::system_error(err, std::generic_category(), "mmap");
+    }
+  }
+
+  // The mappings keep the file alive.
+  close(fd);
+  data_ = base;
+}
+
+MirroredBuffer::~MirroredBuffer() {
+  if (data_ != nullptr)
+    munmap(data_, 2 * size_);
+}
+
+MirroredBuffer::MirroredBuffer(MirroredBuffer &&other) noexcept
+    : data_(std::exchange(other.data_, nullptr)),
+      size_(std::exchange(other.size_, 0)) {}
+
+MirroredBuffer &MirroredBuffer::operator=(MirroredBuffer &&other) noexcept {
+  if (this != &other) {
+    if (data_ != nullptr)
+      munmap(data_, 2 * size_);
+    data_ = std::exchange(other.data_, nullptr);
+    size_ = std::exchange(other.size_, 0);
+  }
+  return *this;
+}
+
+size_t MirroredBuffer::page_size() {
+  static const auto page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  return page_size;
+}
+} // namespace batched_spsc_queue
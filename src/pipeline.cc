@@ -0,0 +1,383 @@
+#include "pipeline.hh"
+#include "batched_spsc_queue.hh"
+#include "buffer.hh"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <pthread.h>
+#include <sched.h>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace batched_spsc_queue {
+namespace {
+int64_t now_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+/// Pins the calling thread to a CPU. Best effort: a CPU outside the allowed
+/// set just leaves the thread unpinned.
+void pin_current_thread(int cpu) {
+  if (cpu < 0 || cpu >= CPU_SETSIZE)
+    return;
+
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+/// Accumulates the time a stage spends waiting into a counter.
+class StallTimer {
+public:
+  explicit StallTimer(std::atomic<int64_t> &total)
+      : total_(total), start_(0), stalled_(false) {}
+
+  /// Called each time the stage cannot make progress.
+  void stall() {
+    if (!stalled_) {
+      start_ = now_ns();
+      stalled_ = true;
+    }
+    std::this_thread::yield();
+  }
+
+  /// Called once the stage makes progress again.
+  void resume() {
+    if (stalled_) {
+      total_.fetch_add(now_ns() - start_, std::memory_order_relaxed);
+      stalled_ = false;
+    }
+  }
+
+private:
+  std::atomic<int64_t> &total_;
+  int64_t start_;
+  bool stalled_;
+};
+} // namespace
+
+/// A buffer shared by the queues between a producer (the source or a
+/// transform stage) and the stages up to the next transform or the sink.
+struct Pipeline::Segment {
+  /// The size of each element in bytes.
+  size_t element_size = 0;
+
+  /// The sum of the batch sizes of the stages using the segment.
+  size_t batch_size_sum = 0;
+
+  /// The backing memory of every queue of the segment.
+  Buffer buffer;
+
+  /// Number of elements written into the segment. Only accessed by the
+  /// producer at its head.
+  uint64_t produced = 0;
+
+  /// Number of elements released by the last stage of the segment.
+  alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> released{0};
+};
+
+/// The queue between two consecutive stages.
+struct Pipeline::Link {
+  Link(size_t nb_slots, size_t enqueue_batch_size, size_t dequeue_batch_size,
+       Segment &segment)
+      : queue(nb_slots, enqueue_batch_size, dequeue_batch_size,
+              segment.element_size, segment.buffer.data()) {}
+
+  Queue queue;
+
+  /// Set by the upstream stage after its last commit.
+  alignas(CACHE_LINE_SIZE) std::atomic<bool> closed{false};
+};
+
+struct Pipeline::Stage {
+  enum class Kind { Source, InPlace, Transform, Sink };
+
+  Stage(std::string name, Kind kind, size_t element_size, size_t batch_size,
+        int cpu)
+      : name(std::move(name)), kind(kind), element_size(element_size),
+        batch_size(batch_size), cpu(cpu) {}
+
+  /// Whether the stage writes into a segment of its own.
+  [[nodiscard]] bool heads_segment() const {
+    return kind == Kind::Source || kind == Kind::Transform;
+  }
+
+  /// Whether the stage is the last one using its input segment.
+  [[nodiscard]] bool releases_input() const {
+    return kind == Kind::Transform || kind == Kind::Sink;
+  }
+
+  std::string name;
+  Kind kind;
+
+  /// The size of each output element, only for stages heading a segment.
+  size_t element_size;
+
+  size_t batch_size;
+  int cpu;
+
+  /// The function matching kind.
+  SourceFn source;
+  InPlaceFn in_place;
+  TransformFn transform;
+  SinkFn sink;
+
+  Link *input = nullptr;
+  Link *output = nullptr;
+  Segment *input_segment = nullptr;
+  Segment *output_segment = nullptr;
+
+  std::thread thread;
+
+  /// Statistics, written by the stage's thread only.
+  alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> batches{0};
+  std::atomic<uint64_t> elements{0};
+  std::atomic<int64_t> busy_ns{0};
+  std::atomic<int64_t> stalled_ns{0};
+  std::atomic<int64_t> start_ns{0};
+  std::atomic<int64_t> end_ns{0};
+};
+
+double Pipeline::StageStats::throughput() const {
+  auto seconds = std::chrono::duration<double>(elapsed).count();
+  return seconds > 0 ? static_cast<double>(elements) / seconds : 0;
+}
+
+Pipeline::Pipeline(size_t nb_slots)
+    : nb_slots_(nb_slots), stop_requested_(false), started_(false) {}
+
+Pipeline::~Pipeline() {
+  stop();
+  wait();
+}
+
+Pipeline &Pipeline::source(std::string name, size_t element_size,
+                           size_t batch_size, SourceFn fn, int cpu) {
+  auto stage = std::make_unique<Stage>(std::move(name), Stage::Kind::Source,
+                                       element_size, batch_size, cpu);
+  stage->source = std::move(fn);
+  return add(std::move(stage));
+}
+
+Pipeline &Pipeline::stage(std::string name, size_t batch_size, InPlaceFn fn,
+                          int cpu) {
+  auto stage = std::make_unique<Stage>(std::move(name), Stage::Kind::InPlace,
+                                       0, batch_size, cpu);
+  stage->in_place = std::move(fn);
+  return add(std::move(stage));
+}
+
+Pipeline &Pipeline::stage(std::string name, size_t element_size,
+                          size_t batch_size, TransformFn fn, int cpu) {
+  auto stage = std::make_unique<Stage>(std::move(name), Stage::Kind::Transform,
+                                       element_size, batch_size, cpu);
+  stage->transform = std::move(fn);
+  return add(std::move(stage));
+}
+
+Pipeline &Pipeline::sink(std::string name, size_t batch_size, SinkFn fn,
+                         int cpu) {
+  auto stage = std::make_unique<Stage>(std::move(name), Stage::Kind::Sink, 0,
+                                       batch_size, cpu);
+  stage->sink = std::move(fn);
+  return add(std::move(stage));
+}
+
+Pipeline &Pipeline::add(std::unique_ptr<Stage> stage) {
+  if (started_)
+    throw std::logic_error("Pipeline already started.");
+  if ((stage->kind == Stage::Kind::Source) != stages_.empty())
+    throw std::logic_error("Pipeline must start with exactly one source.");
+  if (!stages_.empty() && stages_.back()->kind == Stage::Kind::Sink)
+    throw std::logic_error("Pipeline already has a sink.");
+
+  stages_.push_back(std::move(stage));
+  return *this;
+}
+
+void Pipeline::start() {
+  if (started_)
+    throw std::logic_error("Pipeline already started.");
+  if (stages_.empty() || stages_.back()->kind != Stage::Kind::Sink)
+    throw std::logic_error("Pipeline must end with a sink.");
+
+  // Split the stages into segments. A stage reads from the segment of the
+  // previous stage, and writes either into it (in place) or into a new one.
+  // Start over if a previous call threw half-way.
+  segments_.clear();
+  links_.clear();
+  Segment *segment = nullptr;
+  for (auto &stage : stages_) {
+    if (stage->batch_size == 0 || stage->batch_size >= nb_slots_ ||
+        nb_slots_ % stage->batch_size != 0)
+      throw std::logic_error("Stage '" + stage->name +
+                             "' batch size must divide the number of slots.");
+
+    if (segment != nullptr) {
+      stage->input_segment = segment;
+      segment->batch_size_sum += stage->batch_size;
+    }
+
+    if (stage->heads_segment()) {
+      segments_.push_back(std::make_unique<Segment>());
+      segment = segments_.back().get();
+      segment->element_size = stage->element_size;
+      segment->batch_size_sum += stage->batch_size;
+    }
+
+    if (stage->kind != Stage::Kind::Sink)
+      stage->output_segment = segment;
+  }
+
+  // With fewer slots, every queue of a segment could hold a partial batch
+  // while the producer at its head waits for room, and nothing would move.
+  for (auto &segment : segments_) {
+    if (segment->batch_size_sum > nb_slots_)
+      throw std::logic_error("Pipeline number of slots must be at least the "
+                             "sum of the batch sizes sharing a buffer.");
+    segment->buffer = Buffer(nb_slots_ * segment->element_size);
+  }
+
+  for (size_t i = 0; i + 1 < stages_.size(); ++i) {
+    Stage &upstream = *stages_[i];
+    Stage &downstream = *stages_[i + 1];
+    links_.push_back(std::make_unique<Link>(nb_slots_, upstream.batch_size,
+                                            downstream.batch_size,
+                                            *upstream.output_segment));
+    upstream.output = links_.back().get();
+    downstream.input = links_.back().get();
+  }
+
+  started_ = true;
+  for (auto &stage : stages_)
+    stage->thread = std::thread([this, raw = stage.get()]() { run(*raw); });
+}
+
+void Pipeline::stop() {
+  stop_requested_.store(true, std::memory_order_relaxed);
+}
+
+void Pipeline::wait() {
+  for (auto &stage : stages_)
+    if (stage->thread.joinable())
+      stage->thread.join();
+}
+
+std::vector<Pipeline::StageStats> Pipeline::stats() const {
+  std::vector<StageStats> stats;
+  stats.reserve(stages_.size());
+  int64_t now = now_ns();
+  for (const auto &stage : stages_) {
+    int64_t start = stage->start_ns.load(std::memory_order_relaxed);
+    int64_t end = stage->end_ns.load(std::memory_order_relaxed);
+    int64_t elapsed = start == 0 ? 0 : (end == 0 ? now : end) - start;
+    stats.push_back(StageStats{
+        stage->name,
+        stage->batches.load(std::memory_order_relaxed),
+        stage->elements.load(std::memory_order_relaxed),
+        std::chrono::nanoseconds(
+            stage->busy_ns.load(std::memory_order_relaxed)),
+        std::chrono::nanoseconds(
+            stage->stalled_ns.load(std::memory_order_relaxed)),
+        std::chrono::nanoseconds(elapsed),
+    });
+  }
+  return stats;
+}
+
+void Pipeline::run(Stage &stage) {
+  pin_current_thread(stage.cpu);
+  stage.start_ns.store(now_ns(), std::memory_order_relaxed);
+  StallTimer stall(stage.stalled_ns);
+
+  while (true) {
+    // Claim the input batch. Once the upstream stage has closed its queue,
+    // drain what is left, partial batches included.
+    uint8_t *input = nullptr;
+    size_t n = stage.batch_size;
+    if (stage.kind == Stage::Kind::Source) {
+      if (stop_requested_.load(std::memory_order_relaxed))
+        break;
+    } else {
+      input = stage.input->queue.read_ptr();
+      if (input == nullptr) {
+        if (!stage.input->closed.load(std::memory_order_acquire)) {
+          stall.stall();
+          continue;
+        }
+
+        n = std::min(n, stage.input->queue.available_contiguous_read());
+        if (n == 0)
+          break;
+        input = stage.input->queue.read_ptr(n);
+      }
+    }
+
+    // Claim the output batch. The head of a segment waits for the last stage
+    // of the segment to release enough slots. An in-place stage writes at the
+    // index it reads from, so its output is the input batch itself and is
+    // always available.
+    uint8_t *output = input;
+    if (stage.heads_segment()) {
+      Segment &segment = *stage.output_segment;
+      size_t before_end = nb_slots_ - segment.produced % nb_slots_;
+      n = std::min(n, before_end);
+      while (segment.produced + n -
+                 segment.released.load(std::memory_order_acquire) >
+             nb_slots_ - 1)
+        stall.stall();
+      output = stage.output->queue.write_ptr(n);
+    }
+    stall.resume();
+
+    int64_t busy_start = now_ns();
+    switch (stage.kind) {
+    case Stage::Kind::Source:
+      n = stage.source(output, n);
+      break;
+    case Stage::Kind::InPlace:
+      stage.in_place(input, n);
+      break;
+    case Stage::Kind::Transform:
+      stage.transform(input, output, n);
+      break;
+    case Stage::Kind::Sink:
+      stage.sink(input, n);
+      break;
+    }
+    stage.busy_ns.fetch_add(now_ns() - busy_start, std::memory_order_relaxed);
+
+    if (stage.output != nullptr) {
+      stage.output->queue.commit_write(n);
+      if (stage.heads_segment())
+        stage.output_segment->produced += n;
+    }
+    if (stage.input != nullptr) {
+      stage.input->queue.commit_read(n);
+      if (stage.releases_input())
+        stage.input_segment->released.fetch_add(n, std::memory_order_release);
+    }
+
+    if (n > 0) {
+      stage.batches.fetch_add(1, std::memory_order_relaxed);
+      stage.elements.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    if (stage.kind == Stage::Kind::Source && n < stage.batch_size)
+      break;
+  }
+
+  if (stage.output != nullptr)
+    stage.output->closed.store(true, std::memory_order_release);
+  stage.end_ns.store(now_ns(), std::memory_order_relaxed);
+}
+} // namespace batched_spsc_queue
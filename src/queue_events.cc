@@ -0,0 +1,97 @@
+#include "queue_events.hh"
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <stdexcept>
+#include <sys/eventfd.h>
+#include <system_error>
+#include <unistd.h>
+
+namespace batched_spsc_queue {
+namespace {
+int open_eventfd() {
+  int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (fd < 0)
+    throw std::system_error(errno, std::generic_category(), "eventfd");
+  return fd;
+}
+} // namespace
+
+QueueEvents::QueueEvents(Queue &queue) : queue_(queue) {
+  if (queue.events_ != nullptr)
+    throw std::logic_error("The queue already has events");
+
+  data_.fd = open_eventfd();
+  try {
+    space_.fd = open_eventfd();
+  } catch (...) {
+    close(data_.fd);
+    throw;
+  }
+  queue.events_ = this;
+}
+
+QueueEvents::~QueueEvents() {
+  queue_.events_ = nullptr;
+  close(data_.fd);
+  close(space_.fd);
+}
+
+bool QueueEvents::arm_read() {
+  // The seq_cst store/load pair matches the one in Queue::commit_write():
+  // either this side sees the new index, or the producer sees the flag.
+  data_.armed.store(true, std::memory_order_seq_cst);
+  size_t write_idx = queue_.write_idx_.load(std::memory_order_seq_cst);
+  size_t read_idx = queue_.read_idx_.load(std::memory_order_relaxed);
+  size_t size = write_idx - read_idx;
+  if (write_idx < read_idx)
+    size += queue_.nb_slots_;
+  if (size < queue_.dequeue_batch_size_)
+    return true;
+
+  // If the producer already took the flag, its signal only causes a spurious
+  // wake-up later.
+  data_.armed.store(false, std::memory_order_relaxed);
+  return false;
+}
+
+bool QueueEvents::arm_write() {
+  space_.armed.store(true, std::memory_order_seq_cst);
+  size_t read_idx = queue_.read_idx_.load(std::memory_order_seq_cst);
+  size_t write_idx = queue_.write_idx_.load(std::memory_order_relaxed);
+  size_t size = write_idx - read_idx;
+  if (write_idx < read_idx)
+    size += queue_.nb_slots_;
+  if (queue_.nb_slots_ - size < queue_.enqueue_batch_size_ + 1)
+    return true;
+
+  space_.armed.store(false, std::memory_order_relaxed);
+  return false;
+}
+
+void QueueEvents::clear_data() { clear(data_); }
+
+void QueueEvents::clear_space() { clear(space_); }
+
+void QueueEvents::signal(Direction &direction) {
+  // Only a plain load while the other side is not waiting, and a single write
+  // per arming however many commits follow.
+  if (!direction.armed.load(std::memory_order_seq_cst) ||
+      !direction.armed.exchange(false, std::memory_order_acq_rel))
+    return;
+
+  uint64_t one = 1;
+  while (write(direction.fd, &one, sizeof(one)) < 0 && errno == EINTR)
+    ;
+  direction.signals.store(direction.signals.load(std::memory_order_relaxed) +
+                              1,
+                          std::memory_order_relaxed);
+}
+
+void QueueEvents::clear(Direction &direction) {
+  // Non-blocking: fails with EAGAIN if the counter is already zero.
+  uint64_t count;
+  while (read(direction.fd, &count, sizeof(count)) < 0 && errno == EINTR)
+    ;
+}
+} // namespace batched_spsc_queue
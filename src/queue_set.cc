@@ -0,0 +1,114 @@
+#include "queue_set.hh"
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+
+namespace batched_spsc_queue {
+QueueSet::QueueSet()
+    : current_(kMaxQueues - 1), credits_(0), ready_(0),
+      consumer_parked_(false) {}
+
+QueueSet::~QueueSet() {
+  for (auto &entry : queues_)
+    entry.queue->set_ = nullptr;
+}
+
+size_t QueueSet::add(Queue &queue, size_t weight) {
+  if (queues_.size() == kMaxQueues)
+    throw std::length_error("QueueSet already has kMaxQueues queues.");
+  if (weight == 0)
+    throw std::invalid_argument("QueueSet weight must be at least 1.");
+
+  size_t index = queues_.size();
+  queues_.push_back(Entry{&queue, weight});
+  queue.set_ = this;
+  queue.set_index_ = index;
+
+  // The queue may already hold batches.
+  ready_.fetch_or(uint64_t{1} << index, std::memory_order_seq_cst);
+  return index;
+}
+
+void QueueSet::mark_ready(size_t index) {
+  // Most commits find the bit already set and only read the bitmap.
+  uint64_t bit = uint64_t{1} << index;
+  if ((ready_.load(std::memory_order_seq_cst) & bit) != 0)
+    return;
+
+  // The seq_cst read-modify-write/load pair matches the one in
+  // wait_read_ptr(): either the consumer sees the bit, or this side sees that
+  // it is parked.
+  uint64_t previous = ready_.fetch_or(bit, std::memory_order_seq_cst);
+  if (previous == 0 && consumer_parked_.load(std::memory_order_seq_cst))
+    ready_.notify_one();
+}
+
+uint8_t *QueueSet::read_ptr(size_t &index) {
+  // Keep serving the current queue while it has credits left.
+  if (credits_ > 0) {
+    uint8_t *batch = queues_[current_].queue->read_ptr();
+    if (batch != nullptr) {
+      index = current_;
+      return batch;
+    }
+    credits_ = 0;
+  }
+
+  uint64_t ready = ready_.load(std::memory_order_acquire);
+  while (ready != 0) {
+    // The first ready queue after the current one, wrapping around.
+    size_t start = (current_ + 1) % kMaxQueues;
+    uint64_t after = ready & (~uint64_t{0} << start);
+    auto i = static_cast<size_t>(std::countr_zero(after != 0 ? after : ready));
+    uint64_t bit = uint64_t{1} << i;
+
+    Queue &queue = *queues_[i].queue;
+    uint8_t *batch = queue.read_ptr();
+    if (batch == nullptr) {
+      // Clear the bit, then look again. The fence matches the seq_cst store
+      // in Queue::commit_write(): a commit that did not set the bit, because
+      // it saw it still set, is seen here.
+      ready_.fetch_and(~bit, std::memory_order_seq_cst);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      batch = queue.read_ptr();
+      if (batch != nullptr)
+        ready_.fetch_or(bit, std::memory_order_relaxed);
+    }
+
+    if (batch != nullptr) {
+      current_ = i;
+      credits_ = queues_[i].weight;
+      index = i;
+      return batch;
+    }
+    ready &= ~bit;
+  }
+
+  return nullptr;
+}
+
+uint8_t *QueueSet::wait_read_ptr(size_t &index) {
+  for (size_t attempt = 0;; ++attempt) {
+    uint8_t *batch = read_ptr(index);
+    if (batch != nullptr)
+      return batch;
+    if (attempt < kSpinCount)
+      continue;
+
+    // read_ptr() cleared the bits of every empty queue, so ready_ stays 0
+    // until a producer commits.
+    consumer_parked_.store(true, std::memory_order_seq_cst);
+    if (ready_.load(std::memory_order_seq_cst) == 0)
+      ready_.wait(0, std::memory_order_seq_cst);
+    consumer_parked_.store(false, std::memory_order_relaxed);
+  }
+}
+
+void QueueSet::commit_read(size_t index) {
+  queues_[index].queue->commit_read();
+  if (index == current_ && credits_ > 0)
+    --credits_;
+}
+} // namespace batched_spsc_queue
@@ -0,0 +1,136 @@
+#include "segmented_queue.hh"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+
+namespace batched_spsc_queue {
+SegmentedQueue::SegmentedQueue(size_t segment_slots, size_t enqueue_batch_size,
+                               size_t dequeue_batch_size, size_t element_size,
+                               const SegmentedQueueOptions &options)
+    : segment_slots_(segment_slots), enqueue_batch_size_(enqueue_batch_size),
+      dequeue_batch_size_(dequeue_batch_size), element_size_(element_size),
+      options_(options), write_count_(0), read_count_(0),
+      released_segments_(0), head_(nullptr), write_offset_(0),
+      first_(nullptr), taken_segments_(0), write_count_local_(0),
+      tail_(nullptr), read_offset_(0), cached_write_count_(0),
+      read_count_local_(0), released_segments_local_(0),
+      allocated_segments_(0), segment_allocations_(0) {
+  if (enqueue_batch_size == 0 || dequeue_batch_size == 0 ||
+      segment_slots == 0 || segment_slots % enqueue_batch_size != 0 ||
+      segment_slots % dequeue_batch_size != 0)
+    throw std::invalid_argument(
+        "segment_slots must be a multiple of the batch sizes");
+  // With a single segment, the consumer could never move past it.
+  if (options.max_segments == 1)
+    throw std::invalid_argument("max_segments must be at least 2");
+
+  head_ = new Segment{Buffer(segment_slots * element_size, options.buffer)};
+  first_ = head_;
+  tail_ = head_;
+  allocated_segments_.store(1, std::memory_order_relaxed);
+  segment_allocations_.store(1, std::memory_order_relaxed);
+}
+
+SegmentedQueue::~SegmentedQueue() {
+  // Every segment is still linked from first_, drained or not.
+  while (first_ != nullptr) {
+    Segment *next = first_->next.load(std::memory_order_relaxed);
+    delete first_;
+    first_ = next;
+  }
+}
+
+uint8_t *SegmentedQueue::write_ptr() {
+  if (write_offset_ == segment_slots_) {
+    Segment *segment = next_segment();
+    if (segment == nullptr)
+      return nullptr;
+
+    // Published by the release store of the first commit into the segment.
+    head_->next.store(segment, std::memory_order_relaxed);
+    head_ = segment;
+    write_offset_ = 0;
+  }
+
+  return head_->buffer.data() + write_offset_ * element_size_;
+}
+
+void SegmentedQueue::commit_write() {
+  write_offset_ += enqueue_batch_size_;
+  write_count_local_ += enqueue_batch_size_;
+  write_count_.store(write_count_local_, std::memory_order_release);
+}
+
+uint8_t *SegmentedQueue::read_ptr() {
+  // Only reload write_count_ when the cached value says the queue is empty.
+  if (cached_write_count_ - read_count_local_ < dequeue_batch_size_) {
+    cached_write_count_ = write_count_.load(std::memory_order_acquire);
+    if (cached_write_count_ - read_count_local_ < dequeue_batch_size_)
+      return nullptr;
+  }
+
+  if (read_offset_ == segment_slots_) {
+    // The elements after this segment were committed after it was linked.
+    Segment *next = tail_->next.load(std::memory_order_relaxed);
+    tail_ = next;
+    read_offset_ = 0;
+    // The release store keeps the load of next above from being reordered
+    // after it, as the producer may then reuse the segment.
+    released_segments_local_++;
+    released_segments_.store(released_segments_local_,
+                             std::memory_order_release);
+  }
+
+  return tail_->buffer.data() + read_offset_ * element_size_;
+}
+
+void SegmentedQueue::commit_read() {
+  read_offset_ += dequeue_batch_size_;
+  read_count_local_ += dequeue_batch_size_;
+  read_count_.store(read_count_local_, std::memory_order_release);
+}
+
+size_t SegmentedQueue::size() const {
+  uint64_t read_count = read_count_.load(std::memory_order_acquire);
+  uint64_t write_count = write_count_.load(std::memory_order_acquire);
+  return write_count - read_count;
+}
+
+SegmentedQueue::Segment *SegmentedQueue::next_segment() {
+  uint64_t drained = released_segments_.load(std::memory_order_acquire) -
+                     taken_segments_;
+
+  // Give the memory of a burst back, oldest segments first.
+  for (; drained > options_.spare_segments; drained--) {
+    Segment *segment = first_;
+    first_ = segment->next.load(std::memory_order_relaxed);
+    taken_segments_++;
+    delete segment;
+    allocated_segments_.store(
+        allocated_segments_.load(std::memory_order_relaxed) - 1,
+        std::memory_order_relaxed);
+  }
+
+  if (drained > 0) {
+    Segment *segment = first_;
+    first_ = segment->next.load(std::memory_order_relaxed);
+    taken_segments_++;
+    segment->next.store(nullptr, std::memory_order_relaxed);
+    return segment;
+  }
+
+  size_t allocated = allocated_segments_.load(std::memory_order_relaxed);
+  if (options_.max_segments != SegmentedQueueOptions::kUnlimited &&
+      allocated >= options_.max_segments)
+    return nullptr;
+
+  auto *segment =
+      new Segment{Buffer(segment_slots_ * element_size_, options_.buffer)};
+  allocated_segments_.store(allocated + 1, std::memory_order_relaxed);
+  segment_allocations_.store(
+      segment_allocations_.load(std::memory_order_relaxed) + 1,
+      std::memory_order_relaxed);
+  return segment;
+}
+} // namespace batched_spsc_queue
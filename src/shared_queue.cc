@@ -0,0 +1,327 @@
+#include "shared_queue.hh"
+#include <atomic>
+#include <cerrno>
+#include <csignal>
+#include <cstddef>
+#include <cstdint>
+#include <fcntl.h>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <system_error>
+#include <unistd.h>
+#include <utility>
+
+namespace batched_spsc_queue {
+namespace {
+/// Identifies a shared memory object created by SharedQueue::create().
+constexpr uint64_t kMagic = 0x5153505342535143;
+
+/// Bumped whenever the layout of SharedQueue::Header changes.
+constexpr uint32_t kVersion = 1;
+
+static_assert(std::atomic<size_t>::is_always_lock_free);
+static_assert(std::atomic<int64_t>::is_always_lock_free);
+
+bool pid_alive(int64_t pid) {
+  return kill(static_cast<pid_t>(pid), 0) == 0 || errno == EPERM;
+}
+
+size_t round_up(size_t value, size_t alignment) {
+  return (value + alignment - 1) / alignment * alignment;
+}
+} // namespace
+
+/// The layout at the beginning of the shared memory object.
+struct SharedQueue::Header {
+  /// kMagic once the header is fully initialized.
+  std::atomic<uint64_t> magic;
+
+  /// kVersion of the process that created the queue.
+  uint32_t version;
+
+  /// CACHE_LINE_SIZE of the process that created the queue.
+  uint32_t cache_line_size;
+
+  /// Geometry of the queue.
+  uint64_t nb_slots;
+  uint64_t enqueue_batch_size;
+  uint64_t dequeue_batch_size;
+  uint64_t element_size;
+
+  /// Offset of the payload from the beginning of the mapping.
+  uint64_t payload_offset;
+
+  /// The current write index.
+  alignas(CACHE_LINE_SIZE) std::atomic<size_t> write_idx;
+
+  /// The current read index.
+  alignas(CACHE_LINE_SIZE) std::atomic<size_t> read_idx;
+
+  /// The pid of the attached producer, or 0.
+  alignas(CACHE_LINE_SIZE) std::atomic<int64_t> producer_pid;
+
+  /// The pid of the attached consumer, or 0.
+  alignas(CACHE_LINE_SIZE) std::atomic<int64_t> consumer_pid;
+};
+
+SharedQueue SharedQueue::create(const std::string &name, size_t nb_slots,
+                                size_t enqueue_batch_size,
+                                size_t dequeue_batch_size, size_t element_size,
+                                Role role) {
+  size_t payload_offset =
+      round_up(sizeof(Header), static_cast<size_t>(sysconf(_SC_PAGESIZE)));
+  size_t mapping_size = payload_offset + nb_slots * element_size;
+
+  int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+  if (fd == -1)
+    throw std::system_error(errno, std::generic_category(), "shm_open");
+
+  if (ftruncate(fd, static_cast<off_t>(mapping_size)) == -1) {
+    int err = errno;
+    close(fd);
+    shm_unlink(name.c_str());
+    throw std::system_error(err, std::generic_category(), "ftruncate");
+  }
+
+  void *mapping = mmap(nullptr, mapping_size, PROT_READ | PROT_WRITE,
+                       MAP_SHARED, fd, 0);
+  int err = errno;
+  close(fd);
+  if (mapping == MAP_FAILED) {
+    shm_unlink(name.c_str());
+    throw std::system_error(err, std::generic_category(), "mmap");
+  }
+
+  // The file is zero-filled, so every index and pid starts at 0. The magic is
+  // published last so that attach() never sees a half-initialized header.
+  auto *header = new (mapping) Header();
+  header->version = kVersion;
+  header->cache_line_size = CACHE_LINE_SIZE;
+  header->nb_slots = nb_slots;
+  header->enqueue_batch_size = enqueue_batch_size;
+  header->dequeue_batch_size = dequeue_batch_size;
+  header->element_size = element_size;
+  header->payload_offset = payload_offset;
+  header->magic.store(kMagic, std::memory_order_release);
+
+  try {
+    return SharedQueue(mapping, mapping_size, role, name);
+  } catch (...) {
+    munmap(mapping, mapping_size);
+    shm_unlink(name.c_str());
+    throw;
+  }
+}
+
+SharedQueue SharedQueue::attach(const std::string &name, Role role) {
+  int fd = shm_open(name.c_str(), O_RDWR, 0);
+  if (fd == -1)
+    throw std::system_error(errno, std::generic_category(), "shm_open");
+
+  struct stat st {};
+  if (fstat(fd, &st) == -1) {
+    int err = errno;
+    close(fd);
+    throw std::system_error(err, std::generic_category(), "fstat");
+  }
+
+  auto mapping_size = static_cast<size_t>(st.st_size);
+  if (mapping_size < sizeof(Header)) {
+    close(fd);
+    throw std::runtime_error("Shared memory is too small to be a queue.");
+  }
+
+  void *mapping = mmap(nullptr, mapping_size, PROT_READ | PROT_WRITE,
+                       MAP_SHARED, fd, 0);
+  int err = errno;
+  close(fd);
+  if (mapping == MAP_FAILED)
+    throw std::system_error(err, std::generic_category(), "mmap");
+
+  auto *header = static_cast<Header *>(mapping);
+  const char *error = nullptr;
+  if (header->magic.load(std::memory_order_acquire) != kMagic)
+    error = "Shared memory is not an initialized queue.";
+  else if (header->version != kVersion)
+    error = "Shared memory queue was created by an incompatible version.";
+  else if (header->cache_line_size != CACHE_LINE_SIZE)
+    error = "Shared memory queue was created with another CACHE_LINE_SIZE.";
+  else if (header->payload_offset +
+               header->nb_slots * header->element_size >
+           mapping_size)
+    error = "Shared memory queue is truncated.";
+
+  if (error != nullptr) {
+    munmap(mapping, mapping_size);
+    throw std::runtime_error(error);
+  }
+
+  try {
+    return SharedQueue(mapping, mapping_size, role, "");
+  } catch (...) {
+    munmap(mapping, mapping_size);
+    throw;
+  }
+}
+
+SharedQueue::SharedQueue(void *mapping, size_t mapping_size, Role role,
+                         std::string name)
+    : header_(static_cast<Header *>(mapping)), buffer_(nullptr),
+      mapping_size_(mapping_size), role_(role), owned_name_(std::move(name)),
+      nb_slots_(header_->nb_slots),
+      enqueue_batch_size_(header_->enqueue_batch_size),
+      dequeue_batch_size_(header_->dequeue_batch_size),
+      element_size_(header_->element_size), cached_read_idx_(0),
+      cached_write_idx_(0) {
+  buffer_ = static_cast<uint8_t *>(mapping) + header_->payload_offset;
+
+  // Claim the role. A pid left behind by a process that died is taken over.
+  std::atomic<int64_t> &slot = role_ == Role::Producer ? header_->producer_pid
+                                                       : header_->consumer_pid;
+  int64_t self = getpid();
+  int64_t expected = 0;
+  while (!slot.compare_exchange_strong(expected, self,
+                                       std::memory_order_acq_rel)) {
+    if (pid_alive(expected))
+      throw std::runtime_error("Shared memory queue role is already taken.");
+  }
+
+  cached_read_idx_ = header_->read_idx.load(std::memory_order_acquire);
+  cached_write_idx_ = header_->write_idx.load(std::memory_order_acquire);
+}
+
+SharedQueue::~SharedQueue() { detach(); }
+
+SharedQueue::SharedQueue(SharedQueue &&other) noexcept
+    : header_(std::exchange(other.header_, nullptr)), buffer_(other.buffer_),
+      mapping_size_(other.mapping_size_), role_(other.role_),
+      owned_name_(std::move(other.owned_name_)), nb_slots_(other.nb_slots_),
+      enqueue_batch_size_(other.enqueue_batch_size_),
+      dequeue_batch_size_(other.dequeue_batch_size_),
+      element_size_(other.element_size_),
+      cached_read_idx_(other.cached_read_idx_),
+      cached_write_idx_(other.cached_write_idx_) {
+  other.owned_name_.clear();
+}
+
+SharedQueue &SharedQueue::operator=(SharedQueue &&other) noexcept {
+  if (this != &other) {
+    detach();
+    header_ = std::exchange(other.header_, nullptr);
+    buffer_ = other.buffer_;
+    mapping_size_ = other.mapping_size_;
+    role_ = other.role_;
+    owned_name_ = std::move(other.owned_name_);
+    other.owned_name_.clear();
+    nb_slots_ = other.nb_slots_;
+    enqueue_batch_size_ = other.enqueue_batch_size_;
+    dequeue_batch_size_ = other.dequeue_batch_size_;
+    element_size_ = other.element_size_;
+    cached_read_idx_ = other.cached_read_idx_;
+    cached_write_idx_ = other.cached_write_idx_;
+  }
+  return *this;
+}
+
+uint8_t *SharedQueue::write_ptr() {
+  size_t write_idx = header_->write_idx.load(std::memory_order_relaxed);
+
+  // Only reload the read index when the cached value says the queue is full.
+  size_t diff = write_idx - cached_read_idx_;
+  if (write_idx < cached_read_idx_)
+    diff += nb_slots_;
+
+  if (nb_slots_ - diff < enqueue_batch_size_ + 1) {
+    cached_read_idx_ = header_->read_idx.load(std::memory_order_acquire);
+    diff = write_idx - cached_read_idx_;
+    if (write_idx < cached_read_idx_)
+      diff += nb_slots_;
+
+    if (nb_slots_ - diff < enqueue_batch_size_ + 1)
+      return nullptr;
+  }
+
+  return buffer_ + write_idx * element_size_;
+}
+
+void SharedQueue::commit_write() {
+  size_t write_idx = header_->write_idx.load(std::memory_order_relaxed);
+  size_t next_write_idx = write_idx + enqueue_batch_size_;
+  if (next_write_idx == nb_slots_)
+    next_write_idx = 0;
+
+  header_->write_idx.store(next_write_idx, std::memory_order_release);
+}
+
+uint8_t *SharedQueue::read_ptr() {
+  size_t read_idx = header_->read_idx.load(std::memory_order_relaxed);
+
+  // Only reload the write index when the cached value says the queue is empty.
+  size_t diff = cached_write_idx_ - read_idx;
+  if (cached_write_idx_ < read_idx)
+    diff += nb_slots_;
+
+  if (diff < dequeue_batch_size_) {
+    cached_write_idx_ = header_->write_idx.load(std::memory_order_acquire);
+    diff = cached_write_idx_ - read_idx;
+    if (cached_write_idx_ < read_idx)
+      diff += nb_slots_;
+
+    if (diff < dequeue_batch_size_)
+      return nullptr;
+  }
+
+  return buffer_ + read_idx * element_size_;
+}
+
+void SharedQueue::commit_read() {
+  size_t read_idx = header_->read_idx.load(std::memory_order_relaxed);
+  size_t next_read_idx = read_idx + dequeue_batch_size_;
+  if (next_read_idx == nb_slots_)
+    next_read_idx = 0;
+
+  header_->read_idx.store(next_read_idx, std::memory_order_release);
+}
+
+size_t SharedQueue::size() {
+  size_t write_idx = header_->write_idx.load(std::memory_order_acquire);
+  size_t read_idx = header_->read_idx.load(std::memory_order_acquire);
+
+  size_t diff = write_idx - read_idx;
+
+  if (write_idx < read_idx)
+    diff += nb_slots_;
+
+  return diff;
+}
+
+SharedQueue::PeerState SharedQueue::peer_state() const {
+  const std::atomic<int64_t> &slot = role_ == Role::Producer
+                                         ? header_->consumer_pid
+                                         : header_->producer_pid;
+  int64_t pid = slot.load(std::memory_order_acquire);
+  if (pid == 0)
+    return PeerState::Detached;
+
+  return pid_alive(pid) ? PeerState::Alive : PeerState::Dead;
+}
+
+void SharedQueue::detach() {
+  if (header_ == nullptr)
+    return;
+
+  std::atomic<int64_t> &slot = role_ == Role::Producer ? header_->producer_pid
+                                                       : header_->consumer_pid;
+  int64_t self = getpid();
+  slot.compare_exchange_strong(self, 0, std::memory_order_acq_rel);
+
+  munmap(header_, mapping_size_);
+  header_ = nullptr;
+
+  if (!owned_name_.empty())
+    shm_unlink(owned_name_.c_str());
+}
+} // namespace batched_spsc_queue
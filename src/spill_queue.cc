@@ -0,0 +1,192 @@
+#include "spill_queue.hh"
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <fcntl.h>
+#include <memory>
+#include <string>
+#include <system_error>
+#include <unistd.h>
+
+namespace batched_spsc_queue {
+namespace {
+int64_t now_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+/// Opens an unnamed temporary file in directory, falling back to a named one
+/// unlinked right away on file systems without O_TMPFILE.
+int open_spill_file(const std::string &directory) {
+  int fd = open(directory.c_str(), O_TMPFILE | O_RDWR, 0600);
+  if (fd >= 0)
+    return fd;
+
+  std::string path = directory + "/batched_spsc_queue_spill_XXXXXX";
+  fd = mkstemp(path.data());
+  if (fd < 0)
+    throw std::system_error(errno, std::generic_category(), "mkstemp");
+  unlink(path.c_str());
+  return fd;
+}
+
+void pwrite_fully(int fd, const uint8_t *data, size_t size, uint64_t offset) {
+  while (size > 0) {
+    ssize_t written = pwrite(fd, data, size, static_cast<off_t>(offset));
+    if (written < 0) {
+      if (errno == EINTR)
+        continue;
+      throw std::system_error(errno, std::generic_category(), "pwrite");
+    }
+
+    data += written;
+    size -= static_cast<size_t>(written);
+    offset += static_cast<uint64_t>(written);
+  }
+}
+
+void pread_fully(int fd, uint8_t *data, size_t size, uint64_t offset) {
+  while (size > 0) {
+    ssize_t nb_read = pread(fd, data, size, static_cast<off_t>(offset));
+    if (nb_read < 0 && errno == EINTR)
+      continue;
+    if (nb_read <= 0)
+      throw std::system_error(nb_read < 0 ? errno : EIO,
+                              std::generic_category(), "pread");
+
+    data += nb_read;
+    size -= static_cast<size_t>(nb_read);
+    offset += static_cast<uint64_t>(nb_read);
+  }
+}
+} // namespace
+
+SpillQueue::SpillQueue(size_t nb_slots, size_t batch_size, size_t element_size,
+                       const std::string &spill_directory,
+                       uint64_t max_spill_bytes, const BufferOptions &options)
+    : queue_(nb_slots, batch_size, batch_size, element_size, options),
+      batch_size_(batch_size), batch_bytes_(batch_size * element_size),
+      max_spill_bytes_(max_spill_bytes),
+      fd_(open_spill_file(spill_directory)), boundary_(0), episode_base_(0),
+      spill_written_(0), spill_read_(0), drain_start_ns_(0), drain_ns_(0),
+      write_staging_(std::make_unique<uint8_t[]>(batch_bytes_)),
+      write_target_(Target::Ring), ring_committed_(0),
+      read_staging_(std::make_unique<uint8_t[]>(batch_bytes_)),
+      read_source_(Target::Ring), staged_(false), ring_consumed_(0) {}
+
+SpillQueue::~SpillQueue() { close(fd_); }
+
+uint8_t *SpillQueue::write_ptr() {
+  uint64_t written = spill_written_.load(std::memory_order_relaxed);
+
+  // The ring is only used when nothing is left in the spill file, otherwise
+  // the batch would overtake the spilled ones.
+  if (written == spill_read_.load(std::memory_order_acquire)) {
+    uint8_t *batch_begin = queue_.write_ptr();
+    if (batch_begin != nullptr) {
+      write_target_ = Target::Ring;
+      return batch_begin;
+    }
+
+    // A new spill episode, published with its first batch. The consumer has
+    // read the previous one entirely, so it no longer reads these.
+    boundary_.store(ring_committed_, std::memory_order_relaxed);
+    episode_base_.store(written, std::memory_order_relaxed);
+  }
+
+  uint64_t backlog = written - episode_base_.load(std::memory_order_relaxed);
+  if (max_spill_bytes_ != kUnlimited &&
+      backlog + batch_bytes_ > max_spill_bytes_)
+    return nullptr;
+
+  write_target_ = Target::Spill;
+  return write_staging_.get();
+}
+
+void SpillQueue::commit_write() {
+  if (write_target_ == Target::Ring) {
+    queue_.commit_write();
+    ring_committed_ += batch_size_;
+    return;
+  }
+
+  uint64_t written = spill_written_.load(std::memory_order_relaxed);
+  uint64_t base = episode_base_.load(std::memory_order_relaxed);
+  pwrite_fully(fd_, write_staging_.get(), batch_bytes_, written - base);
+  spill_written_.store(written + batch_bytes_, std::memory_order_release);
+}
+
+uint8_t *SpillQueue::read_ptr() {
+  if (staged_)
+    return read_staging_.get();
+
+  // The spilled batches come right after the ring batches committed before
+  // the episode started.
+  uint64_t read = spill_read_.load(std::memory_order_relaxed);
+  if (spill_written_.load(std::memory_order_acquire) != read &&
+      ring_consumed_ == boundary_.load(std::memory_order_relaxed)) {
+    if (drain_start_ns_.load(std::memory_order_relaxed) == 0)
+      drain_start_ns_.store(now_ns(), std::memory_order_relaxed);
+
+    uint64_t offset = read - episode_base_.load(std::memory_order_relaxed);
+    pread_fully(fd_, read_staging_.get(), batch_bytes_, offset);
+    posix_fadvise(fd_, static_cast<off_t>(offset),
+                  static_cast<off_t>(batch_bytes_), POSIX_FADV_DONTNEED);
+    read_source_ = Target::Spill;
+    staged_ = true;
+    return read_staging_.get();
+  }
+
+  read_source_ = Target::Ring;
+  return queue_.read_ptr();
+}
+
+void SpillQueue::commit_read() {
+  if (read_source_ == Target::Ring) {
+    queue_.commit_read();
+    ring_consumed_ += batch_size_;
+    return;
+  }
+
+  uint64_t read = spill_read_.load(std::memory_order_relaxed) + batch_bytes_;
+  staged_ = false;
+
+  // The episode is drained: account for its duration before the producer can
+  // start the next one.
+  if (read == spill_written_.load(std::memory_order_acquire)) {
+    int64_t start_ns = drain_start_ns_.load(std::memory_order_relaxed);
+    drain_ns_.store(drain_ns_.load(std::memory_order_relaxed) + now_ns() -
+                        start_ns,
+                    std::memory_order_relaxed);
+    drain_start_ns_.store(0, std::memory_order_relaxed);
+  }
+  spill_read_.store(read, std::memory_order_release);
+}
+
+bool SpillQueue::spilling() const {
+  return spill_written_.load(std::memory_order_acquire) !=
+         spill_read_.load(std::memory_order_acquire);
+}
+
+SpillStats SpillQueue::stats() const {
+  SpillStats stats;
+  uint64_t read = spill_read_.load(std::memory_order_acquire);
+  uint64_t written = spill_written_.load(std::memory_order_acquire);
+  stats.spilled_bytes = written;
+  stats.drained_bytes = read;
+  stats.backlog_bytes = written > read ? written - read : 0;
+
+  int64_t drain_ns = drain_ns_.load(std::memory_order_relaxed);
+  int64_t start_ns = drain_start_ns_.load(std::memory_order_relaxed);
+  if (start_ns != 0)
+    drain_ns += now_ns() - start_ns;
+  if (drain_ns > 0)
+    stats.drain_rate =
+        static_cast<double>(read) * 1e9 / static_cast<double>(drain_ns);
+  return stats;
+}
+} // namespace batched_spsc_queue
@@ -0,0 +1,308 @@
+#include "transform.hh"
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define BATCHED_SPSC_QUEUE_X86
+#endif
+
+namespace batched_spsc_queue {
+namespace {
+/// Lowers kernel to the best one supported by the CPU.
+CopyKernel supported(CopyKernel kernel) {
+  CopyKernel best = best_copy_kernel();
+  if (static_cast<int>(kernel) > static_cast<int>(best))
+    return best;
+  return kernel;
+}
+
+void normalize_scalar(uint8_t *dst, const uint8_t *src, size_t size,
+                      float scale, float bias) {
+  for (size_t i = 0; i < size; i++) {
+    float value = static_cast<float>(src[i]) * scale + bias;
+    std::memcpy(dst + i * sizeof(float), &value, sizeof(float));
+  }
+}
+
+template <size_t WordSize>
+void byteswap_scalar(uint8_t *dst, const uint8_t *src, size_t size) {
+  for (size_t i = 0; i + WordSize <= size; i += WordSize)
+    for (size_t j = 0; j < WordSize; j++)
+      dst[i + j] = src[i + WordSize - 1 - j];
+}
+
+template <size_t Channels>
+void deinterleave_scalar(uint8_t *dst, const uint8_t *src, size_t pixels,
+                         size_t first_pixel) {
+  for (size_t i = first_pixel; i < pixels; i++)
+    for (size_t channel = 0; channel < Channels; channel++)
+      dst[channel * pixels + i] = src[i * Channels + channel];
+}
+
+#ifdef BATCHED_SPSC_QUEUE_X86
+/// The pshufb mask that reverses the bytes of each word of a Width-byte
+/// vector. pshufb works within 16-byte lanes, and words never straddle them.
+template <size_t WordSize, size_t Width>
+constexpr std::array<uint8_t, Width> byteswap_mask() {
+  std::array<uint8_t, Width> mask{};
+  for (size_t j = 0; j < Width; j++)
+    mask[j] = static_cast<uint8_t>(j / WordSize * WordSize + WordSize - 1 -
+                                   j % WordSize);
+  return mask;
+}
+
+/// The pshufb masks that gather, for each channel, the bytes of 16 pixels of
+/// Channels interleaved channels from each of the Channels 16-byte blocks
+/// holding them. Bytes from other blocks are zeroed (0x80).
+template <size_t Channels>
+constexpr std::array<std::array<std::array<uint8_t, 16>, Channels>, Channels>
+deinterleave_masks() {
+  std::array<std::array<std::array<uint8_t, 16>, Channels>, Channels> masks{};
+  for (size_t channel = 0; channel < Channels; channel++) {
+    for (size_t block = 0; block < Channels; block++) {
+      for (size_t j = 0; j < 16; j++) {
+        size_t index = j * Channels + channel;
+        masks[channel][block][j] =
+            index / 16 == block ? static_cast<uint8_t>(index % 16) : 0x80;
+      }
+    }
+  }
+  return masks;
+}
+
+// The kernels below process full vectors and leave the remainder to their
+// scalar counterpart. Loads and stores are unaligned, as batches are only
+// element-aligned.
+
+__attribute__((target("avx2"))) void
+normalize_avx2(uint8_t *dst, const uint8_t *src, size_t size, float scale,
+               float bias) {
+  __m256 scales = _mm256_set1_ps(scale);
+  __m256 biases = _mm256_set1_ps(bias);
+  auto *out = reinterpret_cast<float *>(dst);
+
+  size_t i = 0;
+  for (; i + 32 <= size; i += 32) {
+    __m256i bytes =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i));
+    __m128i low = _mm256_castsi256_si128(bytes);
+    __m128i high = _mm256_extracti128_si256(bytes, 1);
+    __m128i quarters[] = {low, _mm_srli_si128(low, 8), high,
+                          _mm_srli_si128(high, 8)};
+    for (size_t j = 0; j < 4; j++) {
+      __m256 values = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(quarters[j]));
+      _mm256_storeu_ps(out + i + 8 * j,
+                       _mm256_add_ps(_mm256_mul_ps(values, scales), biases));
+    }
+  }
+
+  normalize_scalar(dst + i * sizeof(float), src + i, size - i, scale, bias);
+}
+
+__attribute__((target("avx512f"))) void
+normalize_avx512(uint8_t *dst, const uint8_t *src, size_t size, float scale,
+                 float bias) {
+  __m512 scales = _mm512_set1_ps(scale);
+  __m512 biases = _mm512_set1_ps(bias);
+  auto *out = reinterpret_cast<float *>(dst);
+
+  size_t i = 0;
+  for (; i + 64 <= size; i += 64) {
+    for (size_t j = 0; j < 4; j++) {
+      __m128i bytes = _mm_loadu_si128(
+          reinterpret_cast<const __m128i *>(src + i + 16 * j));
+      // The zero-masking forms avoid a spurious -Wuninitialized from GCC 12
+      // on the unmasked ones.
+      __m512 values = _mm512_maskz_cvtepi32_ps(
+          0xffff, _mm512_maskz_cvtepu8_epi32(0xffff, bytes));
+      _mm512_storeu_ps(out + i + 16 * j,
+                       _mm512_add_ps(_mm512_mul_ps(values, scales), biases));
+    }
+  }
+
+  normalize_scalar(dst + i * sizeof(float), src + i, size - i, scale, bias);
+}
+
+template <size_t WordSize>
+__attribute__((target("avx2"))) void
+byteswap_avx2(uint8_t *dst, const uint8_t *src, size_t size) {
+  static constexpr auto kMask = byteswap_mask<WordSize, 32>();
+  __m256i mask =
+      _mm256_loadu_si256(reinterpret_cast<const __m256i *>(kMask.data()));
+
+  size_t i = 0;
+  for (; i + 32 <= size; i += 32) {
+    __m256i words =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i));
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i),
+                        _mm256_shuffle_epi8(words, mask));
+  }
+
+  byteswap_scalar<WordSize>(dst + i, src + i, size - i);
+}
+
+template <size_t WordSize>
+__attribute__((target("avx512bw"))) void
+byteswap_avx512(uint8_t *dst, const uint8_t *src, size_t size) {
+  static constexpr auto kMask = byteswap_mask<WordSize, 64>();
+  __m512i mask = _mm512_loadu_si512(kMask.data());
+
+  size_t i = 0;
+  for (; i + 64 <= size; i += 64) {
+    __m512i words = _mm512_loadu_si512(src + i);
+    _mm512_storeu_si512(dst + i, _mm512_shuffle_epi8(words, mask));
+  }
+
+  byteswap_scalar<WordSize>(dst + i, src + i, size - i);
+}
+
+template <size_t Channels>
+__attribute__((target("avx2"))) void
+deinterleave_avx2(uint8_t *dst, const uint8_t *src, size_t pixels) {
+  static constexpr auto kMasks = deinterleave_masks<Channels>();
+
+  size_t i = 0;
+  for (; i + 16 <= pixels; i += 16) {
+    __m128i blocks[Channels];
+    for (size_t block = 0; block < Channels; block++)
+      blocks[block] = _mm_loadu_si128(
+          reinterpret_cast<const __m128i *>(src + i * Channels + 16 * block));
+
+    for (size_t channel = 0; channel < Channels; channel++) {
+      __m128i plane = _mm_setzero_si128();
+      for (size_t block = 0; block < Channels; block++) {
+        __m128i mask = _mm_loadu_si128(reinterpret_cast<const __m128i *>(
+            kMasks[channel][block].data()));
+        plane = _mm_or_si128(plane, _mm_shuffle_epi8(blocks[block], mask));
+      }
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + channel * pixels + i),
+                       plane);
+    }
+  }
+
+  deinterleave_scalar<Channels>(dst, src, pixels, i);
+}
+
+bool supports_avx512bw() {
+  static const bool supported = __builtin_cpu_supports("avx512bw");
+  return supported;
+}
+#endif
+
+template <size_t WordSize>
+Transform::Kernel byteswap_kernel(CopyKernel kernel) {
+  switch (kernel) {
+#ifdef BATCHED_SPSC_QUEUE_X86
+  case CopyKernel::AVX512:
+    if (supports_avx512bw())
+      return byteswap_avx512<WordSize>;
+    return byteswap_avx2<WordSize>;
+  case CopyKernel::AVX2:
+    return byteswap_avx2<WordSize>;
+#endif
+  default:
+    return byteswap_scalar<WordSize>;
+  }
+}
+
+template <size_t Channels>
+Transform::Kernel deinterleave_kernel(size_t frame_bytes,
+                                      [[maybe_unused]] CopyKernel kernel) {
+  size_t pixels = frame_bytes / Channels;
+  void (*frame_kernel)(uint8_t *, const uint8_t *, size_t) =
+      [](uint8_t *dst, const uint8_t *src, size_t n) {
+        deinterleave_scalar<Channels>(dst, src, n, 0);
+      };
+#ifdef BATCHED_SPSC_QUEUE_X86
+  if (kernel != CopyKernel::Scalar)
+    frame_kernel = deinterleave_avx2<Channels>;
+#endif
+
+  return [frame_kernel, frame_bytes, pixels](uint8_t *dst, const uint8_t *src,
+                                             size_t size) {
+    for (size_t offset = 0; offset < size; offset += frame_bytes)
+      frame_kernel(dst + offset, src + offset, pixels);
+  };
+}
+} // namespace
+
+Transform normalize_transform(float scale, float bias, CopyKernel kernel) {
+  Transform transform;
+  transform.in_bytes = 1;
+  transform.out_bytes = sizeof(float);
+
+  switch (supported(kernel)) {
+#ifdef BATCHED_SPSC_QUEUE_X86
+  case CopyKernel::AVX512:
+    transform.kernel = [scale, bias](uint8_t *dst, const uint8_t *src,
+                                     size_t size) {
+      normalize_avx512(dst, src, size, scale, bias);
+    };
+    break;
+  case CopyKernel::AVX2:
+    transform.kernel = [scale, bias](uint8_t *dst, const uint8_t *src,
+                                     size_t size) {
+      normalize_avx2(dst, src, size, scale, bias);
+    };
+    break;
+#endif
+  default:
+    transform.kernel = [scale, bias](uint8_t *dst, const uint8_t *src,
+                                     size_t size) {
+      normalize_scalar(dst, src, size, scale, bias);
+    };
+    break;
+  }
+  return transform;
+}
+
+Transform deinterleave_transform(size_t channels, size_t frame_bytes,
+                                 CopyKernel kernel) {
+  if (channels < 2 || channels > 4)
+    throw std::invalid_argument("channels must be between 2 and 4");
+  if (frame_bytes == 0 || frame_bytes % channels != 0)
+    throw std::invalid_argument("frame_bytes must be a multiple of channels");
+
+  Transform transform;
+  transform.in_bytes = frame_bytes;
+  transform.out_bytes = frame_bytes;
+  kernel = supported(kernel);
+  switch (channels) {
+  case 2:
+    transform.kernel = deinterleave_kernel<2>(frame_bytes, kernel);
+    break;
+  case 3:
+    transform.kernel = deinterleave_kernel<3>(frame_bytes, kernel);
+    break;
+  default:
+    transform.kernel = deinterleave_kernel<4>(frame_bytes, kernel);
+    break;
+  }
+  return transform;
+}
+
+Transform byteswap_transform(size_t word_size, CopyKernel kernel) {
+  Transform transform;
+  transform.in_bytes = word_size;
+  transform.out_bytes = word_size;
+  kernel = supported(kernel);
+  switch (word_size) {
+  case 2:
+    transform.kernel = byteswap_kernel<2>(kernel);
+    break;
+  case 4:
+    transform.kernel = byteswap_kernel<4>(kernel);
+    break;
+  case 8:
+    transform.kernel = byteswap_kernel<8>(kernel);
+    break;
+  default:
+    throw std::invalid_argument("word_size must be 2, 4 or 8");
+  }
+  return transform;
+}
+} // namespace batched_spsc_queue
@@ -0,0 +1,193 @@
+#include "adaptive_batching.hh"
+#include "batched_spsc_queue.hh"
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <future>
+#include <gtest/gtest.h>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+
+namespace batched_spsc_queue {
+namespace {
+void write_elements(Queue &queue, uint64_t &next, size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    auto *slot = reinterpret_cast<uint64_t *>(queue.write_ptr(1));
+    ASSERT_NE(slot, nullptr);
+    *slot = next++;
+    queue.commit_write(1);
+  }
+}
+} // namespace
+
+TEST(AdaptiveReader_FollowsOccupancy, BATCHED_SPSC_QUEUE) {
+  size_t nb_slots = 256;
+  auto buffer = std::make_unique<uint8_t[]>(nb_slots * sizeof(uint64_t));
+  auto queue = Queue(nb_slots, 1, 1, sizeof(uint64_t), buffer.get());
+  auto *slots = reinterpret_cast<uint64_t *>(buffer.get());
+  AdaptiveReader reader(queue, {.min_batch_size = 1,
+                                .max_batch_size = 32,
+                                .sample_interval = 4});
+  EXPECT_EQ(reader.batch_size(), 1);
+
+  // A backlog: the batches grow up to the maximum.
+  uint64_t written = 0;
+  uint64_t read = 0;
+  for (size_t i = 0; i < 2000; i++) {
+    write_elements(queue, written, nb_slots - 1 - queue.size());
+    size_t count;
+    auto *batch = reinterpret_cast<uint64_t *>(reader.read_ptr(count));
+    ASSERT_NE(batch, nullptr);
+    EXPECT_LE(batch + count, slots + nb_slots);
+    EXPECT_EQ(batch[0], read);
+    read += count;
+    queue.commit_read(count);
+  }
+  EXPECT_EQ(reader.batch_size(), 32);
+
+  // Once the traffic stops, the rest is read in smaller and smaller batches.
+  size_t count;
+  while (read < written) {
+    auto *batch = reinterpret_cast<uint64_t *>(reader.read_ptr(count));
+    if (batch == nullptr)
+      continue;
+    EXPECT_EQ(batch[0], read);
+    read += count;
+    queue.commit_read(count);
+  }
+  write_elements(queue, written, 1);
+  for (size_t i = 0; i < 100 && reader.read_ptr(count) == nullptr; i++)
+    ;
+  EXPECT_EQ(reader.batch_size(), 1);
+  EXPECT_EQ(count, 1);
+}
+
+TEST(AdaptiveReader_Hysteresis, BATCHED_SPSC_QUEUE) {
+  // An occupancy of 6 elements makes the size grow from 1 to 2, but is below
+  // both the threshold to grow to 4 (8) and to shrink back to 1 (2).
+  size_t nb_slots = 64;
+  auto buffer = std::make_unique<uint8_t[]>(nb_slots * sizeof(uint64_t));
+  auto queue = Queue(nb_slots, 1, 1, sizeof(uint64_t), buffer.get());
+  AdaptiveReader reader(queue, {.min_batch_size = 1,
+                                .max_batch_size = 16,
+                                .sample_interval = 1});
+
+  uint64_t written = 0;
+  for (size_t i = 0; i < 1000; i++) {
+    write_elements(queue, written, 6 - queue.size());
+    size_t count;
+    ASSERT_NE(reader.read_ptr(count), nullptr);
+    queue.commit_read(count);
+  }
+  EXPECT_EQ(reader.batch_size(), 2);
+  EXPECT_EQ(reader.resizes(), 1);
+}
+
+TEST(AdaptiveWriter_FitsFreeSlots, BATCHED_SPSC_QUEUE) {
+  size_t nb_slots = 64;
+  auto buffer = std::make_unique<uint8_t[]>(nb_slots * sizeof(uint64_t));
+  auto queue = Queue(nb_slots, 1, 1, sizeof(uint64_t), buffer.get());
+  AdaptiveWriter writer(queue, {.min_batch_size = 1,
+                                .max_batch_size = 8,
+                                .sample_interval = 1});
+
+  // The consumer lags behind by about 40 elements: the producer grows its
+  // batches, but only as long as they fit in the free slots.
+  uint64_t written = 0;
+  uint64_t read = 0;
+  for (size_t i = 0; i < 1000; i++) {
+    size_t count;
+    auto *batch = reinterpret_cast<uint64_t *>(writer.write_ptr(count));
+    if (batch != nullptr) {
+      for (size_t j = 0; j < count; j++)
+        batch[j] = written++;
+      queue.commit_write(count);
+    }
+    while (queue.size() > 40) {
+      auto *element = reinterpret_cast<uint64_t *>(queue.read_ptr(1));
+      ASSERT_NE(element, nullptr);
+      EXPECT_EQ(*element, read++);
+      queue.commit_read(1);
+    }
+  }
+  EXPECT_EQ(writer.batch_size(), 8);
+
+  // A full queue makes it shrink back.
+  for (size_t i = 0; i < 100; i++) {
+    size_t count;
+    if (writer.write_ptr(count) != nullptr)
+      queue.commit_write(count);
+  }
+  EXPECT_EQ(queue.size(), nb_slots - 1);
+  EXPECT_EQ(writer.batch_size(), 1);
+}
+
+TEST(AdaptiveBatching_InvalidOptions, BATCHED_SPSC_QUEUE) {
+  size_t nb_slots = 48;
+  auto buffer = std::make_unique<uint8_t[]>(nb_slots);
+  auto queue = Queue(nb_slots, 1, 1, 1, buffer.get());
+
+  EXPECT_THROW(AdaptiveReader(queue, {.min_batch_size = 3}),
+               std::invalid_argument);
+  EXPECT_THROW(AdaptiveReader(queue, {.min_batch_size = 0}),
+               std::invalid_argument);
+  EXPECT_THROW(
+      AdaptiveReader(queue, {.min_batch_size = 8, .max_batch_size = 4}),
+      std::invalid_argument);
+  // 48 is not a multiple of 32.
+  EXPECT_THROW(AdaptiveWriter(queue, {.max_batch_size = 32}),
+               std::invalid_argument);
+  EXPECT_THROW(AdaptiveWriter(queue, {.max_batch_size = 16,
+                                      .sample_interval = 0}),
+               std::invalid_argument);
+  EXPECT_NO_THROW(AdaptiveWriter(queue, {.max_batch_size = 16}));
+}
+
+TEST(MT_AdaptiveBatching, BATCHED_SPSC_QUEUE) {
+  // Both sides adapt, with bursts separated by pauses.
+  size_t nb_slots = 1024;
+  uint64_t nb_elements = 1000000;
+  auto buffer = std::make_unique<uint8_t[]>(nb_slots * sizeof(uint64_t));
+  auto queue = Queue(nb_slots, 1, 1, sizeof(uint64_t), buffer.get());
+  AdaptiveBatchOptions options{.min_batch_size = 1, .max_batch_size = 64};
+
+  auto producer = std::async(std::launch::async, [&]() {
+    AdaptiveWriter writer(queue, options);
+    uint64_t written = 0;
+    while (written < nb_elements) {
+      size_t count;
+      auto *batch = reinterpret_cast<uint64_t *>(writer.write_ptr(count));
+      if (batch == nullptr) {
+        std::this_thread::yield();
+        continue;
+      }
+      count = std::min<uint64_t>(count, nb_elements - written);
+      for (size_t i = 0; i < count; i++)
+        batch[i] = written++;
+      queue.commit_write(count);
+      if (written % 100000 < count)
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+    }
+  });
+
+  AdaptiveReader reader(queue, options);
+  bool in_order = true;
+  uint64_t read = 0;
+  while (read < nb_elements) {
+    size_t count;
+    auto *batch = reinterpret_cast<uint64_t *>(reader.read_ptr(count));
+    if (batch == nullptr) {
+      std::this_thread::yield();
+      continue;
+    }
+    for (size_t i = 0; i < count; i++)
+      in_order = in_order && batch[i] == read + i;
+    read += count;
+    queue.commit_read(count);
+  }
+  producer.get();
+
+  EXPECT_TRUE(in_order);
+}
+} // namespace batched_spsc_queue
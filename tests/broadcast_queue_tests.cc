@@ -0,0 +1,174 @@
+#include "broadcast_queue.hh"
+#include <cstdint>
+#include <future>
+#include <gtest/gtest.h>
+#include <memory>
+#include <numeric>
+#include <stdexcept>
+#include <thread>
+
+namespace batched_spsc_queue {
+namespace {
+void enqueue(BroadcastQueue &queue, size_t first, size_t batch_size) {
+  auto *batch = reinterpret_cast<size_t *>(queue.write_ptr());
+  ASSERT_NE(batch, nullptr);
+  std::iota(batch, batch + batch_size, first);
+  queue.commit_write();
+}
+} // namespace
+
+TEST(BroadcastQueue_Slowest_Consumer, BATCHED_SPSC_QUEUE) {
+  auto buffer = std::make_unique<uint8_t[]>(16 * sizeof(size_t));
+  BroadcastQueue queue(16, 4, 2, sizeof(size_t), buffer.get(), 2);
+  auto fast = queue.attach();
+  auto slow = queue.attach();
+
+  // Both consumers see the same batches, in the shared buffer.
+  for (size_t i = 0; i < 16; i += 4)
+    enqueue(queue, i, 4);
+  ASSERT_EQ(queue.write_ptr(), nullptr);
+
+  for (size_t i = 0; i < 16; i += 2) {
+    auto *batch = reinterpret_cast<size_t *>(fast.read_ptr());
+    ASSERT_NE(batch, nullptr);
+    ASSERT_EQ(batch[0], i);
+    ASSERT_EQ(batch[1], i + 1);
+    fast.commit_read();
+  }
+  ASSERT_EQ(fast.read_ptr(), nullptr);
+
+  // The slow consumer still holds every slot.
+  ASSERT_EQ(queue.write_ptr(), nullptr);
+  ASSERT_EQ(slow.size(), 16);
+  ASSERT_EQ(slow.read_ptr(), buffer.get());
+  slow.commit_read();
+  ASSERT_EQ(queue.write_ptr(), nullptr);
+  slow.commit_read();
+  ASSERT_NE(queue.write_ptr(), nullptr);
+
+  // Detaching the slow consumer frees the producer.
+  slow.detach();
+  for (size_t i = 16; i < 32; i += 4)
+    enqueue(queue, i, 4);
+  ASSERT_EQ(queue.write_ptr(), nullptr);
+}
+
+TEST(BroadcastQueue_Attach_Detach, BATCHED_SPSC_QUEUE) {
+  auto buffer = std::make_unique<uint8_t[]>(16 * sizeof(size_t));
+  BroadcastQueue queue(16, 2, 4, sizeof(size_t), buffer.get(), 1);
+
+  // Without consumers, the producer never blocks.
+  for (size_t i = 0; i < 64; i += 2)
+    enqueue(queue, i, 2);
+
+  {
+    // A late consumer starts at the next dequeue batch boundary.
+    enqueue(queue, 64, 2);
+    auto consumer = queue.attach();
+    ASSERT_THROW(queue.attach(), std::runtime_error);
+    ASSERT_EQ(consumer.read_ptr(), nullptr);
+    for (size_t i = 66; i < 72; i += 2)
+      enqueue(queue, i, 2);
+
+    auto *batch = reinterpret_cast<size_t *>(consumer.read_ptr());
+    ASSERT_NE(batch, nullptr);
+    ASSERT_EQ(batch[0], 68);
+    consumer.commit_read();
+  }
+
+  // The cursor is released on destruction.
+  auto consumer = queue.attach();
+  ASSERT_EQ(consumer.size(), 0);
+}
+
+TEST(BroadcastQueue_Tap_Lapped, BATCHED_SPSC_QUEUE) {
+  auto buffer = std::make_unique<uint8_t[]>(16 * sizeof(size_t));
+  BroadcastQueue queue(16, 4, 4, sizeof(size_t), buffer.get(), 1);
+  auto tap = queue.tap();
+
+  enqueue(queue, 0, 4);
+  auto *batch = reinterpret_cast<size_t *>(tap.read_ptr());
+  ASSERT_NE(batch, nullptr);
+  ASSERT_EQ(batch[0], 0);
+  ASSERT_TRUE(tap.commit_read());
+  ASSERT_EQ(tap.read_ptr(), nullptr);
+
+  // The tap does not hold the producer back. Being lapped, it skips ahead.
+  for (size_t i = 4; i < 40; i += 4)
+    enqueue(queue, i, 4);
+  ASSERT_EQ(tap.read_ptr(), nullptr);
+  ASSERT_EQ(tap.lapped(), 36);
+  enqueue(queue, 40, 4);
+  batch = reinterpret_cast<size_t *>(tap.read_ptr());
+  ASSERT_NE(batch, nullptr);
+  ASSERT_EQ(batch[0], 40);
+
+  // The producer overwrites the batch while the tap reads it.
+  for (size_t i = 44; i < 60; i += 4)
+    enqueue(queue, i, 4);
+  ASSERT_FALSE(tap.commit_read());
+  ASSERT_EQ(tap.lapped(), 40);
+}
+
+TEST(MT_BroadcastQueue, BATCHED_SPSC_QUEUE) {
+  constexpr size_t nb_elements = 1 << 18;
+  auto buffer = std::make_unique<uint8_t[]>(256 * sizeof(size_t));
+  BroadcastQueue queue(256, 8, 16, sizeof(size_t), buffer.get(), 2);
+  auto first = queue.attach();
+  auto second = queue.attach();
+  auto tap = queue.tap();
+  std::atomic<bool> done{false};
+
+  auto consume = [](BroadcastQueue::Consumer &consumer) {
+    for (size_t i = 0; i < nb_elements; i += 16) {
+      size_t *batch = nullptr;
+      while ((batch = reinterpret_cast<size_t *>(consumer.read_ptr())) ==
+             nullptr)
+        std::this_thread::yield();
+      for (size_t j = 0; j < 16; ++j)
+        if (batch[j] != i + j)
+          return false;
+      consumer.commit_read();
+    }
+    return true;
+  };
+
+  // The tap only checks the batches it reports as intact.
+  auto spy = [&]() {
+    size_t intact = 0;
+    while (!done.load()) {
+      auto *batch = reinterpret_cast<size_t *>(tap.read_ptr());
+      if (batch == nullptr) {
+        std::this_thread::yield();
+        continue;
+      }
+      size_t first_element = batch[0];
+      bool consecutive = batch[15] == first_element + 15;
+      if (tap.commit_read()) {
+        if (!consecutive)
+          return false;
+        ++intact;
+      }
+    }
+    return intact > 0 || tap.lapped() > 0;
+  };
+
+  auto first_result = std::async(std::launch::async, consume, std::ref(first));
+  auto second_result =
+      std::async(std::launch::async, consume, std::ref(second));
+  auto tap_result = std::async(std::launch::async, spy);
+
+  for (size_t i = 0; i < nb_elements; i += 8) {
+    size_t *batch = nullptr;
+    while ((batch = reinterpret_cast<size_t *>(queue.write_ptr())) == nullptr)
+      std::this_thread::yield();
+    std::iota(batch, batch + 8, i);
+    queue.commit_write();
+  }
+
+  ASSERT_TRUE(first_result.get());
+  ASSERT_TRUE(second_result.get());
+  done.store(true);
+  ASSERT_TRUE(tap_result.get());
+}
+} // namespace batched_spsc_queue
@@ -0,0 +1,70 @@
+#include "batched_spsc_queue.hh"
+#include "buffer.hh"
+#include <cstdint>
+#include <gtest/gtest.h>
+#include <stdexcept>
+#include <unistd.h>
+#include <utility>
+
+namespace batched_spsc_queue {
+TEST(Buffer_Allocation, BATCHED_SPSC_QUEUE) {
+  auto page_size = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE));
+
+  for (auto huge_pages :
+       {HugePages::None, HugePages::Transparent, HugePages::Explicit}) {
+    for (bool prefault : {false, true}) {
+      BufferOptions options;
+      options.huge_pages = huge_pages;
+      options.prefault = prefault;
+      Buffer buffer(3 * 1024 * 1024 + 5, options);
+
+      ASSERT_NE(buffer.data(), nullptr);
+      ASSERT_EQ(buffer.size(), 3 * 1024 * 1024 + 5);
+      ASSERT_EQ(reinterpret_cast<uintptr_t>(buffer.data()) % page_size, 0);
+      ASSERT_EQ(reinterpret_cast<uintptr_t>(buffer.data()) % CACHE_LINE_SIZE,
+                0);
+      if (huge_pages == HugePages::None) {
+        ASSERT_EQ(buffer.huge_pages(), HugePages::None);
+      }
+
+      buffer.data()[0] = 1;
+      buffer.data()[buffer.size() - 1] = 2;
+      ASSERT_EQ(buffer.data()[0] + buffer.data()[buffer.size() - 1], 3);
+    }
+  }
+
+  ASSERT_THROW(Buffer(0), std::invalid_argument);
+}
+
+TEST(Buffer_Move, BATCHED_SPSC_QUEUE) {
+  Buffer buffer(4096);
+  uint8_t *data = buffer.data();
+
+  Buffer moved(std::move(buffer));
+  ASSERT_EQ(moved.data(), data);
+  ASSERT_EQ(buffer.data(), nullptr); // NOLINT(bugprone-use-after-move)
+
+  buffer = std::move(moved);
+  ASSERT_EQ(buffer.data(), data);
+}
+
+TEST(Buffer_Owned_By_Queue, BATCHED_SPSC_QUEUE) {
+  BufferOptions options;
+  options.prefault = true;
+  auto queue = Queue(128, 8, 64, 1024, options);
+
+  ASSERT_EQ(queue.owned_buffer().size(), 128 * 1024);
+  for (size_t i = 0; i < 8; i++) {
+    uint8_t *batch = queue.write_ptr();
+    ASSERT_EQ(batch, queue.owned_buffer().data() + i * 8 * 1024);
+    batch[0] = static_cast<uint8_t>(i);
+    queue.commit_write();
+  }
+
+  uint8_t *batch = queue.read_ptr();
+  ASSERT_EQ(batch, queue.owned_buffer().data());
+  for (size_t i = 0; i < 8; i++)
+    ASSERT_EQ(batch[i * 8 * 1024], i);
+  queue.commit_read();
+}
+} // namespace batched_spsc_queue
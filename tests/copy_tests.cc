@@ -0,0 +1,58 @@
+#include "batched_spsc_queue.hh"
+#include "copy.hh"
+#include <cstdint>
+#include <gtest/gtest.h>
+#include <memory>
+#include <vector>
+
+namespace batched_spsc_queue {
+TEST(Copy_Kernels, BATCHED_SPSC_QUEUE) {
+  // Sizes around the vector widths, with both pointers misaligned, so that
+  // every kernel goes through its head, loop and tail.
+  std::vector<uint8_t> src(4096 + 64);
+  for (size_t i = 0; i < src.size(); ++i)
+    src[i] = static_cast<uint8_t>(i * 7 + 1);
+
+  for (CopyKernel kernel :
+       {CopyKernel::Scalar, CopyKernel::AVX2, CopyKernel::AVX512}) {
+    for (size_t size : {0, 1, 31, 64, 255, 256, 257, 4000}) {
+      for (size_t offset : {0, 1, 13, 32}) {
+        std::vector<uint8_t> dst(src.size(), 0);
+        copy_batch(dst.data() + offset, src.data() + 3, size, kernel);
+        for (size_t i = 0; i < dst.size(); ++i) {
+          bool copied = i >= offset && i < offset + size;
+          ASSERT_EQ(dst[i], copied ? src[i - offset + 3] : 0)
+              << "kernel " << static_cast<int>(kernel) << ", size " << size
+              << ", offset " << offset << ", byte " << i;
+        }
+      }
+    }
+  }
+}
+
+TEST(Copy_Enqueue_Dequeue, BATCHED_SPSC_QUEUE) {
+  // Batches above kNonTemporalThreshold, to go through the streaming path.
+  size_t nb_slots = 4;
+  size_t element_size = kNonTemporalThreshold / 2 + 40;
+  size_t batch_bytes = 2 * element_size;
+  auto buffer = std::make_unique<uint8_t[]>(nb_slots * element_size);
+  Queue queue(nb_slots, 2, 2, element_size, buffer.get());
+
+  std::vector<uint8_t> src(batch_bytes);
+  std::vector<uint8_t> dst(batch_bytes);
+  ASSERT_FALSE(queue.dequeue_copy(dst.data()));
+
+  for (uint8_t round = 0; round < 5; ++round) {
+    for (size_t i = 0; i < batch_bytes; ++i)
+      src[i] = static_cast<uint8_t>(i + round);
+
+    ASSERT_TRUE(queue.enqueue_copy(src.data()));
+    ASSERT_EQ(queue.size(), 2);
+    ASSERT_TRUE(queue.dequeue_copy(dst.data()));
+    ASSERT_EQ(dst, src);
+  }
+
+  ASSERT_TRUE(queue.enqueue_copy(src.data()));
+  ASSERT_FALSE(queue.enqueue_copy(src.data()));
+}
+} // namespace batched_spsc_queue
@@ -0,0 +1,133 @@
+#include "batched_spsc_queue.hh"
+#include "coroutine.hh"
+#include <cstdint>
+#include <gtest/gtest.h>
+#include <memory>
+#include <numeric>
+#include <stdexcept>
+#include <thread>
+
+namespace batched_spsc_queue {
+namespace {
+constexpr size_t kNbSlots = 12;
+constexpr size_t kEnqueueBatchSize = 2;
+constexpr size_t kDequeueBatchSize = 3;
+
+Task produce(Queue &queue, size_t nb_elements) {
+  for (size_t i = 0; i < nb_elements; i += kEnqueueBatchSize) {
+    auto *batch = reinterpret_cast<size_t *>(co_await queue.next_write_batch());
+    std::iota(batch, batch + kEnqueueBatchSize, i);
+    queue.commit_write();
+  }
+}
+
+Task consume(Queue &queue, size_t nb_elements, bool &in_order) {
+  in_order = true;
+  for (size_t i = 0; i < nb_elements; i += kDequeueBatchSize) {
+    auto *batch = reinterpret_cast<size_t *>(co_await queue.next_read_batch());
+    for (size_t j = 0; j < kDequeueBatchSize; j++)
+      in_order = in_order && batch[j] == i + j;
+    queue.commit_read();
+  }
+}
+
+std::unique_ptr<Queue> make_queue(std::unique_ptr<uint8_t[]> &buffer) {
+  buffer = std::make_unique<uint8_t[]>(kNbSlots * sizeof(size_t));
+  return std::make_unique<Queue>(kNbSlots, kEnqueueBatchSize,
+                                 kDequeueBatchSize, sizeof(size_t),
+                                 buffer.get(), true);
+}
+} // namespace
+
+TEST(Coroutine_SameExecutor, BATCHED_SPSC_QUEUE) {
+  // Both sides take turns on one thread, each suspending when the queue is
+  // full or empty.
+  std::unique_ptr<uint8_t[]> buffer;
+  auto queue_ptr = make_queue(buffer);
+  Queue &queue = *queue_ptr;
+  size_t nb_elements = 6000;
+  bool in_order = false;
+
+  Executor executor;
+  executor.spawn(consume(queue, nb_elements, in_order));
+  executor.spawn(produce(queue, nb_elements));
+  executor.run();
+
+  EXPECT_TRUE(in_order);
+  EXPECT_EQ(queue.size(), 0);
+}
+
+TEST(Coroutine_ManyQueues, BATCHED_SPSC_QUEUE) {
+  std::unique_ptr<uint8_t[]> buffers[8];
+  std::unique_ptr<Queue> queues[8];
+  bool in_order[8] = {};
+  size_t nb_elements = 600;
+
+  Executor executor;
+  for (size_t i = 0; i < 8; i++) {
+    queues[i] = make_queue(buffers[i]);
+    executor.spawn(produce(*queues[i], nb_elements));
+    executor.spawn(consume(*queues[i], nb_elements, in_order[i]));
+  }
+  executor.run();
+
+  for (size_t i = 0; i < 8; i++)
+    EXPECT_TRUE(in_order[i]);
+}
+
+TEST(Coroutine_RequiresParking, BATCHED_SPSC_QUEUE) {
+  auto buffer = std::make_unique<uint8_t[]>(kNbSlots);
+  auto queue = Queue(kNbSlots, 1, 1, 1, buffer.get());
+
+  EXPECT_THROW(queue.next_write_batch(), std::logic_error);
+  EXPECT_THROW(queue.next_read_batch(), std::logic_error);
+}
+
+TEST(MT_Coroutine_TwoExecutors, BATCHED_SPSC_QUEUE) {
+  // Each side is resumed by commits from the other thread.
+  std::unique_ptr<uint8_t[]> buffer;
+  auto queue_ptr = make_queue(buffer);
+  Queue &queue = *queue_ptr;
+  size_t nb_elements = 600000;
+  bool in_order = false;
+
+  std::thread producer([&]() {
+    Executor executor;
+    executor.spawn(produce(queue, nb_elements));
+    executor.run();
+  });
+
+  Executor executor;
+  executor.spawn(consume(queue, nb_elements, in_order));
+  executor.run();
+  producer.join();
+
+  EXPECT_TRUE(in_order);
+}
+
+TEST(MT_Coroutine_PlainThread, BATCHED_SPSC_QUEUE) {
+  // The producer is a plain thread parking on the queue, the consumer a
+  // coroutine.
+  std::unique_ptr<uint8_t[]> buffer;
+  auto queue_ptr = make_queue(buffer);
+  Queue &queue = *queue_ptr;
+  size_t nb_elements = 600000;
+  bool in_order = false;
+
+  std::thread producer([&]() {
+    for (size_t i = 0; i < nb_elements; i += kEnqueueBatchSize) {
+      auto *batch =
+          reinterpret_cast<size_t *>(queue.wait_write_ptr(WaitPolicy::Park));
+      std::iota(batch, batch + kEnqueueBatchSize, i);
+      queue.commit_write();
+    }
+  });
+
+  Executor executor;
+  executor.spawn(consume(queue, nb_elements, in_order));
+  executor.run();
+  producer.join();
+
+  EXPECT_TRUE(in_order);
+}
+} // namespace batched_spsc_queue
@@ -0,0 +1,157 @@
+#include "dispatcher.hh"
+#include <algorithm>
+#include <cstdint>
+#include <future>
+#include <gtest/gtest.h>
+#include <numeric>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+namespace batched_spsc_queue {
+namespace {
+size_t dispatch(Dispatcher &dispatcher, size_t value) {
+  auto *batch = reinterpret_cast<size_t *>(dispatcher.write_ptr());
+  if (batch == nullptr)
+    return dispatcher.nb_queues();
+  std::fill(batch, batch + 4, value);
+  dispatcher.commit_write();
+  return dispatcher.target();
+}
+} // namespace
+
+TEST(Dispatcher_RoundRobin, BATCHED_SPSC_QUEUE) {
+  Dispatcher dispatcher(3, 8, 4, 4, sizeof(size_t),
+                        DispatchPolicy::RoundRobin);
+  ASSERT_EQ(dispatch(dispatcher, 0), 0);
+  ASSERT_EQ(dispatch(dispatcher, 1), 1);
+  ASSERT_EQ(dispatch(dispatcher, 2), 2);
+
+  // Each queue holds a single batch: the full ones are skipped.
+  ASSERT_NE(dispatcher.queue(1).read_ptr(), nullptr);
+  dispatcher.queue(1).commit_read();
+  ASSERT_EQ(dispatch(dispatcher, 3), 1);
+  ASSERT_EQ(dispatch(dispatcher, 4), 3);
+  ASSERT_THROW(Dispatcher(0, 8, 4, 4, 1, DispatchPolicy::RoundRobin),
+               std::invalid_argument);
+}
+
+TEST(Dispatcher_LeastOccupied, BATCHED_SPSC_QUEUE) {
+  Dispatcher dispatcher(2, 16, 4, 4, sizeof(size_t),
+                        DispatchPolicy::LeastOccupied);
+  for (size_t i = 0; i < 4; ++i)
+    dispatch(dispatcher, i);
+  ASSERT_EQ(dispatcher.queue(0).size(), 8);
+  ASSERT_EQ(dispatcher.queue(1).size(), 8);
+
+  // Once the second consumer catches up, it gets the next batches.
+  Queue &fast = dispatcher.queue(1);
+  while (fast.read_ptr() != nullptr)
+    fast.commit_read();
+  for (size_t i = 0; i < 4; ++i)
+    dispatch(dispatcher, i);
+  ASSERT_EQ(dispatcher.queue(0).size(), 12);
+  ASSERT_EQ(dispatcher.queue(1).size(), 12);
+}
+
+TEST(Dispatcher_KeyAffinity, BATCHED_SPSC_QUEUE) {
+  Dispatcher dispatcher(4, 8, 4, 4, sizeof(size_t),
+                        DispatchPolicy::KeyAffinity);
+
+  // The same key always maps to the same queue, and keys spread over queues.
+  std::vector<size_t> targets;
+  for (uint64_t key = 0; key < 16; ++key) {
+    ASSERT_NE(dispatcher.write_ptr(key), nullptr);
+    targets.push_back(dispatcher.target());
+    dispatcher.write_ptr(key);
+    ASSERT_EQ(dispatcher.target(), targets.back());
+  }
+  std::sort(targets.begin(), targets.end());
+  ASSERT_GT(std::unique(targets.begin(), targets.end()) - targets.begin(), 1);
+
+  // Even when the queue of the key is full.
+  ASSERT_NE(dispatcher.write_ptr(7), nullptr);
+  size_t target = dispatcher.target();
+  dispatcher.commit_write();
+  ASSERT_EQ(dispatcher.write_ptr(7), nullptr);
+  ASSERT_EQ(dispatcher.target(), target);
+}
+
+TEST(Dispatcher_Sequence_Numbers, BATCHED_SPSC_QUEUE) {
+  Dispatcher dispatcher(3, 16, 4, 4, sizeof(size_t),
+                        DispatchPolicy::RoundRobin, true);
+  for (size_t i = 0; i < 9; ++i)
+    dispatch(dispatcher, i);
+
+  // Merge the batches back in order by picking the queue whose next batch has
+  // the expected sequence number.
+  for (uint64_t expected = 0; expected < 9; ++expected) {
+    bool found = false;
+    for (size_t q = 0; q < dispatcher.nb_queues() && !found; ++q) {
+      auto *batch = dispatcher.queue(q).read_ptr();
+      if (batch == nullptr || dispatcher.sequence(q, batch) != expected)
+        continue;
+      ASSERT_EQ(*reinterpret_cast<size_t *>(batch), expected);
+      dispatcher.queue(q).commit_read();
+      found = true;
+    }
+    ASSERT_TRUE(found);
+  }
+}
+
+TEST(MT_Dispatcher, BATCHED_SPSC_QUEUE) {
+  constexpr size_t nb_consumers = 4;
+  constexpr size_t nb_batches = 1 << 14;
+  Dispatcher dispatcher(nb_consumers, 64, 4, 4, sizeof(size_t),
+                        DispatchPolicy::LeastOccupied, true);
+
+  std::vector<std::future<std::vector<uint64_t>>> consumers;
+  for (size_t q = 0; q < nb_consumers; ++q)
+    consumers.push_back(std::async(std::launch::async, [&dispatcher, q]() {
+      std::vector<uint64_t> sequences;
+      Queue &queue = dispatcher.queue(q);
+      while (true) {
+        auto *batch = reinterpret_cast<size_t *>(queue.read_ptr());
+        if (batch == nullptr) {
+          std::this_thread::yield();
+          continue;
+        }
+        if (batch[0] == SIZE_MAX)
+          break;
+        uint64_t sequence =
+            dispatcher.sequence(q, reinterpret_cast<uint8_t *>(batch));
+        if (batch[0] != sequence || batch[3] != sequence)
+          return std::vector<uint64_t>{};
+        sequences.push_back(sequence);
+        queue.commit_read();
+      }
+      return sequences;
+    }));
+
+  for (size_t i = 0; i < nb_batches; ++i)
+    while (dispatch(dispatcher, i) == nb_consumers)
+      std::this_thread::yield();
+
+  // One end-of-stream batch per consumer, written to its queue directly.
+  for (size_t q = 0; q < nb_consumers; ++q) {
+    Queue &queue = dispatcher.queue(q);
+    size_t *batch = nullptr;
+    while ((batch = reinterpret_cast<size_t *>(queue.write_ptr())) == nullptr)
+      std::this_thread::yield();
+    *batch = SIZE_MAX;
+    queue.commit_write();
+  }
+
+  // Every batch was consumed exactly once, in order within each queue.
+  std::vector<uint64_t> all;
+  for (auto &consumer : consumers) {
+    auto sequences = consumer.get();
+    ASSERT_TRUE(std::is_sorted(sequences.begin(), sequences.end()));
+    all.insert(all.end(), sequences.begin(), sequences.end());
+  }
+  std::sort(all.begin(), all.end());
+  std::vector<uint64_t> expected(nb_batches);
+  std::iota(expected.begin(), expected.end(), 0);
+  ASSERT_EQ(all, expected);
+}
+} // namespace batched_spsc_queue
@@ -0,0 +1,156 @@
+#include "file_io.hh"
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <gtest/gtest.h>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace batched_spsc_queue {
+namespace {
+std::string temp_path(const std::string &name) {
+  return (std::filesystem::temp_directory_path() /
+          ("batched_spsc_queue_" + name + "_" + std::to_string(getpid())))
+      .string();
+}
+
+std::vector<uint8_t> pattern(size_t size) {
+  std::vector<uint8_t> data(size);
+  for (size_t i = 0; i < size; ++i)
+    data[i] = static_cast<uint8_t>(i * 31 + i / 4096);
+  return data;
+}
+
+std::vector<uint8_t> read_file(const std::string &path) {
+  std::ifstream file(path, std::ios::binary);
+  return {std::istreambuf_iterator<char>(file),
+          std::istreambuf_iterator<char>()};
+}
+
+/// Replays a file through a queue and returns what the consumer received.
+std::vector<uint8_t> replay(const std::string &path, Queue &queue,
+                            const FileIoOptions &options, bool &direct) {
+  FileSource source(path, queue, options);
+  direct = source.direct();
+
+  std::thread producer([&source]() { source.run(); });
+
+  // The consumer reads whatever is there, since the last batch is partial.
+  std::vector<uint8_t> received;
+  size_t expected = std::filesystem::file_size(path) /
+                    queue.element_size() * queue.element_size();
+  while (received.size() < expected) {
+    size_t n = queue.available_contiguous_read();
+    if (n == 0) {
+      std::this_thread::yield();
+      continue;
+    }
+
+    const uint8_t *data = queue.read_ptr(n);
+    received.insert(received.end(), data, data + n * queue.element_size());
+    queue.commit_read(n);
+  }
+
+  producer.join();
+  EXPECT_TRUE(source.eof());
+  EXPECT_EQ(source.bytes_read(), expected);
+  return received;
+}
+} // namespace
+
+TEST(FileSource_Replay, BATCHED_SPSC_QUEUE) {
+  // 100 batches and a partial one, ending with half an element.
+  size_t element_size = 64;
+  size_t batch_bytes = 4 * element_size;
+  std::vector<uint8_t> data =
+      pattern(100 * batch_bytes + 3 * element_size + 32);
+  std::string path = temp_path("source");
+  std::ofstream(path, std::ios::binary)
+      .write(reinterpret_cast<const char *>(data.data()),
+             static_cast<std::streamsize>(data.size()));
+
+  auto buffer = std::make_unique<uint8_t[]>(32 * element_size);
+  Queue queue(32, 4, 4, element_size, buffer.get());
+  FileIoOptions options;
+  options.queue_depth = 3;
+  bool direct = true;
+  std::vector<uint8_t> received = replay(path, queue, options, direct);
+
+  ASSERT_FALSE(direct);
+  data.resize(data.size() - 32);
+  ASSERT_EQ(received, data);
+  std::remove(path.c_str());
+}
+
+TEST(FileSource_Replay_Direct, BATCHED_SPSC_QUEUE) {
+  // Page-aligned slots and batches, so that O_DIRECT can be used if the file
+  // system supports it.
+  size_t element_size = kDirectIoAlignment;
+  std::vector<uint8_t> data = pattern(50 * 2 * element_size + element_size);
+  std::string path = temp_path("source_direct");
+  std::ofstream(path, std::ios::binary)
+      .write(reinterpret_cast<const char *>(data.data()),
+             static_cast<std::streamsize>(data.size()));
+
+  Queue queue(16, 2, 2, element_size, BufferOptions{});
+  bool direct = false;
+  ASSERT_EQ(replay(path, queue, FileIoOptions{}, direct), data);
+  std::remove(path.c_str());
+}
+
+TEST(FileSink_Record, BATCHED_SPSC_QUEUE) {
+  for (bool aligned : {false, true}) {
+    size_t element_size = aligned ? kDirectIoAlignment : 48;
+    std::vector<uint8_t> data = pattern(203 * element_size);
+    std::string path = temp_path("sink");
+
+    Queue queue(32, 1, 4, element_size, BufferOptions{});
+    FileIoOptions options;
+    options.queue_depth = 8;
+    {
+      FileSink sink(path, queue, options);
+      // O_DIRECT also depends on the file system.
+      ASSERT_TRUE(aligned || !sink.direct());
+
+      std::thread producer([&]() {
+        for (size_t i = 0; i < data.size(); i += element_size) {
+          uint8_t *slot = queue.wait_write_ptr(WaitPolicy::SpinThenYield);
+          std::copy_n(data.data() + i, element_size, slot);
+          queue.commit_write();
+        }
+      });
+
+      // Full batches go through poll(); the 3 trailing elements through
+      // flush().
+      while (sink.bytes_written() < 200 * element_size) {
+        if (sink.poll() == 0)
+          std::this_thread::yield();
+      }
+      producer.join();
+      sink.flush();
+      ASSERT_EQ(sink.bytes_written(), data.size());
+      ASSERT_EQ(queue.size(), 0);
+    }
+
+    ASSERT_EQ(read_file(path), data);
+    std::remove(path.c_str());
+  }
+}
+
+TEST(FileIo_Invalid, BATCHED_SPSC_QUEUE) {
+  auto buffer = std::make_unique<uint8_t[]>(16);
+  Queue queue(16, 4, 4, 1, buffer.get());
+  FileIoOptions options;
+  options.queue_depth = 0;
+  ASSERT_THROW(FileSink(temp_path("invalid"), queue, options),
+               std::invalid_argument);
+  ASSERT_THROW(FileSource("/nonexistent/batched_spsc_queue", queue),
+               std::system_error);
+}
+} // namespace batched_spsc_queue
@@ -0,0 +1,134 @@
+#include "lossy_queue.hh"
+#include <cstdint>
+#include <cstring>
+#include <gtest/gtest.h>
+#include <memory>
+#include <thread>
+
+namespace batched_spsc_queue {
+namespace {
+void write_value(LossyQueue &queue, uint64_t value) {
+  uint8_t *batch_begin = queue.write_ptr();
+  ASSERT_NE(batch_begin, nullptr);
+  std::memcpy(batch_begin, &value, sizeof(value));
+  queue.commit_write();
+}
+
+uint64_t read_value(const uint8_t *batch_begin) {
+  uint64_t value;
+  std::memcpy(&value, batch_begin, sizeof(value));
+  return value;
+}
+} // namespace
+
+TEST(LossyQueue_Reject, BATCHED_SPSC_QUEUE) {
+  auto buffer = std::make_unique<uint8_t[]>(4 * sizeof(uint64_t));
+  LossyQueue queue(4, 1, 1, sizeof(uint64_t), buffer.get(),
+                   FullPolicy::Reject);
+
+  for (uint64_t i = 0; i < 4; ++i)
+    write_value(queue, i);
+  ASSERT_EQ(queue.write_ptr(), nullptr);
+
+  ASSERT_EQ(read_value(queue.read_ptr()), 0);
+  ASSERT_TRUE(queue.commit_read());
+  ASSERT_NE(queue.write_ptr(), nullptr);
+}
+
+TEST(LossyQueue_DropNewest, BATCHED_SPSC_QUEUE) {
+  auto buffer = std::make_unique<uint8_t[]>(8 * sizeof(uint64_t));
+  LossyQueue queue(8, 2, 2, sizeof(uint64_t), buffer.get(),
+                   FullPolicy::DropNewest);
+
+  // The queue holds batches 0 to 3; 4 and 5 are dropped.
+  for (uint64_t i = 0; i < 6; ++i)
+    write_value(queue, i);
+  ASSERT_EQ(queue.dropped(), 4);
+
+  for (uint64_t i = 0; i < 4; ++i) {
+    uint8_t *batch_begin = queue.read_ptr();
+    ASSERT_NE(batch_begin, nullptr);
+    ASSERT_EQ(read_value(batch_begin), i);
+    ASSERT_TRUE(queue.commit_read());
+  }
+  ASSERT_EQ(queue.read_ptr(), nullptr);
+
+  write_value(queue, 6);
+  ASSERT_EQ(read_value(queue.read_ptr()), 6);
+  ASSERT_EQ(queue.dropped(), 4);
+}
+
+TEST(LossyQueue_OverwriteOldest, BATCHED_SPSC_QUEUE) {
+  auto buffer = std::make_unique<uint8_t[]>(8 * sizeof(uint64_t));
+  LossyQueue queue(8, 2, 2, sizeof(uint64_t), buffer.get(),
+                   FullPolicy::OverwriteOldest);
+
+  // Batches 0 to 9 are written; only the 3 most recent complete ones are
+  // intact, since the next write would go to the slots of the oldest.
+  for (uint64_t i = 0; i < 10; ++i)
+    write_value(queue, i);
+
+  for (uint64_t i = 7; i < 10; ++i) {
+    uint8_t *batch_begin = queue.read_ptr();
+    ASSERT_NE(batch_begin, nullptr);
+    ASSERT_EQ(read_value(batch_begin), i);
+    ASSERT_TRUE(queue.commit_read());
+  }
+  ASSERT_EQ(queue.read_ptr(), nullptr);
+  ASSERT_EQ(queue.overwritten(), 14);
+
+  // A batch overwritten while it is read fails validation.
+  write_value(queue, 10);
+  uint8_t *batch_begin = queue.read_ptr();
+  ASSERT_EQ(read_value(batch_begin), 10);
+  for (uint64_t i = 11; i < 14; ++i)
+    write_value(queue, i);
+  ASSERT_FALSE(queue.commit_read());
+  ASSERT_EQ(queue.overwritten(), 16);
+}
+
+TEST(MT_LossyQueue_OverwriteOldest, BATCHED_SPSC_QUEUE) {
+  // Every intact batch must hold increasing values, whatever the consumer
+  // missed.
+  constexpr uint64_t nb_batches = 1000000;
+  constexpr size_t batch_size = 4;
+  auto buffer = std::make_unique<uint8_t[]>(64 * sizeof(uint64_t));
+  LossyQueue queue(64, batch_size, batch_size, sizeof(uint64_t), buffer.get(),
+                   FullPolicy::OverwriteOldest);
+
+  std::thread producer([&queue]() {
+    for (uint64_t i = 1; i <= nb_batches; ++i) {
+      auto *elements = reinterpret_cast<uint64_t *>(queue.write_ptr());
+      for (size_t j = 0; j < batch_size; ++j)
+        __atomic_store_n(&elements[j], i, __ATOMIC_RELAXED);
+      queue.commit_write();
+    }
+  });
+
+  uint64_t last = 0;
+  uint64_t nb_read = 0;
+  while (last < nb_batches) {
+    auto *elements = reinterpret_cast<uint64_t *>(queue.read_ptr());
+    if (elements == nullptr) {
+      std::this_thread::yield();
+      continue;
+    }
+
+    uint64_t values[batch_size];
+    for (size_t j = 0; j < batch_size; ++j)
+      values[j] = __atomic_load_n(&elements[j], __ATOMIC_RELAXED);
+    if (!queue.commit_read())
+      continue;
+
+    for (size_t j = 0; j < batch_size; ++j)
+      ASSERT_EQ(values[j], values[0]);
+    ASSERT_GT(values[0], last);
+    last = values[0];
+    ++nb_read;
+  }
+  producer.join();
+
+  ASSERT_EQ(nb_read * batch_size + queue.overwritten(),
+            nb_batches * batch_size);
+}
+} // namespace batched_spsc_queue
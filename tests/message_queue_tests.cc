@@ -0,0 +1,145 @@
+#include "message_queue.hh"
+#include <cstdint>
+#include <cstring>
+#include <future>
+#include <gtest/gtest.h>
+#include <stdexcept>
+#include <thread>
+
+namespace batched_spsc_queue {
+namespace {
+/// The size of record i, from 0 to 200 bytes.
+size_t record_size(uint64_t i) { return (i * 37) % 201; }
+
+void fill_record(uint8_t *record, uint64_t i) {
+  memset(record, static_cast<int>(i & 0xff), record_size(i));
+}
+
+bool check_record(const uint8_t *record, size_t size, uint64_t i) {
+  if (size != record_size(i))
+    return false;
+  for (size_t j = 0; j < size; j++)
+    if (record[j] != static_cast<uint8_t>(i & 0xff))
+      return false;
+  return true;
+}
+} // namespace
+
+TEST(MessageQueue_SkipMarker, BATCHED_SPSC_QUEUE) {
+  MessageQueue queue(64);
+  ASSERT_EQ(queue.max_record_size(), 24);
+
+  // Two 24-byte records, leaving 16 bytes before the end.
+  uint8_t *first = queue.reserve(16);
+  ASSERT_NE(first, nullptr);
+  queue.commit(16);
+  ASSERT_NE(queue.reserve(10), nullptr);
+  queue.commit(10);
+
+  size_t size;
+  ASSERT_NE(queue.read(size), nullptr);
+  EXPECT_EQ(size, 16);
+  ASSERT_NE(queue.read(size), nullptr);
+  EXPECT_EQ(size, 10);
+  EXPECT_EQ(queue.read(size), nullptr);
+  queue.release();
+
+  // A 24-byte record does not fit in the last 16 bytes: it goes to the
+  // beginning, and the skipped bytes count as used until it is released.
+  uint8_t *wrapped = queue.reserve(9);
+  EXPECT_EQ(wrapped, first);
+  memset(wrapped, 7, 9);
+  queue.commit(9);
+  EXPECT_EQ(queue.size(), 40);
+
+  const uint8_t *record = queue.read(size);
+  EXPECT_EQ(record, wrapped);
+  EXPECT_EQ(size, 9);
+  EXPECT_EQ(record[8], 7);
+  queue.release();
+  EXPECT_EQ(queue.size(), 0);
+}
+
+TEST(MessageQueue_Full, BATCHED_SPSC_QUEUE) {
+  MessageQueue queue(64);
+
+  // The whole capacity is usable.
+  for (size_t i = 0; i < 4; i++) {
+    ASSERT_NE(queue.reserve(8), nullptr);
+    queue.commit(8);
+  }
+  EXPECT_EQ(queue.size(), 64);
+  EXPECT_EQ(queue.reserve(0), nullptr);
+
+  // Records read but not released still take room.
+  size_t size;
+  ASSERT_NE(queue.read(size), nullptr);
+  EXPECT_EQ(queue.reserve(8), nullptr);
+  queue.release();
+  EXPECT_NE(queue.reserve(8), nullptr);
+}
+
+TEST(MessageQueue_InvalidArguments, BATCHED_SPSC_QUEUE) {
+  EXPECT_THROW(MessageQueue(100), std::invalid_argument);
+  EXPECT_THROW(MessageQueue(24), std::invalid_argument);
+
+  MessageQueue queue(4096);
+  EXPECT_THROW(queue.reserve(queue.max_record_size() + 1),
+               std::invalid_argument);
+  EXPECT_NE(queue.reserve(queue.max_record_size()), nullptr);
+}
+
+TEST(MessageQueue_Laps, BATCHED_SPSC_QUEUE) {
+  MessageQueue queue(1024);
+  uint64_t written = 0;
+  uint64_t read = 0;
+  while (read < 10000) {
+    while (uint8_t *record = queue.reserve(record_size(written))) {
+      fill_record(record, written);
+      queue.commit(record_size(written));
+      written++;
+    }
+
+    size_t size;
+    while (const uint8_t *record = queue.read(size)) {
+      ASSERT_TRUE(check_record(record, size, read));
+      read++;
+    }
+    queue.release();
+  }
+}
+
+TEST(MT_MessageQueue, BATCHED_SPSC_QUEUE) {
+  MessageQueue queue(4096);
+  uint64_t nb_records = 1000000;
+
+  auto producer = std::async(std::launch::async, [&]() {
+    for (uint64_t i = 0; i < nb_records; i++) {
+      uint8_t *record;
+      while ((record = queue.reserve(record_size(i))) == nullptr)
+        std::this_thread::yield();
+      fill_record(record, i);
+      queue.commit(record_size(i));
+    }
+  });
+
+  bool in_order = true;
+  uint64_t read = 0;
+  while (read < nb_records) {
+    size_t size;
+    for (size_t i = 0; i < 16; i++) {
+      const uint8_t *record = queue.read(size);
+      if (record == nullptr) {
+        std::this_thread::yield();
+        break;
+      }
+      in_order = in_order && check_record(record, size, read);
+      read++;
+    }
+    queue.release();
+  }
+  producer.get();
+
+  EXPECT_TRUE(in_order);
+}
+} // namespace batched_spsc_queue
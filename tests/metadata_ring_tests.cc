@@ -0,0 +1,114 @@
+#include "batched_spsc_queue.hh"
+#include "metadata_ring.hh"
+#include "mirrored_buffer.hh"
+#include <cstdint>
+#include <future>
+#include <gtest/gtest.h>
+#include <memory>
+#include <stdexcept>
+
+namespace batched_spsc_queue {
+TEST(MetadataRing_FollowsIndices, BATCHED_SPSC_QUEUE) {
+  size_t nb_slots = 12;
+  size_t enqueue_batch_size = 2;
+  size_t dequeue_batch_size = 3;
+  auto buffer = std::make_unique<uint8_t[]>(nb_slots * sizeof(uint64_t));
+  auto queue = Queue(nb_slots, enqueue_batch_size, dequeue_batch_size,
+                     sizeof(uint64_t), buffer.get());
+  MetadataRing<uint64_t, uint32_t> metadata(queue);
+
+  // Several laps, so that both sides wrap around.
+  uint64_t written = 0;
+  uint64_t read = 0;
+  while (read < 10 * nb_slots) {
+    while (auto *batch = reinterpret_cast<uint64_t *>(queue.write_ptr())) {
+      auto ids = metadata.write<0>();
+      auto sizes = metadata.write<1>();
+      ASSERT_EQ(ids.size(), enqueue_batch_size);
+      for (size_t i = 0; i < enqueue_batch_size; i++, written++) {
+        batch[i] = written;
+        ids[i] = written;
+        sizes[i] = static_cast<uint32_t>(written % 7);
+      }
+      queue.commit_write();
+    }
+
+    while (auto *batch = reinterpret_cast<uint64_t *>(queue.read_ptr())) {
+      auto ids = metadata.read<0>();
+      auto sizes = metadata.read<1>();
+      ASSERT_EQ(ids.size(), dequeue_batch_size);
+      for (size_t i = 0; i < dequeue_batch_size; i++, read++) {
+        EXPECT_EQ(batch[i], read);
+        EXPECT_EQ(ids[i], read);
+        EXPECT_EQ(sizes[i], read % 7);
+      }
+      queue.commit_read();
+    }
+  }
+}
+
+TEST(MetadataRing_VariableSize, BATCHED_SPSC_QUEUE) {
+  size_t nb_slots = 16;
+  auto buffer = std::make_unique<uint8_t[]>(nb_slots);
+  auto queue = Queue(nb_slots, 1, 1, 1, buffer.get());
+  MetadataRing<uint16_t> metadata(queue);
+
+  ASSERT_NE(queue.write_ptr(5), nullptr);
+  auto ids = metadata.write<0>(5);
+  for (uint16_t i = 0; i < 5; i++)
+    ids[i] = i;
+  queue.commit_write(5);
+
+  ASSERT_NE(queue.read_ptr(2), nullptr);
+  queue.commit_read(2);
+  ASSERT_NE(queue.read_ptr(3), nullptr);
+  auto read_ids = metadata.read<0>(3);
+  EXPECT_EQ(read_ids[0], 2);
+  EXPECT_EQ(read_ids[2], 4);
+}
+
+TEST(MetadataRing_Mirrored, BATCHED_SPSC_QUEUE) {
+  size_t nb_slots = MirroredBuffer::page_size();
+  MirroredBuffer buffer(nb_slots);
+  auto queue = Queue(nb_slots, 1, 1, 1, buffer);
+
+  EXPECT_THROW(MetadataRing<uint64_t>{queue}, std::invalid_argument);
+}
+
+TEST(MT_MetadataRing, BATCHED_SPSC_QUEUE) {
+  // The metadata is published by the same commit as the payload.
+  size_t nb_slots = 64;
+  size_t batch_size = 4;
+  size_t nb_elements = 400000;
+  auto buffer = std::make_unique<uint8_t[]>(nb_slots * sizeof(uint64_t));
+  auto queue = Queue(nb_slots, batch_size, batch_size, sizeof(uint64_t),
+                     buffer.get());
+  MetadataRing<uint64_t> metadata(queue);
+
+  auto producer = std::async(std::launch::async, [&]() {
+    for (uint64_t i = 0; i < nb_elements; i += batch_size) {
+      auto *batch = reinterpret_cast<uint64_t *>(
+          queue.wait_write_ptr(WaitPolicy::SpinThenYield));
+      auto ids = metadata.write<0>();
+      for (size_t j = 0; j < batch_size; j++) {
+        batch[j] = i + j;
+        ids[j] = i + j;
+      }
+      queue.commit_write();
+    }
+  });
+
+  bool consistent = true;
+  for (uint64_t i = 0; i < nb_elements; i += batch_size) {
+    auto *batch = reinterpret_cast<uint64_t *>(
+        queue.wait_read_ptr(WaitPolicy::SpinThenYield));
+    auto ids = metadata.read<0>();
+    for (size_t j = 0; j < batch_size; j++)
+      consistent = consistent && ids[j] == i + j && batch[j] == i + j;
+    queue.commit_read();
+  }
+  producer.get();
+
+  EXPECT_TRUE(consistent);
+}
+} // namespace batched_spsc_queue
@@ -0,0 +1,91 @@
+#include "batched_spsc_queue.hh"
+#include "mirrored_buffer.hh"
+#include <cstdint>
+#include <future>
+#include <gtest/gtest.h>
+#include <numeric>
+#include <stdexcept>
+
+namespace batched_spsc_queue {
+TEST(MirroredBuffer_Aliases_Both_Halves, BATCHED_SPSC_QUEUE) {
+  size_t size = MirroredBuffer::page_size();
+  MirroredBuffer buffer(size);
+
+  buffer.data()[3] = 42;
+  ASSERT_EQ(buffer.data()[size + 3], 42);
+  buffer.data()[size + 5] = 7;
+  ASSERT_EQ(buffer.data()[5], 7);
+
+  ASSERT_THROW(MirroredBuffer(size + 1), std::invalid_argument);
+}
+
+TEST(MirroredBuffer_Read_Across_Wrap, BATCHED_SPSC_QUEUE) {
+  size_t element_size = sizeof(size_t);
+  size_t nb_slots = MirroredBuffer::page_size() / element_size;
+  MirroredBuffer buffer(nb_slots * element_size);
+  auto queue = Queue(nb_slots, 1, 1, element_size, buffer);
+
+  // Move both indices close to the end of the buffer.
+  ASSERT_NE(queue.write_ptr(nb_slots - 3), nullptr);
+  queue.commit_write(nb_slots - 3);
+  ASSERT_NE(queue.read_ptr(nb_slots - 3), nullptr);
+  queue.commit_read(nb_slots - 3);
+
+  // A run of 10 elements crosses the end of the buffer and is still
+  // contiguous.
+  ASSERT_EQ(queue.available_contiguous_write(), nb_slots - 1);
+  auto *batch = reinterpret_cast<size_t *>(queue.write_ptr(10));
+  ASSERT_NE(batch, nullptr);
+  std::iota(batch, batch + 10, 0);
+  queue.commit_write(10);
+
+  ASSERT_EQ(queue.available_contiguous_read(), 10);
+  batch = reinterpret_cast<size_t *>(queue.read_ptr(10));
+  ASSERT_NE(batch, nullptr);
+  for (size_t i = 0; i < 10; i++)
+    ASSERT_EQ(batch[i], i);
+  queue.commit_read(10);
+  ASSERT_EQ(queue.size(), 0);
+}
+
+TEST(MirroredBuffer_MT_Non_Dividing_Batches, BATCHED_SPSC_QUEUE) {
+  size_t element_size = sizeof(size_t);
+  size_t nb_slots = MirroredBuffer::page_size() / element_size;
+  size_t enqueue_batch_size = 3;
+  size_t dequeue_batch_size = 7;
+  size_t nb_elements = 3 * 7 * 10000;
+  MirroredBuffer buffer(nb_slots * element_size);
+  auto queue = Queue(nb_slots, enqueue_batch_size, dequeue_batch_size,
+                     element_size, buffer);
+
+  // Neither batch size divides nb_slots, so batches regularly run past the
+  // end of the buffer.
+  ASSERT_NE(nb_slots % enqueue_batch_size, 0);
+  ASSERT_NE(nb_slots % dequeue_batch_size, 0);
+
+  auto producer = std::async(std::launch::async, [&]() {
+    for (size_t i = 0; i < nb_elements; i += enqueue_batch_size) {
+      auto *batch = reinterpret_cast<size_t *>(
+          queue.wait_write_ptr(WaitPolicy::SpinThenYield));
+      std::iota(batch, batch + enqueue_batch_size, i);
+      queue.commit_write();
+    }
+  });
+
+  auto consumer = std::async(std::launch::async, [&]() {
+    for (size_t i = 0; i < nb_elements; i += dequeue_batch_size) {
+      auto *batch = reinterpret_cast<size_t *>(
+          queue.wait_read_ptr(WaitPolicy::SpinThenYield));
+      for (size_t j = 0; j < dequeue_batch_size; j++) {
+        if (batch[j] != i + j)
+          return false;
+      }
+      queue.commit_read();
+    }
+    return true;
+  });
+
+  producer.get();
+  EXPECT_TRUE(consumer.get());
+}
+} // namespace batched_spsc_queue
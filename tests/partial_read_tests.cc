@@ -0,0 +1,216 @@
+#include "batched_spsc_queue.hh"
+#include <chrono>
+#include <cstdint>
+#include <future>
+#include <gtest/gtest.h>
+#include <memory>
+#include <thread>
+
+namespace batched_spsc_queue {
+namespace {
+constexpr std::chrono::hours kNever{1};
+
+void write_elements(Queue &queue, size_t &next, size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    auto *slot = reinterpret_cast<size_t *>(queue.write_ptr());
+    ASSERT_NE(slot, nullptr);
+    *slot = next++;
+    queue.commit_write();
+  }
+}
+} // namespace
+
+TEST(PartialRead_Deadline, BATCHED_SPSC_QUEUE) {
+  size_t nb_slots = 16;
+  size_t dequeue_batch_size = 4;
+  auto buffer = std::make_unique<uint8_t[]>(nb_slots * sizeof(size_t));
+  auto queue = Queue(nb_slots, 1, dequeue_batch_size, sizeof(size_t),
+                     buffer.get());
+  size_t next = 0;
+  size_t count = 0;
+
+  // A full batch is returned right away.
+  write_elements(queue, next, 4);
+  ASSERT_NE(queue.partial_read_ptr(count, kNever), nullptr);
+  EXPECT_EQ(count, 4);
+  queue.commit_read(count);
+
+  // A partial one only after the deadline.
+  write_elements(queue, next, 3);
+  auto max_delay = std::chrono::milliseconds(5);
+  EXPECT_EQ(queue.partial_read_ptr(count, max_delay), nullptr);
+  std::this_thread::sleep_for(2 * max_delay);
+  auto *batch = reinterpret_cast<size_t *>(
+      queue.partial_read_ptr(count, max_delay));
+  ASSERT_NE(batch, nullptr);
+  EXPECT_EQ(count, 3);
+  EXPECT_EQ(batch[0], 4);
+  queue.commit_read(count);
+}
+
+TEST(PartialRead_Flush, BATCHED_SPSC_QUEUE) {
+  size_t nb_slots = 16;
+  auto buffer = std::make_unique<uint8_t[]>(nb_slots * sizeof(size_t));
+  auto queue = Queue(nb_slots, 1, 8, sizeof(size_t), buffer.get());
+  size_t next = 0;
+  size_t count = 0;
+
+  write_elements(queue, next, 2);
+  EXPECT_EQ(queue.partial_read_ptr(count, kNever), nullptr);
+  queue.flush();
+  ASSERT_NE(queue.partial_read_ptr(count, kNever), nullptr);
+  EXPECT_EQ(count, 2);
+  queue.commit_read(count);
+
+  // The flush only covered the elements committed before it.
+  write_elements(queue, next, 1);
+  EXPECT_EQ(queue.partial_read_ptr(count, kNever), nullptr);
+}
+
+TEST(PartialRead_Realigns, BATCHED_SPSC_QUEUE) {
+  // After a partial batch, the next one ends on a batch boundary, so that no
+  // batch straddles the end of the buffer and read_ptr() can be used again.
+  size_t nb_slots = 12;
+  size_t dequeue_batch_size = 4;
+  auto buffer = std::make_unique<uint8_t[]>(nb_slots * sizeof(size_t));
+  auto queue = Queue(nb_slots, 1, dequeue_batch_size, sizeof(size_t),
+                     buffer.get());
+  auto *slots = reinterpret_cast<size_t *>(buffer.get());
+  size_t next = 0;
+  size_t read = 0;
+  size_t count = 0;
+
+  for (size_t lap = 0; lap < 100; lap++) {
+    // 1 to 3 elements, flushed, then enough to fill the rest of the batch.
+    size_t partial = lap % 3 + 1;
+    write_elements(queue, next, partial);
+    queue.flush();
+    auto *batch = reinterpret_cast<size_t *>(
+        queue.partial_read_ptr(count, kNever));
+    ASSERT_NE(batch, nullptr);
+    ASSERT_EQ(count, partial);
+    EXPECT_EQ(batch[0], read);
+    read += count;
+    queue.commit_read(count);
+
+    write_elements(queue, next, dequeue_batch_size);
+    batch = reinterpret_cast<size_t *>(queue.partial_read_ptr(count, kNever));
+    ASSERT_NE(batch, nullptr);
+    ASSERT_EQ(count, dequeue_batch_size - partial);
+    EXPECT_LE(batch + count, slots + nb_slots);
+    EXPECT_EQ(batch[0], read);
+    read += count;
+    queue.commit_read(count);
+
+    // Back on a boundary: the fixed-size API works again.
+    batch = reinterpret_cast<size_t *>(queue.read_ptr());
+    ASSERT_EQ(batch, nullptr);
+    write_elements(queue, next, dequeue_batch_size - partial);
+    batch = reinterpret_cast<size_t *>(queue.read_ptr());
+    ASSERT_NE(batch, nullptr);
+    EXPECT_EQ(batch[0], read);
+    EXPECT_EQ(batch[dequeue_batch_size - 1], read + dequeue_batch_size - 1);
+    read += dequeue_batch_size;
+    queue.commit_read();
+  }
+}
+
+TEST(PartialRead_PollAndShortCommit, BATCHED_SPSC_QUEUE) {
+  // Polling again before committing, and committing fewer elements than
+  // returned, keep batches within the buffer and on its boundaries.
+  size_t nb_slots = 8;
+  size_t dequeue_batch_size = 4;
+  auto buffer = std::make_unique<uint8_t[]>(nb_slots * sizeof(size_t));
+  auto queue = Queue(nb_slots, 1, dequeue_batch_size, sizeof(size_t),
+                     buffer.get());
+  auto *slots = reinterpret_cast<size_t *>(buffer.get());
+  size_t next = 0;
+  size_t read = 0;
+  size_t count = 0;
+
+  for (size_t lap = 0; lap < 50; lap++) {
+    write_elements(queue, next, 3);
+    queue.flush();
+    auto *first = reinterpret_cast<size_t *>(
+        queue.partial_read_ptr(count, kNever));
+    ASSERT_NE(first, nullptr);
+    ASSERT_EQ(count, 3);
+    auto *again = reinterpret_cast<size_t *>(
+        queue.partial_read_ptr(count, kNever));
+    ASSERT_EQ(again, first);
+    ASSERT_EQ(count, 3);
+    EXPECT_EQ(first[0], read);
+
+    // Only one of the three is consumed, the others stay flushed.
+    queue.commit_read(1);
+    read++;
+    auto *rest = reinterpret_cast<size_t *>(
+        queue.partial_read_ptr(count, kNever));
+    ASSERT_NE(rest, nullptr);
+    ASSERT_EQ(count, 2);
+    EXPECT_EQ(rest[0], read);
+    read += count;
+    queue.commit_read(count);
+
+    // The last element of the batch ends it on a boundary.
+    write_elements(queue, next, 1);
+    auto *batch = reinterpret_cast<size_t *>(
+        queue.partial_read_ptr(count, kNever));
+    ASSERT_NE(batch, nullptr);
+    ASSERT_EQ(count, 1);
+    EXPECT_EQ(batch[0], read);
+    read += count;
+    queue.commit_read(count);
+
+    write_elements(queue, next, dequeue_batch_size);
+    batch = reinterpret_cast<size_t *>(queue.read_ptr());
+    ASSERT_NE(batch, nullptr);
+    EXPECT_LE(batch + dequeue_batch_size, slots + nb_slots);
+    EXPECT_EQ(batch[dequeue_batch_size - 1], read + dequeue_batch_size - 1);
+    read += dequeue_batch_size;
+    queue.commit_read();
+  }
+}
+
+TEST(MT_PartialRead, BATCHED_SPSC_QUEUE) {
+  // A slow producer with a final flush: the consumer gets everything, in
+  // order, without waiting for full batches.
+  size_t nb_slots = 64;
+  size_t dequeue_batch_size = 16;
+  size_t nb_elements = 20000;
+  auto buffer = std::make_unique<uint8_t[]>(nb_slots * sizeof(size_t));
+  auto queue = Queue(nb_slots, 1, dequeue_batch_size, sizeof(size_t),
+                     buffer.get());
+
+  auto producer = std::async(std::launch::async, [&]() {
+    for (size_t i = 0; i < nb_elements; i++) {
+      auto *slot = reinterpret_cast<size_t *>(
+          queue.wait_write_ptr(WaitPolicy::SpinThenYield));
+      *slot = i;
+      queue.commit_write();
+      if (i % 1000 == 0)
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+    queue.flush();
+  });
+
+  bool in_order = true;
+  size_t read = 0;
+  while (read < nb_elements) {
+    size_t count;
+    auto *batch = reinterpret_cast<size_t *>(
+        queue.partial_read_ptr(count, std::chrono::microseconds(50)));
+    if (batch == nullptr) {
+      std::this_thread::yield();
+      continue;
+    }
+    for (size_t i = 0; i < count; i++)
+      in_order = in_order && batch[i] == read + i;
+    read += count;
+    queue.commit_read(count);
+  }
+  producer.get();
+
+  EXPECT_TRUE(in_order);
+}
+} // namespace batched_spsc_queue
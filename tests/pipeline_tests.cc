@@ -0,0 +1,128 @@
+#include "pipeline.hh"
+#include <cstdint>
+#include <cstring>
+#include <gtest/gtest.h>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+namespace batched_spsc_queue {
+TEST(Pipeline_InPlace_Transform_Drain, BATCHED_SPSC_QUEUE) {
+  // Not a multiple of any batch size, so the stream ends with partial batches.
+  constexpr uint64_t nb_elements = 1001;
+
+  uint64_t next = 0;
+  std::vector<uint8_t *> source_batches;
+  std::vector<uint8_t *> stage_batches;
+  uint32_t expected = 0;
+
+  Pipeline pipeline(32);
+  pipeline
+      .source("count", sizeof(uint64_t), 4,
+              [&](uint8_t *batch, size_t batch_size) {
+                source_batches.push_back(batch);
+                size_t n = 0;
+                for (; n < batch_size && next < nb_elements; ++n, ++next)
+                  std::memcpy(batch + n * sizeof(uint64_t), &next,
+                              sizeof(uint64_t));
+                return n;
+              })
+      .stage("increment", 8,
+             [&](uint8_t *batch, size_t n) {
+               stage_batches.push_back(batch);
+               auto *elements = reinterpret_cast<uint64_t *>(batch);
+               for (size_t i = 0; i < n; ++i)
+                 elements[i] += 1;
+             })
+      .stage("narrow", sizeof(uint32_t), 2,
+             [](const uint8_t *input, uint8_t *output, size_t n) {
+               const auto *in = reinterpret_cast<const uint64_t *>(input);
+               auto *out = reinterpret_cast<uint32_t *>(output);
+               for (size_t i = 0; i < n; ++i)
+                 out[i] = static_cast<uint32_t>(in[i] * 2);
+             })
+      .sink("check", 16, [&](const uint8_t *batch, size_t n) {
+        const auto *elements = reinterpret_cast<const uint32_t *>(batch);
+        for (size_t i = 0; i < n; ++i, ++expected)
+          ASSERT_EQ(elements[i], (expected + 1) * 2);
+      });
+  pipeline.start();
+  pipeline.wait();
+
+  ASSERT_EQ(expected, nb_elements);
+
+  // The in-place stage worked on the batches written by the source.
+  ASSERT_GE(source_batches.size(), 2 * (stage_batches.size() - 1));
+  for (size_t i = 0; i + 1 < stage_batches.size(); ++i)
+    ASSERT_EQ(stage_batches[i], source_batches[2 * i]);
+
+  auto stats = pipeline.stats();
+  ASSERT_EQ(stats.size(), 4);
+  ASSERT_EQ(stats[0].name, "count");
+  ASSERT_EQ(stats[3].name, "check");
+  for (const auto &stage : stats) {
+    ASSERT_EQ(stage.elements, nb_elements);
+    ASSERT_GT(stage.elapsed.count(), 0);
+    ASSERT_LE(stage.busy.count() + stage.stalled.count(),
+              stage.elapsed.count());
+  }
+  ASSERT_EQ(stats[0].batches, (nb_elements + 3) / 4);
+}
+
+TEST(Pipeline_Stop_Drains, BATCHED_SPSC_QUEUE) {
+  uint64_t produced = 0;
+  uint64_t consumed = 0;
+
+  Pipeline pipeline(64);
+  pipeline
+      .source("endless", sizeof(uint64_t), 8,
+              [&](uint8_t *batch, size_t batch_size) {
+                auto *elements = reinterpret_cast<uint64_t *>(batch);
+                for (size_t i = 0; i < batch_size; ++i)
+                  elements[i] = produced++;
+                return batch_size;
+              })
+      .sink("check", 4, [&](const uint8_t *batch, size_t n) {
+        const auto *elements = reinterpret_cast<const uint64_t *>(batch);
+        for (size_t i = 0; i < n; ++i, ++consumed)
+          ASSERT_EQ(elements[i], consumed);
+      });
+  pipeline.start();
+  while (pipeline.stats()[1].elements < 10000)
+    std::this_thread::yield();
+  pipeline.stop();
+  pipeline.wait();
+
+  ASSERT_EQ(consumed, produced);
+  ASSERT_EQ(pipeline.stats()[1].elements, produced);
+}
+
+TEST(Pipeline_Invalid, BATCHED_SPSC_QUEUE) {
+  auto source = [](uint8_t *, size_t) -> size_t { return 0; };
+  auto sink = [](const uint8_t *, size_t) {};
+
+  Pipeline no_source(16);
+  ASSERT_THROW(no_source.sink("sink", 4, sink), std::logic_error);
+
+  Pipeline no_sink(16);
+  no_sink.source("source", 1, 4, source);
+  ASSERT_THROW(no_sink.start(), std::logic_error);
+
+  Pipeline not_divisible(16);
+  not_divisible.source("source", 1, 4, source).sink("sink", 3, sink);
+  ASSERT_THROW(not_divisible.start(), std::logic_error);
+
+  Pipeline too_small(16);
+  too_small.source("source", 1, 8, source)
+      .stage("stage", 8, [](uint8_t *, size_t) {})
+      .sink("sink", 8, sink);
+  ASSERT_THROW(too_small.start(), std::logic_error);
+
+  Pipeline empty_stream(16);
+  empty_stream.source("source", 1, 4, source).sink("sink", 8, sink);
+  empty_stream.start();
+  empty_stream.wait();
+  ASSERT_EQ(empty_stream.stats()[1].elements, 0);
+  ASSERT_THROW(empty_stream.start(), std::logic_error);
+}
+} // namespace batched_spsc_queue
@@ -0,0 +1,145 @@
+#include "batched_spsc_queue.hh"
+#include "queue_events.hh"
+#include <cstdint>
+#include <future>
+#include <gtest/gtest.h>
+#include <memory>
+#include <numeric>
+#include <poll.h>
+#include <stdexcept>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+namespace batched_spsc_queue {
+namespace {
+bool readable(int fd) {
+  pollfd pfd{fd, POLLIN, 0};
+  return poll(&pfd, 1, 0) == 1;
+}
+} // namespace
+
+TEST(QueueEvents_Coalesced, BATCHED_SPSC_QUEUE) {
+  size_t nb_slots = 8;
+  auto buffer = std::make_unique<uint8_t[]>(nb_slots);
+  auto queue = Queue(nb_slots, 1, 2, 1, buffer.get());
+  QueueEvents events(queue);
+
+  // Nobody waits: commits do not signal.
+  queue.write_ptr();
+  queue.commit_write();
+  EXPECT_EQ(events.data_signals(), 0);
+  EXPECT_FALSE(readable(events.data_fd()));
+
+  // Only one element, less than a dequeue batch: the consumer may wait, and
+  // the following commits signal once.
+  ASSERT_TRUE(events.arm_read());
+  for (size_t i = 0; i < 3; i++) {
+    queue.write_ptr();
+    queue.commit_write();
+  }
+  EXPECT_EQ(events.data_signals(), 1);
+  EXPECT_TRUE(readable(events.data_fd()));
+
+  events.clear_data();
+  EXPECT_FALSE(readable(events.data_fd()));
+
+  // A batch is available: arming tells the consumer not to wait.
+  EXPECT_FALSE(events.arm_read());
+  queue.write_ptr();
+  queue.commit_write();
+  EXPECT_EQ(events.data_signals(), 1);
+}
+
+TEST(QueueEvents_Space, BATCHED_SPSC_QUEUE) {
+  size_t nb_slots = 4;
+  auto buffer = std::make_unique<uint8_t[]>(nb_slots);
+  auto queue = Queue(nb_slots, 1, 1, 1, buffer.get());
+  QueueEvents events(queue);
+
+  while (queue.write_ptr() != nullptr)
+    queue.commit_write();
+  ASSERT_TRUE(events.arm_write());
+
+  queue.read_ptr();
+  queue.commit_read();
+  queue.read_ptr();
+  queue.commit_read();
+  EXPECT_EQ(events.space_signals(), 1);
+  EXPECT_TRUE(readable(events.space_fd()));
+
+  events.clear_space();
+  EXPECT_FALSE(readable(events.space_fd()));
+  EXPECT_FALSE(events.arm_write());
+}
+
+TEST(QueueEvents_AlreadyAttached, BATCHED_SPSC_QUEUE) {
+  size_t nb_slots = 4;
+  auto buffer = std::make_unique<uint8_t[]>(nb_slots);
+  auto queue = Queue(nb_slots, 1, 1, 1, buffer.get());
+
+  {
+    QueueEvents events(queue);
+    EXPECT_THROW(QueueEvents{queue}, std::logic_error);
+  }
+  EXPECT_NO_THROW(QueueEvents{queue});
+}
+
+TEST(MT_QueueEvents_Epoll, BATCHED_SPSC_QUEUE) {
+  // Both sides wait in epoll_wait() instead of spinning.
+  size_t nb_slots = 60;
+  size_t enqueue_batch_size = 2;
+  size_t dequeue_batch_size = 3;
+  size_t nb_elements = 600000;
+  auto buffer = std::make_unique<uint8_t[]>(nb_slots * sizeof(size_t));
+  auto queue = Queue(nb_slots, enqueue_batch_size, dequeue_batch_size,
+                     sizeof(size_t), buffer.get());
+  QueueEvents events(queue);
+
+  auto make_epoll = [](int fd) {
+    int epoll_fd = epoll_create1(0);
+    epoll_event event{};
+    event.events = EPOLLIN;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event);
+    return epoll_fd;
+  };
+
+  auto producer = std::async(std::launch::async, [&]() {
+    int epoll_fd = make_epoll(events.space_fd());
+    for (size_t i = 0; i < nb_elements; i += enqueue_batch_size) {
+      uint8_t *batch_begin;
+      while ((batch_begin = queue.write_ptr()) == nullptr) {
+        if (!events.arm_write())
+          continue;
+        epoll_event event;
+        epoll_wait(epoll_fd, &event, 1, -1);
+        events.clear_space();
+      }
+      auto *batch = reinterpret_cast<size_t *>(batch_begin);
+      std::iota(batch, batch + enqueue_batch_size, i);
+      queue.commit_write();
+    }
+    close(epoll_fd);
+  });
+
+  int epoll_fd = make_epoll(events.data_fd());
+  bool in_order = true;
+  for (size_t i = 0; i < nb_elements; i += dequeue_batch_size) {
+    uint8_t *batch_begin;
+    while ((batch_begin = queue.read_ptr()) == nullptr) {
+      if (!events.arm_read())
+        continue;
+      epoll_event event;
+      epoll_wait(epoll_fd, &event, 1, -1);
+      events.clear_data();
+    }
+    auto *batch = reinterpret_cast<size_t *>(batch_begin);
+    for (size_t j = 0; j < dequeue_batch_size; j++)
+      in_order = in_order && batch[j] == i + j;
+    queue.commit_read();
+  }
+  close(epoll_fd);
+  producer.get();
+
+  EXPECT_TRUE(in_order);
+}
+} // namespace batched_spsc_queue
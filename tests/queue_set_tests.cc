@@ -0,0 +1,136 @@
+#include "queue_set.hh"
+#include <cstdint>
+#include <future>
+#include <gtest/gtest.h>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+namespace batched_spsc_queue {
+namespace {
+void enqueue(Queue &queue, size_t value) {
+  auto *batch = reinterpret_cast<size_t *>(queue.write_ptr());
+  ASSERT_NE(batch, nullptr);
+  *batch = value;
+  queue.commit_write();
+}
+
+/// Reads nb_batches batches from the set and returns the queue indices.
+std::vector<size_t> read_order(QueueSet &set, size_t nb_batches) {
+  std::vector<size_t> order;
+  for (size_t i = 0; i < nb_batches; ++i) {
+    size_t index = 0;
+    if (set.read_ptr(index) == nullptr)
+      break;
+    order.push_back(index);
+    set.commit_read(index);
+  }
+  return order;
+}
+} // namespace
+
+TEST(QueueSet_RoundRobin, BATCHED_SPSC_QUEUE) {
+  auto buffer = std::make_unique<uint8_t[]>(3 * 16 * sizeof(size_t));
+  std::vector<std::unique_ptr<Queue>> queues;
+  QueueSet set;
+  for (size_t i = 0; i < 3; ++i) {
+    queues.push_back(std::make_unique<Queue>(
+        16, 1, 1, sizeof(size_t), buffer.get() + i * 16 * sizeof(size_t)));
+    ASSERT_EQ(set.add(*queues.back()), i);
+  }
+
+  size_t index = 0;
+  ASSERT_EQ(set.read_ptr(index), nullptr);
+
+  for (size_t i = 0; i < 3; ++i) {
+    enqueue(*queues[0], i);
+    enqueue(*queues[2], i);
+  }
+  ASSERT_EQ(read_order(set, 8), (std::vector<size_t>{0, 2, 0, 2, 0, 2}));
+
+  // An empty queue becomes ready again on commit.
+  enqueue(*queues[1], 42);
+  auto *batch = reinterpret_cast<size_t *>(set.read_ptr(index));
+  ASSERT_NE(batch, nullptr);
+  ASSERT_EQ(index, 1);
+  ASSERT_EQ(*batch, 42);
+  set.commit_read(index);
+  ASSERT_EQ(set.read_ptr(index), nullptr);
+}
+
+TEST(QueueSet_Weighted, BATCHED_SPSC_QUEUE) {
+  auto buffer = std::make_unique<uint8_t[]>(2 * 16 * sizeof(size_t));
+  Queue heavy(16, 1, 1, sizeof(size_t), buffer.get());
+  Queue light(16, 1, 1, sizeof(size_t), buffer.get() + 16 * sizeof(size_t));
+
+  // Batches already in a queue when it is added are found.
+  for (size_t i = 0; i < 6; ++i)
+    enqueue(heavy, i);
+  for (size_t i = 0; i < 3; ++i)
+    enqueue(light, i);
+
+  QueueSet set;
+  set.add(heavy, 2);
+  set.add(light);
+  ASSERT_THROW(set.add(light, 0), std::invalid_argument);
+  ASSERT_EQ(read_order(set, 10),
+            (std::vector<size_t>{0, 0, 1, 0, 0, 1, 0, 0, 1}));
+}
+
+TEST(QueueSet_Full, BATCHED_SPSC_QUEUE) {
+  auto buffer = std::make_unique<uint8_t[]>(2);
+  std::vector<std::unique_ptr<Queue>> queues;
+  QueueSet set;
+  for (size_t i = 0; i < QueueSet::kMaxQueues; ++i) {
+    queues.push_back(std::make_unique<Queue>(2, 1, 1, 1, buffer.get()));
+    set.add(*queues.back());
+  }
+  Queue extra(2, 1, 1, 1, buffer.get());
+  ASSERT_THROW(set.add(extra), std::length_error);
+}
+
+TEST(MT_QueueSet_Wait_Any, BATCHED_SPSC_QUEUE) {
+  constexpr size_t nb_producers = 8;
+  constexpr size_t nb_elements = 1 << 14;
+  constexpr size_t nb_slots = 64;
+  auto buffer =
+      std::make_unique<uint8_t[]>(nb_producers * nb_slots * sizeof(size_t));
+  std::vector<std::unique_ptr<Queue>> queues;
+  QueueSet set;
+  for (size_t i = 0; i < nb_producers; ++i) {
+    queues.push_back(std::make_unique<Queue>(
+        nb_slots, 4, 4, sizeof(size_t),
+        buffer.get() + i * nb_slots * sizeof(size_t)));
+    set.add(*queues.back());
+  }
+
+  std::vector<std::future<void>> producers;
+  for (size_t i = 0; i < nb_producers; ++i)
+    producers.push_back(std::async(std::launch::async, [&queue = *queues[i]]() {
+      for (size_t j = 0; j < nb_elements; j += 4) {
+        size_t *batch = nullptr;
+        while ((batch = reinterpret_cast<size_t *>(queue.write_ptr())) ==
+               nullptr)
+          std::this_thread::yield();
+        for (size_t k = 0; k < 4; ++k)
+          batch[k] = j + k;
+        queue.commit_write();
+      }
+    }));
+
+  std::vector<size_t> expected(nb_producers, 0);
+  for (size_t i = 0; i < nb_producers * nb_elements; i += 4) {
+    size_t index = 0;
+    auto *batch = reinterpret_cast<size_t *>(set.wait_read_ptr(index));
+    for (size_t k = 0; k < 4; ++k)
+      ASSERT_EQ(batch[k], expected[index]++);
+    set.commit_read(index);
+  }
+
+  for (auto &producer : producers)
+    producer.get();
+  size_t index = 0;
+  ASSERT_EQ(set.read_ptr(index), nullptr);
+}
+} // namespace batched_spsc_queue
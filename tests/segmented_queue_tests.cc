@@ -0,0 +1,130 @@
+#include "segmented_queue.hh"
+#include <cstdint>
+#include <future>
+#include <gtest/gtest.h>
+#include <stdexcept>
+#include <thread>
+
+namespace batched_spsc_queue {
+namespace {
+void write_batch(SegmentedQueue &queue, uint64_t &next, size_t batch_size) {
+  auto *batch = reinterpret_cast<uint64_t *>(queue.write_ptr());
+  ASSERT_NE(batch, nullptr);
+  for (size_t i = 0; i < batch_size; i++)
+    batch[i] = next++;
+  queue.commit_write();
+}
+
+void read_batch(SegmentedQueue &queue, uint64_t &next, size_t batch_size) {
+  auto *batch = reinterpret_cast<uint64_t *>(queue.read_ptr());
+  ASSERT_NE(batch, nullptr);
+  for (size_t i = 0; i < batch_size; i++)
+    ASSERT_EQ(batch[i], next++);
+  queue.commit_read();
+}
+} // namespace
+
+TEST(SegmentedQueue_GrowsAndRecycles, BATCHED_SPSC_QUEUE) {
+  size_t segment_slots = 16;
+  size_t enqueue_batch_size = 4;
+  size_t dequeue_batch_size = 8;
+  SegmentedQueue queue(segment_slots, enqueue_batch_size, dequeue_batch_size,
+                       sizeof(uint64_t), {.spare_segments = 2});
+  uint64_t written = 0;
+  uint64_t read = 0;
+
+  // A burst of 10 segments, with nothing read meanwhile.
+  for (size_t i = 0; i < 10 * segment_slots / enqueue_batch_size; i++)
+    write_batch(queue, written, enqueue_batch_size);
+  EXPECT_EQ(queue.size(), 10 * segment_slots);
+  EXPECT_EQ(queue.allocated_segments(), 10);
+
+  while (read < written)
+    read_batch(queue, read, dequeue_batch_size);
+  EXPECT_EQ(queue.read_ptr(), nullptr);
+
+  // Past the burst, the producer unmaps the drained segments beyond the
+  // spare ones, and then only reuses them.
+  for (size_t lap = 0; lap < 100; lap++) {
+    for (size_t i = 0; i < segment_slots / enqueue_batch_size; i++)
+      write_batch(queue, written, enqueue_batch_size);
+    for (size_t i = 0; i < segment_slots / dequeue_batch_size; i++)
+      read_batch(queue, read, dequeue_batch_size);
+  }
+  EXPECT_EQ(queue.segment_allocations(), 10);
+  EXPECT_LE(queue.allocated_segments(), 4);
+}
+
+TEST(SegmentedQueue_MemoryCap, BATCHED_SPSC_QUEUE) {
+  size_t segment_slots = 8;
+  size_t batch_size = 4;
+  SegmentedQueue queue(segment_slots, batch_size, batch_size, sizeof(uint64_t),
+                       {.max_segments = 3});
+  uint64_t written = 0;
+  uint64_t read = 0;
+
+  // The whole capacity of the allowed segments is usable.
+  while (queue.write_ptr() != nullptr)
+    write_batch(queue, written, batch_size);
+  EXPECT_EQ(written, 3 * segment_slots);
+  EXPECT_EQ(queue.allocated_segments(), 3);
+
+  // Reading a batch frees nothing, draining a segment does.
+  read_batch(queue, read, batch_size);
+  EXPECT_EQ(queue.write_ptr(), nullptr);
+  read_batch(queue, read, batch_size);
+  read_batch(queue, read, batch_size);
+  write_batch(queue, written, batch_size);
+  EXPECT_EQ(queue.allocated_segments(), 3);
+
+  while (read < written)
+    read_batch(queue, read, batch_size);
+}
+
+TEST(SegmentedQueue_InvalidArguments, BATCHED_SPSC_QUEUE) {
+  EXPECT_THROW(SegmentedQueue(10, 4, 2, 1), std::invalid_argument);
+  EXPECT_THROW(SegmentedQueue(8, 4, 0, 1), std::invalid_argument);
+  EXPECT_THROW(SegmentedQueue(8, 4, 2, 1, {.max_segments = 1}),
+               std::invalid_argument);
+  EXPECT_NO_THROW(SegmentedQueue(8, 4, 2, 1, {.max_segments = 2}));
+}
+
+TEST(MT_SegmentedQueue, BATCHED_SPSC_QUEUE) {
+  // A producer running ahead in bursts, bounded by the memory cap.
+  size_t segment_slots = 256;
+  size_t batch_size = 8;
+  uint64_t nb_elements = 2000000;
+  SegmentedQueue queue(segment_slots, batch_size, batch_size, sizeof(uint64_t),
+                       {.max_segments = 16, .spare_segments = 1});
+
+  auto producer = std::async(std::launch::async, [&]() {
+    for (uint64_t i = 0; i < nb_elements; i += batch_size) {
+      uint64_t *batch;
+      while ((batch = reinterpret_cast<uint64_t *>(queue.write_ptr())) ==
+             nullptr)
+        std::this_thread::yield();
+      for (size_t j = 0; j < batch_size; j++)
+        batch[j] = i + j;
+      queue.commit_write();
+    }
+  });
+
+  bool in_order = true;
+  uint64_t read = 0;
+  while (read < nb_elements) {
+    auto *batch = reinterpret_cast<uint64_t *>(queue.read_ptr());
+    if (batch == nullptr) {
+      std::this_thread::yield();
+      continue;
+    }
+    for (size_t j = 0; j < batch_size; j++)
+      in_order = in_order && batch[j] == read + j;
+    read += batch_size;
+    queue.commit_read();
+  }
+  producer.get();
+
+  EXPECT_TRUE(in_order);
+  EXPECT_LE(queue.allocated_segments(), 16);
+}
+} // namespace batched_spsc_queue
@@ -0,0 +1,89 @@
+#include "shared_queue.hh"
+#include <cstdint>
+#include <gtest/gtest.h>
+#include <numeric>
+#include <stdexcept>
+#include <string>
+#include <sys/wait.h>
+#include <system_error>
+#include <unistd.h>
+
+namespace batched_spsc_queue {
+namespace {
+std::string unique_name(const char *tag) {
+  return "/batched_spsc_queue_test_" + std::string(tag) + "_" +
+         std::to_string(getpid());
+}
+} // namespace
+
+TEST(SharedQueue_Create_Attach, BATCHED_SPSC_QUEUE) {
+  using Role = SharedQueue::Role;
+  auto name = unique_name("create_attach");
+  auto producer =
+      SharedQueue::create(name, 300, 3, 2, sizeof(size_t), Role::Producer);
+  auto consumer = SharedQueue::attach(name, Role::Consumer);
+
+  ASSERT_EQ(consumer.nb_slots(), 300);
+  ASSERT_EQ(consumer.enqueue_batch_size(), 3);
+  ASSERT_EQ(consumer.dequeue_batch_size(), 2);
+  ASSERT_EQ(consumer.element_size(), sizeof(size_t));
+
+  // The name cannot be created twice, and a role cannot be held twice.
+  ASSERT_THROW(
+      SharedQueue::create(name, 300, 3, 2, sizeof(size_t), Role::Producer),
+      std::system_error);
+  ASSERT_THROW(SharedQueue::attach(name, Role::Producer), std::runtime_error);
+
+  for (size_t i = 0; i < 3000; i += 6) {
+    for (size_t j = 0; j < 6; j += 3) {
+      auto *batch = reinterpret_cast<size_t *>(producer.write_ptr());
+      ASSERT_NE(batch, nullptr);
+      std::iota(batch, batch + 3, i + j);
+      producer.commit_write();
+    }
+
+    for (size_t j = 0; j < 6; j += 2) {
+      auto *batch = reinterpret_cast<size_t *>(consumer.read_ptr());
+      ASSERT_NE(batch, nullptr);
+      ASSERT_EQ(batch[0], i + j);
+      ASSERT_EQ(batch[1], i + j + 1);
+      consumer.commit_read();
+    }
+    ASSERT_EQ(consumer.read_ptr(), nullptr);
+  }
+}
+
+TEST(SharedQueue_Peer_State, BATCHED_SPSC_QUEUE) {
+  using Role = SharedQueue::Role;
+  using PeerState = SharedQueue::PeerState;
+  auto name = unique_name("peer_state");
+  auto consumer =
+      SharedQueue::create(name, 16, 1, 1, sizeof(size_t), Role::Consumer);
+  ASSERT_EQ(consumer.peer_state(), PeerState::Detached);
+
+  // A child attaches as producer, enqueues one element and exits without
+  // detaching, as if it had crashed.
+  pid_t child = fork();
+  ASSERT_NE(child, -1);
+  if (child == 0) {
+    auto producer = SharedQueue::attach(name, Role::Producer);
+    *reinterpret_cast<size_t *>(producer.write_ptr()) = 42;
+    producer.commit_write();
+    _exit(0);
+  }
+
+  int status = 0;
+  ASSERT_EQ(waitpid(child, &status, 0), child);
+  ASSERT_EQ(consumer.peer_state(), PeerState::Dead);
+  ASSERT_EQ(*reinterpret_cast<size_t *>(consumer.read_ptr()), 42);
+  consumer.commit_read();
+
+  // A new producer takes over the role left behind by the dead one.
+  {
+    auto producer = SharedQueue::attach(name, Role::Producer);
+    ASSERT_EQ(consumer.peer_state(), PeerState::Alive);
+    ASSERT_EQ(producer.peer_state(), PeerState::Alive);
+  }
+  ASSERT_EQ(consumer.peer_state(), PeerState::Detached);
+}
+} // namespace batched_spsc_queue
@@ -0,0 +1,120 @@
+#include "spill_queue.hh"
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <gtest/gtest.h>
+#include <thread>
+
+namespace batched_spsc_queue {
+namespace {
+std::string spill_directory() {
+  return std::filesystem::temp_directory_path().string();
+}
+
+bool write_batch(SpillQueue &queue, uint64_t value) {
+  uint8_t *batch_begin = queue.write_ptr();
+  if (batch_begin == nullptr)
+    return false;
+
+  for (size_t i = 0; i < 4; ++i) {
+    uint64_t element = value * 4 + i;
+    std::memcpy(batch_begin + i * sizeof(uint64_t), &element,
+                sizeof(uint64_t));
+  }
+  queue.commit_write();
+  return true;
+}
+
+/// Reads a batch and checks that it is the expected one.
+bool read_batch(SpillQueue &queue, uint64_t expected) {
+  uint8_t *batch_begin = queue.read_ptr();
+  if (batch_begin == nullptr)
+    return false;
+
+  for (size_t i = 0; i < 4; ++i) {
+    uint64_t element;
+    std::memcpy(&element, batch_begin + i * sizeof(uint64_t),
+                sizeof(uint64_t));
+    EXPECT_EQ(element, expected * 4 + i);
+  }
+  queue.commit_read();
+  return true;
+}
+} // namespace
+
+TEST(SpillQueue_Fifo, BATCHED_SPSC_QUEUE) {
+  constexpr size_t batch_bytes = 4 * sizeof(uint64_t);
+  SpillQueue queue(16, 4, sizeof(uint64_t), spill_directory());
+
+  // The ring holds 3 batches; the next 5 are spilled.
+  uint64_t written = 0;
+  uint64_t read = 0;
+  for (; written < 8; ++written)
+    ASSERT_TRUE(write_batch(queue, written));
+  ASSERT_TRUE(queue.spilling());
+  ASSERT_EQ(queue.stats().spilled_bytes, 5 * batch_bytes);
+  ASSERT_EQ(queue.ring().size(), 12);
+
+  // Reading frees the ring, but new batches still go to the spill file to
+  // stay behind the spilled ones.
+  for (; read < 4; ++read)
+    ASSERT_TRUE(read_batch(queue, read));
+  ASSERT_TRUE(write_batch(queue, written++));
+  ASSERT_EQ(queue.stats().spilled_bytes, 6 * batch_bytes);
+  ASSERT_EQ(queue.stats().backlog_bytes, 5 * batch_bytes);
+
+  while (read_batch(queue, read))
+    ++read;
+  ASSERT_EQ(read, written);
+  ASSERT_FALSE(queue.spilling());
+
+  // Drained: back to the ring, then a second spill episode.
+  for (; written < 14; ++written)
+    ASSERT_TRUE(write_batch(queue, written));
+  ASSERT_EQ(queue.stats().spilled_bytes, 8 * batch_bytes);
+  while (read_batch(queue, read))
+    ++read;
+  ASSERT_EQ(read, written);
+
+  SpillStats stats = queue.stats();
+  ASSERT_EQ(stats.drained_bytes, stats.spilled_bytes);
+  ASSERT_EQ(stats.backlog_bytes, 0);
+  ASSERT_GT(stats.drain_rate, 0);
+}
+
+TEST(SpillQueue_Max_Spill_Bytes, BATCHED_SPSC_QUEUE) {
+  constexpr size_t batch_bytes = 4 * sizeof(uint64_t);
+  SpillQueue queue(8, 4, sizeof(uint64_t), spill_directory(), 2 * batch_bytes);
+
+  ASSERT_TRUE(write_batch(queue, 0));
+  ASSERT_TRUE(write_batch(queue, 1));
+  ASSERT_TRUE(write_batch(queue, 2));
+  ASSERT_FALSE(write_batch(queue, 3));
+
+  for (uint64_t i = 0; i < 3; ++i)
+    ASSERT_TRUE(read_batch(queue, i));
+  ASSERT_FALSE(read_batch(queue, 3));
+}
+
+TEST(MT_SpillQueue_Burst, BATCHED_SPSC_QUEUE) {
+  // The consumer starts late and is slower, so the producer spills several
+  // times; every batch must still arrive, in order.
+  constexpr uint64_t nb_batches = 20000;
+  SpillQueue queue(64, 4, sizeof(uint64_t), spill_directory());
+
+  std::thread producer([&queue]() {
+    for (uint64_t i = 0; i < nb_batches; ++i)
+      ASSERT_TRUE(write_batch(queue, i));
+  });
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  for (uint64_t i = 0; i < nb_batches; ++i) {
+    while (!read_batch(queue, i))
+      std::this_thread::yield();
+  }
+  producer.join();
+
+  ASSERT_FALSE(queue.spilling());
+  ASSERT_GT(queue.stats().spilled_bytes, 0);
+}
+} // namespace batched_spsc_queue
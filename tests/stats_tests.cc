@@ -0,0 +1,117 @@
+#include "batched_spsc_queue.hh"
+#include <chrono>
+#include <cstdint>
+#include <gtest/gtest.h>
+#include <memory>
+#include <numeric>
+#include <thread>
+
+namespace batched_spsc_queue {
+namespace {
+uint64_t total(const std::array<uint64_t, QueueStats::kOccupancyBuckets> &h) {
+  return std::accumulate(h.begin(), h.end(), uint64_t{0});
+}
+} // namespace
+
+TEST(Stats_Counters, BATCHED_SPSC_QUEUE) {
+  auto buffer = std::make_unique<uint8_t[]>(16);
+  auto queue = Queue(16, 4, 2, 1, buffer.get());
+
+  ASSERT_EQ(queue.read_ptr(), nullptr);
+  for (size_t i = 0; i < 3; i++) {
+    ASSERT_NE(queue.write_ptr(), nullptr);
+    queue.commit_write();
+  }
+  ASSERT_EQ(queue.write_ptr(), nullptr);
+  ASSERT_EQ(queue.write_ptr(), nullptr);
+
+  for (size_t i = 0; i < 6; i++) {
+    ASSERT_NE(queue.read_ptr(), nullptr);
+    queue.commit_read();
+  }
+  ASSERT_EQ(queue.read_ptr(), nullptr);
+
+  QueueStats stats = queue.stats();
+  if (!Queue::kStatsEnabled) {
+    ASSERT_EQ(stats.producer.batches, 0);
+    ASSERT_EQ(stats.consumer.batches, 0);
+    ASSERT_EQ(total(stats.producer.occupancy), 0);
+    return;
+  }
+
+  ASSERT_EQ(stats.producer.rejections, 2);
+  ASSERT_EQ(stats.producer.batches, 3);
+  ASSERT_EQ(stats.producer.elements, 12);
+  ASSERT_EQ(stats.consumer.rejections, 2);
+  ASSERT_EQ(stats.consumer.batches, 6);
+  ASSERT_EQ(stats.consumer.elements, 12);
+
+  // The producer committed at 4, 8 and 12 elements out of 16.
+  ASSERT_EQ(total(stats.producer.occupancy), 3);
+  ASSERT_EQ(stats.producer.occupancy[4], 1);
+  ASSERT_EQ(stats.producer.occupancy[8], 1);
+  ASSERT_EQ(stats.producer.occupancy[12], 1);
+
+  // The consumer committed at 10, 8, ..., 0 elements left.
+  ASSERT_EQ(total(stats.consumer.occupancy), 6);
+  ASSERT_EQ(stats.consumer.occupancy[0], 1);
+  ASSERT_EQ(stats.consumer.occupancy[10], 1);
+}
+
+TEST(Stats_Stall_Time, BATCHED_SPSC_QUEUE) {
+  auto buffer = std::make_unique<uint8_t[]>(16);
+  auto queue = Queue(16, 1, 1, 1, buffer.get());
+
+  // The stall lasts from the first rejection to the next success.
+  ASSERT_EQ(queue.read_ptr(), nullptr);
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  ASSERT_EQ(queue.read_ptr(), nullptr);
+  ASSERT_EQ(queue.stats().consumer.stalled.count(), 0);
+
+  ASSERT_NE(queue.write_ptr(), nullptr);
+  queue.commit_write();
+  ASSERT_NE(queue.read_ptr(), nullptr);
+
+  QueueStats stats = queue.stats();
+  if (Queue::kStatsEnabled) {
+    ASSERT_GE(stats.consumer.stalled, std::chrono::milliseconds(10));
+    ASSERT_EQ(stats.producer.stalled.count(), 0);
+  } else {
+    ASSERT_EQ(stats.consumer.stalled.count(), 0);
+  }
+}
+
+TEST(Stats_Occupancy_Steady, BATCHED_SPSC_QUEUE) {
+  // The producer stays one batch ahead of the consumer for many laps of the
+  // buffer, neither side ever seeing the queue full or empty.
+  size_t nb_slots = 64;
+  size_t batch_size = 4;
+  size_t laps = 1000;
+  auto buffer = std::make_unique<uint8_t[]>(nb_slots);
+  auto queue = Queue(nb_slots, batch_size, batch_size, 1, buffer.get());
+
+  ASSERT_NE(queue.write_ptr(), nullptr);
+  queue.commit_write();
+  for (size_t i = 0; i < laps; i++) {
+    ASSERT_NE(queue.write_ptr(), nullptr);
+    queue.commit_write();
+    ASSERT_NE(queue.read_ptr(), nullptr);
+    queue.commit_read();
+  }
+
+  QueueStats stats = queue.stats();
+  if (!Queue::kStatsEnabled) {
+    ASSERT_EQ(total(stats.producer.occupancy), 0);
+    ASSERT_EQ(total(stats.consumer.occupancy), 0);
+    return;
+  }
+
+  // Buckets of 4 slots: the producer commits at 8 elements (at 4 for the
+  // first batch), the consumer at 4.
+  ASSERT_EQ(total(stats.producer.occupancy), laps + 1);
+  ASSERT_EQ(stats.producer.occupancy[1], 1);
+  ASSERT_EQ(stats.producer.occupancy[2], laps);
+  ASSERT_EQ(total(stats.consumer.occupancy), laps);
+  ASSERT_EQ(stats.consumer.occupancy[1], laps);
+}
+} // namespace batched_spsc_queue
@@ -0,0 +1,128 @@
+#include "batched_spsc_queue.hh"
+#include "transform.hh"
+#include <cstdint>
+#include <cstring>
+#include <gtest/gtest.h>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+namespace batched_spsc_queue {
+namespace {
+constexpr CopyKernel kKernels[] = {CopyKernel::Scalar, CopyKernel::AVX2,
+                                   CopyKernel::AVX512};
+
+std::vector<uint8_t> pattern(size_t size) {
+  std::vector<uint8_t> bytes(size);
+  for (size_t i = 0; i < size; ++i)
+    bytes[i] = static_cast<uint8_t>(i * 7 + 1);
+  return bytes;
+}
+} // namespace
+
+TEST(Transform_Normalize, BATCHED_SPSC_QUEUE) {
+  // Sizes around the vector widths, with a misaligned source and destination.
+  auto src = pattern(1024 + 1);
+  for (CopyKernel kernel : kKernels) {
+    Transform transform = normalize_transform(1.0f / 255, -0.5f, kernel);
+    for (size_t size : {0, 1, 31, 32, 33, 64, 100, 1024}) {
+      std::vector<uint8_t> dst(size * sizeof(float) + 1);
+      transform.kernel(dst.data() + 1, src.data() + 1, size);
+      for (size_t i = 0; i < size; ++i) {
+        float value;
+        memcpy(&value, dst.data() + 1 + i * sizeof(float), sizeof(value));
+        ASSERT_FLOAT_EQ(value, src[i + 1] * (1.0f / 255) - 0.5f)
+            << "kernel " << static_cast<int>(kernel) << ", size " << size;
+      }
+    }
+  }
+}
+
+TEST(Transform_Deinterleave, BATCHED_SPSC_QUEUE) {
+  for (CopyKernel kernel : kKernels) {
+    for (size_t channels : {2, 3, 4}) {
+      // Two frames of 37 pixels: two full vectors and a tail each.
+      size_t pixels = 37;
+      size_t frame_bytes = pixels * channels;
+      Transform transform = deinterleave_transform(channels, frame_bytes,
+                                                   kernel);
+      auto src = pattern(2 * frame_bytes);
+      std::vector<uint8_t> dst(src.size());
+      transform.kernel(dst.data(), src.data(), src.size());
+      for (size_t frame = 0; frame < 2; ++frame)
+        for (size_t channel = 0; channel < channels; ++channel)
+          for (size_t i = 0; i < pixels; ++i)
+            ASSERT_EQ(dst[frame * frame_bytes + channel * pixels + i],
+                      src[frame * frame_bytes + i * channels + channel])
+                << "kernel " << static_cast<int>(kernel) << ", channels "
+                << channels;
+    }
+  }
+
+  EXPECT_THROW(deinterleave_transform(5, 10), std::invalid_argument);
+  EXPECT_THROW(deinterleave_transform(3, 10), std::invalid_argument);
+}
+
+TEST(Transform_Byteswap, BATCHED_SPSC_QUEUE) {
+  auto src = pattern(1024);
+  for (CopyKernel kernel : kKernels) {
+    for (size_t word_size : {2, 4, 8}) {
+      Transform transform = byteswap_transform(word_size, kernel);
+      for (size_t size : {0, 8, 24, 64, 96, 1016}) {
+        std::vector<uint8_t> dst(size);
+        transform.kernel(dst.data(), src.data(), size);
+        for (size_t i = 0; i < size; ++i)
+          ASSERT_EQ(dst[i], src[i / word_size * word_size + word_size - 1 -
+                                i % word_size])
+              << "kernel " << static_cast<int>(kernel) << ", word size "
+              << word_size << ", size " << size;
+      }
+    }
+  }
+
+  EXPECT_THROW(byteswap_transform(3), std::invalid_argument);
+}
+
+TEST(Transform_Enqueue_Dequeue, BATCHED_SPSC_QUEUE) {
+  // Frames of 64 bytes, two per batch, written byte-swapped and read back
+  // normalized.
+  size_t nb_slots = 8;
+  size_t element_size = 64;
+  size_t batch_bytes = 2 * element_size;
+  auto buffer = std::make_unique<uint8_t[]>(nb_slots * element_size);
+  Queue queue(nb_slots, 2, 2, element_size, buffer.get());
+  Transform swap = byteswap_transform(2);
+  Transform normalize = normalize_transform(2.0f, 1.0f);
+
+  auto src = pattern(batch_bytes);
+  std::vector<float> dst(batch_bytes);
+  ASSERT_FALSE(queue.dequeue_transform(reinterpret_cast<uint8_t *>(dst.data()),
+                                       normalize));
+  ASSERT_TRUE(queue.enqueue_transform(src.data(), swap));
+  ASSERT_TRUE(queue.dequeue_transform(reinterpret_cast<uint8_t *>(dst.data()),
+                                      normalize));
+  for (size_t i = 0; i < batch_bytes; ++i)
+    ASSERT_FLOAT_EQ(dst[i], src[i ^ 1] * 2.0f + 1.0f);
+
+  // A user-supplied kernel, reading half as many bytes as it writes.
+  Transform widen;
+  widen.kernel = [](uint8_t *out, const uint8_t *in, size_t size) {
+    for (size_t i = 0; i < size; ++i)
+      out[2 * i] = out[2 * i + 1] = in[i];
+  };
+  widen.out_bytes = 2;
+  ASSERT_TRUE(queue.enqueue_transform(src.data(), widen));
+  const uint8_t *batch = queue.read_ptr();
+  ASSERT_NE(batch, nullptr);
+  EXPECT_EQ(batch[0], src[0]);
+  EXPECT_EQ(batch[1], src[0]);
+  EXPECT_EQ(batch[batch_bytes - 1], src[batch_bytes / 2 - 1]);
+  queue.commit_read();
+
+  Transform frames = deinterleave_transform(3, 3 * 5);
+  EXPECT_THROW(queue.enqueue_transform(src.data(), frames),
+               std::invalid_argument);
+  EXPECT_THROW(queue.dequeue_transform(src.data(), frames),
+               std::invalid_argument);
+}
+} // namespace batched_spsc_queue
@@ -0,0 +1,120 @@
+#include "typed_queue.hh"
+#include <cstdint>
+#include <future>
+#include <gtest/gtest.h>
+#include <memory>
+#include <numeric>
+
+namespace batched_spsc_queue {
+TEST(TypedQueue_Capacity_Is_Respected_300_3_2, BATCHED_SPSC_QUEUE) {
+  using TQueue = TypedQueue<uint8_t, 300, 3, 2>;
+  auto buffer = std::make_unique<uint8_t[]>(300);
+
+  for (size_t i = 0; i < 300; i++) {
+    TQueue queue(buffer.get());
+
+    // Shift internal read/write indexes by 6 * i.
+    for (size_t j = 0; j < i; j++) {
+      ASSERT_EQ(queue.write_batch().size(), 3);
+      queue.commit_write();
+      ASSERT_EQ(queue.write_batch().size(), 3);
+      queue.commit_write();
+      for (size_t k = 0; k < 3; k++) {
+        ASSERT_EQ(queue.read_batch().size(), 2);
+        queue.commit_read();
+      }
+    }
+
+    // Should be able to enqueue 297 elements (99 3-elements enqueue).
+    for (size_t j = 0; j < 99; j++) {
+      ASSERT_FALSE(queue.write_batch().empty());
+      queue.commit_write();
+    }
+
+    // Should be full now.
+    ASSERT_TRUE(queue.write_batch().empty());
+    ASSERT_EQ(queue.size(), 297);
+
+    // Should be able to dequeue 296 elements (148 2-elements dequeue).
+    for (size_t j = 0; j < 148; j++) {
+      ASSERT_FALSE(queue.read_batch().empty());
+      queue.commit_read();
+    }
+
+    // Should be empty now.
+    ASSERT_TRUE(queue.read_batch().empty());
+  }
+}
+
+TEST(TypedQueue_Capacity_Is_Respected_256_4_8, BATCHED_SPSC_QUEUE) {
+  using TQueue = TypedQueue<uint64_t, 256, 4, 8>;
+  auto buffer = std::make_unique<uint64_t[]>(256);
+
+  for (size_t i = 0; i < 256; i++) {
+    TQueue queue(buffer.get());
+
+    // Shift internal read/write indexes by 8 * i.
+    for (size_t j = 0; j < i; j++) {
+      ASSERT_FALSE(queue.write_batch().empty());
+      queue.commit_write();
+      ASSERT_FALSE(queue.write_batch().empty());
+      queue.commit_write();
+      ASSERT_EQ(queue.read_batch().size(), 8);
+      queue.commit_read();
+    }
+
+    // Should be able to enqueue 252 elements (63 4-elements enqueue).
+    for (size_t j = 0; j < 63; j++) {
+      ASSERT_FALSE(queue.write_batch().empty());
+      queue.commit_write();
+    }
+
+    // Should be full now.
+    ASSERT_TRUE(queue.write_batch().empty());
+    ASSERT_EQ(queue.size(), 252);
+
+    // Should be able to dequeue 248 elements (31 8-elements dequeue).
+    for (size_t j = 0; j < 31; j++) {
+      ASSERT_FALSE(queue.read_batch().empty());
+      queue.commit_read();
+    }
+
+    // Should be empty now.
+    ASSERT_TRUE(queue.read_batch().empty());
+  }
+}
+
+TEST(TypedQueue_MT, BATCHED_SPSC_QUEUE) {
+  using TQueue = TypedQueue<size_t, 256, 4, 8>;
+  constexpr size_t nb_elements = 1 << 16;
+  auto buffer = std::make_unique<size_t[]>(256);
+  TQueue queue(buffer.get());
+
+  auto producer = std::async(std::launch::async, [&queue]() {
+    for (size_t i = 0; i < nb_elements; i += 4) {
+      std::span<size_t> batch;
+      while (batch.empty())
+        batch = queue.write_batch();
+      std::iota(batch.begin(), batch.end(), i);
+      queue.commit_write();
+    }
+  });
+
+  auto consumer = std::async(std::launch::async, [&queue]() {
+    for (size_t i = 0; i < nb_elements; i += 8) {
+      std::span<size_t> batch;
+      while (batch.empty())
+        batch = queue.read_batch();
+      for (size_t j = 0; j < batch.size(); j++) {
+        if (batch[j] != i + j)
+          return false;
+      }
+      queue.commit_read();
+    }
+    return true;
+  });
+
+  producer.get();
+  EXPECT_TRUE(consumer.get());
+}
+} // namespace batched_spsc_queue
@@ -0,0 +1,92 @@
+#include "batched_spsc_queue.hh"
+#include <algorithm>
+#include <cstdint>
+#include <future>
+#include <gtest/gtest.h>
+#include <memory>
+#include <numeric>
+
+namespace batched_spsc_queue {
+TEST(VariableBatch_Contiguous_Space, BATCHED_SPSC_QUEUE) {
+  size_t nb_slots = 10;
+  size_t element_size = 1;
+  auto buffer = std::make_unique<uint8_t[]>(nb_slots * element_size);
+  auto queue = Queue(nb_slots, 1, 1, element_size, buffer.get());
+
+  // One slot is kept empty, so only 9 elements fit.
+  ASSERT_EQ(queue.available_contiguous_write(), 9);
+  ASSERT_EQ(queue.write_ptr(10), nullptr);
+  ASSERT_EQ(queue.write_ptr(9), buffer.get());
+  queue.commit_write(7);
+  ASSERT_EQ(queue.size(), 7);
+  ASSERT_EQ(queue.available_contiguous_write(), 2);
+  ASSERT_EQ(queue.available_contiguous_read(), 7);
+
+  // Read 6, the write index is at 7: all 3 slots before the end of the
+  // buffer are usable, since filling them wraps the write index to 0, still
+  // behind the reader at 6.
+  ASSERT_EQ(queue.read_ptr(8), nullptr);
+  ASSERT_EQ(queue.read_ptr(6), buffer.get());
+  queue.commit_read(6);
+  ASSERT_EQ(queue.available_contiguous_write(), 3);
+  ASSERT_EQ(queue.write_ptr(4), nullptr);
+  ASSERT_EQ(queue.write_ptr(3), buffer.get() + 7);
+  queue.commit_write(3);
+
+  // The write index wrapped: 5 slots are free but the reader sits at 6.
+  ASSERT_EQ(queue.available_contiguous_write(), 5);
+  ASSERT_EQ(queue.available_contiguous_read(), 4);
+  ASSERT_EQ(queue.read_ptr(4), buffer.get() + 6);
+  queue.commit_read(4);
+  ASSERT_EQ(queue.size(), 0);
+  ASSERT_EQ(queue.read_ptr(1), nullptr);
+  ASSERT_EQ(queue.available_contiguous_write(), 9);
+}
+
+TEST(VariableBatch_MT, BATCHED_SPSC_QUEUE) {
+  size_t nb_slots = 300;
+  size_t element_size = sizeof(size_t);
+  size_t nb_elements = 300000;
+  auto buffer = std::make_unique<uint8_t[]>(nb_slots * element_size);
+  auto queue = Queue(nb_slots, 1, 1, element_size, buffer.get());
+
+  // Bursts of 1 to 37 elements, reads of whatever is contiguous.
+  auto producer = std::async(std::launch::async, [&]() {
+    size_t i = 0;
+    for (size_t burst = 1; i < nb_elements; burst = burst % 37 + 1) {
+      size_t n = 0;
+      uint8_t *dst = nullptr;
+      while (dst == nullptr) {
+        n = std::min({burst, nb_elements - i,
+                      queue.available_contiguous_write()});
+        dst = n == 0 ? nullptr : queue.write_ptr(n);
+      }
+      auto *batch = reinterpret_cast<size_t *>(dst);
+      std::iota(batch, batch + n, i);
+      queue.commit_write(n);
+      i += n;
+    }
+  });
+
+  auto consumer = std::async(std::launch::async, [&]() {
+    size_t i = 0;
+    while (i < nb_elements) {
+      size_t n = queue.available_contiguous_read();
+      if (n == 0)
+        continue;
+
+      auto *batch = reinterpret_cast<size_t *>(queue.read_ptr(n));
+      for (size_t j = 0; j < n; j++) {
+        if (batch[j] != i + j)
+          return false;
+      }
+      queue.commit_read(n);
+      i += n;
+    }
+    return true;
+  });
+
+  producer.get();
+  EXPECT_TRUE(consumer.get());
+}
+} // namespace batched_spsc_queue
@@ -0,0 +1,82 @@
+#include "batched_spsc_queue.hh"
+#include <chrono>
+#include <cstdint>
+#include <future>
+#include <gtest/gtest.h>
+#include <memory>
+#include <numeric>
+
+namespace batched_spsc_queue {
+namespace {
+bool transfer(WaitPolicy policy, size_t nb_elements) {
+  size_t nb_slots = 300;
+  size_t enqueue_batch_size = 2;
+  size_t dequeue_batch_size = 3;
+  size_t element_size = sizeof(size_t);
+  auto buffer = std::make_unique<uint8_t[]>(nb_slots * element_size);
+  auto queue = Queue(nb_slots, enqueue_batch_size, dequeue_batch_size,
+                     element_size, buffer.get(), true);
+
+  auto producer = std::async(std::launch::async, [&]() {
+    for (size_t i = 0; i < nb_elements; i += enqueue_batch_size) {
+      auto *batch = reinterpret_cast<size_t *>(queue.wait_write_ptr(policy));
+      std::iota(batch, batch + enqueue_batch_size, i);
+      queue.commit_write();
+    }
+  });
+
+  auto consumer = std::async(std::launch::async, [&]() {
+    for (size_t i = 0; i < nb_elements; i += dequeue_batch_size) {
+      auto *batch = reinterpret_cast<size_t *>(queue.wait_read_ptr(policy));
+      for (size_t j = 0; j < dequeue_batch_size; j++) {
+        if (batch[j] != i + j)
+          return false;
+      }
+      queue.commit_read();
+    }
+    return true;
+  });
+
+  producer.get();
+  return consumer.get();
+}
+} // namespace
+
+TEST(Wait_Spin, BATCHED_SPSC_QUEUE) {
+  EXPECT_TRUE(transfer(WaitPolicy::Spin, 60000));
+}
+
+TEST(Wait_SpinThenYield, BATCHED_SPSC_QUEUE) {
+  EXPECT_TRUE(transfer(WaitPolicy::SpinThenYield, 600000));
+}
+
+TEST(Wait_Park, BATCHED_SPSC_QUEUE) {
+  EXPECT_TRUE(transfer(WaitPolicy::Park, 600000));
+}
+
+TEST(Wait_Timeout, BATCHED_SPSC_QUEUE) {
+  size_t nb_slots = 4;
+  size_t element_size = 1;
+  auto buffer = std::make_unique<uint8_t[]>(nb_slots * element_size);
+  auto queue = Queue(nb_slots, 2, 2, element_size, buffer.get(), true);
+  auto timeout = std::chrono::milliseconds(5);
+
+  for (auto policy :
+       {WaitPolicy::Spin, WaitPolicy::SpinThenYield, WaitPolicy::Park}) {
+    // Empty queue: reads time out.
+    auto start = std::chrono::steady_clock::now();
+    EXPECT_EQ(queue.wait_read_ptr(policy, timeout), nullptr);
+    EXPECT_GE(std::chrono::steady_clock::now() - start, timeout);
+
+    // One batch fills the queue: the write succeeds, the next one times out.
+    EXPECT_NE(queue.wait_write_ptr(policy, timeout), nullptr);
+    queue.commit_write();
+    start = std::chrono::steady_clock::now();
+    EXPECT_EQ(queue.wait_write_ptr(policy, timeout), nullptr);
+    EXPECT_GE(std::chrono::steady_clock::now() - start, timeout);
+
+    EXPECT_NE(queue.wait_read_ptr(policy, timeout), nullptr);
+    queue.commit_read();
+  }
+}
+} // namespace batched_spsc_queue